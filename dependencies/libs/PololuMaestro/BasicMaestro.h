@@ -0,0 +1,721 @@
+// Copyright (C) Pololu Corporation.  See LICENSE.txt for details.
+
+/*! \file BasicMaestro.h
+ *
+ * Header-only Maestro driver templated on the type of its stream.
+ *
+ * Maestro (PololuMaestro.h) stores a `Stream *`, so every byte it sends or
+ * receives goes through a virtual call. BasicMaestro is the same driver with the
+ * stream's concrete type as a template parameter: when \p StreamT is a concrete
+ * class such as HardwareSerial, calls to write(), available() and read() are
+ * made with a qualified name, which the compiler resolves statically and can
+ * inline. When \p StreamT is abstract (plain Stream) the calls stay virtual,
+ * which is how Maestro, MicroMaestro and MiniMaestro use it.
+ *
+ * Each command is encoded into a small buffer on the stack, and the CRC is
+ * computed there as well (from a lookup table), so no per-command state is
+ * kept in the object.
+ *
+ * \p StreamT must be the actual (most derived) type of the stream object, a
+ * qualified call on a base class would skip the derived class's override.
+ *
+ * Host builds (SB_Host) can define SB_MAESTRO_TRACE to record the encoding of
+ * every packet, from startPacket() to the last byte handed to the stream, on
+ * the current SB_Trace. Without it there is no trace code at all.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <Stream.h>
+#include <type_traits>
+
+#ifdef SB_MAESTRO_TRACE
+#include <SB_Trace.hpp>
+
+/** \cond */
+inline const char *maestroTraceName(uint8_t commandByte)
+{
+  switch (commandByte)
+  {
+    case 0x84: return "encode setTarget";
+    case 0x87: return "encode setSpeed";
+    case 0x89: return "encode setAcceleration";
+    case 0x8A: return "encode setPWM";
+    case 0x90: return "encode getPosition";
+    case 0x93: return "encode getMovingState";
+    case 0x9F: return "encode setMultiTarget";
+    case 0xA1: return "encode getErrors";
+    case 0xA2: return "encode goHome";
+    case 0xA4: return "encode stopScript";
+    case 0xA7: return "encode restartScript";
+    case 0xA8: return "encode restartScriptWithParameter";
+    case 0xAE: return "encode getScriptStatus";
+    default: return "encode";
+  }
+}
+/** \endcond **/
+#endif
+
+/** \cond
+ *
+ * CRC7 (polynomial 0x91) of every possible byte, so the CRC of a packet costs a
+ * table lookup per byte instead of eight shift/xor steps:
+ * crc = maestroCRC7Table(crc ^ dataByte).
+ */
+inline uint8_t maestroCRC7Table(uint8_t index)
+{
+  static const uint8_t table[256] = {
+    0x00, 0x41, 0x13, 0x52, 0x26, 0x67, 0x35, 0x74, 0x4C, 0x0D, 0x5F, 0x1E, 0x6A, 0x2B, 0x79, 0x38,
+    0x09, 0x48, 0x1A, 0x5B, 0x2F, 0x6E, 0x3C, 0x7D, 0x45, 0x04, 0x56, 0x17, 0x63, 0x22, 0x70, 0x31,
+    0x12, 0x53, 0x01, 0x40, 0x34, 0x75, 0x27, 0x66, 0x5E, 0x1F, 0x4D, 0x0C, 0x78, 0x39, 0x6B, 0x2A,
+    0x1B, 0x5A, 0x08, 0x49, 0x3D, 0x7C, 0x2E, 0x6F, 0x57, 0x16, 0x44, 0x05, 0x71, 0x30, 0x62, 0x23,
+    0x24, 0x65, 0x37, 0x76, 0x02, 0x43, 0x11, 0x50, 0x68, 0x29, 0x7B, 0x3A, 0x4E, 0x0F, 0x5D, 0x1C,
+    0x2D, 0x6C, 0x3E, 0x7F, 0x0B, 0x4A, 0x18, 0x59, 0x61, 0x20, 0x72, 0x33, 0x47, 0x06, 0x54, 0x15,
+    0x36, 0x77, 0x25, 0x64, 0x10, 0x51, 0x03, 0x42, 0x7A, 0x3B, 0x69, 0x28, 0x5C, 0x1D, 0x4F, 0x0E,
+    0x3F, 0x7E, 0x2C, 0x6D, 0x19, 0x58, 0x0A, 0x4B, 0x73, 0x32, 0x60, 0x21, 0x55, 0x14, 0x46, 0x07,
+    0x48, 0x09, 0x5B, 0x1A, 0x6E, 0x2F, 0x7D, 0x3C, 0x04, 0x45, 0x17, 0x56, 0x22, 0x63, 0x31, 0x70,
+    0x41, 0x00, 0x52, 0x13, 0x67, 0x26, 0x74, 0x35, 0x0D, 0x4C, 0x1E, 0x5F, 0x2B, 0x6A, 0x38, 0x79,
+    0x5A, 0x1B, 0x49, 0x08, 0x7C, 0x3D, 0x6F, 0x2E, 0x16, 0x57, 0x05, 0x44, 0x30, 0x71, 0x23, 0x62,
+    0x53, 0x12, 0x40, 0x01, 0x75, 0x34, 0x66, 0x27, 0x1F, 0x5E, 0x0C, 0x4D, 0x39, 0x78, 0x2A, 0x6B,
+    0x6C, 0x2D, 0x7F, 0x3E, 0x4A, 0x0B, 0x59, 0x18, 0x20, 0x61, 0x33, 0x72, 0x06, 0x47, 0x15, 0x54,
+    0x65, 0x24, 0x76, 0x37, 0x43, 0x02, 0x50, 0x11, 0x29, 0x68, 0x3A, 0x7B, 0x0F, 0x4E, 0x1C, 0x5D,
+    0x7E, 0x3F, 0x6D, 0x2C, 0x58, 0x19, 0x4B, 0x0A, 0x32, 0x73, 0x21, 0x60, 0x14, 0x55, 0x07, 0x46,
+    0x77, 0x36, 0x64, 0x25, 0x51, 0x10, 0x42, 0x03, 0x3B, 0x7A, 0x28, 0x69, 0x1D, 0x5C, 0x0E, 0x4F,
+  };
+  return table[index];
+}
+
+/*
+ * How BasicMaestro reaches its stream. Concrete streams get qualified
+ * (non-virtual) calls, abstract ones go through the vtable.
+ */
+template <class StreamT, bool isAbstract = std::is_abstract<StreamT>::value>
+struct MaestroStreamOps
+{
+  static inline void write(StreamT &stream, uint8_t dataByte)
+  {
+    stream.StreamT::write(dataByte);
+  }
+  static inline int available(StreamT &stream)
+  {
+    return stream.StreamT::available();
+  }
+  static inline void write(StreamT &stream, const uint8_t *buffer, size_t size)
+  {
+    stream.StreamT::write(buffer, size);
+  }
+  static inline int read(StreamT &stream)
+  {
+    return stream.StreamT::read();
+  }
+};
+
+template <class StreamT>
+struct MaestroStreamOps<StreamT, true>
+{
+  static inline void write(StreamT &stream, uint8_t dataByte)
+  {
+    stream.write(dataByte);
+  }
+  static inline int available(StreamT &stream)
+  {
+    return stream.available();
+  }
+  static inline void write(StreamT &stream, const uint8_t *buffer, size_t size)
+  {
+    stream.write(buffer, size);
+  }
+  static inline int read(StreamT &stream)
+  {
+    return stream.read();
+  }
+};
+/** \endcond **/
+
+/*! \brief How one rate fared in BasicMaestro::negotiateBaud(). */
+struct MaestroBaudTrial
+{
+  uint32_t baud;
+  uint8_t probes;   //!< queries sent, 0 if the port couldn't be set to the rate
+  uint8_t failures; //!< queries unanswered, garbled, or errors the Maestro saw
+};
+
+/*! \brief Maestro driver for a stream of type \p StreamT.
+ *
+ * Provides every command of the Micro and Mini Maestro, setPWM and
+ * setMultiTarget are only understood by the Mini Maestro. The commands are
+ * documented on the Maestro class in PololuMaestro.h.
+ */
+template <class StreamT>
+class BasicMaestro
+{
+  public:
+    static const uint8_t deviceNumberDefault = 255;
+    static const uint8_t noResetPin = 255;
+
+    /** \brief Create a BasicMaestro.
+     *
+     * The parameters are the same as MiniMaestro's: \a resetPin is used by
+     * reset(), a \a deviceNumber other than deviceNumberDefault selects the
+     * Pololu protocol, and \a CRCEnabled appends a CRC7 byte to every packet.
+     */
+    BasicMaestro(StreamT &stream,
+                 uint8_t resetPin = noResetPin,
+                 uint8_t deviceNumber = deviceNumberDefault,
+                 bool CRCEnabled = false)
+      : _stream(stream),
+        _deviceNumber(deviceNumber),
+        _resetPin(resetPin),
+        _CRCEnabled(CRCEnabled)
+    {
+    }
+
+    void reset()
+    {
+      if (_resetPin != noResetPin)
+      {
+        digitalWrite(_resetPin, LOW);
+        pinMode(_resetPin, OUTPUT); // Drive low.
+        delay(1);
+        pinMode(_resetPin, INPUT); // Return to high-impedance input (reset is
+                                   // internally pulled up on Maestro).
+        delay(200); // Wait for Maestro to boot up after reset.
+      }
+    }
+
+    void setTargetMiniSSC(uint8_t channelNumber, uint8_t target)
+    {
+      Ops::write(_stream, miniSscCommand);
+      Ops::write(_stream, channelNumber);
+      Ops::write(_stream, target);
+    }
+
+    void setTarget(uint8_t channelNumber, uint16_t target)
+    {
+      sendChannelValue(setTargetCommand, channelNumber, target);
+    }
+
+    void setSpeed(uint8_t channelNumber, uint16_t speed)
+    {
+      sendChannelValue(setSpeedCommand, channelNumber, speed);
+    }
+
+    void setAcceleration(uint8_t channelNumber, uint16_t acceleration)
+    {
+      sendChannelValue(setAccelerationCommand, channelNumber, acceleration);
+    }
+
+    void goHome()
+    {
+      Packet packet;
+      startPacket(packet, goHomeCommand);
+      send(packet);
+    }
+
+    void stopScript()
+    {
+      Packet packet;
+      startPacket(packet, stopScriptCommand);
+      send(packet);
+    }
+
+    void restartScript(uint8_t subroutineNumber)
+    {
+      Packet packet;
+      startPacket(packet, restartScriptAtSubroutineCommand);
+      put7BitData(packet, subroutineNumber);
+      send(packet);
+    }
+
+    void restartScriptWithParameter(uint8_t subroutineNumber, uint16_t parameter)
+    {
+      sendChannelValue(restartScriptAtSubroutineWithParameterCommand,
+                       subroutineNumber, parameter);
+    }
+
+    uint16_t getPosition(uint8_t channelNumber)
+    {
+      requestPosition(channelNumber);
+      return readTwoBytes();
+    }
+
+    uint8_t getMovingState()
+    {
+      requestMovingState();
+      return readOneByte();
+    }
+
+    uint8_t getScriptStatus()
+    {
+      requestScriptStatus();
+      return readOneByte();
+    }
+
+    uint16_t getErrors()
+    {
+      requestErrors();
+      return readTwoBytes();
+    }
+
+    /** \brief Sends the query half of getPosition() without waiting for the
+     * answer.
+     *
+     * The Maestro answers queries in the order they arrive, with two bytes
+     * (low byte first) for requestPosition() and requestErrors() and one byte
+     * for requestMovingState() and requestScriptStatus(). Callers that can't
+     * spin, like an event loop, send the query with these and collect the
+     * response bytes from the stream themselves.
+     */
+    void requestPosition(uint8_t channelNumber)
+    {
+      Packet packet;
+      startPacket(packet, getPositionCommand);
+      put7BitData(packet, channelNumber);
+      send(packet);
+    }
+
+    void requestMovingState()
+    {
+      Packet packet;
+      startPacket(packet, getMovingStateCommand);
+      send(packet);
+    }
+
+    void requestScriptStatus()
+    {
+      Packet packet;
+      startPacket(packet, getScriptStatusCommand);
+      send(packet);
+    }
+
+    void requestErrors()
+    {
+      Packet packet;
+      startPacket(packet, getErrorsCommand);
+      send(packet);
+    }
+
+    /** Mini Maestro only. */
+    void setPWM(uint16_t onTime, uint16_t period)
+    {
+      Packet packet;
+      startPacket(packet, setPwmCommand);
+      put14BitData(packet, onTime);
+      put14BitData(packet, period);
+      send(packet);
+    }
+
+    /** Mini Maestro only, \a numberOfTargets is at most maxMultiTargets. */
+    void setMultiTarget(uint8_t numberOfTargets,
+                        uint8_t firstChannel,
+                        uint16_t *targetList)
+    {
+      if (numberOfTargets > maxMultiTargets)
+      {
+        numberOfTargets = maxMultiTargets;
+      }
+
+      Packet packet;
+      startPacket(packet, setMultipleTargetsCommand);
+      put7BitData(packet, numberOfTargets);
+      put7BitData(packet, firstChannel);
+      for (uint8_t i = 0; i < numberOfTargets; i++)
+      {
+        put14BitData(packet, targetList[i]);
+      }
+      send(packet);
+    }
+
+    /** Every Maestro: a setTarget for each of \a numberOfTargets channels
+     * from \a firstChannel, encoded back to back and handed to the stream in
+     * one write. \a numberOfTargets is at most maxMultiTargets. */
+    void setTargets(uint8_t numberOfTargets,
+                    uint8_t firstChannel,
+                    uint16_t *targetList)
+    {
+      if (numberOfTargets > maxMultiTargets)
+      {
+        numberOfTargets = maxMultiTargets;
+      }
+
+      uint8_t bytes[maxMultiTargets * maxSetTargetSize];
+      uint8_t length = 0;
+      Packet packet;
+#ifdef SB_MAESTRO_TRACE
+      uint64_t traceStartNs = 0;
+#endif
+      for (uint8_t i = 0; i < numberOfTargets; i++)
+      {
+        startPacket(packet, setTargetCommand);
+#ifdef SB_MAESTRO_TRACE
+        if (i == 0)
+        {
+          traceStartNs = packet.traceStartNs;
+        }
+#endif
+        put7BitData(packet, firstChannel + i);
+        put14BitData(packet, targetList[i]);
+        appendCRC(packet);
+        for (uint8_t j = 0; j < packet.length; j++)
+        {
+          bytes[length++] = packet.bytes[j];
+        }
+      }
+      Ops::write(_stream, bytes, length);
+#ifdef SB_MAESTRO_TRACE
+      if (SB_Trace *trace = SB_Trace::current())
+      {
+        trace->endSpan(traceStartNs, TRACE_TRACK_ENCODE,
+                       maestroTraceName(setTargetCommand), length);
+      }
+#endif
+    }
+
+    /** \brief Finds the fastest rate the Maestro answers reliably at, and
+     * leaves the port at it.
+     *
+     * @param setBaud Sets the port to a rate, returning false if it can't do
+     * it, e.g. `[](uint32_t baud) { Serial1.begin(baud); return true; }`.
+     *
+     * @param rates The rates to try, fastest first.
+     *
+     * @param probes Queries sent at each rate, alternately getPosition(0) and
+     * getErrors(). Any that goes unanswered, comes back with bits that can't
+     * be there, or shows the Maestro saw a bad byte counts as a failure.
+     *
+     * @param maxFailures The most failures a rate may have and be taken.
+     *
+     * @param trials If given, one per rate, filled in with how each went.
+     *
+     * @return The rate the port was left at, the first with no more than
+     * \a maxFailures, else whichever answered with the fewest. 0 if none
+     * answered at all, the port is then left at the slowest.
+     *
+     * Each rate starts with a reset() (nothing without a reset pin) and the
+     * 0xAA baud rate indication byte, then one getErrors() to clear whatever
+     * the rates before it garbled. A Maestro set to a fixed baud only answers
+     * at that. One set to detect the baud takes the first 0xAA after a reset
+     * and keeps that rate, so without a reset pin the first rate tried is the
+     * only one it will answer at: if that's too fast for the wiring, give it
+     * a reset pin or start from a slower rate.
+     */
+    uint32_t negotiateBaud(bool (*setBaud)(uint32_t baud),
+                           const uint32_t *rates, uint8_t rateCount,
+                           uint8_t probes = 16, uint8_t maxFailures = 0,
+                           MaestroBaudTrial *trials = nullptr)
+    {
+      uint32_t best = 0;
+      uint8_t bestFailures = 0;
+      for (uint8_t i = 0; i < rateCount; i++)
+      {
+        uint8_t failures = tryBaud(setBaud, rates[i], probes);
+        bool answered = failures != noAnswer && failures != noPort;
+        if (trials)
+        {
+          trials[i].baud = rates[i];
+          trials[i].probes = failures == noPort ? 0 : probes;
+          trials[i].failures = answered ? failures : probes;
+        }
+        if (answered && failures <= maxFailures)
+        {
+          return rates[i];
+        }
+        if (answered && (best == 0 || failures < bestFailures))
+        {
+          best = rates[i];
+          bestFailures = failures;
+        }
+      }
+      if (best == 0)
+      {
+        return 0;
+      }
+      // Back to the best of the unreliable ones
+      reset();
+      setBaud(best);
+      Ops::write(_stream, baudRateIndication);
+      uint16_t errors;
+      query(getErrorsCommand, 0, best, errors);
+      return best;
+    }
+
+    /** \brief Encodes a setTarget into \a bytes without sending it, for
+     * commands built ahead and sent later with writeEncoded(). \a bytes holds
+     * at least maxEncodedSize. Touches nothing but \a bytes, so it can run in
+     * an interrupt. Returns the length. */
+    uint8_t encodeTarget(uint8_t *bytes, uint8_t channelNumber, uint16_t target)
+    {
+      return encodeChannelValue(bytes, setTargetCommand, channelNumber, target);
+    }
+
+    /** Like encodeTarget(), for setSpeed. */
+    uint8_t encodeSpeed(uint8_t *bytes, uint8_t channelNumber, uint16_t speed)
+    {
+      return encodeChannelValue(bytes, setSpeedCommand, channelNumber, speed);
+    }
+
+    /** Like encodeTarget(), for setAcceleration. */
+    uint8_t encodeAcceleration(uint8_t *bytes, uint8_t channelNumber, uint16_t acceleration)
+    {
+      return encodeChannelValue(bytes, setAccelerationCommand, channelNumber, acceleration);
+    }
+
+    /** Hands bytes from the encode functions to the stream in one write. */
+    void writeEncoded(const uint8_t *bytes, uint8_t length)
+    {
+      Ops::write(_stream, bytes, length);
+    }
+
+    StreamT &stream() { return _stream; }
+    uint8_t deviceNumber() const { return _deviceNumber; }
+    bool CRCEnabled() const { return _CRCEnabled; }
+
+    static const uint8_t maxMultiTargets = 24;
+
+    // Pololu header (3) + channel and value (3) + CRC (1)
+    static const uint8_t maxEncodedSize = 3 + 3 + 1;
+
+  private:
+    typedef MaestroStreamOps<StreamT> Ops;
+
+    // tryBaud() results that aren't failure counts
+    static const uint8_t noAnswer = 0xFF;
+    static const uint8_t noPort = 0xFE;
+
+    // How long the Maestro gets to start answering a query
+    static const uint32_t answerTimeoutUs = 2000;
+
+    /**
+     * Sends a getPosition or getErrors query and waits for its two bytes, at
+     * most answerTimeoutUs plus their time on the wire at \a baud.
+     * @return false if they didn't come
+     */
+    bool query(uint8_t commandByte, uint8_t channel, uint32_t baud, uint16_t &answer)
+    {
+      Packet packet;
+      startPacket(packet, commandByte);
+      if (commandByte == getPositionCommand)
+      {
+        put7BitData(packet, channel);
+      }
+      send(packet);
+      uint32_t wireUs = (packet.length + 2) * 10000000UL / baud;
+      uint32_t start = micros();
+      while (Ops::available(_stream) < 2)
+      {
+        if (micros() - start > answerTimeoutUs + wireUs)
+        {
+          return false;
+        }
+      }
+      answer = readTwoBytes();
+      return true;
+    }
+
+    /**
+     * Throws away whatever has arrived, waiting a little for stragglers
+     */
+    void drain()
+    {
+      uint32_t start = micros();
+      while (micros() - start < answerTimeoutUs)
+      {
+        while (Ops::available(_stream) > 0)
+        {
+          Ops::read(_stream);
+        }
+      }
+    }
+
+    /**
+     * @return the failures out of \a probes queries at \a baud, noAnswer if
+     * the first went unanswered, noPort if the port can't do the rate
+     */
+    uint8_t tryBaud(bool (*setBaud)(uint32_t), uint32_t baud, uint8_t probes)
+    {
+      reset();
+      if (!setBaud(baud))
+      {
+        return noPort;
+      }
+      drain();
+      Ops::write(_stream, baudRateIndication);
+      uint16_t answer;
+      if (!query(getErrorsCommand, 0, baud, answer))
+      {
+        return noAnswer;
+      }
+      uint8_t failures = 0;
+      for (uint8_t i = 0; i < probes; i++)
+      {
+        // Positions are 14 bits, and a clean link leaves the error register clear
+        bool errors = i % 2;
+        if (!query(errors ? getErrorsCommand : getPositionCommand, 0, baud, answer) ||
+            (errors ? answer != 0 : answer > 0x3FFF))
+        {
+          failures++;
+          drain();
+        }
+      }
+      return failures;
+    }
+
+    static const uint8_t baudRateIndication = 0xAA;
+
+    static const uint8_t miniSscCommand = 0xFF;
+    static const uint8_t setTargetCommand = 0x84;
+    static const uint8_t setSpeedCommand = 0x87;
+    static const uint8_t setAccelerationCommand = 0x89;
+    static const uint8_t setPwmCommand = 0x8A;
+    static const uint8_t getPositionCommand = 0x90;
+    static const uint8_t getMovingStateCommand = 0x93;
+    static const uint8_t setMultipleTargetsCommand = 0x9F;
+    static const uint8_t getErrorsCommand = 0xA1;
+    static const uint8_t goHomeCommand = 0xA2;
+    static const uint8_t stopScriptCommand = 0xA4;
+    static const uint8_t restartScriptAtSubroutineCommand = 0xA7;
+    static const uint8_t restartScriptAtSubroutineWithParameterCommand = 0xA8;
+    static const uint8_t getScriptStatusCommand = 0xAE;
+
+    // Pololu header (3) + setMultiTarget count and channel (2) + 24 targets
+    // (48) + CRC (1)
+    static const uint8_t maxPacketSize = 3 + 2 + 2 * maxMultiTargets + 1;
+
+    // Pololu header (3) + channel and target (3) + CRC (1)
+    static const uint8_t maxSetTargetSize = 3 + 3 + 1;
+
+    struct Packet
+    {
+      uint8_t bytes[maxPacketSize];
+      uint8_t length;
+#ifdef SB_MAESTRO_TRACE
+      uint8_t commandByte;
+      uint64_t traceStartNs;
+#endif
+    };
+
+    static inline uint8_t CRCUpdate(uint8_t CRCByte, uint8_t dataByte)
+    {
+      return maestroCRC7Table(CRCByte ^ dataByte);
+    }
+
+    inline void startPacket(Packet &packet, uint8_t commandByte)
+    {
+#ifdef SB_MAESTRO_TRACE
+      packet.commandByte = commandByte;
+      SB_Trace *trace = SB_Trace::current();
+      packet.traceStartNs = trace ? trace->now() : 0;
+#endif
+      if (_deviceNumber != deviceNumberDefault)
+      {
+        packet.bytes[0] = baudRateIndication;
+        packet.bytes[1] = _deviceNumber & 0x7F;
+        packet.bytes[2] = commandByte & 0x7F;
+        packet.length = 3;
+      }
+      else
+      {
+        packet.bytes[0] = commandByte;
+        packet.length = 1;
+      }
+    }
+
+    static inline void put7BitData(Packet &packet, uint8_t data)
+    {
+      packet.bytes[packet.length++] = data & 0x7F;
+    }
+
+    static inline void put14BitData(Packet &packet, uint16_t data)
+    {
+      packet.bytes[packet.length++] = data & 0x7F;
+      packet.bytes[packet.length++] = (data >> 7) & 0x7F;
+    }
+
+    inline void sendChannelValue(uint8_t commandByte, uint8_t channel, uint16_t value)
+    {
+      Packet packet;
+      startPacket(packet, commandByte);
+      put7BitData(packet, channel);
+      put14BitData(packet, value);
+      send(packet);
+    }
+
+    inline uint8_t encodeChannelValue(uint8_t *bytes, uint8_t commandByte,
+                                      uint8_t channel, uint16_t value)
+    {
+      // Built by hand rather than in a Packet, startPacket() traces
+      uint8_t length = 0;
+      if (_deviceNumber != deviceNumberDefault)
+      {
+        bytes[length++] = baudRateIndication;
+        bytes[length++] = _deviceNumber & 0x7F;
+        bytes[length++] = commandByte & 0x7F;
+      }
+      else
+      {
+        bytes[length++] = commandByte;
+      }
+      bytes[length++] = channel & 0x7F;
+      bytes[length++] = value & 0x7F;
+      bytes[length++] = (value >> 7) & 0x7F;
+      if (_CRCEnabled)
+      {
+        uint8_t CRCByte = 0;
+        for (uint8_t i = 0; i < length; i++)
+        {
+          CRCByte = CRCUpdate(CRCByte, bytes[i]);
+        }
+        bytes[length++] = CRCByte;
+      }
+      return length;
+    }
+
+    inline void appendCRC(Packet &packet)
+    {
+      if (_CRCEnabled)
+      {
+        uint8_t CRCByte = 0;
+        for (uint8_t i = 0; i < packet.length; i++)
+        {
+          CRCByte = CRCUpdate(CRCByte, packet.bytes[i]);
+        }
+        packet.bytes[packet.length++] = CRCByte;
+      }
+    }
+
+    inline void send(Packet &packet)
+    {
+      appendCRC(packet);
+      for (uint8_t i = 0; i < packet.length; i++)
+      {
+        Ops::write(_stream, packet.bytes[i]);
+      }
+#ifdef SB_MAESTRO_TRACE
+      if (SB_Trace *trace = SB_Trace::current())
+      {
+        trace->endSpan(packet.traceStartNs, TRACE_TRACK_ENCODE,
+                       maestroTraceName(packet.commandByte), packet.length);
+      }
+#endif
+    }
+
+    inline uint8_t readOneByte()
+    {
+      while (Ops::available(_stream) < 1);
+      return Ops::read(_stream);
+    }
+
+    inline uint16_t readTwoBytes()
+    {
+      while (Ops::available(_stream) < 2);
+      uint8_t lowerByte = Ops::read(_stream);
+      uint8_t upperByte = Ops::read(_stream);
+      return (upperByte << 8) | (lowerByte & 0xFF);
+    }
+
+    StreamT &_stream;
+    uint8_t _deviceNumber;
+    uint8_t _resetPin;
+    bool _CRCEnabled;
+};
@@ -5,177 +5,115 @@
 Maestro::Maestro(Stream &stream,
                  uint8_t resetPin,
                  uint8_t deviceNumber,
-                 bool CRCEnabled)
+                 bool CRCEnabled) : _maestro(stream,
+                                             resetPin,
+                                             deviceNumber,
+                                             CRCEnabled)
 {
-  _stream = &stream;
-  _deviceNumber = deviceNumber;
-  _resetPin = resetPin;
-  _CRCEnabled = CRCEnabled;
 }
 
 void Maestro::reset()
 {
-  if (_resetPin != noResetPin)
-  {
-    digitalWrite(_resetPin, LOW);
-    pinMode(_resetPin, OUTPUT); // Drive low.
-    delay(1);
-    pinMode(_resetPin, INPUT); // Return to high-impedance input (reset is
-                               // internally pulled up on Maestro).
-    delay(200); // Wait for Maestro to boot up after reset.
-  }
+  _maestro.reset();
 }
 
 void Maestro::setTargetMiniSSC(uint8_t channelNumber, uint8_t target)
 {
-  _stream->write(miniSscCommand);
-  _stream->write(channelNumber);
-  _stream->write(target);
+  _maestro.setTargetMiniSSC(channelNumber, target);
 }
 
 void Maestro::goHome()
 {
-  writeCommand(goHomeCommand);
-  writeCRC();
+  _maestro.goHome();
 }
 
 void Maestro::stopScript()
 {
-  writeCommand(stopScriptCommand);
-  writeCRC();
+  _maestro.stopScript();
 }
 
 void Maestro::restartScript(uint8_t subroutineNumber)
 {
-  writeCommand(restartScriptAtSubroutineCommand);
-  write7BitData(subroutineNumber);
-  writeCRC();
+  _maestro.restartScript(subroutineNumber);
 }
 
 void Maestro::restartScriptWithParameter(uint8_t subroutineNumber,
                                          uint16_t parameter)
 {
-  writeCommand(restartScriptAtSubroutineWithParameterCommand);
-  write7BitData(subroutineNumber);
-  write14BitData(parameter);
-  writeCRC();
+  _maestro.restartScriptWithParameter(subroutineNumber, parameter);
 }
 
 void Maestro::setTarget(uint8_t channelNumber, uint16_t target)
 {
-  writeCommand(setTargetCommand);
-  write7BitData(channelNumber);
-  write14BitData(target);
-  writeCRC();
+  _maestro.setTarget(channelNumber, target);
+}
+
+void Maestro::setTargets(uint8_t numberOfTargets,
+                         uint8_t firstChannel,
+                         uint16_t *targetList)
+{
+  _maestro.setTargets(numberOfTargets, firstChannel, targetList);
 }
 
 void Maestro::setSpeed(uint8_t channelNumber, uint16_t speed)
 {
-  writeCommand(setSpeedCommand);
-  write7BitData(channelNumber);
-  write14BitData(speed);
-  writeCRC();
+  _maestro.setSpeed(channelNumber, speed);
 }
 
 void Maestro::setAcceleration(uint8_t channelNumber, uint16_t acceleration)
 {
-  writeCommand(setAccelerationCommand);
-  write7BitData(channelNumber);
-  write14BitData(acceleration);
-  writeCRC();
+  _maestro.setAcceleration(channelNumber, acceleration);
 }
 
 uint16_t Maestro::getPosition(uint8_t channelNumber)
 {
-  writeCommand(getPositionCommand);
-  write7BitData(channelNumber);
-  writeCRC();
-
-  while (_stream->available() < 2);
-  uint8_t lowerByte = _stream->read();
-  uint8_t upperByte = _stream->read();
-  return (upperByte << 8) | (lowerByte & 0xFF);
+  return _maestro.getPosition(channelNumber);
 }
 
 uint8_t Maestro::getMovingState()
 {
-  writeCommand(getMovingStateCommand);
-  writeCRC();
-
-  while (_stream->available() < 1);
-  return _stream->read();
+  return _maestro.getMovingState();
 }
 
 uint16_t Maestro::getErrors()
 {
-  writeCommand(getErrorsCommand);
-  writeCRC();
-
-  while (_stream->available() < 2);
-  uint8_t lowerByte = _stream->read();
-  uint8_t upperByte = _stream->read();
-  return (upperByte << 8) | (lowerByte & 0xFF);
+  return _maestro.getErrors();
 }
 
-uint8_t Maestro::getScriptStatus()
+uint8_t Maestro::encodeTarget(uint8_t *bytes, uint8_t channelNumber, uint16_t target)
 {
-  writeCommand(getScriptStatusCommand);
-  writeCRC();
-
-  while (_stream->available() < 1);
-  return _stream->read();
+  return _maestro.encodeTarget(bytes, channelNumber, target);
 }
 
-void Maestro::writeByte(uint8_t dataByte)
+uint8_t Maestro::encodeSpeed(uint8_t *bytes, uint8_t channelNumber, uint16_t speed)
 {
-  _stream->write(dataByte);
-
-  if(_CRCEnabled)
-  {
-    _CRCByte ^= dataByte;
-    for (uint8_t j = 0; j < 8; j++)
-    {
-      if (_CRCByte & 1)
-      {
-        _CRCByte ^= CRC7Polynomial;
-      }
-      _CRCByte >>= 1;
-    }
-  }
+  return _maestro.encodeSpeed(bytes, channelNumber, speed);
 }
 
-void Maestro::writeCRC()
+uint8_t Maestro::encodeAcceleration(uint8_t *bytes, uint8_t channelNumber, uint16_t acceleration)
 {
-  if(_CRCEnabled)
-  {
-    _stream->write(_CRCByte);
-    _CRCByte = 0; // Reset CRCByte to initial value.
-  }
+  return _maestro.encodeAcceleration(bytes, channelNumber, acceleration);
 }
 
-void Maestro::writeCommand(uint8_t commandByte)
+void Maestro::writeEncoded(const uint8_t *bytes, uint8_t length)
 {
-  if (_deviceNumber != deviceNumberDefault)
-  {
-    writeByte(baudRateIndication);
-    write7BitData(_deviceNumber);
-    write7BitData(commandByte);
-  }
-  else
-  {
-    writeByte(commandByte);
-  }
+  _maestro.writeEncoded(bytes, length);
 }
 
-void Maestro::write7BitData(uint8_t data)
+const uint32_t Maestro::baudRates[] = {200000, 115200, 57600, 38400, 19200, 9600};
+
+uint32_t Maestro::negotiateBaud(bool (*setBaud)(uint32_t baud),
+                                const uint32_t *rates, uint8_t rateCount,
+                                uint8_t probes, uint8_t maxFailures,
+                                MaestroBaudTrial *trials)
 {
-  writeByte(data & 0x7F);
+  return _maestro.negotiateBaud(setBaud, rates, rateCount, probes,
+                                maxFailures, trials);
 }
 
-void Maestro::write14BitData(uint16_t data)
+uint8_t Maestro::getScriptStatus()
 {
-  writeByte(data & 0x7F);
-  writeByte((data >> 7) & 0x7F);
+  return _maestro.getScriptStatus();
 }
 
 MicroMaestro::MicroMaestro(Stream &stream,
@@ -200,24 +138,12 @@ MiniMaestro::MiniMaestro(Stream &stream,
 
 void MiniMaestro::setPWM(uint16_t onTime, uint16_t period)
 {
-  writeCommand(setPwmCommand);
-  write14BitData(onTime);
-  write14BitData(period);
-  writeCRC();
+  _maestro.setPWM(onTime, period);
 }
 
 void MiniMaestro::setMultiTarget(uint8_t numberOfTargets,
                                  uint8_t firstChannel,
                                  uint16_t *targetList)
 {
-  writeCommand(setMultipleTargetsCommand);
-  write7BitData(numberOfTargets);
-  write7BitData(firstChannel);
-
-  for (int i = 0; i < numberOfTargets; i++)
-  {
-    write14BitData(targetList[i]);
-  }
-
-  writeCRC();
+  _maestro.setMultiTarget(numberOfTargets, firstChannel, targetList);
 }
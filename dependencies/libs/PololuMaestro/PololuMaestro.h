@@ -15,6 +15,7 @@
 
 #include <Arduino.h>
 #include <Stream.h>
+#include "BasicMaestro.h"
 
 /*! \brief Main Maestro class that handles common functions between the Micro
  *  Maestro and Mini Maestro.
@@ -22,6 +23,10 @@
  * The subclasses, MicroMaestro and MiniMaestro inherit all of the functions
  * from Maestro. The Maestro class is not meant to be instantiated directly; use
  * the MicroMaestro or MiniMaestro subclasses instead.
+ *
+ * Maestro is a thin wrapper around BasicMaestro<Stream>, which works with any
+ * Stream through virtual calls. Code that knows the concrete type of its
+ * stream can use BasicMaestro (BasicMaestro.h) directly to avoid them.
  */
 class Maestro
 {
@@ -75,6 +80,27 @@ class Maestro
      */
     void setTarget(uint8_t channelNumber, uint16_t target);
 
+    /** \brief Sets the targets of a contiguous block of channels with one
+     * Set Target command each.
+     *
+     * @param numberOfTargets A number from 0 to 24.
+     *
+     * @param firstChannel The first channel of the block.
+     *
+     * @param targetList An array of numbers from 0 to 16383.
+     *
+     * The commands are encoded back to back and handed to the stream in one
+     * write, so they go out without gaps. Unlike setMultiTarget this works on
+     * every Maestro, the Micro included, at the cost of a command byte (and
+     * the Pololu protocol header and CRC) per target.
+     *
+     * The compact protocol is used by default. If the %deviceNumber was given
+     * to the constructor, it uses the Pololu protocol.
+     */
+    void setTargets(uint8_t numberOfTargets,
+                    uint8_t firstChannel,
+                    uint16_t *targetList);
+
     /** \brief Sets the \a speed limit of \a channelNumber.
      *
      * @param channelNumber A servo number from 0 to 127.
@@ -236,6 +262,61 @@ class Maestro
      */
     uint16_t getErrors();
 
+    /** \brief The rates negotiateBaud() tries by default, fastest first:
+     * 200000 (the fastest the Maestro's UART takes) down to 9600.
+     */
+    static const uint32_t baudRates[];
+    static const uint8_t baudRateCount = 6;
+
+    /** \brief Finds the fastest rate the Maestro answers reliably at, and
+     * leaves the port at it.
+     *
+     * @param setBaud Sets the port to a rate, returning false if it can't,
+     * e.g. `[](uint32_t baud) { Serial1.begin(baud); return true; }`.
+     *
+     * @return The rate the port was left at, 0 if the Maestro didn't answer
+     * at any.
+     *
+     * Each rate gets the 0xAA baud rate indication byte, then \a probes
+     * getPosition and getErrors queries, and the first with no more than
+     * \a maxFailures failures is taken. A Maestro set to detect the baud only
+     * takes it from the first 0xAA after a reset, so it needs a reset pin to
+     * be tried at more than one rate. See BasicMaestro::negotiateBaud().
+     */
+    uint32_t negotiateBaud(bool (*setBaud)(uint32_t baud),
+                           const uint32_t *rates = baudRates,
+                           uint8_t rateCount = baudRateCount,
+                           uint8_t probes = 16, uint8_t maxFailures = 0,
+                           MaestroBaudTrial *trials = nullptr);
+
+    /** \brief The most bytes encodeTarget(), encodeSpeed() and
+     * encodeAcceleration() write: a Pololu protocol header and a CRC.
+     */
+    static const uint8_t maxEncodedSize = BasicMaestro<Stream>::maxEncodedSize;
+
+    /** \brief Encodes a Set Target command into \a bytes without sending it.
+     *
+     * @param bytes Where the command goes, at least maxEncodedSize long.
+     *
+     * @return The command's length.
+     *
+     * For commands that are built in one place (an interrupt, say) and sent
+     * from another with writeEncoded(). It uses the same protocol and CRC
+     * setting as setTarget(), and doesn't touch the stream.
+     */
+    uint8_t encodeTarget(uint8_t *bytes, uint8_t channelNumber, uint16_t target);
+
+    /** \brief Like encodeTarget(), for Set Speed. */
+    uint8_t encodeSpeed(uint8_t *bytes, uint8_t channelNumber, uint16_t speed);
+
+    /** \brief Like encodeTarget(), for Set Acceleration. */
+    uint8_t encodeAcceleration(uint8_t *bytes, uint8_t channelNumber, uint16_t acceleration);
+
+    /** \brief Writes a command from the encode functions to the stream in
+     * one write.
+     */
+    void writeEncoded(const uint8_t *bytes, uint8_t length);
+
     /** \cond
     *
     * This should be considered a private implementation detail of the library.
@@ -246,35 +327,8 @@ class Maestro
             uint8_t deviceNumber,
             bool CRCEnabled);
 
-    void writeByte(uint8_t dataByte);
-    void writeCRC();
-    void writeCommand(uint8_t commandByte);
-    void write7BitData(uint8_t data);
-    void write14BitData(uint16_t data);
+    BasicMaestro<Stream> _maestro;
   /** \endcond **/
-
-  private:
-    static const uint8_t CRC7Polynomial = 0x91;
-    static const uint8_t baudRateIndication = 0xAA;
-
-    static const uint8_t miniSscCommand = 0xFF;
-    static const uint8_t setTargetCommand = 0x84;
-    static const uint8_t setSpeedCommand = 0x87;
-    static const uint8_t setAccelerationCommand = 0x89;
-    static const uint8_t getPositionCommand = 0x90;
-    static const uint8_t getMovingStateCommand = 0x93;
-    static const uint8_t getErrorsCommand = 0xA1;
-    static const uint8_t goHomeCommand = 0xA2;
-    static const uint8_t stopScriptCommand = 0xA4;
-    static const uint8_t restartScriptAtSubroutineCommand = 0xA7;
-    static const uint8_t restartScriptAtSubroutineWithParameterCommand = 0xA8;
-    static const uint8_t getScriptStatusCommand = 0xAE;
-
-    uint8_t _deviceNumber;
-    uint8_t _resetPin;
-    bool _CRCEnabled;
-    uint8_t _CRCByte;
-    Stream *_stream;
 };
 
 class MicroMaestro : public Maestro
@@ -374,8 +428,4 @@ class MiniMaestro : public Maestro
     void setMultiTarget(uint8_t numberOfTargets,
                         uint8_t firstChannel,
                         uint16_t *targetList);
-
-  private:
-    static const uint8_t setPwmCommand = 0x8A;
-    static const uint8_t setMultipleTargetsCommand = 0x9F;
 };
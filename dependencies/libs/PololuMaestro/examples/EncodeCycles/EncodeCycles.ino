@@ -0,0 +1,90 @@
+/* Measures CPU cycles per Maestro command for MiniMaestro (virtual calls
+ * through Stream) and BasicMaestro<NullStream> (calls resolved at compile
+ * time).
+ *
+ * The commands are written to a stream that throws the bytes away, so only the
+ * cost of encoding a command and handing its bytes to the stream is measured,
+ * not the time to shift them out of a UART. Cycles are counted with the ARM
+ * DWT cycle counter, so this needs a Teensy 3.x or 4.x.
+ *
+ * Open the Serial Monitor at any baud to read the results.
+ */
+
+#include <PololuMaestro.h>
+#include <BasicMaestro.h>
+
+class NullStream : public Stream
+{
+  public:
+    volatile uint32_t bytes = 0;
+    volatile uint32_t checksum = 0; // so the encoded bytes can't be optimized away
+
+    size_t write(uint8_t dataByte) override
+    {
+      bytes++;
+      checksum = checksum * 31 + dataByte;
+      return 1;
+    }
+    int available() override { return 2; }
+    int read() override { return 0x17; }
+    int peek() override { return 0x17; }
+};
+
+NullStream sink;
+MiniMaestro virtualMaestro(sink);
+BasicMaestro<NullStream> inlineMaestro(sink);
+MiniMaestro virtualCRCMaestro(sink, Maestro::noResetPin, 12, true);
+BasicMaestro<NullStream> inlineCRCMaestro(sink, Maestro::noResetPin, 12, true);
+
+const uint32_t iterations = 10000;
+
+template <class MaestroT>
+uint32_t setTargetCycles(MaestroT &maestro)
+{
+  uint32_t start = ARM_DWT_CYCCNT;
+  for (uint32_t i = 0; i < iterations; i++)
+  {
+    maestro.setTarget(i & 7, 4000 + (i & 0xFFF));
+  }
+  return (ARM_DWT_CYCCNT - start) / iterations;
+}
+
+template <class MaestroT>
+uint32_t getPositionCycles(MaestroT &maestro)
+{
+  uint32_t start = ARM_DWT_CYCCNT;
+  for (uint32_t i = 0; i < iterations; i++)
+  {
+    maestro.getPosition(i & 7);
+  }
+  return (ARM_DWT_CYCCNT - start) / iterations;
+}
+
+void report(const char *what, uint32_t virtualCycles, uint32_t inlineCycles)
+{
+  Serial.print(what);
+  Serial.print(": MiniMaestro ");
+  Serial.print(virtualCycles);
+  Serial.print(" cycles, BasicMaestro ");
+  Serial.print(inlineCycles);
+  Serial.println(" cycles");
+}
+
+void setup()
+{
+  Serial.begin(9600);
+  while (!Serial && millis() < 3000);
+
+  // Turn on the cycle counter
+  ARM_DEMCR |= ARM_DEMCR_TRCENA;
+  ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+
+  report("setTarget, compact", setTargetCycles(virtualMaestro), setTargetCycles(inlineMaestro));
+  report("setTarget, Pololu + CRC", setTargetCycles(virtualCRCMaestro), setTargetCycles(inlineCRCMaestro));
+  report("getPosition, compact", getPositionCycles(virtualMaestro), getPositionCycles(inlineMaestro));
+  report("getPosition, Pololu + CRC", getPositionCycles(virtualCRCMaestro), getPositionCycles(inlineCRCMaestro));
+}
+
+void loop()
+{
+}
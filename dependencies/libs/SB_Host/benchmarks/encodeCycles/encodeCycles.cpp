@@ -0,0 +1,88 @@
+/**
+ * Host version of PololuMaestro/examples/EncodeCycles: cycles per command for
+ * MiniMaestro (virtual stream calls) against BasicMaestro on a concrete stream.
+ *
+ * Bytes go to a stream that throws them away, so this is the encode and hand-off
+ * cost only. Cycles come from the TSC on x86 and are nanoseconds elsewhere.
+ *
+ * Usage: encodeCycles [iterations]
+ */
+
+#include <Arduino.h>
+#include <PololuMaestro.h>
+
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t cycles() { return __rdtsc(); }
+static const char *cycleUnit = "cycles";
+#else
+static inline uint64_t cycles() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+static const char *cycleUnit = "ns";
+#endif
+
+class NullStream : public Stream {
+	public:
+		uint32_t bytes = 0;
+		uint32_t checksum = 0; // so the encoded bytes can't be optimized away
+
+		size_t write(uint8_t dataByte) override { bytes++; checksum = checksum * 31 + dataByte; return 1; }
+		int available() override { return 2; }
+		int read() override { return 0x17; }
+		int peek() override { return 0x17; }
+};
+
+static uint32_t iterations = 1000000;
+
+// Keeps the compiler from merging or dropping iterations
+#define BARRIER() asm volatile("" ::: "memory")
+
+template <class MaestroT>
+static double setTargetCycles(MaestroT &maestro) {
+	uint64_t start = cycles();
+	for (uint32_t i = 0; i < iterations; i++) {
+		maestro.setTarget(i & 7, 4000 + (i & 0xFFF));
+		BARRIER();
+	}
+	return (double) (cycles() - start) / iterations;
+}
+
+template <class MaestroT>
+static double getPositionCycles(MaestroT &maestro) {
+	uint64_t start = cycles();
+	for (uint32_t i = 0; i < iterations; i++) {
+		maestro.getPosition(i & 7);
+		BARRIER();
+	}
+	return (double) (cycles() - start) / iterations;
+}
+
+static void report(const char *what, double virtualCycles, double inlineCycles) {
+	printf("%-28s MiniMaestro %7.1f %s   BasicMaestro %7.1f %s\n", what,
+			virtualCycles, cycleUnit, inlineCycles, cycleUnit);
+}
+
+int main(int argc, char **argv) {
+	if (argc > 1) {
+		iterations = strtoul(argv[1], nullptr, 10);
+	}
+	NullStream sink;
+	MiniMaestro virtualMaestro(sink);
+	BasicMaestro<NullStream> inlineMaestro(sink);
+	MiniMaestro virtualCRCMaestro(sink, Maestro::noResetPin, 12, true);
+	BasicMaestro<NullStream> inlineCRCMaestro(sink, Maestro::noResetPin, 12, true);
+
+	// One untimed pass each to warm the caches
+	setTargetCycles(virtualMaestro);
+	setTargetCycles(inlineMaestro);
+
+	report("setTarget, compact", setTargetCycles(virtualMaestro), setTargetCycles(inlineMaestro));
+	report("setTarget, Pololu + CRC", setTargetCycles(virtualCRCMaestro), setTargetCycles(inlineCRCMaestro));
+	report("getPosition, compact", getPositionCycles(virtualMaestro), getPositionCycles(inlineMaestro));
+	report("getPosition, Pololu + CRC", getPositionCycles(virtualCRCMaestro), getPositionCycles(inlineCRCMaestro));
+	printf("(%lu bytes written, checksum %08lx)\n", (unsigned long) sink.bytes, (unsigned long) sink.checksum);
+	return 0;
+}
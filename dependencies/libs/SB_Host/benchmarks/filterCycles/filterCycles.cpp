@@ -0,0 +1,79 @@
+/**
+ * Host version of SB_Servo/examples/filterCycles: cycles per frame of six RC
+ * channels through SB_RcFilter, the packed path against the scalar one.
+ *
+ * Off ARM the packed path runs on the portable versions of the DSP
+ * instructions, so this tracks regressions in the packing rather than the
+ * speedup, which only the Teensy version shows. Cycles come from the TSC on x86
+ * and are nanoseconds elsewhere.
+ *
+ * Usage: filterCycles [frames]
+ */
+
+#include <Arduino.h>
+#include <SB_RcFilter.hpp>
+
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t cycles() { return __rdtsc(); }
+static const char *cycleUnit = "cycles";
+#else
+static inline uint64_t cycles() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+static const char *cycleUnit = "ns";
+#endif
+
+#define CHANNELS 6
+
+static uint32_t frames = 1000000;
+static int widths[64][CHANNELS];
+static uint32_t checksum = 0; // so the results can't be optimized away
+
+// Keeps the compiler from merging or dropping frames
+#define BARRIER() asm volatile("" ::: "memory")
+
+static double frameCycles(SB_RcFilter &filter, bool packed) {
+	int out[CHANNELS];
+	uint64_t start = cycles();
+	for (uint32_t i = 0; i < frames; i++) {
+		if (packed) {
+			filter.filter(widths[i & 63], out);
+		} else {
+			filter.filterScalar(widths[i & 63], out);
+		}
+		checksum = checksum * 31 + out[i % CHANNELS];
+		BARRIER();
+	}
+	return (double) (cycles() - start) / frames;
+}
+
+static void report(const char *what, uint8_t windowShift, uint16_t alpha) {
+	SB_RcFilter packed(CHANNELS, windowShift, alpha);
+	SB_RcFilter scalar(CHANNELS, windowShift, alpha);
+	// One untimed pass each to warm the caches
+	frameCycles(packed, true);
+	frameCycles(scalar, false);
+	printf("%-28s packed %7.1f %s   scalar %7.1f %s\n", what,
+			frameCycles(packed, true), cycleUnit, frameCycles(scalar, false), cycleUnit);
+}
+
+int main(int argc, char **argv) {
+	if (argc > 1) {
+		frames = strtoul(argv[1], nullptr, 10);
+	}
+	for (int i = 0; i < 64; i++) {
+		for (int c = 0; c < CHANNELS; c++) {
+			widths[i][c] = 1500 + (int) (400 * sin(i / (5.0 + c))) + (i * 7 + c * 13) % 9 - 4;
+		}
+	}
+
+	printf("DSP instructions: %s\n", SB_RcFilter::usesDSP() ? "yes" : "portable");
+	report("average 4, IIR 1/4", 2, RC_FILTER_ALPHA_ONE / 4);
+	report("average 16, IIR 1/16", 4, RC_FILTER_ALPHA_ONE / 16);
+	report("average only, 8", 3, RC_FILTER_ALPHA_ONE);
+	printf("(checksum %08lx)\n", (unsigned long) checksum);
+	return 0;
+}
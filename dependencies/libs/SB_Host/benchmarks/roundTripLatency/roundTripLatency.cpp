@@ -0,0 +1,94 @@
+/**
+ * Measures getPosition() round trip latency through SB_TermiosStream and a pty.
+ *
+ * A responder thread answers every compact getPosition packet on the master side,
+ * so what's measured is the host serial path itself: buffering, the write and read
+ * syscalls and the pty hop in both directions. Baud has no effect on a pty, it's
+ * set anyway so the numbers come from the same code path as a real port.
+ *
+ * Usage: roundTripLatency [iterations] [baud]
+ */
+
+#include <Arduino.h>
+#include <PololuMaestro.h>
+#include <SB_PtyPair.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <poll.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+static SB_PtyPair pty;
+static std::atomic<bool> running{true};
+
+static void responder() {
+	uint8_t buffer[64];
+	int pending = 0; // bytes of the current packet seen so far
+	while (running) {
+		struct pollfd master = {pty.getMasterFd(), POLLIN, 0};
+		if (poll(&master, 1, 10) <= 0) {
+			continue;
+		}
+		ssize_t n = ::read(pty.getMasterFd(), buffer, sizeof(buffer));
+		for (ssize_t i = 0; i < n; i++) {
+			if (buffer[i] == 0x90) {
+				pending = 1;
+			} else if (pending == 1) {
+				uint8_t response[2] = {0x70, 0x17}; // 6000
+				::write(pty.getMasterFd(), response, 2);
+				pending = 0;
+			}
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	int iterations = argc > 1 ? atoi(argv[1]) : 10000;
+	unsigned long baud = argc > 2 ? atol(argv[2]) : 115200;
+
+	if (!pty.open()) {
+		Serial.println("Couldn't allocate a pty");
+		return 1;
+	}
+	std::thread responderThread(responder);
+
+	SB_TermiosStream port(pty.getSlavePath());
+	if (!port.begin(baud)) {
+		Serial.print("begin() failed, error code ");
+		Serial.println(port.getErrorCode());
+		return 1;
+	}
+	MiniMaestro maestro(port);
+
+	// Warm up the threads and page in the buffers
+	for (int i = 0; i < 100; i++) {
+		maestro.getPosition(0);
+	}
+
+	std::vector<double> samples;
+	samples.reserve(iterations);
+	for (int i = 0; i < iterations; i++) {
+		auto start = std::chrono::steady_clock::now();
+		maestro.getPosition(0);
+		auto stop = std::chrono::steady_clock::now();
+		samples.push_back(std::chrono::duration<double, std::micro>(stop - start).count());
+	}
+	running = false;
+	responderThread.join();
+
+	std::sort(samples.begin(), samples.end());
+	auto percentile = [&](double p) { return samples[(size_t) (p * (samples.size() - 1))]; };
+	Serial.print("getPosition round trip over a pty, ");
+	Serial.print(iterations);
+	Serial.println(" iterations (us)");
+	Serial.print("min: "); Serial.println(samples.front());
+	Serial.print("p50: "); Serial.println(percentile(0.50));
+	Serial.print("p90: "); Serial.println(percentile(0.90));
+	Serial.print("p99: "); Serial.println(percentile(0.99));
+	Serial.print("max: "); Serial.println(samples.back());
+	Serial.flush();
+	return 0;
+}
@@ -0,0 +1,186 @@
+/**
+ * Measures how long after a target is sent the Maestro reports it back through
+ * getPosition, for every combination of baud, protocol, CRC and batch size,
+ * against SB_MaestroEmulator in virtual time.
+ *
+ * A poller watches the last channel of the burst the whole time without waiting
+ * on the answers: up to [depth] requestPosition() queries are kept in flight and
+ * their answers are picked off the stream as they arrive. At random moments a trial
+ * timestamps a burst of new targets (channels 0 to batch - 1, sent as back to back
+ * setTargets or one setMultiTarget) into the middle of that traffic. The latency is
+ * from the moment the burst was handed to the stream to the arrival of the first
+ * answer showing the new target, so it includes the wire time of the burst, of the
+ * polls queued ahead of it and of the one that sees it, and the emulator's
+ * response latency.
+ *
+ * Virtual time makes the numbers exact and repeatable. The SB_Servo example of
+ * the same name takes the same measurements against a real Maestro.
+ *
+ * Usage: targetLatency [trials] [responseLatencyUs] [depth]
+ */
+
+#include <Arduino.h>
+#include <BasicMaestro.h>
+#include <SB_EmulatedSerial.hpp>
+#include <SB_MaestroEmulator.hpp>
+#include <SB_Simulation.hpp>
+
+#include <algorithm>
+#include <vector>
+
+#define MAX_BATCH 12
+
+static const uint32_t bauds[] = {9600, 38400, 115200, 200000, 250000};
+static const uint8_t batches[] = {1, 4, MAX_BATCH};
+
+static int trials = 200;
+static uint32_t responseLatencyUs = 0;
+static size_t depth = 2;
+
+struct Config {
+	uint32_t baud;
+	bool pololu;
+	bool crc;
+	uint8_t batch;
+	bool multi; // one setMultiTarget instead of batch setTargets
+};
+
+struct Result {
+	Config config;
+	uint32_t p50, p90, p99, max;
+};
+
+static std::vector<Result> results;
+
+/**
+ * Runs the trials for one configuration on a fresh emulator and simulation
+ */
+static Result measure(const Config &config) {
+	SB_Simulation simulation;
+	simulation.makeCurrent();
+	SB_MaestroEmulator emulator(EMULATOR_MAX_CHANNELS, EMULATOR_DEFAULT_DEVICE_NUMBER, config.crc);
+	emulator.setBaud(config.baud);
+	emulator.setResponseLatency(responseLatencyUs);
+	SB_EmulatedSerial serial(emulator);
+	BasicMaestro<SB_EmulatedSerial> maestro(serial, BasicMaestro<SB_EmulatedSerial>::noResetPin,
+			config.pololu ? EMULATOR_DEFAULT_DEVICE_NUMBER : BasicMaestro<SB_EmulatedSerial>::deviceNumberDefault,
+			config.crc);
+
+	std::vector<uint32_t> samples;
+	samples.reserve(trials);
+	uint32_t random = 12345;
+	uint16_t targets[MAX_BATCH];
+	uint8_t watched = config.batch - 1;
+
+	// The poller runs the whole time, a new target goes out at a random moment
+	// once the last one has been seen
+	size_t inFlight = 0;
+	int low = -1;
+	bool waiting = false;
+	uint16_t expected = 0;
+	uint32_t sentUs = 0;
+	uint32_t nextTargetUs = 0;
+	int trial = 0;
+	while (trial < trials) {
+		if (!waiting && micros() >= nextTargetUs) {
+			// A different target every time, never the one already there
+			uint16_t target = 4000 + (trial * 2477) % 4000;
+			for (uint8_t i = 0; i < config.batch; i++) {
+				targets[i] = target + i;
+			}
+			expected = targets[watched];
+			sentUs = micros();
+			if (config.multi) {
+				maestro.setMultiTarget(config.batch, 0, targets);
+			} else {
+				for (uint8_t i = 0; i < config.batch; i++) {
+					maestro.setTarget(i, targets[i]);
+				}
+			}
+			waiting = true;
+		}
+		if (inFlight < depth) {
+			maestro.requestPosition(watched);
+			inFlight++;
+		}
+		if (serial.available() <= 0) {
+			continue;
+		}
+		int value = serial.read();
+		if (low < 0) {
+			low = value;
+			continue;
+		}
+		uint16_t position = low | (value << 8);
+		low = -1;
+		inFlight--;
+		if (waiting && position == expected) {
+			samples.push_back(micros() - sentUs);
+			waiting = false;
+			trial++;
+			random = random * 1103515245 + 12345;
+			nextTargetUs = micros() + (random >> 8) % EMULATOR_FRAME_PERIOD_US;
+		}
+	}
+	SB_Simulation::clearCurrent();
+
+	std::sort(samples.begin(), samples.end());
+	auto percentile = [&](double p) { return samples[(size_t) (p * (samples.size() - 1))]; };
+	return Result{config, percentile(0.50), percentile(0.90), percentile(0.99), samples.back()};
+}
+
+static void print(const Result &result) {
+	const Config &config = result.config;
+	printf("%7lu  %-7s %-4s %5u  %-6s %8lu %8lu %8lu %8lu\n", (unsigned long) config.baud,
+			config.pololu ? "pololu" : "compact", config.crc ? "on" : "off", config.batch,
+			config.multi ? "multi" : "single", (unsigned long) result.p50, (unsigned long) result.p90,
+			(unsigned long) result.p99, (unsigned long) result.max);
+}
+
+int main(int argc, char **argv) {
+	if (argc > 1) {
+		trials = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		responseLatencyUs = strtoul(argv[2], nullptr, 10);
+	}
+	if (argc > 3) {
+		depth = std::max(1, atoi(argv[3]));
+	}
+	if (trials < 1) {
+		trials = 1;
+	}
+
+	printf("target to getPosition latency, emulated Maestro, %d trials, %lu us response latency, "
+			"%u polls in flight (us)\n", trials, (unsigned long) responseLatencyUs, (unsigned) depth);
+	printf("   baud  proto   crc  batch  send        p50      p90      p99      max\n");
+	for (uint32_t baud : bauds) {
+		for (bool pololu : {false, true}) {
+			for (bool crc : {false, true}) {
+				for (uint8_t batch : batches) {
+					for (bool multi : {false, true}) {
+						if (multi && batch == 1) {
+							continue;
+						}
+						results.push_back(measure(Config{baud, pololu, crc, batch, multi}));
+						print(results.back());
+					}
+				}
+			}
+		}
+	}
+
+	// The configuration to pick for each batch size, by worst case first
+	printf("\nlowest p99 per batch size:\n");
+	for (uint8_t batch : batches) {
+		const Result *best = nullptr;
+		for (const Result &result : results) {
+			if (result.config.batch == batch && (!best || result.p99 < best->p99
+					|| (result.p99 == best->p99 && result.p50 < best->p50))) {
+				best = &result;
+			}
+		}
+		print(*best);
+	}
+	return 0;
+}
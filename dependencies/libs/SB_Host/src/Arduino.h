@@ -0,0 +1,102 @@
+/**
+ * Host (Linux) stand-in for the Arduino core.
+ *
+ * Putting this directory on the include path ahead of everything else lets the
+ * PololuMaestro and SB_Servo libraries (and most of the sketches in this repo)
+ * compile natively on the companion computer. Serial is the terminal and
+ * Serial1 is a termios serial port, see SB_HostSerial.hpp.
+ *
+ * This directory must NOT be linked into ~/Arduino/libraries, it would shadow
+ * the real Arduino.h.
+ */
+
+#pragma once
+
+// Lets library code tell it's built for the host, e.g. to keep state per thread
+#define SB_HOST 1
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+
+#include "WString.h"
+#include "Print.h"
+#include "Stream.h"
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+// Timing, measured from the first call into the host core, or the clock of the
+// thread's SB_Simulation
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+// There are no pins on the host, these keep the sketches happy. Under a
+// SB_Simulation digitalRead() and the interrupt functions use its simulated pins
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+int digitalPinToInterrupt(uint8_t pin);
+void attachInterrupt(int interruptNum, void (*isr)(), int mode);
+void detachInterrupt(int interruptNum);
+void noInterrupts();
+void interrupts();
+
+// Host only, for code written against a whole GPIO port: one interrupt for
+// every pin in pinMask, and all the pin levels as one word (bit n for pin n)
+// like the port's input register
+void attachPortInterrupt(uint64_t pinMask, void (*isr)());
+uint64_t readPort();
+
+// Host only: micros() at the pin's last edge, latched when the edge happened
+// like a timer's input capture rather than when an ISR got round to it
+unsigned long pinCaptureMicros(uint8_t pin);
+
+// The Teensy's periodic timer interrupt. Under a SB_Simulation the callback runs
+// every period on its clock, without one it never runs
+class IntervalTimer {
+	private:
+		void (*callback)() = nullptr;
+		unsigned long periodUs = 0;
+		uint32_t generation = 0; // bumped by end(), so ticks already queued do nothing
+		bool running = false;
+
+		void schedule(uint32_t forGeneration);
+
+	public:
+		IntervalTimer() {}
+		~IntervalTimer() { end(); }
+		IntervalTimer(const IntervalTimer &) = delete;
+		IntervalTimer &operator=(const IntervalTimer &) = delete;
+
+		bool begin(void (*timerCallback)(), unsigned long microseconds);
+		void end();
+};
+
+long random(long howBig);
+long random(long howSmall, long howBig);
+void randomSeed(unsigned long seed);
+
+long map(long x, long inMin, long inMax, long outMin, long outMax);
+
+template <class T, class L, class H>
+inline T constrain(T x, L low, H high) {
+	return x < low ? low : (x > high ? high : x);
+}
+
+#include "SB_HostSerial.hpp"
@@ -0,0 +1,218 @@
+/**
+ * Host implementations of the Arduino core functions declared in Arduino.h,
+ * plus the Serial and Serial1 objects.
+ *
+ * Time, pins and interrupts go to the thread's SB_Simulation when there is one.
+ */
+
+#include "Arduino.h"
+#include "SB_Simulation.hpp"
+#include "SB_Trace.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <unistd.h>
+#include <poll.h>
+
+static const std::chrono::steady_clock::time_point hostStart = std::chrono::steady_clock::now();
+
+unsigned long micros() {
+	if (SB_Simulation *sim = SB_Simulation::current()) {
+		return (uint32_t) sim->now();
+	}
+	auto elapsed = std::chrono::steady_clock::now() - hostStart;
+	// Wraps like the real thing (every ~71 minutes on a 32-bit target)
+	return (uint32_t) std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+}
+
+unsigned long millis() {
+	if (SB_Simulation *sim = SB_Simulation::current()) {
+		return (uint32_t) (sim->now() / 1000);
+	}
+	auto elapsed = std::chrono::steady_clock::now() - hostStart;
+	return (uint32_t) std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+}
+
+void delay(unsigned long ms) {
+	if (SB_Simulation *sim = SB_Simulation::current()) {
+		sim->advance((uint64_t) ms * 1000);
+		return;
+	}
+	// Whatever the sketch wrote should be on its way while it sleeps
+	Serial1.flush();
+	std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(unsigned int us) {
+	if (SB_Simulation *sim = SB_Simulation::current()) {
+		sim->advance(us);
+		return;
+	}
+	std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void pinMode(uint8_t, uint8_t) {}
+void digitalWrite(uint8_t, uint8_t) {}
+
+int digitalRead(uint8_t pin) {
+	SB_Simulation *sim = SB_Simulation::current();
+	return sim ? sim->getPin(pin) : LOW;
+}
+
+int analogRead(uint8_t) { return 0; }
+int digitalPinToInterrupt(uint8_t pin) { return pin; }
+
+void attachInterrupt(int interruptNum, void (*isr)(), int mode) {
+	if (SB_Simulation *sim = SB_Simulation::current()) {
+		sim->attachInterrupt(interruptNum, isr, mode);
+	}
+}
+
+void detachInterrupt(int interruptNum) {
+	if (SB_Simulation *sim = SB_Simulation::current()) {
+		sim->detachInterrupt(interruptNum);
+	}
+}
+
+void noInterrupts() {
+	if (SB_Simulation *sim = SB_Simulation::current()) {
+		sim->setInterruptsEnabled(false);
+	}
+}
+
+void interrupts() {
+	if (SB_Simulation *sim = SB_Simulation::current()) {
+		sim->setInterruptsEnabled(true);
+	}
+}
+
+void attachPortInterrupt(uint64_t pinMask, void (*isr)()) {
+	if (SB_Simulation *sim = SB_Simulation::current()) {
+		sim->attachPortInterrupt(pinMask, isr);
+	}
+}
+
+unsigned long pinCaptureMicros(uint8_t pin) {
+	SB_Simulation *sim = SB_Simulation::current();
+	return sim ? (uint32_t) sim->getPinEdgeUs(pin) : 0; // wraps with micros()
+}
+
+uint64_t readPort() {
+	SB_Simulation *sim = SB_Simulation::current();
+	return sim ? sim->readPort() : 0;
+}
+
+bool IntervalTimer::begin(void (*timerCallback)(), unsigned long microseconds) {
+	end();
+	if (!SB_Simulation::current() || microseconds == 0) {
+		return false;
+	}
+	callback = timerCallback;
+	periodUs = microseconds;
+	running = true;
+	schedule(generation);
+	return true;
+}
+
+void IntervalTimer::end() {
+	running = false;
+	generation++;
+}
+
+void IntervalTimer::schedule(uint32_t forGeneration) {
+	SB_Simulation *sim = SB_Simulation::current();
+	if (!sim) {
+		return;
+	}
+	sim->after(periodUs, [this, forGeneration]() {
+		if (!running || generation != forGeneration) {
+			return;
+		}
+		{
+			SB_TraceScope scope(TRACE_TRACK_ISR, "interval timer");
+			callback();
+		}
+		// The callback may have ended or restarted the timer
+		if (running && generation == forGeneration) {
+			schedule(forGeneration);
+		}
+	});
+}
+
+static std::minstd_rand hostRandom;
+
+long random(long howBig) {
+	if (howBig <= 0) {
+		return 0;
+	}
+	return hostRandom() % howBig;
+}
+
+long random(long howSmall, long howBig) {
+	if (howSmall >= howBig) {
+		return howSmall;
+	}
+	return random(howBig - howSmall) + howSmall;
+}
+
+void randomSeed(unsigned long seed) {
+	if (seed != 0) {
+		hostRandom.seed(seed);
+	}
+}
+
+long map(long x, long inMin, long inMax, long outMin, long outMax) {
+	return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+int SB_ConsoleStream::available() {
+	if (peeked >= 0) {
+		return 1;
+	}
+	struct pollfd input = {STDIN_FILENO, POLLIN, 0};
+	return poll(&input, 1, 0) > 0 && (input.revents & POLLIN) ? 1 : 0;
+}
+
+int SB_ConsoleStream::read() {
+	if (peeked >= 0) {
+		int c = peeked;
+		peeked = -1;
+		return c;
+	}
+	if (!available()) {
+		return -1;
+	}
+	uint8_t c;
+	return ::read(STDIN_FILENO, &c, 1) == 1 ? c : -1;
+}
+
+int SB_ConsoleStream::peek() {
+	if (peeked < 0) {
+		peeked = read();
+	}
+	return peeked;
+}
+
+size_t SB_ConsoleStream::write(uint8_t dataByte) {
+	return fputc(dataByte, stdout) == EOF ? 0 : 1;
+}
+
+size_t SB_ConsoleStream::write(const uint8_t *buffer, size_t size) {
+	return fwrite(buffer, 1, size, stdout);
+}
+
+void SB_ConsoleStream::flush() {
+	fflush(stdout);
+}
+
+static const char *serial1Path() {
+	const char *path = getenv("SB_SERIAL1");
+	return path ? path : "/dev/ttyACM0";
+}
+
+thread_local Stream *SB_HostSerialPort::route = nullptr;
+
+SB_ConsoleStream Serial;
+SB_HostSerialPort Serial1(serial1Path());
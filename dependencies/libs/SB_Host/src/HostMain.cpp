@@ -0,0 +1,19 @@
+/**
+ * Entry point for running an unchanged sketch on the host: link this with the
+ * sketch (compiled as C++) and it calls setup() once and loop() forever,
+ * the same way the Arduino core does.
+ */
+
+#include "Arduino.h"
+
+void setup();
+void loop();
+
+int main() {
+	setup();
+	while (true) {
+		loop();
+		Serial.flush();
+		Serial1.flush();
+	}
+}
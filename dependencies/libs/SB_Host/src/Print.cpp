@@ -0,0 +1,73 @@
+/**
+ * Source file for the host Print stand-in, formatting follows the Arduino core
+ */
+
+#include "Print.h"
+
+#include <cstdio>
+#include <cstring>
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+	size_t n = 0;
+	while (size--) {
+		if (write(*buffer++)) {
+			n++;
+		} else {
+			break;
+		}
+	}
+	return n;
+}
+
+size_t Print::write(const char *str) {
+	if (str == nullptr) {
+		return 0;
+	}
+	return write((const uint8_t *) str, strlen(str));
+}
+
+size_t Print::printNumber(unsigned long value, uint8_t base) {
+	char digits[8 * sizeof(long) + 1];
+	char *cursor = &digits[sizeof(digits) - 1];
+	*cursor = '\0';
+	if (base < 2) {
+		base = 10;
+	}
+	do {
+		char digit = value % base;
+		value /= base;
+		*--cursor = digit < 10 ? digit + '0' : digit + 'A' - 10;
+	} while (value);
+	return write(cursor);
+}
+
+size_t Print::print(const char str[]) { return write(str); }
+size_t Print::print(const String &str) { return write(str.c_str()); }
+size_t Print::print(char c) { return write((uint8_t) c); }
+size_t Print::print(int value, int base) { return print((long) value, base); }
+size_t Print::print(unsigned int value, int base) { return print((unsigned long) value, base); }
+
+size_t Print::print(long value, int base) {
+	if (base == DEC && value < 0) {
+		return print('-') + printNumber(-(unsigned long) value, DEC);
+	}
+	return printNumber(value, base);
+}
+
+size_t Print::print(unsigned long value, int base) { return printNumber(value, base); }
+
+size_t Print::print(double value, int digits) {
+	char formatted[64];
+	snprintf(formatted, sizeof(formatted), "%.*f", digits, value);
+	return write(formatted);
+}
+
+size_t Print::println() { return write("\r\n"); }
+size_t Print::println(const char str[]) { return print(str) + println(); }
+size_t Print::println(const String &str) { return print(str) + println(); }
+size_t Print::println(char c) { return print(c) + println(); }
+size_t Print::println(int value, int base) { return print(value, base) + println(); }
+size_t Print::println(unsigned int value, int base) { return print(value, base) + println(); }
+size_t Print::println(long value, int base) { return print(value, base) + println(); }
+size_t Print::println(unsigned long value, int base) { return print(value, base) + println(); }
+size_t Print::println(double value, int digits) { return print(value, digits) + println(); }
@@ -0,0 +1,51 @@
+/**
+ * Host (Linux) stand-in for the Arduino Print class.
+ *
+ * Every Stream (and therefore every serial port) descends from this, it turns
+ * print()/println() calls into single byte writes the same way the Arduino core does.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "WString.h"
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+class Print {
+	private:
+		size_t printNumber(unsigned long value, uint8_t base);
+
+	public:
+		virtual ~Print() {}
+
+		virtual size_t write(uint8_t dataByte) = 0;
+		virtual size_t write(const uint8_t *buffer, size_t size);
+		size_t write(const char *str);
+
+		// Arduino's flush() waits for outgoing data, by default there is nothing to wait on
+		virtual void flush() {}
+
+		size_t print(const char str[]);
+		size_t print(const String &str);
+		size_t print(char c);
+		size_t print(int value, int base = DEC);
+		size_t print(unsigned int value, int base = DEC);
+		size_t print(long value, int base = DEC);
+		size_t print(unsigned long value, int base = DEC);
+		size_t print(double value, int digits = 2);
+
+		size_t println();
+		size_t println(const char str[]);
+		size_t println(const String &str);
+		size_t println(char c);
+		size_t println(int value, int base = DEC);
+		size_t println(unsigned int value, int base = DEC);
+		size_t println(long value, int base = DEC);
+		size_t println(unsigned long value, int base = DEC);
+		size_t println(double value, int digits = 2);
+};
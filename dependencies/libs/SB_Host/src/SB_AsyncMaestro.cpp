@@ -0,0 +1,266 @@
+/**
+ * Source file for SB_AsyncMaestro.hpp
+ */
+
+#include "SB_AsyncMaestro.hpp"
+
+#include <algorithm>
+
+// How often outstanding queries are checked against their deadlines
+#define ASYNC_WATCHDOG_PERIOD_US 1000
+
+SB_CancelSource::~SB_CancelSource() {
+	for (SB_MaestroRequest *request : requests) {
+		request->cancelSource = nullptr;
+	}
+}
+
+void SB_CancelSource::cancel() {
+	if (cancelled) {
+		return;
+	}
+	cancelled = true;
+	// withdraw() unregisters each request, so work from a copy
+	std::vector<SB_MaestroRequest *> toCancel;
+	toCancel.swap(requests);
+	for (SB_MaestroRequest *request : toCancel) {
+		request->cancelSource = nullptr;
+		request->owner->withdraw(request, ASYNC_CANCELLED, true);
+	}
+}
+
+SB_AsyncMaestro::SB_AsyncMaestro(SB_EventLoop &eventLoop, SB_TermiosStream &port,
+		uint8_t deviceNumber, bool CRCEnabled) :
+		loop(eventLoop),
+		stream(port),
+		encoder(port, BasicMaestro<SB_TermiosStream>::noResetPin, deviceNumber, CRCEnabled) {
+	loop.watch(stream.getFd(), [this]() { onReadable(); });
+}
+
+SB_AsyncMaestro::~SB_AsyncMaestro() {
+	loop.unwatch(stream.getFd());
+	if (watchdogTimer) {
+		loop.cancelTimer(watchdogTimer);
+	}
+	while (!pending.empty()) {
+		complete(pending.front(), ASYNC_CANCELLED);
+		pending.pop_front();
+	}
+	for (InFlight &entry : inFlight) {
+		if (entry.request) {
+			complete(entry.request, ASYNC_CANCELLED);
+		}
+	}
+}
+
+SB_MaestroQuery<uint16_t> SB_AsyncMaestro::getPosition(uint8_t channel, uint64_t timeoutUs, SB_CancelSource *cancel) {
+	return SB_MaestroQuery<uint16_t>(this, QUERY_POSITION, channel, timeoutUs ? timeoutUs : defaultTimeoutUs, cancel);
+}
+
+SB_MaestroQuery<uint8_t> SB_AsyncMaestro::getMovingState(uint64_t timeoutUs, SB_CancelSource *cancel) {
+	return SB_MaestroQuery<uint8_t>(this, QUERY_MOVING_STATE, 0, timeoutUs ? timeoutUs : defaultTimeoutUs, cancel);
+}
+
+SB_MaestroQuery<uint16_t> SB_AsyncMaestro::getErrors(uint64_t timeoutUs, SB_CancelSource *cancel) {
+	return SB_MaestroQuery<uint16_t>(this, QUERY_ERRORS, 0, timeoutUs ? timeoutUs : defaultTimeoutUs, cancel);
+}
+
+SB_MaestroQuery<uint8_t> SB_AsyncMaestro::getScriptStatus(uint64_t timeoutUs, SB_CancelSource *cancel) {
+	return SB_MaestroQuery<uint8_t>(this, QUERY_SCRIPT_STATUS, 0, timeoutUs ? timeoutUs : defaultTimeoutUs, cancel);
+}
+
+void SB_AsyncMaestro::setTarget(uint8_t channel, uint16_t target) {
+	encoder.setTarget(channel, target);
+	stream.flush();
+}
+
+void SB_AsyncMaestro::setSpeed(uint8_t channel, uint16_t speed) {
+	encoder.setSpeed(channel, speed);
+	stream.flush();
+}
+
+void SB_AsyncMaestro::setAcceleration(uint8_t channel, uint16_t acceleration) {
+	encoder.setAcceleration(channel, acceleration);
+	stream.flush();
+}
+
+void SB_AsyncMaestro::setMultiTarget(uint8_t numberOfTargets, uint8_t firstChannel, uint16_t *targets) {
+	encoder.setMultiTarget(numberOfTargets, firstChannel, targets);
+	stream.flush();
+}
+
+void SB_AsyncMaestro::goHome() {
+	encoder.goHome();
+	stream.flush();
+}
+
+bool SB_AsyncMaestro::submit(SB_MaestroRequest *request) {
+	if (request->cancelSource && request->cancelSource->isCancelled()) {
+		request->status = ASYNC_CANCELLED;
+		cancellations++;
+		return false;
+	}
+	if (request->cancelSource) {
+		request->cancelSource->requests.push_back(request);
+	}
+	request->deadlineUs = SB_EventLoop::now() + request->timeoutUs;
+	request->queued = true;
+	pending.push_back(request);
+	sendPending();
+	armWatchdog();
+	return true;
+}
+
+void SB_AsyncMaestro::unregisterCancel(SB_MaestroRequest *request) {
+	if (request->cancelSource) {
+		std::vector<SB_MaestroRequest *> &requests = request->cancelSource->requests;
+		requests.erase(std::remove(requests.begin(), requests.end(), request), requests.end());
+		request->cancelSource = nullptr;
+	}
+}
+
+void SB_AsyncMaestro::complete(SB_MaestroRequest *request, SB_AsyncStatus status) {
+	unregisterCancel(request);
+	request->status = status;
+	request->queued = false;
+	switch (status) {
+		case ASYNC_OK: completed++; break;
+		case ASYNC_TIMEOUT: timeouts++; break;
+		case ASYNC_CANCELLED: cancellations++; break;
+		case ASYNC_RESYNC: break;
+	}
+	// Resume on the next turn of the loop, never from inside our own bookkeeping,
+	// and not at all if the frame is destroyed before then
+	request->resumePosted = std::make_shared<bool>(true);
+	std::shared_ptr<bool> posted = request->resumePosted;
+	std::coroutine_handle<> waiter = request->waiter;
+	loop.post([posted, waiter]() {
+		if (*posted) {
+			*posted = false;
+			waiter.resume();
+		}
+	});
+}
+
+void SB_AsyncMaestro::withdraw(SB_MaestroRequest *request, SB_AsyncStatus status, bool resume) {
+	auto waiting = std::find(pending.begin(), pending.end(), request);
+	if (waiting != pending.end()) {
+		pending.erase(waiting);
+	} else {
+		for (InFlight &entry : inFlight) {
+			if (entry.request == request) {
+				entry.request = nullptr; // its answer is still coming, swallow it
+			}
+		}
+	}
+	if (resume) {
+		complete(request, status);
+	} else {
+		unregisterCancel(request);
+		request->queued = false;
+	}
+}
+
+void SB_AsyncMaestro::sendPending() {
+	uint64_t now = SB_EventLoop::now();
+	if (now < quietUntilUs) {
+		return;
+	}
+	bool sent = false;
+	while (!pending.empty() && inFlight.size() < maxInFlight) {
+		SB_MaestroRequest *request = pending.front();
+		pending.pop_front();
+		uint8_t length = 2;
+		switch (request->query) {
+			case QUERY_POSITION: encoder.requestPosition(request->channel); break;
+			case QUERY_MOVING_STATE: encoder.requestMovingState(); length = 1; break;
+			case QUERY_ERRORS: encoder.requestErrors(); break;
+			case QUERY_SCRIPT_STATUS: encoder.requestScriptStatus(); length = 1; break;
+		}
+		inFlight.push_back({request, length, 0, now + linkTimeoutUs});
+		sent = true;
+	}
+	if (sent) {
+		stream.flush();
+	}
+}
+
+void SB_AsyncMaestro::onReadable() {
+	uint64_t now = SB_EventLoop::now();
+	while (stream.available() > 0) {
+		uint8_t dataByte = stream.read();
+		if (now < quietUntilUs || inFlight.empty()) {
+			discardedBytes++;
+			continue;
+		}
+		InFlight &head = inFlight.front();
+		if (head.request) {
+			head.request->response[head.received] = dataByte;
+		}
+		head.received++;
+		if (head.received == head.length) {
+			if (head.request) {
+				complete(head.request, ASYNC_OK);
+			}
+			inFlight.pop_front();
+			// The next answer can only start now, give it the full link timeout
+			if (!inFlight.empty()) {
+				inFlight.front().linkDeadlineUs = std::max(inFlight.front().linkDeadlineUs, now + linkTimeoutUs);
+			}
+		}
+	}
+	sendPending();
+}
+
+void SB_AsyncMaestro::resync(uint64_t nowUs) {
+	resyncs++;
+	bool head = true;
+	for (InFlight &entry : inFlight) {
+		if (entry.request) {
+			complete(entry.request, head ? ASYNC_TIMEOUT : ASYNC_RESYNC);
+		}
+		head = false;
+	}
+	inFlight.clear();
+	quietUntilUs = nowUs + resyncQuietUs;
+}
+
+void SB_AsyncMaestro::checkTimeouts() {
+	uint64_t now = SB_EventLoop::now();
+
+	for (auto waiting = pending.begin(); waiting != pending.end();) {
+		if (now >= (*waiting)->deadlineUs) {
+			SB_MaestroRequest *request = *waiting;
+			waiting = pending.erase(waiting);
+			complete(request, ASYNC_TIMEOUT);
+		} else {
+			++waiting;
+		}
+	}
+
+	for (InFlight &entry : inFlight) {
+		if (entry.request && now >= entry.request->deadlineUs) {
+			SB_MaestroRequest *request = entry.request;
+			entry.request = nullptr;
+			complete(request, ASYNC_TIMEOUT);
+		}
+	}
+
+	if (!inFlight.empty() && now >= inFlight.front().linkDeadlineUs) {
+		resync(now);
+	}
+}
+
+void SB_AsyncMaestro::armWatchdog() {
+	if (watchdogTimer) {
+		return;
+	}
+	watchdogTimer = loop.callAfter(ASYNC_WATCHDOG_PERIOD_US, [this]() {
+		watchdogTimer = 0;
+		checkTimeouts();
+		sendPending();
+		if (!pending.empty() || !inFlight.empty()) {
+			armWatchdog();
+		}
+	});
+}
@@ -0,0 +1,247 @@
+/**
+ * Coroutine interface to a Maestro for host-side code.
+ *
+ * 		SB_AsyncResult<uint16_t> position = co_await maestro.getPosition(0);
+ *
+ * suspends the calling coroutine instead of spinning like Maestro::getPosition().
+ * Queries are sent straight away (up to setMaxInFlight() at a time, the rest
+ * wait their turn) and the Maestro answers them in order, so as response bytes
+ * come in they're handed to the oldest outstanding query and its coroutine is
+ * resumed on the event loop. Hundreds of queries over several controllers can
+ * share one SB_EventLoop thread.
+ *
+ * Every query has a timeout, and can be tied to an SB_CancelSource. A query
+ * that times out or is cancelled after it went out still has an answer on the
+ * way, so its slot stays in line (a "zombie") to swallow those bytes.
+ * If the oldest slot gets no answer within the link timeout the bytes really
+ * were lost; then every outstanding query fails with ASYNC_RESYNC, input is
+ * discarded for a short quiet period, and the queue starts over in step
+ * with the Maestro again.
+ *
+ * The Maestro's answers carry no framing, so a byte lost in the middle of a
+ * pipelined burst can shift the next answer into the wrong query. On a link
+ * that actually drops bytes use setMaxInFlight(1): a lost byte then stalls the
+ * only query in flight until the link timeout and the resync cleans it up.
+ *
+ * Commands without a response (setTarget etc.) are written immediately.
+ */
+
+#ifndef SB_async_maestro
+#define SB_async_maestro
+
+#include <Arduino.h>
+#include <BasicMaestro.h>
+#include "SB_EventLoop.hpp"
+#include "SB_TermiosStream.hpp"
+
+#include <coroutine>
+#include <deque>
+#include <memory>
+#include <vector>
+
+enum SB_AsyncStatus {
+	ASYNC_OK = 0,
+	ASYNC_TIMEOUT,   // the caller's timeout passed first
+	ASYNC_CANCELLED, // the SB_CancelSource was cancelled
+	ASYNC_RESYNC,    // a response was lost, the link was resynchronised under this query
+};
+
+template <class T>
+struct SB_AsyncResult {
+	SB_AsyncStatus status = ASYNC_OK;
+	T value = T();
+
+	bool ok() const { return status == ASYNC_OK; }
+};
+
+class SB_AsyncMaestro;
+class SB_CancelSource;
+
+/**
+ * One outstanding query, lives inside the awaiter (so in the coroutine frame)
+ */
+struct SB_MaestroRequest {
+	SB_AsyncMaestro *owner = nullptr;
+	uint8_t query = 0;
+	uint8_t channel = 0;
+	uint64_t timeoutUs = 0;
+	uint64_t deadlineUs = 0;
+	SB_CancelSource *cancelSource = nullptr;
+
+	uint8_t response[2] = {0, 0};
+	SB_AsyncStatus status = ASYNC_OK;
+	std::coroutine_handle<> waiter;
+	bool queued = false; // submitted and not completed yet
+	// Set while a resume is posted, cleared if the frame goes away before it runs
+	std::shared_ptr<bool> resumePosted;
+};
+
+/**
+ * Cancels every query that was started with it and hasn't finished yet,
+ * and any query started with it afterwards
+ */
+class SB_CancelSource {
+	private:
+		friend class SB_AsyncMaestro;
+		std::vector<SB_MaestroRequest *> requests;
+		bool cancelled = false;
+
+	public:
+		SB_CancelSource() = default;
+		SB_CancelSource(const SB_CancelSource &) = delete;
+		// Queries still tied to the source carry on without it
+		~SB_CancelSource();
+
+		void cancel();
+		bool isCancelled() const { return cancelled; }
+};
+
+template <class T>
+class SB_MaestroQuery {
+	private:
+		SB_MaestroRequest request;
+
+	public:
+		SB_MaestroQuery(SB_AsyncMaestro *owner, uint8_t query, uint8_t channel,
+				uint64_t timeoutUs, SB_CancelSource *cancelSource) {
+			request.owner = owner;
+			request.query = query;
+			request.channel = channel;
+			request.timeoutUs = timeoutUs;
+			request.cancelSource = cancelSource;
+		}
+		SB_MaestroQuery(const SB_MaestroQuery &) = delete;
+		~SB_MaestroQuery();
+
+		bool await_ready() const noexcept { return false; }
+		bool await_suspend(std::coroutine_handle<> waiter);
+		SB_AsyncResult<T> await_resume() const {
+			SB_AsyncResult<T> result;
+			result.status = request.status;
+			if (request.status == ASYNC_OK) {
+				result.value = sizeof(T) == 1 ? request.response[0]
+					: (T) ((request.response[1] << 8) | request.response[0]);
+			}
+			return result;
+		}
+};
+
+class SB_AsyncMaestro {
+	public:
+		enum {
+			QUERY_POSITION,
+			QUERY_MOVING_STATE,
+			QUERY_ERRORS,
+			QUERY_SCRIPT_STATUS,
+		};
+
+	private:
+		struct InFlight {
+			SB_MaestroRequest *request; // nullptr once the query gave up (a zombie)
+			uint8_t length;
+			uint8_t received;
+			uint64_t linkDeadlineUs;
+		};
+
+		SB_EventLoop &loop;
+		SB_TermiosStream &stream;
+		BasicMaestro<SB_TermiosStream> encoder;
+
+		std::deque<SB_MaestroRequest *> pending;
+		std::deque<InFlight> inFlight;
+		uint64_t quietUntilUs = 0;
+		uint64_t watchdogTimer = 0;
+
+		size_t maxInFlight = 16;
+		uint64_t defaultTimeoutUs = 100000;
+		uint64_t linkTimeoutUs = 50000;
+		uint64_t resyncQuietUs = 5000;
+
+		uint32_t completed = 0;
+		uint32_t timeouts = 0;
+		uint32_t cancellations = 0;
+		uint32_t resyncs = 0;
+		uint32_t discardedBytes = 0;
+
+		void onReadable();
+		void sendPending();
+		void checkTimeouts();
+		void resync(uint64_t nowUs);
+		void armWatchdog();
+		void complete(SB_MaestroRequest *request, SB_AsyncStatus status);
+		void unregisterCancel(SB_MaestroRequest *request);
+
+		template <class T>
+		friend class SB_MaestroQuery;
+		friend class SB_CancelSource;
+
+		/**
+		 * @return false if the query was finished on the spot (already cancelled)
+		 */
+		bool submit(SB_MaestroRequest *request);
+
+		/**
+		 * Finishes a query early: one still waiting to be sent is dropped, one
+		 * already sent becomes a zombie. Resumes the waiter only if resume is set
+		 */
+		void withdraw(SB_MaestroRequest *request, SB_AsyncStatus status, bool resume);
+
+	public:
+		/**
+		 * @param stream -- an open port, the loop watches its descriptor
+		 * @param deviceNumber, CRCEnabled -- same as for MiniMaestro
+		 */
+		SB_AsyncMaestro(SB_EventLoop &loop, SB_TermiosStream &stream,
+				uint8_t deviceNumber = BasicMaestro<SB_TermiosStream>::deviceNumberDefault,
+				bool CRCEnabled = false);
+		~SB_AsyncMaestro();
+
+		// Queries, timeoutUs of 0 uses the default
+		SB_MaestroQuery<uint16_t> getPosition(uint8_t channel, uint64_t timeoutUs = 0, SB_CancelSource *cancel = nullptr);
+		SB_MaestroQuery<uint8_t> getMovingState(uint64_t timeoutUs = 0, SB_CancelSource *cancel = nullptr);
+		SB_MaestroQuery<uint16_t> getErrors(uint64_t timeoutUs = 0, SB_CancelSource *cancel = nullptr);
+		SB_MaestroQuery<uint8_t> getScriptStatus(uint64_t timeoutUs = 0, SB_CancelSource *cancel = nullptr);
+
+		// Commands, these don't wait on anything
+		void setTarget(uint8_t channel, uint16_t target);
+		void setSpeed(uint8_t channel, uint16_t speed);
+		void setAcceleration(uint8_t channel, uint16_t acceleration);
+		void setMultiTarget(uint8_t numberOfTargets, uint8_t firstChannel, uint16_t *targets);
+		void goHome();
+
+		void setMaxInFlight(size_t count) { maxInFlight = count ? count : 1; }
+		void setDefaultTimeout(uint64_t timeoutUs) { defaultTimeoutUs = timeoutUs; }
+		/**
+		 * How long the oldest query sent can go without its answer before the
+		 * bytes are considered lost and the link is resynchronised
+		 */
+		void setLinkTimeout(uint64_t timeoutUs) { linkTimeoutUs = timeoutUs; }
+		void setResyncQuiet(uint64_t quietUs) { resyncQuietUs = quietUs; }
+
+		size_t getOutstanding() const { return pending.size() + inFlight.size(); }
+		uint32_t getCompleted() const { return completed; }
+		uint32_t getTimeouts() const { return timeouts; }
+		uint32_t getCancellations() const { return cancellations; }
+		uint32_t getResyncs() const { return resyncs; }
+		uint32_t getDiscardedBytes() const { return discardedBytes; }
+};
+
+template <class T>
+SB_MaestroQuery<T>::~SB_MaestroQuery() {
+	// The coroutine was destroyed while waiting, quietly give up the slot
+	if (request.queued) {
+		request.owner->withdraw(&request, ASYNC_CANCELLED, false);
+	}
+	// Or after it finished but before the loop got round to resuming it
+	if (request.resumePosted) {
+		*request.resumePosted = false;
+	}
+}
+
+template <class T>
+bool SB_MaestroQuery<T>::await_suspend(std::coroutine_handle<> waiter) {
+	request.waiter = waiter;
+	return request.owner->submit(&request);
+}
+
+#endif
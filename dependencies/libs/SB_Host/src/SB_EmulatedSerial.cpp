@@ -0,0 +1,118 @@
+/**
+ * Source file for SB_EmulatedSerial.hpp
+ */
+
+#include "SB_EmulatedSerial.hpp"
+#include "Arduino.h"
+#include "SB_Simulation.hpp"
+
+bool SB_EmulatedSerial::mismatched() const {
+	return lineBaud && emulator.getBaud() && lineBaud != emulator.getBaud();
+}
+
+bool SB_EmulatedSerial::noisy() {
+	return errorRate > 0 && lineBaud > errorsAboveBaud && unit(random) < errorRate;
+}
+
+void SB_EmulatedSerial::receiveByte(uint8_t dataByte, uint32_t doneUs) {
+	bool garbled = noisy();
+	if (emulator.isDetectingBaud()) {
+		// Only a clean 0xAA sets the rate, anything before it is ignored
+		if (!garbled && dataByte == 0xAA) {
+			emulator.detectBaud(lineBaud ? lineBaud : emulator.getBaud());
+		}
+		return;
+	}
+	if (garbled || mismatched()) {
+		bytesGarbled++;
+		emulator.receiveGarbled(doneUs);
+		return;
+	}
+	emulator.receive(dataByte, doneUs);
+}
+
+void SB_EmulatedSerial::deliver(uint32_t nowUs) {
+	while (!transmitting.empty() && (int32_t) (nowUs - transmitting.front().doneUs) >= 0) {
+		receiveByte(transmitting.front().value, transmitting.front().doneUs);
+		transmitting.pop_front();
+	}
+	emulator.update(nowUs);
+	// Answers at the wrong rate are framing errors here, the UART drops them
+	uint8_t dropped;
+	while (mismatched() && emulator.takeResponse(&dropped, 1, nowUs) == 1) {
+		bytesGarbled++;
+	}
+}
+
+int SB_EmulatedSerial::available() {
+	if (SB_Simulation *sim = SB_Simulation::current()) {
+		sim->poll();
+	}
+	uint32_t now = micros();
+	deliver(now);
+	int count = emulator.responseAvailable(now) + (peeked >= 0 ? 1 : 0);
+	if (count == 0) {
+		blocked.empty();
+	} else {
+		blocked.ready();
+	}
+	return count;
+}
+
+int SB_EmulatedSerial::read() {
+	if (peeked >= 0) {
+		int c = peeked;
+		peeked = -1;
+		return c;
+	}
+	uint8_t dataByte;
+	uint32_t now = micros();
+	deliver(now);
+	if (emulator.takeResponse(&dataByte, 1, now) == 1) {
+		bytesRead++;
+		if (noisy()) {
+			dataByte ^= 1 << (random() % 8);
+			bytesGarbled++;
+		}
+		blocked.ready();
+		return dataByte;
+	}
+	blocked.empty();
+	if (SB_Simulation *sim = SB_Simulation::current()) {
+		sim->poll();
+	}
+	return -1;
+}
+
+int SB_EmulatedSerial::peek() {
+	if (peeked < 0) {
+		peeked = read();
+	}
+	return peeked;
+}
+
+size_t SB_EmulatedSerial::write(uint8_t dataByte) {
+	uint32_t now = micros();
+	uint32_t byteTimeUs = lineBaud ? (10000000 + lineBaud - 1) / lineBaud : emulator.getByteTimeUs();
+	bytesWritten++;
+	if (byteTimeUs == 0) {
+		deliver(now);
+		receiveByte(dataByte, now);
+		return 1;
+	}
+	// Starts when the byte ahead of it is done, or now if the line is idle
+	uint32_t startUs = transmitting.empty() || (int32_t) (now - txDoneUs) > 0 ? now : txDoneUs;
+	txDoneUs = startUs + byteTimeUs;
+	transmitting.push_back({txDoneUs, dataByte});
+	deliver(now);
+	return 1;
+}
+
+void SB_EmulatedSerial::flush() {
+	while (!transmitting.empty()) {
+		if (SB_Simulation *sim = SB_Simulation::current()) {
+			sim->advanceTo(sim->now() + (uint32_t) (transmitting.back().doneUs - micros()));
+		}
+		deliver(micros());
+	}
+}
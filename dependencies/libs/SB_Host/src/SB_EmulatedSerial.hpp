@@ -0,0 +1,105 @@
+/**
+ * A Stream wired straight into a SB_MaestroEmulator, no tty in between.
+ *
+ * Hand one to a MiniMaestro and every byte the driver writes is received by the
+ * emulator at micros(), while available()/read() hand back response bytes once
+ * the emulator says they're ready (so configured latency and baud pacing apply).
+ * When this end or the emulator has a baud set, written bytes are paced the same
+ * way: each one reaches the emulator a byte time after the previous one
+ * finished, the way a UART drains its transmit buffer.
+ *
+ * begin(baud) sets the rate this end of the link runs at. Left at 0 it's always
+ * the emulator's own, otherwise the two have to match: at different rates every
+ * byte is garbled both ways, the emulator seeing framing errors and this end
+ * seeing nothing. setLineErrors() makes a link that only works up to a rate.
+ *
+ * Under a SB_Simulation every available() call, and every read() or peek() that
+ * comes up empty, charges the simulation's poll cost. That's what moves virtual
+ * time forward while the driver spins waiting for an answer. Stretches of empty
+ * polls are recorded as blocked reads on the current SB_Trace.
+ */
+
+#ifndef SB_emulated_serial
+#define SB_emulated_serial
+
+#include "Stream.h"
+#include "SB_MaestroEmulator.hpp"
+#include "SB_Trace.hpp"
+
+#include <deque>
+#include <random>
+
+class SB_EmulatedSerial : public Stream {
+	private:
+		struct PendingByte {
+			uint32_t doneUs;
+			uint8_t value;
+		};
+
+		SB_MaestroEmulator &emulator;
+		int peeked = -1;
+		SB_TraceBlockedRead blocked;
+
+		std::deque<PendingByte> transmitting;
+		uint32_t txDoneUs = 0; // when the last written byte finishes on the wire
+
+		uint32_t bytesWritten = 0;
+		uint32_t bytesRead = 0;
+
+		uint32_t lineBaud = 0;
+		uint32_t errorsAboveBaud = 0;
+		float errorRate = 0;
+		std::mt19937 random;
+		std::uniform_real_distribution<float> unit{0.0f, 1.0f};
+		uint32_t bytesGarbled = 0;
+
+		bool mismatched() const;
+		bool noisy();
+		void receiveByte(uint8_t dataByte, uint32_t doneUs);
+
+	public:
+		explicit SB_EmulatedSerial(SB_MaestroEmulator &maestro) : emulator(maestro) {}
+
+		/**
+		 * Hands the emulator every written byte that's finished on the wire by
+		 * nowUs, then brings its frames up to nowUs. The stream calls it itself,
+		 * a simulation task watching the emulator between driver calls should
+		 * call it rather than the emulator's update()
+		 */
+		void deliver(uint32_t nowUs);
+
+		/**
+		 * Nothing to open, just the rate this end runs at, 0 for the emulator's
+		 */
+		void begin(unsigned long baud) { lineBaud = baud; }
+		uint32_t getLineBaud() const { return lineBaud; }
+
+		/**
+		 * Above aboveBaud, each byte either way is garbled with probability rate
+		 */
+		void setLineErrors(uint32_t aboveBaud, float rate, uint32_t seed = 1) {
+			errorsAboveBaud = aboveBaud;
+			errorRate = rate;
+			random.seed(seed);
+		}
+
+		int available() override;
+		int read() override;
+		int peek() override;
+		size_t write(uint8_t dataByte) override;
+		using Print::write;
+
+		/**
+		 * Waits until every written byte has reached the emulator
+		 */
+		void flush() override;
+
+		SB_MaestroEmulator &getEmulator() { return emulator; }
+
+		// Traffic in each direction, for working out how busy the link was
+		uint32_t getBytesWritten() const { return bytesWritten; }
+		uint32_t getBytesRead() const { return bytesRead; }
+		uint32_t getBytesGarbled() const { return bytesGarbled; }
+};
+
+#endif
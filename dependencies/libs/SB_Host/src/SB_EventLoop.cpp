@@ -0,0 +1,130 @@
+/**
+ * Source file for SB_EventLoop.hpp
+ */
+
+#include "SB_EventLoop.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+SB_EventLoop::SB_EventLoop() {
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+}
+
+SB_EventLoop::~SB_EventLoop() {
+	if (epollFd >= 0) {
+		::close(epollFd);
+	}
+}
+
+uint64_t SB_EventLoop::now() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool SB_EventLoop::watch(int fd, Callback onReadable) {
+	struct epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.fd = fd;
+	int op = watchers.count(fd) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	if (epoll_ctl(epollFd, op, fd, &event) < 0) {
+		return false;
+	}
+	watchers[fd] = onReadable;
+	return true;
+}
+
+void SB_EventLoop::unwatch(int fd) {
+	if (watchers.erase(fd)) {
+		epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+	}
+}
+
+uint64_t SB_EventLoop::callAt(uint64_t dueUs, Callback callback) {
+	uint64_t id = nextTimerId++;
+	timers[{dueUs, id}] = callback;
+	timerDue[id] = dueUs;
+	return id;
+}
+
+void SB_EventLoop::cancelTimer(uint64_t id) {
+	auto due = timerDue.find(id);
+	if (due != timerDue.end()) {
+		timers.erase({due->second, id});
+		timerDue.erase(due);
+	}
+}
+
+void SB_EventLoop::post(Callback callback) {
+	posted.push_back(callback);
+}
+
+void SB_EventLoop::post(std::coroutine_handle<> coroutine) {
+	posted.push_back([coroutine]() { coroutine.resume(); });
+}
+
+void SB_EventLoop::runPosted() {
+	// Only what was posted before we started, anything posted now waits a turn
+	size_t count = posted.size();
+	while (count-- > 0 && !posted.empty()) {
+		Callback callback = posted.front();
+		posted.pop_front();
+		callback();
+	}
+}
+
+void SB_EventLoop::runTimers() {
+	uint64_t current = now();
+	while (!timers.empty() && timers.begin()->first.first <= current) {
+		auto timer = timers.begin();
+		Callback callback = timer->second;
+		timerDue.erase(timer->first.second);
+		timers.erase(timer);
+		callback();
+	}
+}
+
+void SB_EventLoop::runOnce(int64_t maxWaitUs) {
+	int64_t waitUs = maxWaitUs;
+	if (!posted.empty()) {
+		waitUs = 0;
+	} else if (!timers.empty()) {
+		int64_t untilTimer = (int64_t) timers.begin()->first.first - (int64_t) now();
+		if (untilTimer < 0) {
+			untilTimer = 0;
+		}
+		if (waitUs < 0 || untilTimer < waitUs) {
+			waitUs = untilTimer;
+		}
+	}
+	// Round up so a timer isn't woken early and spun on
+	int waitMs = waitUs < 0 ? -1 : (int) ((waitUs + 999) / 1000);
+
+	struct epoll_event events[32];
+	int ready = epoll_wait(epollFd, events, 32, waitMs);
+	for (int i = 0; i < ready; i++) {
+		auto watcher = watchers.find(events[i].data.fd);
+		if (watcher != watchers.end()) {
+			Callback callback = watcher->second;
+			callback();
+		}
+	}
+	runTimers();
+	runPosted();
+}
+
+void SB_EventLoop::run() {
+	stopRequested = false;
+	while (!stopRequested) {
+		runOnce();
+	}
+}
+
+void SB_EventLoop::runUntil(const std::function<bool()> &done) {
+	stopRequested = false;
+	while (!stopRequested && !done()) {
+		runOnce();
+	}
+}
@@ -0,0 +1,99 @@
+/**
+ * A single threaded epoll event loop for host-side code.
+ *
+ * File descriptors get a callback when they're readable, timers get a callback
+ * when they're due, and coroutines (or plain callbacks) can be posted to run on
+ * the next turn of the loop. Everything runs on the thread that calls run(),
+ * nothing here is thread safe.
+ *
+ * Timer resolution is a millisecond, epoll_wait() can't sleep for less.
+ */
+
+#ifndef SB_event_loop
+#define SB_event_loop
+
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <unordered_map>
+
+class SB_EventLoop {
+	public:
+		typedef std::function<void()> Callback;
+
+	private:
+		int epollFd = -1;
+		bool stopRequested = false;
+		uint64_t nextTimerId = 1;
+
+		std::unordered_map<int, Callback> watchers;
+		std::map<std::pair<uint64_t, uint64_t>, Callback> timers; // (due, id) -> callback
+		std::unordered_map<uint64_t, uint64_t> timerDue;          // id -> due
+		std::deque<Callback> posted;
+
+		void runPosted();
+		void runTimers();
+
+	public:
+		SB_EventLoop();
+		~SB_EventLoop();
+		SB_EventLoop(const SB_EventLoop &) = delete;
+		SB_EventLoop &operator=(const SB_EventLoop &) = delete;
+
+		/**
+		 * Monotonic microseconds, the loop's clock
+		 */
+		static uint64_t now();
+
+		/**
+		 * Calls onReadable every time fd has data (level triggered)
+		 * @return false if epoll wouldn't take the descriptor
+		 */
+		bool watch(int fd, Callback onReadable);
+		void unwatch(int fd);
+
+		/**
+		 * @return an id for cancelTimer(), never 0
+		 */
+		uint64_t callAt(uint64_t dueUs, Callback callback);
+		uint64_t callAfter(uint64_t delayUs, Callback callback) { return callAt(now() + delayUs, callback); }
+		void cancelTimer(uint64_t id);
+
+		/**
+		 * Runs the callback (or resumes the coroutine) on the next turn of the loop,
+		 * never from inside the call to post()
+		 */
+		void post(Callback callback);
+		void post(std::coroutine_handle<> coroutine);
+
+		/**
+		 * Waits for at most maxWaitUs (-1 for the next event) and handles whatever happened
+		 */
+		void runOnce(int64_t maxWaitUs = -1);
+		void run();
+		void runUntil(const std::function<bool()> &done);
+		void stop() { stopRequested = true; }
+};
+
+/**
+ * co_await sleepFor(loop, us) suspends the coroutine for (at least) that long
+ */
+struct SB_SleepAwaiter {
+	SB_EventLoop &loop;
+	uint64_t delayUs;
+
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> coroutine) {
+		SB_EventLoop *target = &loop;
+		loop.callAfter(delayUs, [target, coroutine]() { target->post(coroutine); });
+	}
+	void await_resume() const noexcept {}
+};
+
+inline SB_SleepAwaiter sleepFor(SB_EventLoop &loop, uint64_t delayUs) {
+	return SB_SleepAwaiter{loop, delayUs};
+}
+
+#endif
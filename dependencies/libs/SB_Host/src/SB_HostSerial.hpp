@@ -0,0 +1,79 @@
+/**
+ * The serial ports a sketch sees when it's built for the host.
+ *
+ * 		Serial  -- the terminal the program was started from (stdout/stdin)
+ * 		Serial1 -- a SB_TermiosStream, the device comes from the SB_SERIAL1
+ * 		           environment variable and defaults to /dev/ttyACM0, which is
+ * 		           where a Maestro's USB command port usually shows up
+ *
+ * SB_Servo's shared MiniMaestro is bound to Serial1, so pointing SB_SERIAL1 at a
+ * real Maestro (or at the slave side of a pty) is all it takes to run it natively.
+ *
+ * A thread can also route its Serial1 traffic to any other Stream with
+ * SB_HostSerialPort::routeThread(), which is how simulations running side by
+ * side each give SB_Servo their own emulated Maestro. begin() on a routed
+ * thread doesn't touch the device.
+ */
+
+#ifndef SB_host_serial
+#define SB_host_serial
+
+#include "Stream.h"
+#include "SB_TermiosStream.hpp"
+
+class SB_ConsoleStream : public Stream {
+	private:
+		int peeked = -1;
+
+	public:
+		// The terminal has no baud rate, this is here so sketches build unchanged
+		void begin(unsigned long) {}
+		explicit operator bool() const { return true; }
+
+		int available() override;
+		int read() override;
+		int peek() override;
+		size_t write(uint8_t dataByte) override;
+		size_t write(const uint8_t *buffer, size_t size) override;
+		using Print::write;
+		void flush() override;
+};
+
+class SB_HostSerialPort : public SB_TermiosStream {
+	private:
+		static thread_local Stream *route;
+
+	public:
+		explicit SB_HostSerialPort(const char *path) : SB_TermiosStream(path) {}
+
+		/**
+		 * Sends this thread's Serial1 traffic to stream instead of the device,
+		 * nullptr goes back to the device. The stream is not owned
+		 */
+		static void routeThread(Stream *stream) { route = stream; }
+		static Stream *getRoute() { return route; }
+
+		bool begin(unsigned long baud) { return route ? true : SB_TermiosStream::begin(baud); }
+		bool begin(const char *path, unsigned long baud) { return route ? true : SB_TermiosStream::begin(path, baud); }
+
+		int available() override { return route ? route->available() : SB_TermiosStream::available(); }
+		int read() override { return route ? route->read() : SB_TermiosStream::read(); }
+		int peek() override { return route ? route->peek() : SB_TermiosStream::peek(); }
+		size_t write(uint8_t dataByte) override { return route ? route->write(dataByte) : SB_TermiosStream::write(dataByte); }
+		size_t write(const uint8_t *buffer, size_t size) override {
+			return route ? route->write(buffer, size) : SB_TermiosStream::write(buffer, size);
+		}
+		using Print::write;
+		void flush() override {
+			if (route) {
+				route->flush();
+			} else {
+				SB_TermiosStream::flush();
+			}
+		}
+};
+
+extern SB_ConsoleStream Serial;
+extern SB_HostSerialPort Serial1;
+
+#endif
@@ -0,0 +1,556 @@
+/**
+ * Source file for SB_MaestroEmulator.hpp
+ */
+
+#include "SB_MaestroEmulator.hpp"
+#include "SB_Trace.hpp"
+
+#include <cmath>
+
+// Command bytes, from the Maestro User's Guide (and PololuMaestro.h)
+#define BAUD_RATE_INDICATION 0xAA
+#define MINI_SSC_COMMAND 0xFF
+#define SET_TARGET_COMMAND 0x84
+#define SET_SPEED_COMMAND 0x87
+#define SET_ACCELERATION_COMMAND 0x89
+#define SET_PWM_COMMAND 0x8A
+#define GET_POSITION_COMMAND 0x90
+#define GET_MOVING_STATE_COMMAND 0x93
+#define SET_MULTIPLE_TARGETS_COMMAND 0x9F
+#define GET_ERRORS_COMMAND 0xA1
+#define GO_HOME_COMMAND 0xA2
+#define STOP_SCRIPT_COMMAND 0xA4
+#define RESTART_SCRIPT_COMMAND 0xA7
+#define RESTART_SCRIPT_WITH_PARAMETER_COMMAND 0xA8
+#define GET_SCRIPT_STATUS_COMMAND 0xAE
+
+// Mini SSC maps 0-254 onto neutral +/- range, these are the Control Center defaults
+#define MINI_SSC_NEUTRAL 6000
+#define MINI_SSC_RANGE 1905
+
+static const char *commandName(uint8_t command) {
+	switch (command) {
+		case MINI_SSC_COMMAND: return "miniSSC";
+		case SET_TARGET_COMMAND: return "setTarget";
+		case SET_SPEED_COMMAND: return "setSpeed";
+		case SET_ACCELERATION_COMMAND: return "setAcceleration";
+		case SET_PWM_COMMAND: return "setPWM";
+		case GET_POSITION_COMMAND: return "getPosition";
+		case GET_MOVING_STATE_COMMAND: return "getMovingState";
+		case SET_MULTIPLE_TARGETS_COMMAND: return "setMultiTarget";
+		case GET_ERRORS_COMMAND: return "getErrors";
+		case GO_HOME_COMMAND: return "goHome";
+		case STOP_SCRIPT_COMMAND: return "stopScript";
+		case RESTART_SCRIPT_COMMAND: return "restartScript";
+		case RESTART_SCRIPT_WITH_PARAMETER_COMMAND: return "restartScriptWithParameter";
+		case GET_SCRIPT_STATUS_COMMAND: return "getScriptStatus";
+		default: return "unknown";
+	}
+}
+
+// Counter names for the trace, which keeps them by pointer
+static const char *const positionCounterNames[EMULATOR_MAX_CHANNELS] = {
+	"ch 0 position", "ch 1 position", "ch 2 position", "ch 3 position",
+	"ch 4 position", "ch 5 position", "ch 6 position", "ch 7 position",
+	"ch 8 position", "ch 9 position", "ch 10 position", "ch 11 position",
+	"ch 12 position", "ch 13 position", "ch 14 position", "ch 15 position",
+	"ch 16 position", "ch 17 position", "ch 18 position", "ch 19 position",
+	"ch 20 position", "ch 21 position", "ch 22 position", "ch 23 position",
+};
+
+SB_MaestroEmulator::SB_MaestroEmulator(uint8_t count, uint8_t device, bool crc) :
+		channelCount(count > EMULATOR_MAX_CHANNELS ? EMULATOR_MAX_CHANNELS : count),
+		deviceNumber(device),
+		crcEnabled(crc) {}
+
+/**
+ * Same CRC7 the PololuMaestro library computes in BasicMaestro::appendCRC()
+ */
+uint8_t SB_MaestroEmulator::crcUpdate(uint8_t crc, uint8_t dataByte) {
+	crc ^= dataByte;
+	for (uint8_t j = 0; j < 8; j++) {
+		if (crc & 1) {
+			crc ^= 0x91;
+		}
+		crc >>= 1;
+	}
+	return crc;
+}
+
+int SB_MaestroEmulator::dataLength() const {
+	bool mini = channelCount > 6;
+	switch (command) {
+		case SET_TARGET_COMMAND:
+		case SET_SPEED_COMMAND:
+		case SET_ACCELERATION_COMMAND:
+		case RESTART_SCRIPT_WITH_PARAMETER_COMMAND:
+			return 3;
+		case SET_PWM_COMMAND:
+			return mini ? 4 : -1;
+		case SET_MULTIPLE_TARGETS_COMMAND:
+			if (!mini) {
+				return -1;
+			}
+			// number of targets, first channel, then two bytes a target
+			return packetLength > dataStart ? 2 + 2 * packet[dataStart] : 2;
+		case GET_POSITION_COMMAND:
+		case RESTART_SCRIPT_COMMAND:
+			return 1;
+		case GET_MOVING_STATE_COMMAND:
+		case GET_ERRORS_COMMAND:
+		case GO_HOME_COMMAND:
+		case STOP_SCRIPT_COMMAND:
+		case GET_SCRIPT_STATUS_COMMAND:
+			return 0;
+		default:
+			return -1;
+	}
+}
+
+bool SB_MaestroEmulator::packetComplete() const {
+	if (pololuPacket && packetLength < 3) {
+		return false; // still waiting on the device number or command
+	}
+	return packetLength - dataStart >= dataLength();
+}
+
+void SB_MaestroEmulator::receive(uint8_t dataByte, uint32_t nowUs) {
+	if (SB_Trace *trace = SB_Trace::current()) {
+		// The byte finished arriving now, it started a byte time ago
+		uint32_t wireUs = nowUs < byteTimeUs ? nowUs : byteTimeUs;
+		trace->span(TRACE_TRACK_UART_TX, "tx byte", nowUs - wireUs, wireUs, dataByte);
+	}
+	if (rxLossRate > 0 && unit(random) < rxLossRate) {
+		rxBytesLost++;
+		return;
+	}
+	update(nowUs);
+
+	if (miniSscPacket) {
+		// Mini SSC data bytes are full 8-bit values
+		packet[packetLength++] = dataByte;
+		if (packetLength == 3) {
+			execute(nowUs);
+		}
+		return;
+	}
+
+	if (dataByte & 0x80) {
+		// A lone 0xAA is just the baud rate indication, anything else that gets
+		// interrupted by a new command byte is a protocol error
+		if (packetLength > 0 && !(pololuPacket && packetLength == 1)) {
+			errors |= MAESTRO_SERIAL_PROTOCOL_ERROR;
+		}
+		packetLength = 0;
+		packetStartUs = nowUs;
+		packet[packetLength++] = dataByte;
+		crc = crcUpdate(0, dataByte);
+
+		if (dataByte == MINI_SSC_COMMAND) {
+			miniSscPacket = true;
+			return;
+		}
+		pololuPacket = dataByte == BAUD_RATE_INDICATION;
+		if (!pololuPacket) {
+			command = dataByte;
+			dataStart = 1;
+			if (dataLength() < 0) {
+				errors |= MAESTRO_SERIAL_PROTOCOL_ERROR;
+				packetLength = 0;
+				return;
+			}
+			if (!crcEnabled && packetComplete()) {
+				execute(nowUs);
+			}
+		}
+		return;
+	}
+
+	if (packetLength == 0) {
+		errors |= MAESTRO_SERIAL_PROTOCOL_ERROR; // data byte without a command
+		return;
+	}
+
+	if (crcEnabled && packetComplete()) {
+		if (dataByte != crc) {
+			errors |= MAESTRO_SERIAL_CRC_ERROR;
+			packetLength = 0;
+			return;
+		}
+		execute(nowUs);
+		return;
+	}
+
+	packet[packetLength++] = dataByte;
+	crc = crcUpdate(crc, dataByte);
+
+	if (pololuPacket && packetLength == 3) {
+		command = dataByte | 0x80;
+		dataStart = 3;
+		if (dataLength() < 0) {
+			errors |= MAESTRO_SERIAL_PROTOCOL_ERROR;
+			packetLength = 0;
+			return;
+		}
+	}
+	if (command == SET_MULTIPLE_TARGETS_COMMAND && packetLength == dataStart + 1 &&
+			packet[dataStart] > channelCount) {
+		errors |= MAESTRO_SERIAL_PROTOCOL_ERROR;
+		packetLength = 0;
+		return;
+	}
+
+	if (!crcEnabled && packetComplete()) {
+		execute(nowUs);
+	}
+}
+
+void SB_MaestroEmulator::execute(uint32_t nowUs) {
+	const uint8_t *data = packet + dataStart;
+	uint8_t channel = data[0];
+	bool responded = false;
+
+	if (miniSscPacket) {
+		miniSscPacket = false;
+		packetLength = 0;
+		command = MINI_SSC_COMMAND;
+		channel = packet[1];
+		if (channel < channelCount && packet[2] < 255) {
+			setChannelTarget(channel, MINI_SSC_NEUTRAL + ((int) packet[2] - 127) * MINI_SSC_RANGE / 127, nowUs);
+		}
+		finishCommand(nowUs, channel, false);
+		return;
+	}
+	packetLength = 0;
+
+	// Pololu protocol packets for some other device on the line are ignored
+	if (pololuPacket && packet[1] != deviceNumber) {
+		return;
+	}
+
+	switch (command) {
+		case SET_TARGET_COMMAND:
+		case SET_SPEED_COMMAND:
+		case SET_ACCELERATION_COMMAND: {
+			if (channel >= channelCount) {
+				errors |= MAESTRO_SERIAL_PROTOCOL_ERROR;
+				break;
+			}
+			uint16_t value = data[1] | (data[2] << 7);
+			if (command == SET_TARGET_COMMAND) {
+				setChannelTarget(channel, value, nowUs);
+			} else if (command == SET_SPEED_COMMAND) {
+				channels[channel].speed = value;
+			} else {
+				channels[channel].acceleration = value > 255 ? 255 : value;
+			}
+			break;
+		}
+		case SET_PWM_COMMAND:
+			pwmOnTime = data[0] | (data[1] << 7);
+			pwmPeriod = data[2] | (data[3] << 7);
+			channel = 0;
+			break;
+		case SET_MULTIPLE_TARGETS_COMMAND: {
+			uint8_t count = data[0];
+			uint8_t first = data[1];
+			channel = first;
+			if (first + count > channelCount) {
+				errors |= MAESTRO_SERIAL_PROTOCOL_ERROR;
+				break;
+			}
+			for (uint8_t i = 0; i < count; i++) {
+				setChannelTarget(first + i, data[2 + 2 * i] | (data[3 + 2 * i] << 7), nowUs);
+			}
+			break;
+		}
+		case GET_POSITION_COMMAND: {
+			if (channel >= channelCount) {
+				errors |= MAESTRO_SERIAL_PROTOCOL_ERROR;
+				break;
+			}
+			uint16_t position = getPosition(channel);
+			respond(position & 0xFF, nowUs);
+			respond(position >> 8, nowUs);
+			responded = true;
+			break;
+		}
+		case GET_MOVING_STATE_COMMAND:
+			respond(isMoving() ? 1 : 0, nowUs);
+			responded = true;
+			channel = 0;
+			break;
+		case GET_ERRORS_COMMAND:
+			respond(errors & 0xFF, nowUs);
+			respond(errors >> 8, nowUs);
+			errors = 0;
+			responded = true;
+			channel = 0;
+			break;
+		case GO_HOME_COMMAND:
+			for (uint8_t i = 0; i < channelCount; i++) {
+				setChannelTarget(i, channels[i].home, nowUs);
+			}
+			channel = 0;
+			break;
+		case STOP_SCRIPT_COMMAND:
+			scriptRunning = false;
+			channel = 0;
+			break;
+		case RESTART_SCRIPT_COMMAND:
+		case RESTART_SCRIPT_WITH_PARAMETER_COMMAND:
+			// There's no script engine, only the status is tracked
+			scriptRunning = true;
+			break;
+		case GET_SCRIPT_STATUS_COMMAND:
+			respond(scriptRunning ? 0 : 1, nowUs);
+			responded = true;
+			channel = 0;
+			break;
+	}
+
+	finishCommand(nowUs, channel, responded);
+}
+
+void SB_MaestroEmulator::finishCommand(uint32_t nowUs, uint8_t channel, bool responded) {
+	uint32_t doneUs = responded ? lastResponseUs : nowUs;
+	uint32_t serviceUs = doneUs - packetStartUs;
+
+	SB_EmulatorCommandStats &stats = commandStats[command & 0x7F];
+	stats.count++;
+	stats.totalServiceUs += serviceUs;
+	if (serviceUs > stats.maxServiceUs) {
+		stats.maxServiceUs = serviceUs;
+	}
+
+	if (SB_Trace *trace = SB_Trace::current()) {
+		trace->span(TRACE_TRACK_MAESTRO, commandName(command), packetStartUs, serviceUs, channel);
+	}
+	if (commandLog) {
+		fprintf(commandLog, "%lu,%s,%u,%lu,%d\n", (unsigned long) packetStartUs,
+				commandName(command), channel, (unsigned long) serviceUs, responded ? 1 : 0);
+	}
+}
+
+void SB_MaestroEmulator::respond(uint8_t value, uint32_t nowUs) {
+	// Queue behind whatever is still going out
+	uint32_t readyUs = nowUs + responseLatencyUs;
+	if ((int32_t) (lastResponseUs - readyUs) > 0) {
+		readyUs = lastResponseUs;
+	}
+	readyUs += byteTimeUs;
+	lastResponseUs = readyUs;
+
+	if (SB_Trace *trace = SB_Trace::current()) {
+		trace->span(TRACE_TRACK_UART_RX, "rx byte", readyUs - byteTimeUs, byteTimeUs, value);
+	}
+
+	// A lost byte still took its time on the wire
+	if (txLossRate > 0 && unit(random) < txLossRate) {
+		txBytesLost++;
+		return;
+	}
+	responses.push_back({readyUs, value});
+}
+
+void SB_MaestroEmulator::setChannelTarget(uint8_t index, uint16_t target, uint32_t nowUs) {
+	Channel &channel = channels[index];
+	if (target != 0) {
+		if (target < minTarget) {
+			target = minTarget;
+		} else if (target > maxTarget) {
+			target = maxTarget;
+		}
+	}
+	channel.target = target;
+
+	// Turning a channel off, turning it on, or moving without limits all take
+	// effect immediately, limited moves ramp on frame boundaries
+	if (target == 0 || channel.position == 0 ||
+			(channel.speed == 0 && channel.acceleration == 0)) {
+		channel.position = target;
+		channel.velocity = 0;
+	}
+	channel.commandedUs = nowUs;
+	channel.pulsePending = true;
+}
+
+void SB_MaestroEmulator::receiveGarbled(uint32_t nowUs) {
+	update(nowUs);
+	errors |= MAESTRO_SERIAL_SIGNAL_ERROR;
+}
+
+void SB_MaestroEmulator::reset() {
+	for (uint8_t i = 0; i < channelCount; i++) {
+		uint16_t home = channels[i].home;
+		channels[i] = Channel();
+		channels[i].home = home;
+	}
+	errors = 0;
+	scriptRunning = false;
+	packetLength = 0;
+	pololuPacket = false;
+	miniSscPacket = false;
+	responses.clear();
+	baudDetected = false;
+}
+
+void SB_MaestroEmulator::setHome(uint8_t channel, uint16_t home) {
+	if (channel < channelCount) {
+		channels[channel].home = home;
+	}
+}
+
+void SB_MaestroEmulator::update(uint32_t nowUs) {
+	if (!started) {
+		// First boundary at or after now that lines up with the configured phase
+		nextFrameUs = nowUs + (framePhaseUs - nowUs) % framePeriodUs;
+		started = true;
+	}
+	while ((int32_t) (nowUs - nextFrameUs) >= 0) {
+		frame(nextFrameUs);
+		nextFrameUs += framePeriodUs;
+	}
+}
+
+void SB_MaestroEmulator::frame(uint32_t frameUs) {
+	// Speed and acceleration are specified per 10 ms
+	uint32_t ticks = framePeriodUs / 10000;
+	if (ticks == 0) {
+		ticks = 1;
+	}
+	for (uint8_t i = 0; i < channelCount; i++) {
+		Channel &channel = channels[i];
+		if (channel.pulsePending) {
+			pulseUpdates++;
+			totalPulseLatencyUs += frameUs - channel.commandedUs;
+			channel.pulsePending = false;
+		}
+		for (uint32_t t = 0; t < ticks; t++) {
+			stepChannel(channel);
+		}
+	}
+
+	if (SB_Trace *trace = SB_Trace::current()) {
+		for (uint8_t i = 0; i < channelCount; i++) {
+			uint16_t position = getPosition(i);
+			if (position != channels[i].tracedPosition) {
+				trace->counter(positionCounterNames[i], frameUs, position);
+				channels[i].tracedPosition = position;
+			}
+		}
+	}
+}
+
+void SB_MaestroEmulator::stepChannel(Channel &channel) {
+	float remaining = fabsf(channel.target - channel.position);
+	if (remaining == 0 || channel.target == 0) {
+		channel.velocity = 0;
+		return;
+	}
+	float maxVelocity = channel.speed ? channel.speed : INFINITY;
+
+	if (channel.acceleration) {
+		// Acceleration is in speed units per 80 ms
+		float acceleration = channel.acceleration / 8.0f;
+		if (channel.velocity * channel.velocity / (2 * acceleration) >= remaining) {
+			channel.velocity -= acceleration; // time to start braking
+			if (channel.velocity < acceleration) {
+				channel.velocity = acceleration;
+			}
+		} else {
+			channel.velocity += acceleration;
+		}
+		if (channel.velocity > maxVelocity) {
+			channel.velocity = maxVelocity;
+		}
+	} else {
+		channel.velocity = maxVelocity;
+	}
+
+	if (channel.velocity >= remaining) {
+		channel.position = channel.target;
+		channel.velocity = 0;
+	} else if (channel.target > channel.position) {
+		channel.position += channel.velocity;
+	} else {
+		channel.position -= channel.velocity;
+	}
+}
+
+size_t SB_MaestroEmulator::responseAvailable(uint32_t nowUs) const {
+	size_t count = 0;
+	for (const PendingByte &pending : responses) {
+		if ((int32_t) (nowUs - pending.readyUs) < 0) {
+			break;
+		}
+		count++;
+	}
+	return count;
+}
+
+size_t SB_MaestroEmulator::takeResponse(uint8_t *buffer, size_t maxBytes, uint32_t nowUs) {
+	size_t count = 0;
+	while (count < maxBytes && !responses.empty() &&
+			(int32_t) (nowUs - responses.front().readyUs) >= 0) {
+		buffer[count++] = responses.front().value;
+		responses.pop_front();
+	}
+	return count;
+}
+
+uint32_t SB_MaestroEmulator::nextEventUs() const {
+	if (!responses.empty() && (int32_t) (responses.front().readyUs - nextFrameUs) < 0) {
+		return responses.front().readyUs;
+	}
+	return nextFrameUs;
+}
+
+void SB_MaestroEmulator::setCommandLog(FILE *log) {
+	commandLog = log;
+	if (commandLog) {
+		fprintf(commandLog, "start_us,command,channel,service_us,responded\n");
+	}
+}
+
+uint16_t SB_MaestroEmulator::getTarget(uint8_t channel) const {
+	return channel < channelCount ? channels[channel].target : 0;
+}
+
+uint16_t SB_MaestroEmulator::getPosition(uint8_t channel) const {
+	return channel < channelCount ? (uint16_t) lroundf(channels[channel].position) : 0;
+}
+
+uint16_t SB_MaestroEmulator::getSpeed(uint8_t channel) const {
+	return channel < channelCount ? channels[channel].speed : 0;
+}
+
+uint16_t SB_MaestroEmulator::getAcceleration(uint8_t channel) const {
+	return channel < channelCount ? channels[channel].acceleration : 0;
+}
+
+bool SB_MaestroEmulator::isMoving() const {
+	for (uint8_t i = 0; i < channelCount; i++) {
+		if (channels[i].target != 0 && lroundf(channels[i].position) != channels[i].target) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void SB_MaestroEmulator::printStats(FILE *out) const {
+	fprintf(out, "%-28s %10s %12s %12s\n", "command", "count", "mean_us", "max_us");
+	for (int i = 0; i < 128; i++) {
+		const SB_EmulatorCommandStats &stats = commandStats[i];
+		if (stats.count == 0) {
+			continue;
+		}
+		fprintf(out, "%-28s %10lu %12.1f %12lu\n", commandName(i | 0x80), (unsigned long) stats.count,
+				(double) stats.totalServiceUs / stats.count, (unsigned long) stats.maxServiceUs);
+	}
+	fprintf(out, "bytes lost: %lu received, %lu sent\n", (unsigned long) rxBytesLost, (unsigned long) txBytesLost);
+	if (pulseUpdates) {
+		fprintf(out, "target to pulse latency: %.1f us mean over %lu updates\n",
+				(double) totalPulseLatencyUs / pulseUpdates, (unsigned long) pulseUpdates);
+	}
+}
@@ -0,0 +1,267 @@
+/**
+ * An emulated Pololu Maestro servo controller.
+ *
+ * This is the protocol engine only: bytes go in through receive(), response bytes
+ * come out of takeResponse(), and time only moves when the caller says so. That
+ * keeps it usable from the standalone pty emulator (tools/maestroEmulator), from
+ * an in-process Stream (SB_EmulatedSerial) and from virtual-time simulations.
+ *
+ * What's emulated (see the Serial Interface section of the Maestro User's Guide):
+ * 		compact and Pololu protocols, Mini SSC, optional CRC7
+ * 		setTarget, setSpeed, setAcceleration, setPWM, setMultipleTargets,
+ * 		getPosition, getMovingState, getErrors, goHome, stopScript,
+ * 		restartScript(WithParameter), getScriptStatus
+ * 		speed and acceleration ramps, advanced once per servo frame (20 ms)
+ * 		the error register, with the serial CRC and protocol error bits
+ *
+ * setPWM and setMultipleTargets only exist on the Mini Maestros, a 6 channel
+ * (Micro) emulator treats them as unknown commands like the real board does.
+ *
+ * For stress testing there's configurable response latency, wire time at a given
+ * baud, and random byte loss in either direction. Every command is timed from
+ * its first byte to the moment its response is ready, and can be logged as CSV.
+ *
+ * With a SB_Trace current, the emulator records the wire time of every byte in
+ * both directions, each command's service span, and the channel positions on
+ * every frame they change as counters.
+ */
+
+#ifndef SB_maestro_emulator
+#define SB_maestro_emulator
+
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <random>
+
+// The Maestro's error register bits
+#define MAESTRO_SERIAL_SIGNAL_ERROR 0x0001
+#define MAESTRO_SERIAL_OVERRUN_ERROR 0x0002
+#define MAESTRO_SERIAL_BUFFER_FULL_ERROR 0x0004
+#define MAESTRO_SERIAL_CRC_ERROR 0x0008
+#define MAESTRO_SERIAL_PROTOCOL_ERROR 0x0010
+#define MAESTRO_SERIAL_TIMEOUT_ERROR 0x0020
+
+#define EMULATOR_MAX_CHANNELS 24
+#define EMULATOR_DEFAULT_DEVICE_NUMBER 12
+#define EMULATOR_FRAME_PERIOD_US 20000
+
+/**
+ * Service time bookkeeping for one command byte (indexed by command & 0x7F)
+ */
+struct SB_EmulatorCommandStats {
+	uint32_t count = 0;
+	uint64_t totalServiceUs = 0;
+	uint32_t maxServiceUs = 0;
+};
+
+class SB_MaestroEmulator {
+	private:
+		struct Channel {
+			uint16_t target = 0;
+			float position = 0;
+			float velocity = 0; // quarter-microseconds per 10 ms
+			uint16_t speed = 0;
+			uint16_t acceleration = 0;
+			uint16_t home = 0;
+
+			// Pulse output latency: when the current target was commanded, and
+			// whether the output has caught up to it on a frame boundary yet
+			uint32_t commandedUs = 0;
+			bool pulsePending = false;
+
+			uint16_t tracedPosition = 0xFFFF; // last position counter recorded
+		};
+
+		struct PendingByte {
+			uint32_t readyUs;
+			uint8_t value;
+		};
+
+		const uint8_t channelCount;
+		uint8_t deviceNumber;
+		bool crcEnabled;
+
+		Channel channels[EMULATOR_MAX_CHANNELS];
+		uint16_t minTarget = 256;   //   64 us, the widest range the Control Center allows
+		uint16_t maxTarget = 16320; // 4080 us
+		uint16_t errors = 0;
+		bool scriptRunning = false;
+		uint16_t pwmOnTime = 0;
+		uint16_t pwmPeriod = 0;
+
+		// Packet parser
+		uint8_t packet[64];
+		uint8_t packetLength = 0;
+		bool pololuPacket = false;
+		bool miniSscPacket = false;
+		uint8_t command = 0;
+		uint8_t dataStart = 0; // index of the first data byte in packet
+		uint8_t crc = 0;
+		uint32_t packetStartUs = 0;
+
+		// Time
+		bool started = false;
+		uint32_t nextFrameUs = 0;
+		uint32_t framePeriodUs = EMULATOR_FRAME_PERIOD_US;
+		uint32_t framePhaseUs = 0;
+
+		// Impairments
+		uint32_t responseLatencyUs = 0;
+		uint32_t baud = 0;
+		uint32_t byteTimeUs = 0;
+		bool autoDetectBaud = false;
+		bool baudDetected = false;
+		float rxLossRate = 0;
+		float txLossRate = 0;
+		std::minstd_rand random;
+		std::uniform_real_distribution<float> unit{0.0f, 1.0f};
+		uint32_t rxBytesLost = 0;
+		uint32_t txBytesLost = 0;
+
+		std::deque<PendingByte> responses;
+		uint32_t lastResponseUs = 0; // when the last response byte finished on the wire
+
+		SB_EmulatorCommandStats commandStats[128];
+		uint32_t pulseUpdates = 0;
+		uint64_t totalPulseLatencyUs = 0;
+		FILE *commandLog = nullptr;
+
+		static uint8_t crcUpdate(uint8_t crc, uint8_t dataByte);
+
+		/**
+		 * @return the number of data bytes the current command needs, CRC not included,
+		 * or -1 if the command isn't one this model of Maestro knows
+		 */
+		int dataLength() const;
+		bool packetComplete() const;
+		void execute(uint32_t nowUs);
+		void finishCommand(uint32_t nowUs, uint8_t channel, bool responded);
+
+		void respond(uint8_t value, uint32_t nowUs);
+		void setChannelTarget(uint8_t channel, uint16_t target, uint32_t nowUs);
+		void frame(uint32_t frameUs);
+		void stepChannel(Channel &channel);
+
+	public:
+		/**
+		 * @param channelCount -- 6 for a Micro Maestro, 12, 18 or 24 for a Mini Maestro
+		 * @param deviceNumber -- the device number Pololu protocol packets must address
+		 * @param crcEnabled -- whether every packet carries a trailing CRC7 byte
+		 */
+		SB_MaestroEmulator(uint8_t channelCount = EMULATOR_MAX_CHANNELS,
+				uint8_t deviceNumber = EMULATOR_DEFAULT_DEVICE_NUMBER,
+				bool crcEnabled = false);
+
+		/**
+		 * Feeds one byte from the host to the emulated Maestro
+		 */
+		void receive(uint8_t dataByte, uint32_t nowUs);
+
+		/**
+		 * Advances servo frames (and with them the speed/acceleration ramps) up to nowUs
+		 */
+		void update(uint32_t nowUs);
+
+		/**
+		 * @return how many response bytes are ready to go out at nowUs
+		 */
+		size_t responseAvailable(uint32_t nowUs) const;
+
+		/**
+		 * Moves up to maxBytes ready response bytes into buffer
+		 * @return the number of bytes moved
+		 */
+		size_t takeResponse(uint8_t *buffer, size_t maxBytes, uint32_t nowUs);
+
+		/**
+		 * @return when the next thing happens (a response byte becomes ready or a
+		 * frame boundary passes), so an event loop knows how long it can sleep
+		 */
+		uint32_t nextEventUs() const;
+
+		// Impairments
+		void setResponseLatency(uint32_t latencyUs) { responseLatencyUs = latencyUs; }
+		/**
+		 * Paces response bytes at the wire time of the given baud (10 bits a byte), 0 disables pacing
+		 */
+		void setBaud(uint32_t rate) { baud = rate; byteTimeUs = rate ? (10000000 + rate - 1) / rate : 0; }
+		uint32_t getBaud() const { return baud; }
+		uint32_t getByteTimeUs() const { return byteTimeUs; }
+
+		/**
+		 * Like a Maestro set to "UART, detect baud rate": it takes nothing until
+		 * a 0xAA arrives, and the rate that came at becomes its own. Only the
+		 * link knows what rate a byte came at, so SB_EmulatedSerial does the
+		 * detecting and calls detectBaud(). reset() forgets the rate again
+		 */
+		void setAutoDetectBaud(bool enabled) { autoDetectBaud = enabled; baudDetected = false; }
+		bool isDetectingBaud() const { return autoDetectBaud && !baudDetected; }
+		void detectBaud(uint32_t rate) { setBaud(rate); baudDetected = true; }
+
+		/**
+		 * A byte that arrived garbled (wrong baud, noise): the UART's framing
+		 * error, which sets the serial signal error bit
+		 */
+		void receiveGarbled(uint32_t nowUs);
+
+		/**
+		 * What pulling RST low does: targets, positions, speeds, accelerations,
+		 * errors, half received commands, unsent responses and a detected baud
+		 * are all forgotten
+		 */
+		void reset();
+		void setLossRates(float rxRate, float txRate) { rxLossRate = rxRate; txLossRate = txRate; }
+		void setSeed(uint32_t seed) { random.seed(seed); }
+
+		// Configuration
+		void setCrcEnabled(bool enabled) { crcEnabled = enabled; }
+		void setTargetRange(uint16_t minimum, uint16_t maximum) { minTarget = minimum; maxTarget = maximum; }
+		void setHome(uint8_t channel, uint16_t home);
+		/**
+		 * @param phaseUs -- where, relative to time 0, the emulated frame boundaries fall
+		 */
+		void setFrame(uint32_t periodUs, uint32_t phaseUs) { framePeriodUs = periodUs; framePhaseUs = phaseUs; started = false; }
+
+		/**
+		 * Writes one CSV line per command: first byte time, command, channel,
+		 * service time (first byte to response ready) and whether it answered
+		 */
+		void setCommandLog(FILE *log);
+
+		// State, for tests and simulations to check against
+		uint8_t getChannelCount() const { return channelCount; }
+		uint16_t getTarget(uint8_t channel) const;
+		uint16_t getPosition(uint8_t channel) const;
+		uint16_t getSpeed(uint8_t channel) const;
+		uint16_t getAcceleration(uint8_t channel) const;
+		/**
+		 * When the channel's current target arrived (its last byte was received)
+		 */
+		uint32_t getCommandedUs(uint8_t channel) const { return channel < channelCount ? channels[channel].commandedUs : 0; }
+		uint16_t peekErrors() const { return errors; }
+		bool isMoving() const;
+		bool isScriptRunning() const { return scriptRunning; }
+		uint16_t getPwmOnTime() const { return pwmOnTime; }
+		uint16_t getPwmPeriod() const { return pwmPeriod; }
+		uint32_t getFramePeriodUs() const { return framePeriodUs; }
+		uint32_t getFramePhaseUs() const { return framePhaseUs; }
+
+		const SB_EmulatorCommandStats &getCommandStats(uint8_t commandByte) const { return commandStats[commandByte & 0x7F]; }
+		uint32_t getRxBytesLost() const { return rxBytesLost; }
+		uint32_t getTxBytesLost() const { return txBytesLost; }
+
+		/**
+		 * Target-to-pulse latency: how long commanded targets waited for a frame
+		 * boundary before the output pulse could reflect them
+		 */
+		uint32_t getPulseUpdates() const { return pulseUpdates; }
+		uint64_t getTotalPulseLatencyUs() const { return totalPulseLatencyUs; }
+
+		/**
+		 * Prints the per-command service time table
+		 */
+		void printStats(FILE *out) const;
+};
+
+#endif
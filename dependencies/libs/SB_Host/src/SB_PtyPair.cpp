@@ -0,0 +1,52 @@
+/**
+ * Source file for SB_PtyPair.hpp
+ */
+
+#include "SB_PtyPair.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+SB_PtyPair::~SB_PtyPair() {
+	close();
+}
+
+bool SB_PtyPair::open() {
+	close();
+
+	masterFd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (masterFd < 0 || grantpt(masterFd) < 0 || unlockpt(masterFd) < 0 ||
+			ptsname_r(masterFd, slavePath, sizeof(slavePath)) != 0) {
+		close();
+		return false;
+	}
+
+	slaveFd = ::open(slavePath, O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (slaveFd < 0) {
+		close();
+		return false;
+	}
+
+	struct termios settings;
+	if (tcgetattr(slaveFd, &settings) == 0) {
+		cfmakeraw(&settings);
+		tcsetattr(slaveFd, TCSANOW, &settings);
+	}
+	return true;
+}
+
+void SB_PtyPair::close() {
+	if (slaveFd >= 0) {
+		::close(slaveFd);
+	}
+	if (masterFd >= 0) {
+		::close(masterFd);
+	}
+	slaveFd = -1;
+	masterFd = -1;
+	slavePath[0] = '\0';
+}
@@ -0,0 +1,39 @@
+/**
+ * A pseudo-terminal pair for testing the Linux serial path without hardware.
+ *
+ * Whatever is written to the master side comes out of the slave device and vice
+ * versa, so a SB_TermiosStream opened on getSlavePath() behaves exactly like
+ * one opened on a real Maestro, with the "Maestro" being whoever holds the master.
+ *
+ * The pair keeps its own handle on the slave open (in raw mode) so the slave
+ * doesn't apply line editing before a client opens it, and so the master
+ * doesn't see a hangup every time a client closes and reopens the port.
+ */
+
+#ifndef SB_pty_pair
+#define SB_pty_pair
+
+class SB_PtyPair {
+	private:
+		int masterFd = -1;
+		int slaveFd = -1;
+		char slavePath[64] = {0};
+
+	public:
+		SB_PtyPair() {}
+		~SB_PtyPair();
+		SB_PtyPair(const SB_PtyPair &) = delete;
+		SB_PtyPair &operator=(const SB_PtyPair &) = delete;
+
+		/**
+		 * Allocates the pair, the master is opened non-blocking
+		 * @return false if the kernel wouldn't give us a pty
+		 */
+		bool open();
+		void close();
+
+		int getMasterFd() const { return masterFd; }
+		const char *getSlavePath() const { return slavePath; }
+};
+
+#endif
@@ -0,0 +1,123 @@
+/**
+ * Source file for SB_RcRecording.hpp
+ */
+
+#include "SB_RcRecording.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+
+bool SB_RcRecording::load(const char *path) {
+	rows.clear();
+	channelCount = 0;
+
+	FILE *in = fopen(path, "r");
+	if (!in) {
+		errorCode |= RC_RECORDING_OPEN_ERROR_BIT;
+		return false;
+	}
+
+	char line[256];
+	bool first = true;
+	bool good = true;
+	while (fgets(line, sizeof(line), in)) {
+		const char *cursor = line;
+		while (*cursor == ' ' || *cursor == '\t') {
+			cursor++;
+		}
+		if (*cursor == '\n' || *cursor == '\r' || *cursor == '\0') {
+			continue;
+		}
+		if (!isdigit((unsigned char) *cursor)) {
+			if (first) {
+				first = false;
+				continue; // the header
+			}
+			good = false;
+			break;
+		}
+		first = false;
+
+		char *end;
+		uint64_t timeUs = strtoull(cursor, &end, 10);
+		uint16_t widths[RC_RECORDING_MAX_CHANNELS];
+		uint8_t columns = 0;
+		while (*end == ',' && columns < RC_RECORDING_MAX_CHANNELS) {
+			widths[columns++] = (uint16_t) strtoul(end + 1, &end, 10);
+		}
+		if (columns == 0 || (!rows.empty() && columns != channelCount)) {
+			good = false;
+			break;
+		}
+		size_t before = rows.size();
+		add(timeUs, widths, columns);
+		if (rows.size() == before) {
+			good = false;
+			break;
+		}
+	}
+	fclose(in);
+
+	if (!good) {
+		errorCode |= RC_RECORDING_FORMAT_ERROR_BIT;
+		return false;
+	}
+	return true;
+}
+
+bool SB_RcRecording::save(const char *path) {
+	FILE *out = fopen(path, "w");
+	if (!out) {
+		errorCode |= RC_RECORDING_OPEN_ERROR_BIT;
+		return false;
+	}
+	fprintf(out, "time_us");
+	for (uint8_t channel = 0; channel < channelCount; channel++) {
+		fprintf(out, ",ch%u_us", channel);
+	}
+	fprintf(out, "\n");
+	for (const Row &row : rows) {
+		fprintf(out, "%llu", (unsigned long long) row.timeUs);
+		for (uint8_t channel = 0; channel < channelCount; channel++) {
+			fprintf(out, ",%u", row.widthUs[channel]);
+		}
+		fprintf(out, "\n");
+	}
+	if (fclose(out) != 0) {
+		errorCode |= RC_RECORDING_OPEN_ERROR_BIT;
+		return false;
+	}
+	return true;
+}
+
+void SB_RcRecording::add(uint64_t timeUs, const uint16_t *widthsUs, uint8_t channels) {
+	if (channels > RC_RECORDING_MAX_CHANNELS) {
+		channels = RC_RECORDING_MAX_CHANNELS;
+	}
+	if (rows.empty()) {
+		channelCount = channels;
+	} else if (channels != channelCount || timeUs < rows.back().timeUs) {
+		errorCode |= RC_RECORDING_FORMAT_ERROR_BIT;
+		return;
+	}
+	Row row = {timeUs, {0}};
+	for (uint8_t channel = 0; channel < channels; channel++) {
+		row.widthUs[channel] = widthsUs[channel];
+	}
+	rows.push_back(row);
+}
+
+uint16_t SB_RcRecording::widthAt(uint8_t channel, uint64_t timeUs) const {
+	if (channel >= channelCount || rows.empty()) {
+		return RC_RECORDING_NEUTRAL_US;
+	}
+	// The first row after timeUs, the one before it is in effect
+	auto after = std::upper_bound(rows.begin(), rows.end(), timeUs,
+			[](uint64_t time, const Row &row) { return time < row.timeUs; });
+	if (after == rows.begin()) {
+		return rows.front().widthUs[channel];
+	}
+	return (after - 1)->widthUs[channel];
+}
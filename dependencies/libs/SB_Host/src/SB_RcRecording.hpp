@@ -0,0 +1,76 @@
+/**
+ * Recorded RC receiver input, to replay into a SB_Simulation.
+ *
+ * A recording is a CSV file, one row per receiver frame:
+ *
+ * 		time_us,ch2_us,ch3_us,...
+ * 		0,1500,1500
+ * 		22000,1512,1500
+ *
+ * Any number of channel columns, a header line is optional (a first line that
+ * doesn't start with a number is skipped). Between rows each channel holds its
+ * last value, so widthAt() can be handed straight to a SB_RcPulseGenerator.
+ *
+ * The rows are read only after load(), so one recording can be shared by
+ * simulations running on several threads.
+ */
+
+#ifndef SB_rc_recording
+#define SB_rc_recording
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define RC_RECORDING_MAX_CHANNELS 8
+#define RC_RECORDING_NEUTRAL_US 1500
+
+#define RC_RECORDING_OPEN_ERROR_BIT 0x01   // the file couldn't be opened or written
+#define RC_RECORDING_FORMAT_ERROR_BIT 0x02 // a row had the wrong number of columns or went back in time
+
+class SB_RcRecording {
+	private:
+		struct Row {
+			uint64_t timeUs;
+			uint16_t widthUs[RC_RECORDING_MAX_CHANNELS];
+		};
+
+		std::vector<Row> rows;
+		uint8_t channelCount = 0;
+		int errorCode = 0;
+
+	public:
+		/**
+		 * Replaces the contents with a CSV file
+		 * @sets RC_RECORDING_OPEN_ERROR_BIT
+		 * @sets RC_RECORDING_FORMAT_ERROR_BIT
+		 */
+		bool load(const char *path);
+
+		/**
+		 * @sets RC_RECORDING_OPEN_ERROR_BIT
+		 */
+		bool save(const char *path);
+
+		/**
+		 * Appends a row, rows must be added in time order
+		 * @sets RC_RECORDING_FORMAT_ERROR_BIT
+		 */
+		void add(uint64_t timeUs, const uint16_t *widthsUs, uint8_t channels);
+
+		/**
+		 * The pulse width of a channel at a time: the last row at or before it,
+		 * the first row before the recording starts, neutral for a channel the
+		 * recording doesn't have
+		 */
+		uint16_t widthAt(uint8_t channel, uint64_t timeUs) const;
+
+		uint8_t getChannelCount() const { return channelCount; }
+		size_t size() const { return rows.size(); }
+		uint64_t getDurationUs() const { return rows.empty() ? 0 : rows.back().timeUs; }
+
+		int getErrorCode() const { return errorCode; }
+		void clearErrorCode() { errorCode = 0; }
+};
+
+#endif
@@ -0,0 +1,204 @@
+/**
+ * Source file for SB_Simulation.hpp
+ */
+
+#include "SB_Simulation.hpp"
+#include "SB_Trace.hpp"
+#include "Arduino.h"
+
+thread_local SB_Simulation *SB_Simulation::currentSimulation = nullptr;
+
+SB_Simulation::~SB_Simulation() {
+	if (currentSimulation == this) {
+		currentSimulation = nullptr;
+	}
+}
+
+void SB_Simulation::at(uint64_t atUs, Callback callback) {
+	if (atUs < nowUs) {
+		atUs = nowUs;
+	}
+	events.push({atUs, nextSequence++, std::move(callback)});
+}
+
+void SB_Simulation::every(const char *name, uint64_t periodUs, Callback callback, uint64_t firstUs) {
+	size_t index = tasks.size();
+	tasks.push_back({name, periodUs ? periodUs : 1, std::move(callback)});
+	at(firstUs, [this, index, firstUs]() { runTask(index, firstUs); });
+}
+
+void SB_Simulation::runTask(size_t index, uint64_t dueUs) {
+	// Copied out, the task may add more tasks and move the vector
+	const char *name = tasks[index].name;
+	uint64_t nextUs = dueUs + tasks[index].periodUs;
+	Callback callback = tasks[index].callback;
+	at(nextUs, [this, index, nextUs]() { runTask(index, nextUs); });
+
+	taskRuns++;
+	SB_TraceScope scope(TRACE_TRACK_TASK, name);
+	callback();
+}
+
+void SB_Simulation::advanceTo(uint64_t untilUs) {
+	while (!events.empty() && events.top().atUs <= untilUs) {
+		// Moved out before running, the callback may schedule more events
+		Event event = std::move(const_cast<Event &>(events.top()));
+		events.pop();
+		if (event.atUs > nowUs) {
+			nowUs = event.atUs;
+		}
+		event.callback();
+	}
+	if (untilUs > nowUs) {
+		nowUs = untilUs;
+	}
+}
+
+void SB_Simulation::run(uint64_t durationUs, Callback loop) {
+	uint64_t endUs = nowUs + durationUs;
+	stopRequested = false;
+	while (nowUs < endUs && !stopRequested) {
+		uint64_t startUs = nowUs;
+		loop();
+		if (nowUs < startUs + loopCostUs) {
+			advanceTo(startUs + loopCostUs);
+		}
+	}
+}
+
+void SB_Simulation::setPin(uint8_t pin, uint8_t level) {
+	if (pin >= SIMULATION_MAX_PINS) {
+		return;
+	}
+	Pin &state = pins[pin];
+	level = level ? HIGH : LOW;
+	if (state.level == level) {
+		return;
+	}
+	state.level = level;
+	state.edgeUs = nowUs;
+	if (port.isr && (port.mask >> pin & 1)) {
+		if (!interruptsEnabled) {
+			port.pending = true;
+		} else if (!port.scheduled) {
+			// Runs after any other edges already due at this instant
+			port.scheduled = true;
+			at(nowUs, [this]() {
+				port.scheduled = false;
+				if (!port.isr) {
+					return; // detached in the meantime
+				}
+				if (interruptsEnabled) {
+					firePortIsr();
+				} else {
+					port.pending = true;
+				}
+			});
+		}
+	}
+	if (!state.isr) {
+		return;
+	}
+	bool fires = state.mode == CHANGE ||
+		(state.mode == RISING && level == HIGH) ||
+		(state.mode == FALLING && level == LOW);
+	if (!fires) {
+		return;
+	}
+	if (interruptsEnabled) {
+		fireIsr(pin);
+	} else {
+		state.pending = true;
+	}
+}
+
+void SB_Simulation::firePortIsr() {
+	isrCount++;
+	SB_TraceScope scope(TRACE_TRACK_ISR, "port", (int32_t) readPort());
+	port.isr();
+}
+
+void SB_Simulation::fireIsr(uint8_t pin) {
+	isrCount++;
+	SB_TraceScope scope(TRACE_TRACK_ISR, pins[pin].name.c_str(), pins[pin].level);
+	pins[pin].isr();
+}
+
+void SB_Simulation::attachInterrupt(uint8_t pin, void (*isr)(), int mode) {
+	if (pin >= SIMULATION_MAX_PINS) {
+		return;
+	}
+	Pin &state = pins[pin];
+	if (state.name.empty()) {
+		// Made once, the trace keeps a pointer to it
+		state.name = "pin " + std::to_string(pin);
+	}
+	state.isr = isr;
+	state.mode = mode;
+	state.pending = false;
+}
+
+void SB_Simulation::detachInterrupt(uint8_t pin) {
+	if (pin < SIMULATION_MAX_PINS) {
+		pins[pin].isr = nullptr;
+		pins[pin].pending = false;
+	}
+}
+
+void SB_Simulation::setInterruptsEnabled(bool enabled) {
+	interruptsEnabled = enabled;
+	if (!enabled) {
+		return;
+	}
+	for (uint8_t pin = 0; pin < SIMULATION_MAX_PINS; pin++) {
+		if (pins[pin].pending && pins[pin].isr) {
+			pins[pin].pending = false;
+			fireIsr(pin);
+		}
+	}
+	if (port.pending && port.isr) {
+		port.pending = false;
+		firePortIsr();
+	}
+}
+
+void SB_Simulation::attachPortInterrupt(uint64_t pinMask, void (*isr)()) {
+	port.mask = pinMask;
+	port.isr = isr;
+	port.pending = false;
+}
+
+uint64_t SB_Simulation::readPort() const {
+	uint64_t levels = 0;
+	for (uint8_t pin = 0; pin < SIMULATION_MAX_PINS; pin++) {
+		levels |= (uint64_t) pins[pin].level << pin;
+	}
+	return levels;
+}
+
+SB_RcPulseGenerator::SB_RcPulseGenerator(SB_Simulation &sim, uint8_t outputPin,
+		uint32_t framePeriodUs, WidthFunction widthUs) :
+		simulation(sim),
+		pin(outputPin),
+		periodUs(framePeriodUs),
+		width(std::move(widthUs)) {}
+
+void SB_RcPulseGenerator::start(uint64_t offsetUs) {
+	running = true;
+	simulation.after(offsetUs, [this]() { rise(); });
+}
+
+void SB_RcPulseGenerator::rise() {
+	if (!running) {
+		return;
+	}
+	uint64_t riseUs = simulation.now();
+	uint16_t widthUs = width(riseUs);
+	simulation.setPin(pin, HIGH);
+	simulation.at(riseUs + widthUs, [this]() {
+		lastFallUs = simulation.now();
+		simulation.setPin(pin, LOW);
+		pulses++;
+	});
+	simulation.at(riseUs + periodUs, [this]() { rise(); });
+}
@@ -0,0 +1,220 @@
+/**
+ * A virtual-time runtime for running sketch code on the host.
+ *
+ * While a SB_Simulation is current on a thread, the host Arduino core on that
+ * thread runs on it instead of the real world:
+ *
+ * 		micros()/millis()   -- the simulation clock, which starts at 0
+ * 		delay()             -- advances the clock, running whatever falls due
+ * 		digitalRead()       -- the simulated pin levels
+ * 		attachInterrupt()   -- handlers fire on simulated pin edges, and can
+ * 		                       re-attach themselves from inside like on the Teensy
+ * 		attachPortInterrupt() -- one handler for a group of pins, entered once
+ * 		                       for all the edges at the same instant like a
+ * 		                       GPIO port's shared vector
+ * 		noInterrupts()      -- edges are held and their handlers run on interrupts()
+ *
+ * Time only moves when something waits: delay(), a stream polled with nothing
+ * to read (SB_EmulatedSerial charges setPollCost() per empty poll, so the
+ * driver's spin on available() lets the emulated Maestro's answer arrive), or
+ * run() between calls to loop(). Events scheduled with at()/after(), tasks from
+ * every() and pin edges all run in time order as the clock passes them.
+ *
+ * ISRs and tasks are recorded on the current SB_Trace, if there is one.
+ *
+ * One simulation per thread, nothing here is thread safe, so independent
+ * simulations can run side by side on as many threads as there are cores.
+ */
+
+#ifndef SB_simulation
+#define SB_simulation
+
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <string>
+#include <vector>
+
+#define SIMULATION_MAX_PINS 64
+
+class SB_Simulation {
+	public:
+		typedef std::function<void()> Callback;
+
+	private:
+		static thread_local SB_Simulation *currentSimulation;
+
+		struct Event {
+			uint64_t atUs;
+			uint64_t sequence; // keeps events at the same time in scheduling order
+			Callback callback;
+			bool operator>(const Event &other) const {
+				return atUs != other.atUs ? atUs > other.atUs : sequence > other.sequence;
+			}
+		};
+
+		struct Pin {
+			uint8_t level = 0;
+			uint64_t edgeUs = 0; // when the level last changed, latched like a timer's input capture
+			void (*isr)() = nullptr;
+			int mode = 0;
+			bool pending = false; // an edge arrived while interrupts were off
+			std::string name;
+		};
+
+		// A group of pins sharing one interrupt, like a GPIO port
+		struct Port {
+			uint64_t mask = 0;
+			void (*isr)() = nullptr;
+			bool scheduled = false; // an entry is queued for the current instant
+			bool pending = false;   // an edge arrived while interrupts were off
+		};
+
+		struct Task {
+			const char *name;
+			uint64_t periodUs;
+			Callback callback;
+		};
+
+		uint64_t nowUs = 0;
+		uint64_t nextSequence = 0;
+		std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+		std::vector<Task> tasks;
+		Pin pins[SIMULATION_MAX_PINS];
+		Port port;
+		bool interruptsEnabled = true;
+		bool stopRequested = false;
+
+		uint32_t pollCostUs = 1;
+		uint32_t loopCostUs = 1;
+
+		uint64_t isrCount = 0;
+		uint64_t taskRuns = 0;
+
+		void runTask(size_t index, uint64_t dueUs);
+		void fireIsr(uint8_t pin);
+		void firePortIsr();
+
+	public:
+		SB_Simulation() {}
+		~SB_Simulation();
+		SB_Simulation(const SB_Simulation &) = delete;
+		SB_Simulation &operator=(const SB_Simulation &) = delete;
+
+		/**
+		 * The simulation the host core on this thread runs on, nullptr for real time
+		 */
+		static SB_Simulation *current() { return currentSimulation; }
+		void makeCurrent() { currentSimulation = this; }
+		static void clearCurrent() { currentSimulation = nullptr; }
+
+		uint64_t now() const { return nowUs; }
+
+		/**
+		 * Runs callback when the clock reaches atUs (or right away on the next
+		 * advance if that's already passed)
+		 */
+		void at(uint64_t atUs, Callback callback);
+		void after(uint64_t delayUs, Callback callback) { at(nowUs + delayUs, callback); }
+
+		/**
+		 * A periodic scheduler task, first run at firstUs, traced under name.
+		 * The name is not copied
+		 */
+		void every(const char *name, uint64_t periodUs, Callback callback, uint64_t firstUs = 0);
+
+		/**
+		 * Moves the clock forward, running everything that falls due on the way
+		 */
+		void advanceTo(uint64_t untilUs);
+		void advance(uint64_t durationUs) { advanceTo(nowUs + durationUs); }
+
+		/**
+		 * A stream was polled and had nothing, charges the poll cost
+		 */
+		void poll() { advance(pollCostUs); }
+
+		/**
+		 * Calls loop() over and over until durationUs has passed (or stop() is
+		 * called), each call costing at least the loop cost
+		 */
+		void run(uint64_t durationUs, Callback loop);
+		void stop() { stopRequested = true; }
+
+		/**
+		 * How much virtual time an empty stream poll and an iteration of loop() cost
+		 */
+		void setPollCost(uint32_t us) { pollCostUs = us ? us : 1; }
+		void setLoopCost(uint32_t us) { loopCostUs = us ? us : 1; }
+
+		// Pins, driven by the simulation and read by the sketch
+		void setPin(uint8_t pin, uint8_t level);
+		uint8_t getPin(uint8_t pin) const { return pin < SIMULATION_MAX_PINS ? pins[pin].level : 0; }
+
+		/**
+		 * When the pin's level last changed, whether or not interrupts were on
+		 */
+		uint64_t getPinEdgeUs(uint8_t pin) const { return pin < SIMULATION_MAX_PINS ? pins[pin].edgeUs : 0; }
+		void attachInterrupt(uint8_t pin, void (*isr)(), int mode);
+		void detachInterrupt(uint8_t pin);
+		void setInterruptsEnabled(bool enabled);
+
+		/**
+		 * One handler for every pin in pinMask, on both edges. Edges at the same
+		 * instant (and all those held while interrupts are off) share one entry,
+		 * read readPort() to see which pins changed
+		 */
+		void attachPortInterrupt(uint64_t pinMask, void (*isr)());
+		void detachPortInterrupt() { port = Port(); }
+
+		/**
+		 * Every pin's level as one word, bit n for pin n
+		 */
+		uint64_t readPort() const;
+
+		uint64_t getIsrCount() const { return isrCount; }
+		uint64_t getTaskRuns() const { return taskRuns; }
+};
+
+/**
+ * An RC receiver channel: a pulse on a simulated pin every period, as wide as
+ * the width function says at the time of each rising edge
+ */
+class SB_RcPulseGenerator {
+	public:
+		typedef std::function<uint16_t(uint64_t nowUs)> WidthFunction;
+
+	private:
+		SB_Simulation &simulation;
+		uint8_t pin;
+		uint32_t periodUs;
+		WidthFunction width;
+		bool running = false;
+		uint32_t pulses = 0;
+		uint64_t lastFallUs = 0;
+
+		void rise();
+
+	public:
+		/**
+		 * @param periodUs -- the frame rate of the receiver, the AR620 sends a
+		 * pulse every 22 ms
+		 */
+		SB_RcPulseGenerator(SB_Simulation &sim, uint8_t outputPin, uint32_t framePeriodUs, WidthFunction widthUs);
+
+		/**
+		 * Starts pulsing, the first rising edge comes offsetUs from now
+		 */
+		void start(uint64_t offsetUs = 0);
+		void stop() { running = false; }
+
+		uint32_t getPulses() const { return pulses; }
+
+		/**
+		 * When the last pulse ended, which is when the receiver's value for it
+		 * became measurable
+		 */
+		uint64_t getLastFallUs() const { return lastFallUs; }
+};
+
+#endif
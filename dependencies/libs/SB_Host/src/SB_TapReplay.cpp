@@ -0,0 +1,252 @@
+/**
+ * Source file for SB_TapReplay.hpp
+ */
+
+#include "SB_TapReplay.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+
+#define POLOLU_START 0xAA
+#define MINI_SSC_START 0xFF
+#define SET_TARGET 0x84
+#define SET_MULTI_TARGET 0x9F
+
+/**
+ * Data bytes after the command byte, -1 for setMultiTarget, which depends on its
+ * first data byte
+ */
+static int dataLength(uint8_t command) {
+	switch (command) {
+		case SET_TARGET: case 0x87: case 0x89: case 0xA8: return 3;
+		case 0x8A: return 4;
+		case 0x90: case 0xA7: return 1;
+		case SET_MULTI_TARGET: return -1;
+		default: return 0;
+	}
+}
+
+bool SB_TapReplay::load(const char *path) {
+	FILE *in = fopen(path, "rb");
+	if (!in) {
+		errorCode |= TAP_REPLAY_OPEN_ERROR_BIT;
+		return false;
+	}
+	std::vector<uint8_t> log;
+	uint8_t buffer[4096];
+	size_t got;
+	while ((got = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+		log.insert(log.end(), buffer, buffer + got);
+	}
+	fclose(in);
+	return load(log.data(), log.size());
+}
+
+bool SB_TapReplay::load(const uint8_t *log, size_t length) {
+	bytes.assign(length / 2, SB_TapByte{});
+	long decoded = SB_StreamTap::decode(log, length, bytes.data(), bytes.size(), baud);
+	if (decoded < 0) {
+		bytes.clear();
+		packets.clear();
+		errorCode |= TAP_REPLAY_FORMAT_ERROR_BIT;
+		return false;
+	}
+	bytes.resize(decoded);
+	split();
+	return true;
+}
+
+void SB_TapReplay::split() {
+	packets.clear();
+	enum { IDLE, DEVICE, COMMAND, DATA } state = IDLE;
+	bool complete = false; // the last packet has all its data, and could be followed by a CRC
+	int need = 0;
+	uint32_t start = bytes.empty() ? 0 : bytes.front().timeUs;
+	for (const SB_TapByte &b : bytes) {
+		if (b.direction != TAP_TX) {
+			continue;
+		}
+		uint32_t timeUs = b.timeUs - start;
+		bool miniSscData = state == DATA && packets.back().command == MINI_SSC_START;
+		if (b.value & 0x80 && !miniSscData) {
+			// A new packet, whatever was going on: one cut short is dropped
+			if (state != IDLE) {
+				packets.pop_back();
+			}
+			complete = false;
+			if (b.value == POLOLU_START) {
+				state = DEVICE;
+				packets.push_back({timeUs, 0, {}, false});
+				continue;
+			}
+			packets.push_back({timeUs, b.value, {}, false});
+			need = b.value == MINI_SSC_START ? 2 : dataLength(b.value);
+			state = need == 0 ? IDLE : DATA;
+			complete = need == 0;
+			continue;
+		}
+		switch (state) {
+			case DEVICE:
+				state = COMMAND;
+				break;
+			case COMMAND:
+				packets.back().command = b.value | 0x80;
+				need = dataLength(packets.back().command);
+				state = need == 0 ? IDLE : DATA;
+				complete = need == 0;
+				break;
+			case DATA:
+				packets.back().data.push_back(b.value);
+				if (need < 0) {
+					// setMultiTarget's count, then channel and two bytes a target
+					need = 1 + 2 * b.value;
+				} else if (--need == 0) {
+					state = IDLE;
+					complete = packets.back().command != MINI_SSC_START;
+				}
+				break;
+			case IDLE:
+				// The byte after a whole packet is its CRC7, anything else is noise
+				if (complete) {
+					packets.back().crc = true;
+					complete = false;
+				}
+				break;
+		}
+	}
+	if (state != IDLE) {
+		packets.pop_back();
+	}
+}
+
+SB_TapReplayResult SB_TapReplay::replay(SB_MaestroEmulator &emulator) const {
+	SB_TapReplayResult result;
+	std::vector<uint8_t> logged;
+	uint32_t byteTimeUs = emulator.getByteTimeUs();
+	uint32_t start = bytes.empty() ? 0 : bytes.front().timeUs;
+	uint32_t lineFreeUs = 0;
+	for (const SB_TapByte &b : bytes) {
+		if (b.direction == TAP_RX) {
+			logged.push_back(b.value);
+			result.rxBytes++;
+			continue;
+		}
+		// Lands a byte time after it started, as soon as the line was free
+		uint32_t timeUs = b.timeUs - start;
+		uint32_t doneUs = std::max(timeUs, lineFreeUs) + byteTimeUs;
+		emulator.update(doneUs);
+		emulator.receive(b.value, doneUs);
+		lineFreeUs = doneUs;
+		result.txBytes++;
+	}
+
+	// Whatever it had to say, however long it takes to say it
+	uint32_t endUs = lineFreeUs + 1000000;
+	emulator.update(endUs);
+	uint8_t answer;
+	while (emulator.takeResponse(&answer, 1, endUs) == 1) {
+		if (result.firstMismatch < 0) {
+			if (result.answeredBytes < logged.size() && logged[result.answeredBytes] == answer) {
+				result.matchedBytes++;
+			} else {
+				result.firstMismatch = result.answeredBytes;
+			}
+		}
+		result.answeredBytes++;
+	}
+	if (result.firstMismatch < 0 && result.answeredBytes < logged.size()) {
+		result.firstMismatch = result.answeredBytes;
+	}
+	return result;
+}
+
+SB_TapOccupancy SB_TapReplay::place(const std::vector<std::pair<uint32_t, uint32_t>> &sends, uint32_t baud) const {
+	SB_TapOccupancy occupancy;
+	if (baud == 0) {
+		baud = this->baud;
+	}
+	uint32_t byteTimeUs = baud ? (10000000 + baud - 1) / baud : 0;
+	uint64_t busyUs = 0;
+	uint32_t lineFreeUs = 0;
+	for (const auto &send : sends) {
+		uint32_t startUs = std::max(send.first, lineFreeUs);
+		occupancy.maxQueueUs = std::max(occupancy.maxQueueUs, startUs - send.first);
+		busyUs += (uint64_t) send.second * byteTimeUs;
+		lineFreeUs = startUs + send.second * byteTimeUs;
+		occupancy.txBytes += send.second;
+	}
+	uint32_t durationUs = std::max(getDurationUs(), lineFreeUs);
+	occupancy.busyFraction = durationUs ? (double) busyUs / durationUs : 0;
+	return occupancy;
+}
+
+SB_TapOccupancy SB_TapReplay::occupancy(uint32_t baud) const {
+	std::vector<std::pair<uint32_t, uint32_t>> sends;
+	uint32_t start = bytes.empty() ? 0 : bytes.front().timeUs;
+	for (const SB_TapByte &b : bytes) {
+		if (b.direction == TAP_TX) {
+			sends.push_back({b.timeUs - start, 1});
+		}
+	}
+	SB_TapOccupancy result = place(sends, baud);
+	result.packets = packets.size();
+	return result;
+}
+
+SB_TapOccupancy SB_TapReplay::reencoded(bool pololu, bool crc, uint32_t batchUs, uint32_t baud) const {
+	uint32_t overhead = (pololu ? 3 : 1) + (crc ? 1 : 0);
+	std::vector<std::pair<uint32_t, uint32_t>> sends;
+	uint32_t conflated = 0;
+
+	std::map<uint8_t, uint16_t> batch; // channel to target, in channel order
+	uint32_t batchEndUs = 0;
+	auto sendBatch = [&]() {
+		// A command per run of neighbouring channels
+		auto run = batch.begin();
+		while (run != batch.end()) {
+			auto end = std::next(run);
+			uint32_t count = 1;
+			while (end != batch.end() && end->first == std::prev(end)->first + 1) {
+				++end;
+				count++;
+			}
+			sends.push_back({batchEndUs, overhead + (count == 1 ? 3 : 2 + 2 * count)});
+			run = end;
+		}
+		batch.clear();
+	};
+
+	for (const Packet &packet : packets) {
+		bool targets = packet.command == SET_TARGET || packet.command == SET_MULTI_TARGET;
+		if (batchUs == 0 || !targets) {
+			uint32_t length = packet.command == MINI_SSC_START ? 3 : overhead + packet.data.size();
+			sends.push_back({packet.timeUs, length});
+			continue;
+		}
+		if (!batch.empty() && (int32_t) (packet.timeUs - batchEndUs) >= 0) {
+			sendBatch();
+		}
+		if (batch.empty()) {
+			batchEndUs = packet.timeUs + batchUs;
+		}
+		uint8_t channel = packet.data[packet.command == SET_MULTI_TARGET ? 1 : 0];
+		size_t count = packet.command == SET_MULTI_TARGET ? packet.data[0] : 1;
+		size_t first = packet.command == SET_MULTI_TARGET ? 2 : 1;
+		for (size_t i = 0; i < count && first + 2 * i + 1 < packet.data.size(); i++) {
+			uint16_t target = packet.data[first + 2 * i] | (packet.data[first + 2 * i + 1] << 7);
+			conflated += batch.count(channel + i);
+			batch[channel + i] = target;
+		}
+	}
+	if (!batch.empty()) {
+		sendBatch();
+	}
+
+	std::stable_sort(sends.begin(), sends.end(),
+			[](const std::pair<uint32_t, uint32_t> &a, const std::pair<uint32_t, uint32_t> &b) { return a.first < b.first; });
+	SB_TapOccupancy result = place(sends, baud);
+	result.packets = sends.size();
+	result.conflatedTargets = conflated;
+	return result;
+}
@@ -0,0 +1,113 @@
+/**
+ * Replays a Maestro traffic log recorded by SB_StreamTap (in SB_Servo).
+ *
+ * replay() feeds the bytes the Teensy wrote to a SB_MaestroEmulator at the
+ * times it wrote them, paced at the emulator's baud, and checks the answers it
+ * gives against the bytes the Teensy read. An incident from the field plays out
+ * again on the desk, and the emulator's state afterwards (targets, error
+ * register, command stats) shows what the Maestro was told.
+ *
+ * The written bytes are also split into packets (compact, Pololu or Mini SSC,
+ * with or without CRC, told apart by the bytes themselves) so the same traffic
+ * can be costed under a different encoding: reencoded() works out how busy the
+ * transmit line would have been in compact or Pololu protocol, with or without
+ * CRC, and with targets batched over a window into setMultiTarget commands,
+ * the latest target for a channel in a window replacing earlier ones.
+ *
+ * Needs SB_Servo/src/SB_StreamTap.cpp for the log format.
+ */
+
+#ifndef SB_tap_replay
+#define SB_tap_replay
+
+#include "SB_MaestroEmulator.hpp"
+
+#include <SB_StreamTap.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define TAP_REPLAY_OPEN_ERROR_BIT 0x01   // the file couldn't be read
+#define TAP_REPLAY_FORMAT_ERROR_BIT 0x02 // not a SB_StreamTap log
+
+/**
+ * How replay() went
+ */
+struct SB_TapReplayResult {
+	uint32_t txBytes = 0;      // bytes the log wrote, all fed to the emulator
+	uint32_t rxBytes = 0;      // bytes the log read
+	uint32_t answeredBytes = 0; // bytes the emulator answered with
+	uint32_t matchedBytes = 0;  // answers agreeing with the log, byte for byte in order
+	long firstMismatch = -1;    // index among the read bytes of the first that didn't, -1 for none
+};
+
+/**
+ * How busy the transmit line was, or would have been
+ */
+struct SB_TapOccupancy {
+	uint32_t packets = 0;
+	uint64_t txBytes = 0;
+	uint32_t conflatedTargets = 0; // targets replaced by a later one in the same batch
+	double busyFraction = 0;       // of the log's duration
+	uint32_t maxQueueUs = 0;       // longest a packet waited for the line
+};
+
+class SB_TapReplay {
+	private:
+		struct Packet {
+			uint32_t timeUs; // of its first byte
+			uint8_t command; // compact command byte, 0xFF for Mini SSC
+			std::vector<uint8_t> data;
+			bool crc;
+		};
+
+		std::vector<SB_TapByte> bytes;
+		std::vector<Packet> packets;
+		uint32_t baud = 0;
+		int errorCode = 0;
+
+		void split();
+		SB_TapOccupancy place(const std::vector<std::pair<uint32_t, uint32_t>> &sends, uint32_t baud) const;
+
+	public:
+		/**
+		 * Replaces the contents with a log file, as written by SB_StreamTap::dump()
+		 * @sets TAP_REPLAY_OPEN_ERROR_BIT
+		 * @sets TAP_REPLAY_FORMAT_ERROR_BIT
+		 */
+		bool load(const char *path);
+		bool load(const uint8_t *log, size_t length);
+
+		/**
+		 * Plays the written bytes into the emulator, which should be set up like
+		 * the Maestro that was recorded (channels, device number, CRC, baud).
+		 * Times start from the first byte, at 0
+		 */
+		SB_TapReplayResult replay(SB_MaestroEmulator &emulator) const;
+
+		/**
+		 * The transmit line as recorded
+		 * @param baud -- 0 for the log's own
+		 */
+		SB_TapOccupancy occupancy(uint32_t baud = 0) const;
+
+		/**
+		 * The transmit line had the same commands gone out another way
+		 * @param pololu, crc -- the encoding
+		 * @param batchUs -- targets within this long of the first in a batch go
+		 * out together at its end, 0 sends each when it was sent
+		 * @param baud -- 0 for the log's own
+		 */
+		SB_TapOccupancy reencoded(bool pololu, bool crc, uint32_t batchUs, uint32_t baud = 0) const;
+
+		const std::vector<SB_TapByte> &getBytes() const { return bytes; }
+		size_t getPacketCount() const { return packets.size(); }
+		uint32_t getBaud() const { return baud; }
+		uint32_t getDurationUs() const { return bytes.empty() ? 0 : bytes.back().timeUs - bytes.front().timeUs; }
+
+		int getErrorCode() const { return errorCode; }
+		void clearErrorCode() { errorCode = 0; }
+};
+
+#endif
@@ -0,0 +1,118 @@
+/**
+ * The coroutine type for host-side async code.
+ *
+ * An SB_Task starts running as soon as it's called (it doesn't wait to be
+ * awaited) and runs until its first real suspension, so a caller can start
+ * hundreds of them and then drive an SB_EventLoop until they're all done().
+ * Another coroutine can co_await a task to get its result.
+ *
+ * The task owns the coroutine frame, destroying a task that hasn't finished
+ * destroys the frame (and with it whatever it was awaiting).
+ */
+
+#ifndef SB_task
+#define SB_task
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+template <class T>
+class SB_Task;
+
+template <class T>
+struct SB_TaskPromiseBase {
+	std::coroutine_handle<> continuation;
+	std::exception_ptr exception;
+
+	std::suspend_never initial_suspend() noexcept { return {}; }
+
+	struct FinalAwaiter {
+		bool await_ready() const noexcept { return false; }
+		template <class Promise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> self) noexcept {
+			std::coroutine_handle<> next = self.promise().continuation;
+			return next ? next : std::noop_coroutine();
+		}
+		void await_resume() const noexcept {}
+	};
+	FinalAwaiter final_suspend() noexcept { return {}; }
+
+	void unhandled_exception() { exception = std::current_exception(); }
+};
+
+template <class T>
+struct SB_TaskPromise : SB_TaskPromiseBase<T> {
+	std::optional<T> value;
+
+	SB_Task<T> get_return_object();
+	void return_value(T result) { value = std::move(result); }
+	T take() {
+		if (this->exception) {
+			std::rethrow_exception(this->exception);
+		}
+		return std::move(*value);
+	}
+};
+
+template <>
+struct SB_TaskPromise<void> : SB_TaskPromiseBase<void> {
+	SB_Task<void> get_return_object();
+	void return_void() {}
+	void take() {
+		if (exception) {
+			std::rethrow_exception(exception);
+		}
+	}
+};
+
+template <class T = void>
+class SB_Task {
+	public:
+		typedef SB_TaskPromise<T> promise_type;
+
+	private:
+		std::coroutine_handle<promise_type> coroutine;
+
+	public:
+		explicit SB_Task(std::coroutine_handle<promise_type> handle) : coroutine(handle) {}
+		SB_Task(SB_Task &&other) noexcept : coroutine(std::exchange(other.coroutine, nullptr)) {}
+		SB_Task &operator=(SB_Task &&other) noexcept {
+			if (this != &other) {
+				if (coroutine) {
+					coroutine.destroy();
+				}
+				coroutine = std::exchange(other.coroutine, nullptr);
+			}
+			return *this;
+		}
+		SB_Task(const SB_Task &) = delete;
+		~SB_Task() {
+			if (coroutine) {
+				coroutine.destroy();
+			}
+		}
+
+		bool done() const { return !coroutine || coroutine.done(); }
+
+		/**
+		 * The result of a finished task (rethrows if it ended with an exception)
+		 */
+		T result() { return coroutine.promise().take(); }
+
+		bool await_ready() const noexcept { return done(); }
+		void await_suspend(std::coroutine_handle<> awaiting) noexcept { coroutine.promise().continuation = awaiting; }
+		T await_resume() { return coroutine.promise().take(); }
+};
+
+template <class T>
+SB_Task<T> SB_TaskPromise<T>::get_return_object() {
+	return SB_Task<T>(std::coroutine_handle<SB_TaskPromise<T>>::from_promise(*this));
+}
+
+inline SB_Task<void> SB_TaskPromise<void>::get_return_object() {
+	return SB_Task<void>(std::coroutine_handle<SB_TaskPromise<void>>::from_promise(*this));
+}
+
+#endif
@@ -0,0 +1,289 @@
+/**
+ * Source file for SB_TermiosStream.hpp
+ */
+
+#include "SB_TermiosStream.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <termios.h>
+#include <unistd.h>
+
+SB_TermiosStream::SB_TermiosStream(const char *path) : devicePath(path) {}
+
+SB_TermiosStream::~SB_TermiosStream() {
+	end();
+}
+
+unsigned int SB_TermiosStream::baudToSpeed(unsigned long baud) {
+	switch (baud) {
+		case 1200: return B1200;
+		case 2400: return B2400;
+		case 4800: return B4800;
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 115200: return B115200;
+		case 230400: return B230400;
+		case 460800: return B460800;
+		case 500000: return B500000;
+		case 921600: return B921600;
+		case 1000000: return B1000000;
+		default: return 0;
+	}
+}
+
+bool SB_TermiosStream::begin(unsigned long baud) {
+	return begin(devicePath, baud);
+}
+
+bool SB_TermiosStream::begin(const char *path, unsigned long baud) {
+	end();
+	devicePath = path;
+
+	fd = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) {
+		errorCode |= TERMIOS_OPEN_ERROR_BIT;
+		return false;
+	}
+
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.fd = fd;
+	if (epollFd < 0 || epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+		errorCode |= TERMIOS_OPEN_ERROR_BIT;
+		end();
+		return false;
+	}
+
+	if (!setBaud(baud)) {
+		end();
+		return false;
+	}
+	return true;
+}
+
+bool SB_TermiosStream::setBaud(unsigned long baud) {
+	speed_t speed = baudToSpeed(baud);
+	if (speed == 0) {
+		errorCode |= TERMIOS_BAUD_ERROR_BIT;
+		return false;
+	}
+
+	flushTx();
+
+	struct termios settings;
+	if (tcgetattr(fd, &settings) < 0) {
+		errorCode |= TERMIOS_CONFIG_ERROR_BIT;
+		return false;
+	}
+	// 8N1, no flow control, no line discipline: the Maestro protocol is binary
+	cfmakeraw(&settings);
+	settings.c_cflag |= CLOCAL | CREAD;
+	settings.c_cflag &= ~(CSTOPB | CRTSCTS);
+	settings.c_cc[VMIN] = 0;
+	settings.c_cc[VTIME] = 0;
+	cfsetispeed(&settings, speed);
+	cfsetospeed(&settings, speed);
+	if (tcsetattr(fd, TCSANOW, &settings) < 0) {
+		errorCode |= TERMIOS_CONFIG_ERROR_BIT;
+		return false;
+	}
+	return true;
+}
+
+void SB_TermiosStream::end() {
+	if (fd >= 0) {
+		flushTx();
+		::close(fd);
+	}
+	if (epollFd >= 0) {
+		::close(epollFd);
+	}
+	fd = -1;
+	epollFd = -1;
+	rxHead = 0;
+	rxCount = 0;
+	txCount = 0;
+}
+
+bool SB_TermiosStream::waitFor(uint32_t events, int timeoutMs) {
+	struct epoll_event event = {};
+	event.events = events;
+	event.data.fd = fd;
+	if (epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event) < 0) {
+		return false;
+	}
+
+	struct epoll_event fired;
+	int ready;
+	do {
+		ready = epoll_wait(epollFd, &fired, 1, timeoutMs);
+	} while (ready < 0 && errno == EINTR);
+
+	// Leave the set watching for input, that's what getEpollFd() promises
+	if (events != EPOLLIN) {
+		event.events = EPOLLIN;
+		epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event);
+	}
+
+	if (ready > 0 && (fired.events & (EPOLLERR | EPOLLHUP)) && !(fired.events & events)) {
+		errorCode |= TERMIOS_IO_ERROR_BIT;
+		return false;
+	}
+	return ready > 0;
+}
+
+void SB_TermiosStream::flushTx() {
+	size_t sent = 0;
+	while (fd >= 0 && sent < txCount) {
+		ssize_t n = ::write(fd, txBuffer + sent, txCount - sent);
+		if (n > 0) {
+			sent += n;
+		} else if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0 && errno == EAGAIN) {
+			if (!waitFor(EPOLLOUT, writeTimeout)) {
+				errorCode |= TERMIOS_TX_TIMEOUT_BIT;
+				break;
+			}
+		} else {
+			errorCode |= TERMIOS_IO_ERROR_BIT;
+			break;
+		}
+	}
+	txCount = 0;
+}
+
+void SB_TermiosStream::sendTx() {
+	size_t sent = 0;
+	while (fd >= 0 && sent < txCount) {
+		ssize_t n = ::write(fd, txBuffer + sent, txCount - sent);
+		if (n > 0) {
+			sent += n;
+		} else if (n < 0 && errno == EINTR) {
+			continue;
+		} else {
+			if (n < 0 && errno != EAGAIN) {
+				errorCode |= TERMIOS_IO_ERROR_BIT;
+				sent = txCount;
+			}
+			break;
+		}
+	}
+	txCount -= sent;
+	memmove(txBuffer, txBuffer + sent, txCount);
+}
+
+void SB_TermiosStream::pumpRx() {
+	if (fd < 0) {
+		return;
+	}
+	// Anybody looking for input is waiting on an answer to what they just wrote
+	if (txCount > 0) {
+		flushTx();
+	}
+	while (rxCount < TERMIOS_RX_BUFFER_SIZE) {
+		// Read into the contiguous free space after the tail of the ring
+		size_t tail = (rxHead + rxCount) % TERMIOS_RX_BUFFER_SIZE;
+		size_t space = tail >= rxHead ? TERMIOS_RX_BUFFER_SIZE - tail
+			: rxHead - tail;
+		if (space > TERMIOS_RX_BUFFER_SIZE - rxCount) {
+			space = TERMIOS_RX_BUFFER_SIZE - rxCount;
+		}
+		ssize_t n = ::read(fd, rxBuffer + tail, space);
+		if (n > 0) {
+			rxCount += n;
+			if ((size_t) n < space) {
+				return;
+			}
+		} else if (n < 0 && errno == EINTR) {
+			continue;
+		} else {
+			if (n < 0 && errno != EAGAIN) {
+				errorCode |= TERMIOS_IO_ERROR_BIT;
+			}
+			return;
+		}
+	}
+}
+
+int SB_TermiosStream::available() {
+	if (rxCount == 0) {
+		pumpRx();
+	}
+	if (rxCount == 0) {
+		blocked.empty();
+	} else {
+		blocked.ready();
+	}
+	return rxCount;
+}
+
+int SB_TermiosStream::read() {
+	if (available() == 0) {
+		return -1;
+	}
+	uint8_t dataByte = rxBuffer[rxHead];
+	rxHead = (rxHead + 1) % TERMIOS_RX_BUFFER_SIZE;
+	rxCount--;
+	return dataByte;
+}
+
+int SB_TermiosStream::peek() {
+	if (available() == 0) {
+		return -1;
+	}
+	return rxBuffer[rxHead];
+}
+
+size_t SB_TermiosStream::write(uint8_t dataByte) {
+	if (fd < 0) {
+		return 0;
+	}
+	if (txCount == TERMIOS_TX_BUFFER_SIZE) {
+		flushTx();
+	}
+	txBuffer[txCount++] = dataByte;
+	sendTx();
+	return 1;
+}
+
+size_t SB_TermiosStream::write(const uint8_t *buffer, size_t size) {
+	if (fd < 0) {
+		return 0;
+	}
+	size_t copied = 0;
+	while (copied < size) {
+		if (txCount == TERMIOS_TX_BUFFER_SIZE) {
+			flushTx();
+		}
+		size_t chunk = TERMIOS_TX_BUFFER_SIZE - txCount;
+		if (chunk > size - copied) {
+			chunk = size - copied;
+		}
+		memcpy(txBuffer + txCount, buffer + copied, chunk);
+		txCount += chunk;
+		copied += chunk;
+	}
+	sendTx();
+	return size;
+}
+
+void SB_TermiosStream::flush() {
+	flushTx();
+}
+
+bool SB_TermiosStream::waitReadable(int timeoutMs) {
+	if (available() > 0) {
+		return true;
+	}
+	if (fd < 0 || !waitFor(EPOLLIN, timeoutMs)) {
+		return false;
+	}
+	return available() > 0;
+}
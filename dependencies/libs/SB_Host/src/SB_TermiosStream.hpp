@@ -0,0 +1,163 @@
+/**
+ * A Stream that talks to a Linux serial device (or pseudo-terminal) through termios.
+ *
+ * This is what lets the unchanged Maestro/SB_Servo code drive a Maestro from the
+ * companion computer: hand one of these to a MiniMaestro instead of Serial1.
+ *
+ * The file descriptor is opened non-blocking and in raw mode. Reads go through a
+ * small receive ring so available() is cheap to spin on (which is exactly what
+ * Maestro::getPosition() does). Every write() hands its bytes to the kernel
+ * before returning without waiting on it; whatever the kernel won't take yet
+ * stays in a transmit buffer and goes out with the next write(), flush(), or
+ * as soon as somebody looks for a response with available()/read()/peek().
+ * Only a full transmit buffer or flush() wait on the port. Readiness is
+ * tracked with epoll so callers that don't want to spin can use waitReadable().
+ *
+ * Waits on an empty port (spinning on available() or in waitReadable()) are
+ * recorded as blocked reads on the current SB_Trace.
+ *
+ * Like SB_Servo, failures don't throw, they set bits in an error code.
+ */
+
+#ifndef SB_termios_stream
+#define SB_termios_stream
+
+#include "Stream.h"
+#include "SB_Trace.hpp"
+
+#define TERMIOS_OPEN_ERROR_BIT 0x01   // open() or epoll setup failed
+#define TERMIOS_BAUD_ERROR_BIT 0x02   // the requested baud has no termios speed constant
+#define TERMIOS_CONFIG_ERROR_BIT 0x04 // tcgetattr()/tcsetattr() failed
+#define TERMIOS_IO_ERROR_BIT 0x08     // read() or write() failed, or the other end hung up
+#define TERMIOS_TX_TIMEOUT_BIT 0x10   // the kernel wouldn't take our bytes before the write timeout
+
+#define TERMIOS_RX_BUFFER_SIZE 256
+#define TERMIOS_TX_BUFFER_SIZE 256
+
+class SB_TermiosStream : public Stream {
+	private:
+		const char *devicePath;
+		int fd = -1;
+		int epollFd = -1;
+		int errorCode = 0;
+
+		// How long a write will wait on a full kernel queue before giving up, milliseconds
+		int writeTimeout = 1000;
+
+		uint8_t rxBuffer[TERMIOS_RX_BUFFER_SIZE];
+		size_t rxHead = 0; // next byte handed out by read()
+		size_t rxCount = 0;
+
+		uint8_t txBuffer[TERMIOS_TX_BUFFER_SIZE];
+		size_t txCount = 0;
+
+		SB_TraceBlockedRead blocked;
+
+		/**
+		 * Pushes everything sitting in the transmit buffer to the kernel,
+		 * waiting on EPOLLOUT if the kernel queue is full
+		 * @sets TERMIOS_IO_ERROR_BIT
+		 * @sets TERMIOS_TX_TIMEOUT_BIT
+		 */
+		void flushTx();
+
+		/**
+		 * Hands the kernel as much of the transmit buffer as it takes right now,
+		 * what's left moves to the front of the buffer
+		 * @sets TERMIOS_IO_ERROR_BIT
+		 */
+		void sendTx();
+
+		/**
+		 * Moves whatever the kernel has for us into the receive ring without blocking
+		 * @sets TERMIOS_IO_ERROR_BIT
+		 */
+		void pumpRx();
+
+		/**
+		 * Waits on the epoll set for the given events
+		 * @return true if one of the events fired before the timeout
+		 */
+		bool waitFor(uint32_t events, int timeoutMs);
+
+	public:
+		/**
+		 * @param path -- the device to open on begin(), e.g. /dev/ttyACM0 for a
+		 * Maestro's command port, or the slave side of a pty. The string is not copied.
+		 */
+		explicit SB_TermiosStream(const char *path);
+		~SB_TermiosStream();
+
+		/**
+		 * Opens the device at the path given to the constructor.
+		 * Mirrors HardwareSerial::begin() so sketches can call Serial1.begin(9600) unchanged
+		 *
+		 * @param baud -- the baud rate, must be one of the standard termios rates
+		 * @return whether the port is open and configured
+		 * @sets TERMIOS_OPEN_ERROR_BIT
+		 * @sets TERMIOS_BAUD_ERROR_BIT
+		 * @sets TERMIOS_CONFIG_ERROR_BIT
+		 */
+		bool begin(unsigned long baud);
+
+		/**
+		 * Same as begin() but for a different device than the one given to the constructor
+		 */
+		bool begin(const char *path, unsigned long baud);
+
+		/**
+		 * Changes the baud rate of an already open port, pending output is sent first
+		 * @sets TERMIOS_BAUD_ERROR_BIT
+		 * @sets TERMIOS_CONFIG_ERROR_BIT
+		 */
+		bool setBaud(unsigned long baud);
+
+		/**
+		 * Sends anything still buffered and closes the port
+		 */
+		void end();
+
+		bool isOpen() const { return fd >= 0; }
+
+		int available() override;
+		int read() override;
+		int peek() override;
+
+		size_t write(uint8_t dataByte) override;
+		size_t write(const uint8_t *buffer, size_t size) override;
+		using Print::write;
+
+		/**
+		 * Hands all buffered output to the kernel. Unlike the Teensy this doesn't
+		 * wait for the bytes to physically leave the UART
+		 */
+		void flush() override;
+
+		/**
+		 * Blocks until at least one byte can be read or the timeout expires,
+		 * sending any buffered output first so the other side has something to answer
+		 *
+		 * @param timeoutMs -- milliseconds to wait, -1 waits forever
+		 * @return true if there is data to read
+		 */
+		bool waitReadable(int timeoutMs);
+
+		/**
+		 * The epoll descriptor that signals readability of this port, for callers
+		 * that want to fold the port into their own event loop. -1 if not open
+		 */
+		int getEpollFd() const { return epollFd; }
+		int getFd() const { return fd; }
+
+		void setWriteTimeout(int timeoutMs) { writeTimeout = timeoutMs; }
+
+		int getErrorCode() const { return errorCode; }
+		void clearErrorCode() { errorCode = 0; }
+
+		/**
+		 * @return the termios speed constant for a baud rate, or 0 if there isn't one
+		 */
+		static unsigned int baudToSpeed(unsigned long baud);
+};
+
+#endif
@@ -0,0 +1,251 @@
+/**
+ * Source file for SB_Trace.hpp
+ */
+
+#include "SB_Trace.hpp"
+#include "Arduino.h"
+
+#include <chrono>
+#include <cstring>
+
+// "SBTRACE" and a format version
+static const char traceMagic[8] = {'S', 'B', 'T', 'R', 'A', 'C', 'E', 1};
+
+thread_local SB_Trace *SB_Trace::currentTrace = nullptr;
+
+static uint64_t hostNs() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+SB_Trace::~SB_Trace() {
+	if (currentTrace == this) {
+		currentTrace = nullptr;
+	}
+}
+
+uint16_t SB_Trace::intern(const char *name) {
+	auto found = nameIndex.find(name);
+	if (found != nameIndex.end()) {
+		return found->second;
+	}
+	uint16_t index = names.size();
+	names.push_back(name);
+	nameIndex[name] = index;
+	return index;
+}
+
+void SB_Trace::record(uint64_t timeNs, uint32_t durationNs, const char *name,
+		SB_TraceTrack track, uint8_t phase, int32_t value) {
+	if (events.size() >= capacity) {
+		dropped++;
+		errorCode |= TRACE_FULL_ERROR_BIT;
+		return;
+	}
+	events.push_back({timeNs, durationNs, intern(name), track, phase, value, 0});
+}
+
+uint64_t SB_Trace::now() {
+	uint32_t us = micros();
+	uint64_t host = hostNs();
+	if (!clockStarted || us != lastMicros) {
+		// Widen the 32-bit micros() so traces longer than ~71 minutes stay ordered
+		extendedMicros += clockStarted ? (uint32_t) (us - lastMicros) : us;
+		lastMicros = us;
+		microStartNs = host;
+		clockStarted = true;
+	}
+	uint64_t offsetNs = host - microStartNs;
+	if (offsetNs > 999) {
+		offsetNs = 999;
+	}
+	return extendedMicros * 1000 + offsetNs;
+}
+
+void SB_Trace::endSpan(uint64_t startNs, SB_TraceTrack track, const char *name, int32_t value) {
+	uint64_t endNs = now();
+	record(startNs, endNs > startNs ? endNs - startNs : 0, name, track, 'X', value);
+}
+
+void SB_Trace::span(SB_TraceTrack track, const char *name, uint64_t startUs, uint32_t durationUs, int32_t value) {
+	record(startUs * 1000, durationUs * 1000, name, track, 'X', value);
+}
+
+void SB_Trace::instant(SB_TraceTrack track, const char *name, int32_t value) {
+	record(now(), 0, name, track, 'i', value);
+}
+
+void SB_Trace::counter(const char *name, uint64_t timeUs, int32_t value) {
+	record(timeUs * 1000, 0, name, TRACE_TRACK_MAESTRO, 'C', value);
+}
+
+void SB_Trace::clear() {
+	events.clear();
+	dropped = 0;
+	errorCode &= ~TRACE_FULL_ERROR_BIT;
+}
+
+const char *SB_Trace::trackName(uint8_t track) {
+	switch (track) {
+		case TRACE_TRACK_ISR: return "ISR";
+		case TRACE_TRACK_TASK: return "tasks";
+		case TRACE_TRACK_ENCODE: return "encode";
+		case TRACE_TRACK_UART_TX: return "UART tx";
+		case TRACE_TRACK_UART_RX: return "UART rx";
+		case TRACE_TRACK_BLOCKED: return "blocked";
+		case TRACE_TRACK_MAESTRO: return "Maestro";
+		default: return "unknown";
+	}
+}
+
+/**
+ * Names are ours (string literals, channel labels) but escape anyway
+ */
+static void writeJsonString(FILE *out, const char *text) {
+	fputc('"', out);
+	for (; *text; text++) {
+		unsigned char c = *text;
+		if (c == '"' || c == '\\') {
+			fputc('\\', out);
+			fputc(c, out);
+		} else if (c < 0x20) {
+			fprintf(out, "\\u%04x", c);
+		} else {
+			fputc(c, out);
+		}
+	}
+	fputc('"', out);
+}
+
+bool SB_Trace::writeJson(FILE *out) {
+	fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	fprintf(out, "{\"ph\":\"M\",\"pid\":1,\"name\":\"process_name\",\"args\":{\"name\":\"SB_Host\"}}");
+	for (uint8_t track = TRACE_TRACK_ISR; track < TRACE_TRACK_COUNT; track++) {
+		fprintf(out, ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"name\":\"thread_name\",\"args\":{\"name\":\"%s\"}}",
+				track, trackName(track));
+		fprintf(out, ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"name\":\"thread_sort_index\",\"args\":{\"sort_index\":%u}}",
+				track, track);
+	}
+
+	for (const SB_TraceEvent &event : events) {
+		// Chrome wants microseconds, the fraction keeps the nanoseconds
+		fprintf(out, ",\n{\"ph\":\"%c\",\"pid\":1,\"tid\":%u,\"ts\":%llu.%03u,\"name\":",
+				event.phase, event.track, (unsigned long long) (event.timeNs / 1000),
+				(unsigned) (event.timeNs % 1000));
+		writeJsonString(out, names[event.name]);
+		switch (event.phase) {
+			case 'X':
+				fprintf(out, ",\"dur\":%u.%03u,\"args\":{\"value\":%d}}",
+						event.durationNs / 1000, event.durationNs % 1000, event.value);
+				break;
+			case 'C':
+				fprintf(out, ",\"args\":{\"value\":%d}}", event.value);
+				break;
+			default:
+				fprintf(out, ",\"s\":\"t\",\"args\":{\"value\":%d}}", event.value);
+				break;
+		}
+	}
+	fprintf(out, "\n]}\n");
+
+	if (ferror(out)) {
+		errorCode |= TRACE_WRITE_ERROR_BIT;
+		return false;
+	}
+	return true;
+}
+
+bool SB_Trace::writeJson(const char *path) {
+	FILE *out = fopen(path, "w");
+	if (!out) {
+		errorCode |= TRACE_WRITE_ERROR_BIT;
+		return false;
+	}
+	bool written = writeJson(out);
+	if (fclose(out) != 0) {
+		errorCode |= TRACE_WRITE_ERROR_BIT;
+		written = false;
+	}
+	return written;
+}
+
+bool SB_Trace::writeBinary(FILE *out) {
+	uint32_t nameCount = names.size();
+	uint64_t eventCount = events.size();
+	fwrite(traceMagic, 1, sizeof(traceMagic), out);
+	fwrite(&nameCount, sizeof(nameCount), 1, out);
+	for (const char *name : names) {
+		uint16_t length = strlen(name);
+		fwrite(&length, sizeof(length), 1, out);
+		fwrite(name, 1, length, out);
+	}
+	fwrite(&eventCount, sizeof(eventCount), 1, out);
+	fwrite(events.data(), sizeof(SB_TraceEvent), events.size(), out);
+
+	if (ferror(out)) {
+		errorCode |= TRACE_WRITE_ERROR_BIT;
+		return false;
+	}
+	return true;
+}
+
+bool SB_Trace::writeBinary(const char *path) {
+	FILE *out = fopen(path, "wb");
+	if (!out) {
+		errorCode |= TRACE_WRITE_ERROR_BIT;
+		return false;
+	}
+	bool written = writeBinary(out);
+	if (fclose(out) != 0) {
+		errorCode |= TRACE_WRITE_ERROR_BIT;
+		written = false;
+	}
+	return written;
+}
+
+bool SB_Trace::load(FILE *in) {
+	events.clear();
+	names.clear();
+	nameIndex.clear();
+	loadedNames.clear();
+	dropped = 0;
+
+	char magic[sizeof(traceMagic)];
+	uint32_t nameCount;
+	if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) || memcmp(magic, traceMagic, sizeof(magic)) != 0 ||
+			fread(&nameCount, sizeof(nameCount), 1, in) != 1 || nameCount > 0xFFFF) {
+		errorCode |= TRACE_FORMAT_ERROR_BIT;
+		return false;
+	}
+
+	loadedNames.resize(nameCount);
+	for (uint32_t i = 0; i < nameCount; i++) {
+		uint16_t length;
+		if (fread(&length, sizeof(length), 1, in) != 1) {
+			errorCode |= TRACE_FORMAT_ERROR_BIT;
+			return false;
+		}
+		loadedNames[i].resize(length + 1);
+		if (fread(loadedNames[i].data(), 1, length, in) != length) {
+			errorCode |= TRACE_FORMAT_ERROR_BIT;
+			return false;
+		}
+		loadedNames[i][length] = '\0';
+		names.push_back(loadedNames[i].data());
+	}
+
+	uint64_t eventCount;
+	if (fread(&eventCount, sizeof(eventCount), 1, in) != 1) {
+		errorCode |= TRACE_FORMAT_ERROR_BIT;
+		return false;
+	}
+	SB_TraceEvent event;
+	for (uint64_t i = 0; i < eventCount; i++) {
+		if (fread(&event, sizeof(event), 1, in) != 1 || event.name >= nameCount) {
+			errorCode |= TRACE_FORMAT_ERROR_BIT;
+			return false;
+		}
+		events.push_back(event);
+	}
+	return true;
+}
@@ -0,0 +1,220 @@
+/**
+ * A trace recorder for the host runtime, exported as Chrome trace-event JSON
+ * (chrome://tracing, ui.perfetto.dev) or as a compact binary file that
+ * tools/traceToJson converts later.
+ *
+ * Recording is per thread: make a SB_Trace current with setCurrent() and the
+ * instrumented pieces of SB_Host pick it up, with no trace current they do
+ * nothing. What gets recorded, one timeline row (track) each:
+ *
+ * 		ISR       -- interrupt handlers fired by SB_Simulation pin edges
+ * 		tasks     -- SB_Simulation scheduler tasks
+ * 		encode    -- BasicMaestro packet encoding, when built with -DSB_MAESTRO_TRACE
+ * 		UART tx   -- every byte the emulated Maestro receives, for its wire time
+ * 		UART rx   -- every response byte the emulated Maestro sends
+ * 		blocked   -- time spent waiting on a stream that had nothing to read
+ * 		Maestro   -- emulated command service (first byte to done), and the
+ * 		             channel positions as counters on every frame
+ *
+ * Timestamps are nanoseconds on the micros() clock, which is virtual time under a
+ * SB_Simulation. Virtual time stands still while code runs, so spans of code
+ * (ISRs, tasks, encoding) start at the current microsecond plus however long
+ * the host has been working since that microsecond began, and last as long as
+ * the host took to run them. Sequential code within one simulated microsecond
+ * is then laid out in order instead of piling up on one point. Wire and wait
+ * spans are in plain virtual time.
+ *
+ * Names are stored by pointer and must outlive the trace, string literals are
+ * the norm. Like everything else in SB_Host, failures set bits in an error code.
+ */
+
+#ifndef SB_trace
+#define SB_trace
+
+#include <cstdint>
+#include <cstdio>
+#include <unordered_map>
+#include <vector>
+
+#define TRACE_WRITE_ERROR_BIT 0x01  // writing the JSON or binary file failed
+#define TRACE_FORMAT_ERROR_BIT 0x02 // load() was handed something that isn't a trace file
+#define TRACE_FULL_ERROR_BIT 0x04   // the event capacity was reached and events were dropped
+
+#define TRACE_DEFAULT_CAPACITY (1u << 20)
+
+enum SB_TraceTrack : uint8_t {
+	TRACE_TRACK_ISR = 1,
+	TRACE_TRACK_TASK,
+	TRACE_TRACK_ENCODE,
+	TRACE_TRACK_UART_TX,
+	TRACE_TRACK_UART_RX,
+	TRACE_TRACK_BLOCKED,
+	TRACE_TRACK_MAESTRO,
+	TRACE_TRACK_COUNT
+};
+
+/**
+ * One recorded event, this is also the record layout of the binary file
+ */
+struct SB_TraceEvent {
+	uint64_t timeNs;
+	uint32_t durationNs;
+	uint16_t name;    // index into the name table
+	uint8_t track;    // SB_TraceTrack
+	uint8_t phase;    // 'X' span, 'i' instant, 'C' counter
+	int32_t value;    // span/instant argument, or the counter value
+	uint32_t reserved;
+};
+
+class SB_Trace {
+	private:
+		static thread_local SB_Trace *currentTrace;
+
+		std::vector<SB_TraceEvent> events;
+		size_t capacity = TRACE_DEFAULT_CAPACITY;
+		uint32_t dropped = 0;
+		int errorCode = 0;
+
+		// Names as recorded (by pointer), and as loaded from a file
+		std::unordered_map<const char *, uint16_t> nameIndex;
+		std::vector<const char *> names;
+		std::vector<std::vector<char>> loadedNames;
+
+		// Sub-microsecond layout of code spans, see the top of the file
+		uint32_t lastMicros = 0;
+		uint64_t extendedMicros = 0;
+		uint64_t microStartNs = 0;
+		bool clockStarted = false;
+
+		uint16_t intern(const char *name);
+		void record(uint64_t timeNs, uint32_t durationNs, const char *name,
+				SB_TraceTrack track, uint8_t phase, int32_t value);
+
+	public:
+		SB_Trace() {}
+		~SB_Trace();
+		SB_Trace(const SB_Trace &) = delete;
+		SB_Trace &operator=(const SB_Trace &) = delete;
+
+		/**
+		 * The trace the instrumentation on this thread records into, nullptr for none
+		 */
+		static SB_Trace *current() { return currentTrace; }
+		static void setCurrent(SB_Trace *trace) { currentTrace = trace; }
+
+		/**
+		 * Stops recording (and sets TRACE_FULL_ERROR_BIT) after this many events
+		 */
+		void setCapacity(size_t maxEvents) { capacity = maxEvents; }
+
+		/**
+		 * Now on the trace clock, in nanoseconds
+		 */
+		uint64_t now();
+
+		/**
+		 * Records a span from startNs to now(), what SB_TraceScope uses
+		 */
+		void endSpan(uint64_t startNs, SB_TraceTrack track, const char *name, int32_t value = 0);
+
+		/**
+		 * Records a span with explicit microsecond times, for wire and wait times
+		 */
+		void span(SB_TraceTrack track, const char *name, uint64_t startUs, uint32_t durationUs, int32_t value = 0);
+
+		void instant(SB_TraceTrack track, const char *name, int32_t value = 0);
+
+		/**
+		 * Records a counter sample, each name is its own graph
+		 */
+		void counter(const char *name, uint64_t timeUs, int32_t value);
+
+		void clear();
+
+		size_t size() const { return events.size(); }
+		const SB_TraceEvent &event(size_t index) const { return events[index]; }
+		const char *name(uint16_t index) const { return names[index]; }
+		uint32_t getDropped() const { return dropped; }
+
+		/**
+		 * Writes Chrome trace-event JSON
+		 * @sets TRACE_WRITE_ERROR_BIT
+		 */
+		bool writeJson(FILE *out);
+		bool writeJson(const char *path);
+
+		/**
+		 * Writes the compact binary form: a header, the name table and the
+		 * SB_TraceEvent records as they are in memory (little endian hosts only)
+		 * @sets TRACE_WRITE_ERROR_BIT
+		 */
+		bool writeBinary(FILE *out);
+		bool writeBinary(const char *path);
+
+		/**
+		 * Replaces the contents of this trace with a binary trace file
+		 * @sets TRACE_FORMAT_ERROR_BIT
+		 */
+		bool load(FILE *in);
+
+		static const char *trackName(uint8_t track);
+
+		int getErrorCode() const { return errorCode; }
+		void clearErrorCode() { errorCode = 0; }
+};
+
+/**
+ * Records a span on the current trace covering the lifetime of the scope
+ */
+class SB_TraceScope {
+	private:
+		SB_Trace *trace;
+		uint64_t startNs = 0;
+		SB_TraceTrack track;
+		const char *name;
+		int32_t value;
+
+	public:
+		SB_TraceScope(SB_TraceTrack spanTrack, const char *spanName, int32_t spanValue = 0) :
+				trace(SB_Trace::current()), track(spanTrack), name(spanName), value(spanValue) {
+			if (trace) {
+				startNs = trace->now();
+			}
+		}
+		~SB_TraceScope() {
+			if (trace) {
+				trace->endSpan(startNs, track, name, value);
+			}
+		}
+		SB_TraceScope(const SB_TraceScope &) = delete;
+		SB_TraceScope &operator=(const SB_TraceScope &) = delete;
+};
+
+/**
+ * Turns a stream's fruitless available()/read() polls into one "blocked read"
+ * span, from the first poll that came up empty to the one that found data
+ */
+class SB_TraceBlockedRead {
+	private:
+		uint64_t sinceNs = 0;
+		bool waiting = false;
+
+	public:
+		void empty() {
+			SB_Trace *trace = SB_Trace::current();
+			if (trace && !waiting) {
+				sinceNs = trace->now();
+				waiting = true;
+			}
+		}
+		void ready() {
+			if (waiting) {
+				waiting = false;
+				if (SB_Trace *trace = SB_Trace::current()) {
+					trace->endSpan(sinceNs, TRACE_TRACK_BLOCKED, "blocked read");
+				}
+			}
+		}
+};
+
+#endif
@@ -0,0 +1,112 @@
+/**
+ * Source file for SB_WorkStealingPool.hpp
+ */
+
+#include "SB_WorkStealingPool.hpp"
+
+thread_local const SB_WorkStealingPool *SB_WorkStealingPool::currentPool = nullptr;
+thread_local int SB_WorkStealingPool::currentWorker = -1;
+
+SB_WorkStealingPool::SB_WorkStealingPool(unsigned threads) {
+	if (threads == 0) {
+		threads = std::thread::hardware_concurrency();
+	}
+	if (threads == 0) {
+		threads = 1;
+	}
+	for (unsigned i = 0; i < threads; i++) {
+		workers.emplace_back(new Worker);
+	}
+	// Started only once every deque exists, workers steal from all of them
+	for (unsigned i = 0; i < threads; i++) {
+		workers[i]->thread = std::thread([this, i]() { run(i); });
+	}
+}
+
+SB_WorkStealingPool::~SB_WorkStealingPool() {
+	wait();
+	{
+		std::lock_guard<std::mutex> guard(idleLock);
+		stopping = true;
+	}
+	workAvailable.notify_all();
+	for (auto &worker : workers) {
+		worker->thread.join();
+	}
+}
+
+void SB_WorkStealingPool::submit(Job job) {
+	// A job on one of our workers queues on its own deque, anybody else's round robin
+	unsigned index = currentPool == this ? currentWorker
+		: nextWorker.fetch_add(1, std::memory_order_relaxed) % workers.size();
+	{
+		std::lock_guard<std::mutex> guard(workers[index]->lock);
+		workers[index]->jobs.push_back(std::move(job));
+	}
+	{
+		std::lock_guard<std::mutex> guard(idleLock);
+		queued++;
+		unfinished++;
+	}
+	workAvailable.notify_one();
+}
+
+bool SB_WorkStealingPool::take(int index, Job &job) {
+	Worker &own = *workers[index];
+	{
+		std::lock_guard<std::mutex> guard(own.lock);
+		if (!own.jobs.empty()) {
+			job = std::move(own.jobs.back());
+			own.jobs.pop_back();
+			return true;
+		}
+	}
+	// Steal the oldest job, starting with the next worker over so the
+	// thieves spread out
+	for (size_t offset = 1; offset < workers.size(); offset++) {
+		Worker &victim = *workers[(index + offset) % workers.size()];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (!victim.jobs.empty()) {
+			job = std::move(victim.jobs.front());
+			victim.jobs.pop_front();
+			own.stolen++;
+			return true;
+		}
+	}
+	return false;
+}
+
+void SB_WorkStealingPool::run(int index) {
+	currentPool = this;
+	currentWorker = index;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> guard(idleLock);
+			workAvailable.wait(guard, [this]() { return queued > 0 || stopping; });
+			if (queued == 0 && stopping) {
+				return;
+			}
+			// Claimed before it's taken, so other idle workers don't all wake for one job
+			queued--;
+		}
+
+		// Jobs are pushed before they're counted, so there's always one in
+		// some deque for every claim
+		Job job;
+		while (!take(index, job)) {
+			std::this_thread::yield();
+		}
+		job();
+		workers[index]->executed++;
+
+		std::lock_guard<std::mutex> guard(idleLock);
+		if (--unfinished == 0) {
+			allDone.notify_all();
+		}
+	}
+}
+
+void SB_WorkStealingPool::wait() {
+	std::unique_lock<std::mutex> guard(idleLock);
+	allDone.wait(guard, [this]() { return unfinished == 0; });
+}
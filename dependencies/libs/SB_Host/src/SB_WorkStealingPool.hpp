@@ -0,0 +1,87 @@
+/**
+ * A fixed set of worker threads with one job deque each.
+ *
+ * submit() deals jobs round robin onto the workers' deques (a job submitted
+ * from inside a worker goes on that worker's own deque). A worker takes its
+ * newest job first, and when its own deque is empty it steals the oldest job
+ * of another worker, so long and short jobs even out across the cores without
+ * one shared queue everybody fights over.
+ *
+ * Each deque has its own mutex. Jobs here are whole simulations, milliseconds
+ * to seconds long, so the lock is never the bottleneck and a lock-free deque
+ * wouldn't buy anything.
+ */
+
+#ifndef SB_work_stealing_pool
+#define SB_work_stealing_pool
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class SB_WorkStealingPool {
+	public:
+		typedef std::function<void()> Job;
+
+	private:
+		struct Worker {
+			std::mutex lock;
+			std::deque<Job> jobs;
+			std::thread thread;
+			uint64_t executed = 0;
+			uint64_t stolen = 0;
+		};
+
+		// The worker this thread is, and whose: an index only means something to its own pool
+		static thread_local const SB_WorkStealingPool *currentPool;
+		static thread_local int currentWorker;
+
+		std::vector<std::unique_ptr<Worker>> workers;
+		std::atomic<unsigned> nextWorker{0};
+
+		std::mutex idleLock;
+		std::condition_variable workAvailable;
+		std::condition_variable allDone;
+		size_t queued = 0;     // jobs sitting in deques, guarded by idleLock
+		size_t unfinished = 0; // submitted and not finished yet, guarded by idleLock
+		bool stopping = false;
+
+		void run(int index);
+		bool take(int index, Job &job);
+
+	public:
+		/**
+		 * @param threads -- how many workers, 0 for one per hardware thread
+		 */
+		explicit SB_WorkStealingPool(unsigned threads = 0);
+
+		/**
+		 * Finishes every submitted job, then joins the workers
+		 */
+		~SB_WorkStealingPool();
+		SB_WorkStealingPool(const SB_WorkStealingPool &) = delete;
+		SB_WorkStealingPool &operator=(const SB_WorkStealingPool &) = delete;
+
+		void submit(Job job);
+
+		/**
+		 * Blocks until every job submitted so far has finished
+		 */
+		void wait();
+
+		unsigned getThreadCount() const { return workers.size(); }
+
+		/**
+		 * Per worker counts, only stable after wait()
+		 */
+		uint64_t getExecuted(unsigned worker) const { return workers[worker]->executed; }
+		uint64_t getStolen(unsigned worker) const { return workers[worker]->stolen; }
+};
+
+#endif
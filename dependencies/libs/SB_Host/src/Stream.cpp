@@ -0,0 +1,101 @@
+/**
+ * Source file for the host Stream stand-in, the timed helpers follow the Arduino core
+ */
+
+#include "Stream.h"
+#include "Arduino.h"
+
+int Stream::timedRead() {
+	unsigned long start = millis();
+	do {
+		int c = read();
+		if (c >= 0) {
+			return c;
+		}
+	} while (millis() - start < _timeout);
+	return -1;
+}
+
+int Stream::timedPeek() {
+	unsigned long start = millis();
+	do {
+		int c = peek();
+		if (c >= 0) {
+			return c;
+		}
+	} while (millis() - start < _timeout);
+	return -1;
+}
+
+// Skips anything that can't start a number, returns -1 on timeout
+int Stream::peekNextDigit() {
+	while (true) {
+		int c = timedPeek();
+		if (c < 0 || c == '-' || (c >= '0' && c <= '9')) {
+			return c;
+		}
+		read();
+	}
+}
+
+size_t Stream::readBytes(char *buffer, size_t length) {
+	size_t count = 0;
+	while (count < length) {
+		int c = timedRead();
+		if (c < 0) {
+			break;
+		}
+		buffer[count++] = (char) c;
+	}
+	return count;
+}
+
+long Stream::parseInt() {
+	bool negative = false;
+	long value = 0;
+
+	int c = peekNextDigit();
+	if (c < 0) {
+		return 0; // zero on timeout, same as the Arduino core
+	}
+	do {
+		if (c == '-') {
+			negative = true;
+		} else if (c >= '0' && c <= '9') {
+			value = value * 10 + c - '0';
+		}
+		read();
+		c = timedPeek();
+	} while ((c >= '0' && c <= '9'));
+
+	return negative ? -value : value;
+}
+
+float Stream::parseFloat() {
+	bool negative = false;
+	bool fraction = false;
+	float value = 0;
+	float scale = 1;
+
+	int c = peekNextDigit();
+	if (c < 0) {
+		return 0;
+	}
+	do {
+		if (c == '-') {
+			negative = true;
+		} else if (c == '.') {
+			fraction = true;
+		} else if (c >= '0' && c <= '9') {
+			value = value * 10 + c - '0';
+			if (fraction) {
+				scale *= 0.1f;
+			}
+		}
+		read();
+		c = timedPeek();
+	} while ((c >= '0' && c <= '9') || (c == '.' && !fraction));
+
+	value *= scale;
+	return negative ? -value : value;
+}
@@ -0,0 +1,33 @@
+/**
+ * Host (Linux) stand-in for the Arduino Stream class.
+ *
+ * The PololuMaestro library only needs available(), read() and write() from its
+ * stream, the timed helpers are here so the example sketches (which lean on
+ * Serial.parseInt()) build unchanged as well.
+ */
+
+#pragma once
+
+#include "Print.h"
+
+class Stream : public Print {
+	protected:
+		unsigned long _timeout = 1000; // milliseconds, same default as the Arduino core
+
+		int timedRead();
+		int timedPeek();
+		int peekNextDigit();
+
+	public:
+		virtual int available() = 0;
+		virtual int read() = 0;
+		virtual int peek() = 0;
+
+		void setTimeout(unsigned long timeout) { _timeout = timeout; }
+		unsigned long getTimeout() const { return _timeout; }
+
+		size_t readBytes(char *buffer, size_t length);
+		size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *) buffer, length); }
+		long parseInt();
+		float parseFloat();
+};
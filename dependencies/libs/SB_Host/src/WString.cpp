@@ -0,0 +1,15 @@
+/**
+ * Source file for the host String stand-in
+ */
+
+#include "WString.h"
+
+#include <cstdio>
+
+String::String(float value, unsigned char decimalPlaces) : String((double) value, decimalPlaces) {}
+
+String::String(double value, unsigned char decimalPlaces) {
+	char formatted[64];
+	snprintf(formatted, sizeof(formatted), "%.*f", decimalPlaces, value);
+	buffer = formatted;
+}
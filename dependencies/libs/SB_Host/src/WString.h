@@ -0,0 +1,36 @@
+/**
+ * Host (Linux) stand-in for the Arduino String class.
+ *
+ * Only the parts of String that the SailBot libraries actually touch are here,
+ * it's a thin wrapper around std::string so SB_Servo's debug printing compiles
+ * unchanged on a companion computer.
+ */
+
+#pragma once
+
+#include <string>
+
+class String {
+	private:
+		std::string buffer;
+
+	public:
+		String() {}
+		String(const char *str) : buffer(str ? str : "") {}
+		String(const std::string &str) : buffer(str) {}
+		String(char c) : buffer(1, c) {}
+		String(int value) : buffer(std::to_string(value)) {}
+		String(unsigned int value) : buffer(std::to_string(value)) {}
+		String(long value) : buffer(std::to_string(value)) {}
+		String(unsigned long value) : buffer(std::to_string(value)) {}
+		String(float value, unsigned char decimalPlaces = 2);
+		String(double value, unsigned char decimalPlaces = 2);
+
+		const char *c_str() const { return buffer.c_str(); }
+		unsigned int length() const { return buffer.length(); }
+
+		String &operator+=(const String &rhs) { buffer += rhs.buffer; return *this; }
+		friend String operator+(String lhs, const String &rhs) { lhs += rhs; return lhs; }
+		bool operator==(const String &rhs) const { return buffer == rhs.buffer; }
+		bool operator!=(const String &rhs) const { return buffer != rhs.buffer; }
+};
@@ -0,0 +1,27 @@
+/**
+ * The check shared by the host test programs: each prints what it checked
+ * with the expected and actual values side by side, and counts the mismatches
+ * in failures for main() to return.
+ *
+ * One per test program, include it from the program's only source file.
+ */
+
+#ifndef SB_expect
+#define SB_expect
+
+#include <Arduino.h>
+
+static int failures = 0;
+
+static void expect(const char *what, long expected, long actual) {
+	Serial.print(what);
+	Serial.print(" expected: ");
+	Serial.print(expected);
+	Serial.print(" actual: ");
+	Serial.println(actual);
+	if (expected != actual) {
+		failures++;
+	}
+}
+
+#endif
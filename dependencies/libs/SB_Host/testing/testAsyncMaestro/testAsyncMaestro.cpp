@@ -0,0 +1,199 @@
+/**
+ * Tests SB_AsyncMaestro against emulated Maestros on pseudo-terminals, with the
+ * emulators served from the same SB_EventLoop thread as the coroutines.
+ *
+ * 		- 300 concurrent getPosition queries over three controllers, every one
+ * 		  must come back with the right channel's position
+ * 		- cancelling a slow query, the next query must still line up
+ * 		- resyncs with response bytes being dropped, nothing may hang or be misfiled
+ * 		- a coroutine destroyed with its resume posted, or outliving its cancel source
+ *
+ * Expected and actual values are printed side by side, the exit code is the
+ * number of mismatches.
+ */
+
+#include <Arduino.h>
+#include <SB_AsyncMaestro.hpp>
+#include <SB_MaestroEmulator.hpp>
+#include <SB_PtyPair.hpp>
+#include <SB_Task.hpp>
+#include "../SB_Expect.h"
+
+#include <memory>
+#include <unistd.h>
+#include <vector>
+
+/**
+ * An emulated Maestro on the master side of a pty, served by the event loop
+ */
+struct EmulatedController {
+	SB_PtyPair pty;
+	SB_MaestroEmulator emulator;
+	SB_TermiosStream port;
+	std::unique_ptr<SB_AsyncMaestro> maestro;
+
+	EmulatedController(SB_EventLoop &loop) : port("") {
+		pty.open();
+		port.begin(pty.getSlavePath(), 115200);
+		loop.watch(pty.getMasterFd(), [this]() {
+			uint8_t buffer[256];
+			ssize_t n;
+			while ((n = ::read(pty.getMasterFd(), buffer, sizeof(buffer))) > 0) {
+				for (ssize_t i = 0; i < n; i++) {
+					emulator.receive(buffer[i], micros());
+				}
+			}
+		});
+		serve(loop);
+		maestro.reset(new SB_AsyncMaestro(loop, port));
+	}
+
+	void serve(SB_EventLoop &loop) {
+		loop.callAfter(200, [this, &loop]() {
+			uint8_t buffer[256];
+			uint32_t now = micros();
+			emulator.update(now);
+			size_t n = emulator.takeResponse(buffer, sizeof(buffer), now);
+			if (n > 0) {
+				::write(pty.getMasterFd(), buffer, n);
+			}
+			serve(loop);
+		});
+	}
+};
+
+static SB_Task<> query(SB_AsyncMaestro &maestro, uint8_t channel, uint16_t expected, int &correct) {
+	SB_AsyncResult<uint16_t> position = co_await maestro.getPosition(channel);
+	if (position.ok() && position.value == expected) {
+		correct++;
+	}
+}
+
+static SB_Task<> queryStatus(SB_AsyncMaestro &maestro, uint8_t channel, SB_CancelSource *cancel, int &status, uint16_t &value) {
+	SB_AsyncResult<uint16_t> position = co_await maestro.getPosition(channel, 0, cancel);
+	status = position.status;
+	value = position.value;
+}
+
+int main() {
+	SB_EventLoop loop;
+	std::vector<std::unique_ptr<EmulatedController>> controllers;
+	for (int i = 0; i < 3; i++) {
+		controllers.emplace_back(new EmulatedController(loop));
+		for (uint8_t channel = 0; channel < 8; channel++) {
+			controllers[i]->maestro->setTarget(channel, 4000 + 100 * i + channel);
+		}
+	}
+
+	{
+		int correct = 0;
+		std::vector<SB_Task<>> tasks;
+		for (int i = 0; i < 300; i++) {
+			uint8_t controller = i % 3;
+			uint8_t channel = (i / 3) % 8;
+			tasks.push_back(query(*controllers[controller]->maestro, channel, 4000 + 100 * controller + channel, correct));
+		}
+		loop.runUntil([&]() {
+			for (SB_Task<> &task : tasks) {
+				if (!task.done()) return false;
+			}
+			return true;
+		});
+		expect("concurrent queries answered correctly", 300, correct);
+	}
+
+	{
+		// Cancel a query the Maestro is slow to answer, its late answer must not
+		// be mistaken for the next query's
+		EmulatedController &slow = *controllers[0];
+		slow.emulator.setResponseLatency(30000);
+		slow.maestro->setLinkTimeout(200000);
+		SB_CancelSource cancel;
+		int status = -1;
+		uint16_t value = 0;
+		SB_Task<> cancelled = queryStatus(*slow.maestro, 1, &cancel, status, value);
+		loop.callAfter(5000, [&]() { cancel.cancel(); });
+		loop.runUntil([&]() { return cancelled.done(); });
+		expect("cancelled query status", ASYNC_CANCELLED, status);
+
+		int nextStatus = -1;
+		uint16_t nextValue = 0;
+		SB_Task<> next = queryStatus(*slow.maestro, 2, nullptr, nextStatus, nextValue);
+		loop.runUntil([&]() { return next.done(); });
+		expect("query after the cancel status", ASYNC_OK, nextStatus);
+		expect("query after the cancel value", 4002, nextValue);
+
+		SB_CancelSource already;
+		already.cancel();
+		int alreadyStatus = -1;
+		SB_Task<> never = queryStatus(*slow.maestro, 2, &already, alreadyStatus, nextValue);
+		expect("query on an already cancelled source finishes at once", true, never.done());
+		expect("already cancelled status", ASYNC_CANCELLED, alreadyStatus);
+		slow.emulator.setResponseLatency(0);
+	}
+
+	{
+		// A frame destroyed after its query finished but before the loop resumed
+		// it must not be resumed
+		EmulatedController &controller = *controllers[2];
+		SB_CancelSource cancel;
+		int status = -1;
+		uint16_t value = 0;
+		{
+			SB_Task<> gone = queryStatus(*controller.maestro, 0, &cancel, status, value);
+			cancel.cancel();
+		}
+		loop.runOnce(0);
+		expect("destroyed frame not resumed", -1, status);
+
+		// A cancel source that goes first leaves its queries to finish on their own
+		std::unique_ptr<SB_CancelSource> shortLived(new SB_CancelSource());
+		SB_Task<> outlives = queryStatus(*controller.maestro, 1, shortLived.get(), status, value);
+		shortLived.reset();
+		loop.runUntil([&]() { return outlives.done(); });
+		expect("query outliving its cancel source status", ASYNC_OK, status);
+		expect("query outliving its cancel source value", 4201, value);
+	}
+
+	{
+		// Drop a quarter of the response bytes. With one query in flight a lost
+		// byte stalls the head until the link timeout and a resync, so queries
+		// fail rather than get somebody else's answer. Nothing may hang.
+		EmulatedController &lossy = *controllers[1];
+		lossy.emulator.setLossRates(0.0f, 0.25f);
+		lossy.emulator.setSeed(7);
+		lossy.maestro->setMaxInFlight(1);
+		lossy.maestro->setDefaultTimeout(2000000);
+		lossy.maestro->setLinkTimeout(5000);
+		lossy.maestro->setResyncQuiet(2000);
+		int correct = 0;
+		std::vector<SB_Task<>> tasks;
+		for (int i = 0; i < 100; i++) {
+			tasks.push_back(query(*lossy.maestro, i % 8, 4100 + i % 8, correct));
+		}
+		uint64_t start = SB_EventLoop::now();
+		loop.runUntil([&]() {
+			for (SB_Task<> &task : tasks) {
+				if (!task.done()) return false;
+			}
+			return true;
+		});
+		uint64_t elapsedMs = (SB_EventLoop::now() - start) / 1000;
+		SB_AsyncMaestro &maestro = *lossy.maestro;
+		uint32_t answered = maestro.getCompleted() - 100; // the first test's queries on this controller
+		expect("lossy link: every query finished", 0, maestro.getOutstanding());
+		expect("lossy link: at least one resync", true, maestro.getResyncs() > 0);
+		expect("lossy link: no misfiled answers", answered, correct);
+		expect("lossy link: finished in under 2 s", true, elapsedMs < 2000);
+		Serial.print("lossy link: ");
+		Serial.print(correct);
+		Serial.print(" answered, ");
+		Serial.print(maestro.getResyncs());
+		Serial.println(" resyncs");
+	}
+
+	Serial.print("Failures: ");
+	Serial.println(failures);
+	Serial.flush();
+	return failures;
+}
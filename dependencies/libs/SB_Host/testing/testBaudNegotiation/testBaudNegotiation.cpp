@@ -0,0 +1,161 @@
+/**
+ * Tests Maestro::negotiateBaud() (in PololuMaestro) against the emulator in
+ * virtual time: a Maestro at a fixed baud is found and left with a clear error
+ * register, one detecting the baud settles on the fastest rate the link carries
+ * cleanly when it can be reset between rates and keeps the first one it hears
+ * when it can't, a port that can't do a rate is skipped, and SB_Servo's maestro
+ * negotiates through Serial1 and answers a fraction as slowly as at 9600.
+ *
+ * Expected and actual values are printed side by side, the exit code is the
+ * number of mismatches.
+ */
+
+#include <Arduino.h>
+#include <PololuMaestro.h>
+#include <SB_EmulatedSerial.hpp>
+#include <SB_HostSerial.hpp>
+#include <SB_Servo.hpp>
+#include <SB_Simulation.hpp>
+#include "../SB_Expect.h"
+
+// The link the callbacks below set the rate of
+static SB_EmulatedSerial *link = nullptr;
+
+static bool setBaud(uint32_t baud) {
+	link->begin(baud);
+	return true;
+}
+
+/**
+ * What a reset pin does to a Maestro, then the rate
+ */
+static bool resetAndSetBaud(uint32_t baud) {
+	link->getEmulator().reset();
+	link->begin(baud);
+	return true;
+}
+
+static bool noPort(uint32_t) {
+	return false;
+}
+
+/**
+ * The time a getPosition() round trip takes
+ */
+static uint64_t roundTripUs(SB_Simulation &simulation, Maestro &maestro) {
+	uint64_t start = simulation.now();
+	maestro.getPosition(0);
+	return simulation.now() - start;
+}
+
+int main() {
+	SB_Simulation simulation;
+	simulation.makeCurrent();
+	MaestroBaudTrial trials[Maestro::baudRateCount];
+
+	{
+		// Fixed at 57600: the two faster rates go unanswered
+		SB_MaestroEmulator emulator(12);
+		emulator.setBaud(57600);
+		SB_EmulatedSerial serial(emulator);
+		link = &serial;
+		MiniMaestro maestro(serial);
+		uint32_t baud = maestro.negotiateBaud(setBaud, Maestro::baudRates, Maestro::baudRateCount, 16, 0, trials);
+		expect("fixed: found", 57600, baud);
+		expect("fixed: port left there", 57600, serial.getLineBaud());
+		expect("fixed: 200000 unanswered", 16, trials[0].failures);
+		expect("fixed: 115200 unanswered", 16, trials[1].failures);
+		expect("fixed: 57600 clean", 0, trials[2].failures);
+		expect("fixed: 57600 probed", 16, trials[2].probes);
+		expect("fixed: the garbage was seen", true, serial.getBytesGarbled() > 0);
+		expect("fixed: and cleared", 0, maestro.getErrors());
+		maestro.setTarget(3, 6000);
+		serial.flush();
+		expect("fixed: commands get through", 6000, emulator.getTarget(3));
+	}
+
+	{
+		// Detecting, clean link: the fastest
+		SB_MaestroEmulator emulator(12);
+		emulator.setAutoDetectBaud(true);
+		SB_EmulatedSerial serial(emulator);
+		link = &serial;
+		MiniMaestro maestro(serial);
+		expect("detect: fastest", 200000, maestro.negotiateBaud(setBaud));
+		expect("detect: maestro at it", 200000, emulator.getBaud());
+		expect("detect: no errors", 0, maestro.getErrors());
+	}
+
+	{
+		// Detecting, the link garbles 2% of bytes above 115200, reset before each rate
+		SB_MaestroEmulator emulator(12);
+		emulator.setAutoDetectBaud(true);
+		SB_EmulatedSerial serial(emulator);
+		serial.setLineErrors(115200, 0.02f, 7);
+		link = &serial;
+		MiniMaestro maestro(serial);
+		uint32_t baud = maestro.negotiateBaud(resetAndSetBaud, Maestro::baudRates, Maestro::baudRateCount, 32, 0, trials);
+		expect("noisy with reset: the fastest clean rate", 115200, baud);
+		expect("noisy with reset: maestro at it", 115200, emulator.getBaud());
+		expect("noisy with reset: 200000 had failures", true, trials[0].failures > 0);
+		expect("noisy with reset: 115200 had none", 0, trials[1].failures);
+
+		// Without the reset it keeps the first rate: the best there is, unreliable
+		SB_MaestroEmulator stuck(12);
+		stuck.setAutoDetectBaud(true);
+		SB_EmulatedSerial stuckSerial(stuck);
+		stuckSerial.setLineErrors(115200, 0.02f, 7);
+		link = &stuckSerial;
+		MiniMaestro stuckMaestro(stuckSerial);
+		baud = stuckMaestro.negotiateBaud(setBaud, Maestro::baudRates, Maestro::baudRateCount, 32, 0, trials);
+		expect("noisy without reset: the first rate", 200000, baud);
+		expect("noisy without reset: it had failures", true, trials[0].failures > 0);
+		expect("noisy without reset: nothing slower answered", 32, trials[1].failures);
+		expect("noisy without reset: port back at it", 200000, stuckSerial.getLineBaud());
+	}
+
+	{
+		// A port that can't do any of them, or a maestro that isn't there
+		SB_MaestroEmulator emulator(12);
+		emulator.setBaud(57600);
+		SB_EmulatedSerial serial(emulator);
+		link = &serial;
+		MiniMaestro maestro(serial);
+		expect("no port: nothing", 0, maestro.negotiateBaud(noPort, Maestro::baudRates, Maestro::baudRateCount, 16, 0, trials));
+		expect("no port: not probed", 0, trials[0].probes);
+		uint32_t odd[] = {250000, 31250};
+		expect("no answer: nothing", 0, maestro.negotiateBaud(setBaud, odd, 2, 16, 0, trials));
+		expect("no answer: all failed", 16, trials[1].failures);
+	}
+
+	{
+		// SB_Servo's maestro, through Serial1: a fraction of the 9600 round trip
+		SB_MaestroEmulator emulator(12);
+		emulator.setBaud(9600);
+		SB_EmulatedSerial serial(emulator);
+		link = &serial;
+		SB_HostSerialPort::routeThread(&serial);
+		MiniMaestro direct(SB_Servo::getMaestroTap());
+		serial.begin(9600);
+		uint64_t slow = roundTripUs(simulation, direct);
+
+		emulator.setAutoDetectBaud(true);
+		expect("servo: negotiated", 200000, SB_Servo::negotiateMaestroBaud(setBaud));
+		SB_Servo rudder(0);
+		rudder.rotateToDegrees(90);
+		serial.flush();
+		expect("servo: target", 6000, emulator.getTarget(0));
+		uint64_t fast = roundTripUs(simulation, direct);
+		Serial.print("getPosition round trip us, 9600: ");
+		Serial.print((long) slow);
+		Serial.print(" negotiated: ");
+		Serial.println((long) fast);
+		expect("servo: under a tenth of the 9600 round trip", true, fast * 10 < slow);
+		SB_HostSerialPort::routeThread(nullptr);
+	}
+
+	SB_Simulation::clearCurrent();
+	Serial.print("Failures: ");
+	Serial.println(failures);
+	return failures;
+}
@@ -0,0 +1,249 @@
+/**
+ * Tests SB_CommandParser and SB_ServoCommands (in SB_Servo): lines and frames
+ * parse the same however the bytes are split up, bad lines and frames are
+ * dropped without losing what follows them, and commands read from a port
+ * reach SB_Servos on the emulator and are answered, with poll() never waiting
+ * on half a command or reading more than its share.
+ *
+ * Expected and actual values are printed side by side, the exit code is the
+ * number of mismatches.
+ */
+
+#include <Arduino.h>
+#include <PololuMaestro.h>
+#include <SB_CommandParser.hpp>
+#include <SB_EmulatedSerial.hpp>
+#include <SB_HostSerial.hpp>
+#include <SB_Servo.hpp>
+#include <SB_ServoCommands.hpp>
+#include <SB_Simulation.hpp>
+#include "../SB_Expect.h"
+
+#include <deque>
+#include <string>
+#include <vector>
+
+/**
+ * The ground station's end: bytes queued to be read, and what was written back
+ */
+class Console : public Stream {
+	public:
+		std::deque<uint8_t> input;
+		std::string output;
+
+		void type(const std::string &text) { input.insert(input.end(), text.begin(), text.end()); }
+		void type(const uint8_t *bytes, size_t length) { input.insert(input.end(), bytes, bytes + length); }
+
+		int available() override { return input.size(); }
+		int read() override {
+			if (input.empty()) {
+				return -1;
+			}
+			uint8_t dataByte = input.front();
+			input.pop_front();
+			return dataByte;
+		}
+		int peek() override { return input.empty() ? -1 : input.front(); }
+		size_t write(uint8_t dataByte) override {
+			output += (char) dataByte;
+			return 1;
+		}
+		using Print::write;
+};
+
+/**
+ * Feeds text, @return the commands it completed
+ */
+static std::vector<SB_Command> feed(SB_CommandParser &parser, const std::string &text) {
+	std::vector<SB_Command> commands;
+	SB_Command command;
+	for (char c : text) {
+		if (parser.feed(c, command)) {
+			commands.push_back(command);
+		}
+	}
+	return commands;
+}
+
+static std::vector<SB_Command> feed(SB_CommandParser &parser, const uint8_t *bytes, size_t length) {
+	return feed(parser, std::string((const char *) bytes, length));
+}
+
+static void printStats(Print &out) {
+	out.println("stats from main");
+}
+
+int main() {
+	SB_Simulation simulation;
+	simulation.makeCurrent();
+
+	{
+		// Lines
+		SB_CommandParser parser;
+		std::vector<SB_Command> got = feed(parser, "t 0 90\n");
+		expect("line: one command", 1, got.size());
+		expect("line: letter", 't', got[0].letter);
+		expect("line: count", 2, got[0].count);
+		expect("line: index", 0, got[0].values[0]);
+		expect("line: degrees", 9000, got[0].values[1]);
+		expect("line: not binary", false, got[0].binary);
+
+		// A byte at a time, only the newline completes it
+		std::string text = "S 1, 45.5 -12.257\r\n";
+		int early = 0;
+		SB_Command command;
+		for (size_t i = 0; i + 2 < text.size(); i++) {
+			early += parser.feed(text[i], command);
+		}
+		expect("split: nothing before the newline", 0, early);
+		expect("split: \\r completes", true, parser.feed('\r', command));
+		expect("split: \\n after it is nothing", false, parser.feed('\n', command));
+		expect("split: letter lower cased", 's', command.letter);
+		expect("split: count", 3, command.count);
+		expect("split: index", 100, command.values[0]);
+		expect("split: decimals", 4550, command.values[1]);
+		expect("split: negative, third place dropped", -1225, command.values[2]);
+
+		got = feed(parser, "90\n-7.5\n\n\n   \n.25\n");
+		expect("bare: three commands", 3, got.size());
+		expect("bare: is a target", 't', got[0].letter);
+		expect("bare: for servo 0", 0, got[0].values[0]);
+		expect("bare: degrees", 9000, got[0].values[1]);
+		expect("bare: negative", -750, got[1].values[1]);
+		expect("bare: no whole part", 25, got[2].values[1]);
+		expect("line: no errors yet", 0, parser.getErrorCode());
+
+		// Bad lines are dropped whole, the next one still parses
+		const char *bad[] = {"t 0 9x\n", "t 0 99999999999\n", "d 1 2 3 4\n", "t - 5\n", "tt 0\n", "1 2\n", "t 1..5\n"};
+		for (const char *line : bad) {
+			parser.clearErrorCode();
+			got = feed(parser, std::string(line) + "p 2\n");
+			expect("bad: only the next line", 1, got.size());
+			expect("bad: the next line", 200, got.empty() ? -1 : got[0].values[0]);
+			expect("bad: syntax bit", COMMAND_SYNTAX_BIT, parser.getErrorCode());
+		}
+		parser.clearErrorCode();
+		got = feed(parser, "t 0 21474836.47\n");
+		expect("line: largest value", 1, got.size());
+		expect("line: largest value, no error", 0, parser.getErrorCode());
+	}
+
+	{
+		// Frames
+		SB_CommandParser parser;
+		uint8_t frame[COMMAND_FRAME_BYTES];
+		SB_CommandParser::encodeFrame(frame, 't', 2, -4550, (int32_t) 0xA5A5A5A5);
+		std::vector<SB_Command> got = feed(parser, frame, sizeof(frame));
+		expect("frame: one command", 1, got.size());
+		expect("frame: binary", true, got[0].binary);
+		expect("frame: letter", 't', got[0].letter);
+		expect("frame: index in hundredths", 200, got[0].values[0]);
+		expect("frame: first", -4550, got[0].values[1]);
+		expect("frame: 0xA5 in a value is data", (int32_t) 0xA5A5A5A5, got[0].values[2]);
+
+		// A bad CRC drops the frame, the next one still parses
+		uint8_t corrupt[COMMAND_FRAME_BYTES];
+		memcpy(corrupt, frame, sizeof(frame));
+		corrupt[4] ^= 0x10;
+		std::string both = std::string((char *) corrupt, sizeof(corrupt)) + std::string((char *) frame, sizeof(frame));
+		got = feed(parser, both);
+		expect("crc: only the good frame", 1, got.size());
+		expect("crc: bit", COMMAND_CRC_BIT, parser.getErrorCode());
+
+		// A frame cutting into a line drops the line, lines after it are fine
+		parser.clearErrorCode();
+		got = feed(parser, "t 0 4" + std::string((char *) frame, sizeof(frame)) + "5\np 1\n");
+		expect("mixed: frame and the lines after it", 3, got.size());
+		expect("mixed: frame first", true, got[0].binary);
+		expect("mixed: a bare number after it", 500, got[1].values[1]);
+		expect("mixed: then a line", 'p', got[2].letter);
+		expect("mixed: syntax bit for the cut line", COMMAND_SYNTAX_BIT, parser.getErrorCode());
+	}
+
+	{
+		// Commands from a port carried out on servos at channels 0 and 3
+		SB_MaestroEmulator emulator(12);
+		emulator.setBaud(9600);
+		SB_EmulatedSerial serial(emulator);
+		SB_HostSerialPort::routeThread(&serial);
+		SB_Servo rudder(0);
+		SB_Servo sail(3);
+		SB_Servo *servos[] = {&rudder, &sail};
+		Console console;
+		SB_ServoCommands commands(console, servos, 2);
+		commands.setStatsHandler(printStats);
+
+		console.type("t 0 90\nt 1 4");
+		uint64_t before = simulation.now();
+		expect("poll: the whole command", 1, commands.poll());
+		expect("poll: half a command waits for nothing", 0, (long) (simulation.now() - before));
+		serial.flush();
+		expect("poll: rudder target", 6000, emulator.getTarget(0));
+		expect("poll: sail untouched", 0, emulator.getTarget(3));
+		console.type("5\n");
+		expect("poll: the rest of it", 1, commands.poll());
+		serial.flush();
+		expect("poll: sail target", 4000, emulator.getTarget(3));
+
+		// 'p' answers from the last poll, 20 ms later here
+		simulation.advance(100000);
+		SB_Servo::pollPositions();
+		simulation.advance(20000);
+		console.type("p 0\n");
+		before = simulation.now();
+		commands.poll();
+		expect("p: waits for nothing", 0, (long) (simulation.now() - before));
+		expect("p: answers with the reading and its age", true, console.output.find("p 0 90.00 2") != std::string::npos);
+
+		uint8_t frame[COMMAND_FRAME_BYTES];
+		SB_CommandParser::encodeFrame(frame, 'p', 1, 0, 0);
+		console.output.clear();
+		console.type(frame, sizeof(frame));
+		commands.poll();
+		SB_CommandParser reader;
+		std::vector<SB_Command> answers = feed(reader, (const uint8_t *) console.output.data(), console.output.size());
+		expect("p frame: answered with a frame", 1, answers.size());
+		expect("p frame: letter", 'p', answers.empty() ? 0 : answers[0].letter);
+		expect("p frame: servo", 100, answers.empty() ? 0 : answers[0].values[0]);
+		expect("p frame: hundredths", 4500, answers.empty() ? 0 : answers[0].values[1]);
+		int32_t ageMs = answers.empty() ? 0 : answers[0].values[2];
+		expect("p frame: age ms", true, ageMs >= 20 && ageMs < 30);
+
+		console.output.clear();
+		console.type("q 0\nt 5 10\nt 0.5 10\np\n");
+		commands.poll();
+		expect("reject: counted", 4, commands.getRejected());
+		expect("reject: answered", true, console.output == "?\r\n?\r\n?\r\n?\r\n");
+
+		console.type("s 0 90\nt 0 0\n");
+		commands.poll();
+		expect("s: slew limits set", true, rudder.isSlewing());
+		serial.flush();
+		expect("s: target not sent straight away", true, emulator.getTarget(0) > 4000);
+
+		console.output.clear();
+		console.type("d\n");
+		commands.poll();
+		expect("d: counts", true, console.output.find("commands 7 rejected 4") != std::string::npos);
+		expect("d: mailbox", true, console.output.find("targets sent ") != std::string::npos);
+		expect("d: servos", true, console.output.find("servo 1 errors 0x0") != std::string::npos);
+		expect("d: stats handler", true, console.output.find("stats from main") != std::string::npos);
+
+		// A flood is read a share at a time
+		console.type(std::string(1000, ' ') + "t 1 0\n");
+		int polls = 0;
+		while (commands.poll() == 0 && polls < 100) {
+			polls++;
+		}
+		expect("flood: polls before the command", 1006 / COMMAND_POLL_BYTES, polls);
+		serial.flush();
+		expect("flood: command carried out", 2000, emulator.getTarget(3));
+
+		SB_HostSerialPort::routeThread(nullptr);
+	}
+
+	SB_Simulation::clearCurrent();
+	Serial.print("Failures: ");
+	Serial.println(failures);
+	return failures;
+}
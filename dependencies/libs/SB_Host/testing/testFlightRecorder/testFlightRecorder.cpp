@@ -0,0 +1,335 @@
+/**
+ * Tests SB_FlightRecorder (in SB_Servo): records come back out of the blocks
+ * exactly as logged, whatever the values and time steps, and a simulated SPI
+ * flash with typical page program and sector erase times keeps up with every RC
+ * channel and servo target at full rate for 10 s without a record dropped. A
+ * sink that stalls or fails costs records or blocks, counted, but log() and
+ * service() never wait for it.
+ *
+ * Expected and actual values are printed side by side, the exit code is the
+ * number of mismatches.
+ */
+
+#include <Arduino.h>
+#include <SB_FlightRecorder.hpp>
+#include "../SB_Expect.h"
+
+#include <algorithm>
+#include <string.h>
+#include <vector>
+
+static uint64_t nowUs = 0;
+
+/**
+ * Keeps every block, ready whenever ready is set
+ */
+class MemorySink : public SB_RecorderSink {
+	public:
+		std::vector<uint8_t> bytes;
+		bool isReady = true;
+		bool fail = false;
+
+		bool ready() override { return isReady; }
+		bool write(const uint8_t *data, size_t length) override {
+			if (fail) {
+				return false;
+			}
+			bytes.insert(bytes.end(), data, data + length);
+			return true;
+		}
+		size_t chunkBytes() const override { return RECORDER_BLOCK_BYTES; }
+};
+
+/**
+ * A W25Q style flash in nowUs time: busy for a page program after each page and
+ * for a sector erase before each new sector, the way SB_SpiFlashSink drives it.
+ * Programming can only clear bits, so writing over unerased flash is caught
+ */
+class FlashSink : public SB_RecorderSink {
+	private:
+		uint64_t busyUntil = 0;
+		uint32_t address = 0;
+		bool erased = false;
+
+	public:
+		std::vector<uint8_t> flash;
+		uint32_t programUs;
+		uint32_t eraseUs;
+		uint32_t overwrites = 0;
+
+		FlashSink(size_t size, uint32_t programUs, uint32_t eraseUs)
+				: flash(size, 0x00), programUs(programUs), eraseUs(eraseUs) {}
+
+		bool ready() override {
+			if (nowUs < busyUntil) {
+				return false;
+			}
+			if (!erased) {
+				memset(&flash[address], 0xFF, 4096);
+				busyUntil = nowUs + eraseUs;
+				erased = true;
+				return false;
+			}
+			return true;
+		}
+		bool write(const uint8_t *data, size_t length) override {
+			if (nowUs < busyUntil || !erased) {
+				return false;
+			}
+			for (size_t i = 0; i < length; i++) {
+				if (flash[address + i] != 0xFF) {
+					overwrites++;
+				}
+				flash[address + i] &= data[i];
+			}
+			busyUntil = nowUs + programUs;
+			address = (address + 256) % flash.size();
+			if (address % 4096 == 0) {
+				erased = false;
+			}
+			return true;
+		}
+		size_t chunkBytes() const override { return 256; }
+};
+
+struct Logged {
+	uint32_t timeUs;
+	uint8_t type;
+	uint8_t channel;
+	int32_t value;
+};
+
+/**
+ * Decodes every block in bytes, in sequence order
+ * @return the records, bad counts the blocks that didn't decode
+ */
+static std::vector<Logged> decode(const std::vector<uint8_t> &bytes, int &bad, uint32_t &firstSequence,
+		uint32_t &lastSequence) {
+	std::vector<std::pair<uint32_t, std::vector<Logged>>> blocks;
+	SB_RecordEntry entries[RECORDER_MAX_RECORDS];
+	bad = 0;
+	for (size_t at = 0; at + RECORDER_BLOCK_BYTES <= bytes.size(); at += RECORDER_BLOCK_BYTES) {
+		uint32_t sequence;
+		uint8_t run;
+		int count = SB_FlightRecorder::decodeBlock(&bytes[at], sequence, run, entries);
+		if (count < 0) {
+			bad += bytes[at] != 0xFF;
+			continue;
+		}
+		std::vector<Logged> records;
+		for (int i = 0; i < count; i++) {
+			records.push_back({entries[i].timeUs, entries[i].type, entries[i].channel, entries[i].value});
+		}
+		blocks.push_back({sequence, records});
+	}
+	std::sort(blocks.begin(), blocks.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+	std::vector<Logged> all;
+	for (const auto &block : blocks) {
+		all.insert(all.end(), block.second.begin(), block.second.end());
+	}
+	firstSequence = blocks.empty() ? 0 : blocks.front().first;
+	lastSequence = blocks.empty() ? 0 : blocks.back().first;
+	return all;
+}
+
+static bool same(const std::vector<Logged> &a, const std::vector<Logged> &b) {
+	if (a.size() != b.size()) {
+		return false;
+	}
+	for (size_t i = 0; i < a.size(); i++) {
+		if (a[i].timeUs != b[i].timeUs || a[i].type != b[i].type || a[i].channel != b[i].channel
+				|| a[i].value != b[i].value) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static uint32_t lcg = 12345;
+
+static uint32_t next() {
+	lcg = lcg * 1664525 + 1013904223;
+	return lcg;
+}
+
+static void drain(SB_FlightRecorder &recorder) {
+	recorder.flush();
+	for (int i = 0; i < 100 && !recorder.isIdle(); i++) {
+		recorder.service();
+	}
+}
+
+int main() {
+	{
+		// Anything logged comes back: extreme values, big and backwards time steps
+		MemorySink sink;
+		SB_FlightRecorder recorder(sink);
+		std::vector<Logged> logged;
+		uint32_t timeUs = 0xFFFF0000; // wraps partway through
+		for (int i = 0; i < 20000; i++) {
+			uint32_t r = next();
+			switch (r % 8) {
+				case 0: timeUs += next(); break; // anywhere, wrapping included
+				case 1: timeUs -= r % 100; break;
+				default: timeUs += r % 2000; break;
+			}
+			uint8_t type = (r >> 8) % RECORDER_TYPES;
+			uint8_t channel = (r >> 12) % RECORDER_CHANNELS;
+			int32_t value;
+			switch ((r >> 20) % 4) {
+				case 0: value = (int32_t) next(); break;
+				case 1: value = (r >> 24) % 2 ? INT32_MAX : INT32_MIN; break;
+				default: value = 4000 + (int32_t) (next() % 4000) - 2000; break;
+			}
+			if (recorder.log(type, channel, value, timeUs)) {
+				logged.push_back({timeUs, type, channel, value});
+			}
+			recorder.service();
+		}
+		drain(recorder);
+		int bad;
+		uint32_t first, last;
+		std::vector<Logged> decoded = decode(sink.bytes, bad, first, last);
+		expect("round trip: nothing dropped", 0, recorder.getDropped());
+		expect("round trip: all logged", 20000, recorder.getLogged());
+		expect("round trip: same records", true, same(logged, decoded));
+		expect("round trip: no bad blocks", 0, bad);
+		expect("round trip: whole blocks", 0, sink.bytes.size() % RECORDER_BLOCK_BYTES);
+		expect("round trip: sequence numbers", recorder.getBlocksWritten() - 1, last - first);
+		expect("round trip: no errors", 0, recorder.getErrorCode());
+	}
+
+	{
+		// Full rate into typical flash timings: 12 servos at 1 kHz and 6 RC
+		// channels at 45 Hz for 10 s, service() once a millisecond
+		FlashSink sink(1 << 20, 700, 45000);
+		SB_FlightRecorder recorder(sink);
+		std::vector<Logged> logged;
+		int32_t servo[12];
+		for (int i = 0; i < 12; i++) {
+			servo[i] = 6000;
+		}
+		for (nowUs = 0; nowUs < 10000000; nowUs += 1000) {
+			uint32_t timeUs = nowUs + next() % 50;
+			for (int i = 0; i < 12; i++) {
+				servo[i] += (int32_t) (next() % 9) - 4;
+				recorder.log(RECORD_SERVO, i, servo[i], timeUs);
+				logged.push_back({timeUs, RECORD_SERVO, (uint8_t) i, servo[i]});
+			}
+			if (nowUs % 22000 == 0) {
+				for (int i = 0; i < 6; i++) {
+					int32_t width = 1500 + (int32_t) (next() % 11) - 5;
+					recorder.log(RECORD_RC, i, width, timeUs + 100);
+					logged.push_back({timeUs + 100, RECORD_RC, (uint8_t) i, width});
+				}
+			}
+			recorder.service();
+		}
+		while (!recorder.isIdle()) {
+			recorder.flush();
+			recorder.service();
+			nowUs += 100;
+		}
+		int bad;
+		uint32_t first, last;
+		std::vector<Logged> decoded = decode(sink.flash, bad, first, last);
+		expect("flash: nothing dropped", 0, recorder.getDropped());
+		expect("flash: same records", true, same(logged, decoded));
+		expect("flash: never programmed over unerased flash", 0, sink.overwrites);
+		uint32_t bytes = recorder.getBlocksWritten() * RECORDER_BLOCK_BYTES;
+		Serial.print("flash: bytes a record ");
+		Serial.println((float) bytes / logged.size());
+		// 3 bytes for most servo targets, 4 for the first of a tick (its time step) and RC widths
+		expect("flash: about 3 bytes a record, padding included", true, bytes <= 13 * logged.size() / 4);
+	}
+
+	{
+		// A 400 ms erase (the datasheet maximum) at the same rate: both blocks
+		// fill, records are dropped and counted, and it picks up again after
+		FlashSink sink(1 << 20, 700, 45000);
+		SB_FlightRecorder recorder(sink);
+		uint32_t attempted = 0, kept = 0;
+		for (nowUs = 0; nowUs < 2000000; nowUs += 1000) {
+			sink.eraseUs = nowUs > 500000 && nowUs < 700000 ? 400000 : 45000;
+			for (int i = 0; i < 12; i++) {
+				attempted++;
+				kept += recorder.log(RECORD_SERVO, i, 6000 + (int32_t) (next() % 100), nowUs);
+			}
+			recorder.service();
+		}
+		expect("stall: counted", attempted - kept, recorder.getDropped());
+		expect("stall: some dropped", true, recorder.getDropped() > 0);
+		expect("stall: overrun bit", RECORDER_OVERRUN_BIT, recorder.getErrorCode());
+		recorder.clearErrorCode();
+		expect("stall: logging again after", true, recorder.log(RECORD_MARK, 0, 1, nowUs));
+	}
+
+	{
+		// A sink that's never ready holds two blocks' worth and drops the rest
+		MemorySink sink;
+		sink.isReady = false;
+		SB_FlightRecorder recorder(sink);
+		int kept = 0;
+		for (int i = 0; i < 10000; i++) {
+			kept += recorder.log(RECORD_RC, 2, 1500 + i % 3, i * 100);
+			recorder.service();
+		}
+		expect("never ready: logged and dropped add up", 10000, recorder.getLogged() + recorder.getDropped());
+		expect("never ready: logged", kept, recorder.getLogged());
+		expect("never ready: nothing written", 0, sink.bytes.size());
+		expect("never ready: some dropped", true, recorder.getDropped() > 0);
+		sink.isReady = true;
+		drain(recorder);
+		int bad;
+		uint32_t first, last;
+		expect("never ready: the kept records come out", kept, decode(sink.bytes, bad, first, last).size());
+	}
+
+	{
+		// flush() sends a partial block, a failed write loses just that block
+		MemorySink sink;
+		SB_FlightRecorder recorder(sink);
+		recorder.log(RECORD_FAULT, 1, 0x40, 1000);
+		recorder.service();
+		expect("partial: held until full", 0, sink.bytes.size());
+		expect("partial: not idle", false, recorder.isIdle());
+		drain(recorder);
+		expect("partial: flushed", RECORDER_BLOCK_BYTES, sink.bytes.size());
+		expect("partial: idle", true, recorder.isIdle());
+
+		sink.fail = true;
+		recorder.log(RECORD_FAULT, 1, 0x80, 2000);
+		drain(recorder);
+		expect("failed write: bit", RECORDER_SINK_BIT, recorder.getErrorCode());
+		expect("failed write: block lost", 1, recorder.getBlocksLost());
+		expect("failed write: idle", true, recorder.isIdle());
+		recorder.clearErrorCode();
+
+		recorder.log(RECORDER_TYPES, 0, 0, 3000);
+		recorder.log(RECORD_RC, RECORDER_CHANNELS, 0, 3000);
+		expect("bad type or channel", RECORDER_RECORD_BIT, recorder.getErrorCode());
+		expect("bad type or channel: not logged", 2, recorder.getLogged());
+	}
+
+	{
+		// Damage is caught rather than decoded into garbage
+		MemorySink sink;
+		SB_FlightRecorder recorder(sink);
+		for (int i = 0; i < 50; i++) {
+			recorder.log(RECORD_SERVO, 0, 6000 + i * 200, i * 1000);
+		}
+		drain(recorder);
+		SB_RecordEntry entries[RECORDER_MAX_RECORDS];
+		uint32_t sequence;
+		uint8_t run;
+		expect("intact block", 50, SB_FlightRecorder::decodeBlock(sink.bytes.data(), sequence, run, entries));
+		sink.bytes[RECORDER_HEADER_BYTES + 100] = 0xFF;
+		expect("damaged block", -1, SB_FlightRecorder::decodeBlock(sink.bytes.data(), sequence, run, entries));
+		std::vector<uint8_t> blank(RECORDER_BLOCK_BYTES, 0xFF);
+		expect("erased flash", -1, SB_FlightRecorder::decodeBlock(blank.data(), sequence, run, entries));
+	}
+
+	Serial.print("Failures: ");
+	Serial.println(failures);
+	return failures;
+}
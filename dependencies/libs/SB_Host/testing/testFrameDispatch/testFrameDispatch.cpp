@@ -0,0 +1,216 @@
+/**
+ * Tests SB_FrameDispatcher against the emulator in virtual time: the frame
+ * phase estimated from getPosition() and getMovingState() observations, batches
+ * landing just before the emulator's frames instead of wherever the control
+ * loop happens to run, coalescing, and the latency it reports saving against
+ * the emulator's own measurement.
+ *
+ * Expected and actual values are printed side by side, the exit code is the
+ * number of mismatches.
+ */
+
+#include <Arduino.h>
+#include <PololuMaestro.h>
+#include <SB_EmulatedSerial.hpp>
+#include <SB_FrameDispatcher.hpp>
+#include <SB_Simulation.hpp>
+#include "../SB_Expect.h"
+
+#define BAUD 115200
+#define FRAME_PHASE_US 7300
+#define OBSERVED_CHANNEL 5
+
+/**
+ * How far a time is from the nearest of the emulator's frame boundaries
+ */
+static long phaseError(uint32_t timeUs, const SB_MaestroEmulator &emulator) {
+	long offset = (long) ((timeUs - emulator.getFramePhaseUs()) % emulator.getFramePeriodUs());
+	return offset > (long) emulator.getFramePeriodUs() / 2 ? offset - (long) emulator.getFramePeriodUs() : offset;
+}
+
+/**
+ * Sweeps a speed limited channel back and forth, observing it every few
+ * milliseconds, until the dispatcher knows the phase
+ */
+static void learnPhase(SB_Simulation &simulation, MiniMaestro &maestro, SB_FrameDispatcher &dispatcher) {
+	maestro.setSpeed(OBSERVED_CHANNEL, 20);
+	maestro.setTarget(OBSERVED_CHANNEL, 4000);
+	maestro.setTarget(OBSERVED_CHANNEL, 8000);
+	for (int i = 0; i < 150; i++) {
+		dispatcher.observePosition(OBSERVED_CHANNEL);
+		// Uneven gaps, so the changes land all over our reads
+		simulation.advance(2500 + (i * 737) % 1000);
+	}
+}
+
+/**
+ * A control task at 50 Hz, deliberately out of phase with the frames, setting
+ * two channels. Returns the emulator's average time from a target arriving to
+ * the frame that outputs it
+ */
+static double controlRun(bool aligned, SB_FrameDispatcher **used) {
+	SB_Simulation simulation;
+	simulation.makeCurrent();
+	SB_MaestroEmulator emulator(12);
+	emulator.setBaud(BAUD);
+	emulator.setFrame(EMULATOR_FRAME_PERIOD_US, FRAME_PHASE_US);
+	SB_EmulatedSerial serial(emulator);
+	MiniMaestro maestro(serial);
+	SB_FrameDispatcher *dispatcher = new SB_FrameDispatcher(maestro, BAUD);
+	learnPhase(simulation, maestro, *dispatcher);
+
+	uint64_t latencyBefore = emulator.getTotalPulseLatencyUs();
+	uint32_t updatesBefore = emulator.getPulseUpdates();
+	// First run 2 ms after a frame starts, so sending straight away waits most of a period
+	uint64_t startUs = simulation.now() + 1000;
+	startUs += (FRAME_PHASE_US + 2000 - startUs % EMULATOR_FRAME_PERIOD_US + EMULATOR_FRAME_PERIOD_US)
+		% EMULATOR_FRAME_PERIOD_US;
+	uint16_t target = 5000;
+	simulation.every("control", 20000, [&]() {
+		target = target == 5000 ? 7000 : 5000;
+		dispatcher->setTarget(0, target);
+		dispatcher->setTarget(1, target);
+		if (!aligned) {
+			dispatcher->flush();
+		}
+	}, startUs);
+	simulation.run(1000000, [&]() {
+		dispatcher->update();
+		serial.deliver(micros());
+	});
+	serial.flush();
+
+	double latency = (double) (emulator.getTotalPulseLatencyUs() - latencyBefore)
+		/ (emulator.getPulseUpdates() - updatesBefore);
+	*used = dispatcher;
+	SB_Simulation::clearCurrent();
+	return latency;
+}
+
+int main() {
+	// Phase from getPosition()
+	{
+		SB_Simulation simulation;
+		simulation.makeCurrent();
+		SB_MaestroEmulator emulator(12);
+		emulator.setBaud(BAUD);
+		emulator.setFrame(EMULATOR_FRAME_PERIOD_US, FRAME_PHASE_US);
+		SB_EmulatedSerial serial(emulator);
+		MiniMaestro maestro(serial);
+		SB_FrameDispatcher dispatcher(maestro, BAUD);
+
+		expect("phase unknown at first", 0, dispatcher.isPhaseKnown());
+		learnPhase(simulation, maestro, dispatcher);
+		expect("phase known", 1, dispatcher.isPhaseKnown());
+		expect("phase narrowed to 200 us", 1, dispatcher.getPhaseUncertaintyUs() <= 200);
+		uint32_t next = dispatcher.getNextFrameUs(micros());
+		expect("next frame near a real boundary", 1, labs(phaseError(next, emulator)) <= 200);
+		expect("next frame ahead", 1, (int32_t) (next - micros()) >= 0 && next - micros() <= 20000);
+		expect("no resets", 0, dispatcher.getPhaseResets());
+		SB_Simulation::clearCurrent();
+	}
+
+	// Phase from getMovingState()
+	{
+		SB_Simulation simulation;
+		simulation.makeCurrent();
+		SB_MaestroEmulator emulator(12);
+		emulator.setBaud(BAUD);
+		emulator.setFrame(EMULATOR_FRAME_PERIOD_US, FRAME_PHASE_US);
+		SB_EmulatedSerial serial(emulator);
+		MiniMaestro maestro(serial);
+		SB_FrameDispatcher dispatcher(maestro, BAUD);
+
+		maestro.setSpeed(OBSERVED_CHANNEL, 200);
+		maestro.setTarget(OBSERVED_CHANNEL, 6000);
+		for (int move = 0; move < 10; move++) {
+			// Short moves that stop a frame or two later, at a different point in our loop each time
+			maestro.setTarget(OBSERVED_CHANNEL, move % 2 ? 6000 : 6400);
+			simulation.advance(1700 * move);
+			while (dispatcher.observeMovingState()) {
+				simulation.advance(1000);
+			}
+		}
+		expect("moving state phase known", 1, dispatcher.isPhaseKnown());
+		uint32_t next = dispatcher.getNextFrameUs(micros());
+		expect("moving state frame near a real boundary", 1,
+				labs(phaseError(next, emulator)) <= (long) dispatcher.getPhaseUncertaintyUs() + 1);
+		SB_Simulation::clearCurrent();
+	}
+
+	// Aligned against immediate sends
+	{
+		SB_FrameDispatcher *immediate;
+		SB_FrameDispatcher *aligned;
+		double immediateLatency = controlRun(false, &immediate);
+		double alignedLatency = controlRun(true, &aligned);
+		Serial.print("Immediate arrival to frame us: ");
+		Serial.println(immediateLatency);
+		Serial.print("Aligned arrival to frame us: ");
+		Serial.println(alignedLatency);
+		Serial.print("Aligned reported wait us: ");
+		Serial.println(aligned->getAverageWaitUs());
+		Serial.print("Aligned reported saving us: ");
+		Serial.println(aligned->getAverageSavedUs());
+		Serial.print("Immediate reported saving us: ");
+		Serial.println(immediate->getAverageSavedUs());
+
+		expect("immediate waits most of a period", 1, immediateLatency > 17000);
+		expect("aligned waits under a millisecond", 1, alignedLatency < 1000);
+		expect("reported wait matches the emulator", 1, fabs(aligned->getAverageWaitUs() - alignedLatency) < 200);
+		expect("reported saving matches the emulator", 1,
+				fabs(aligned->getAverageSavedUs() - (immediateLatency - alignedLatency)) < 300);
+		// Sent straight away, the only difference is a setTarget each being shorter than the setMultiTarget
+		expect("immediate saves next to nothing", 1, fabs(immediate->getAverageSavedUs()) < 400);
+		expect("one command per batch", aligned->getSentTargets() / 2, aligned->getFlushes());
+		expect("no missed frames", 0, aligned->getMissedFrames());
+		delete immediate;
+		delete aligned;
+	}
+
+	// Latest value wins, contiguous channels batch together
+	{
+		SB_Simulation simulation;
+		simulation.makeCurrent();
+		SB_MaestroEmulator emulator(12);
+		SB_EmulatedSerial serial(emulator);
+		MiniMaestro maestro(serial);
+		SB_FrameDispatcher dispatcher(maestro, BAUD);
+		dispatcher.setPhase(0);
+		dispatcher.setTarget(2, 5000);
+		dispatcher.setTarget(2, 5500);
+		dispatcher.setTarget(3, 6000);
+		dispatcher.setTarget(7, 7000);
+		dispatcher.setTarget(30, 7000);
+		expect("bad channel", DISPATCH_CHANNEL_ERROR_BIT, dispatcher.getErrorCode());
+		expect("conflated", 1, dispatcher.getConflated());
+		dispatcher.flush();
+		serial.flush();
+		expect("latest target", 5500, emulator.getTarget(2));
+		expect("batched neighbour", 6000, emulator.getTarget(3));
+		expect("separate channel", 7000, emulator.getTarget(7));
+		expect("multi target commands", 1, emulator.getCommandStats(0x9F).count);
+		expect("sent", 3, dispatcher.getSentTargets());
+		SB_Simulation::clearCurrent();
+	}
+
+	// No baud: batches still go out, timed as if they took no time on the wire
+	{
+		SB_Simulation simulation;
+		simulation.makeCurrent();
+		SB_MaestroEmulator emulator(12);
+		SB_EmulatedSerial serial(emulator);
+		MiniMaestro maestro(serial);
+		SB_FrameDispatcher dispatcher(maestro, 0);
+		dispatcher.setPhase(0);
+		dispatcher.setTarget(4, 6200);
+		dispatcher.flush();
+		serial.flush();
+		expect("no baud: sent", 6200, emulator.getTarget(4));
+		SB_Simulation::clearCurrent();
+	}
+
+	Serial.print("Failures: ");
+	Serial.println(failures);
+	return failures;
+}
@@ -0,0 +1,130 @@
+/**
+ * Tests the Maestro emulator's protocol handling against the real PololuMaestro
+ * driver (through SB_EmulatedSerial), and its ramps and impairments by feeding
+ * it bytes directly with made up timestamps.
+ *
+ * Expected and actual values are printed side by side, the exit code is the
+ * number of mismatches.
+ */
+
+#include <Arduino.h>
+#include <PololuMaestro.h>
+#include <SB_EmulatedSerial.hpp>
+#include "../SB_Expect.h"
+
+static void feed(SB_MaestroEmulator &emulator, const uint8_t *bytes, size_t length, uint32_t nowUs) {
+	for (size_t i = 0; i < length; i++) {
+		emulator.receive(bytes[i], nowUs);
+	}
+}
+
+int main() {
+	{
+		SB_MaestroEmulator emulator;
+		SB_EmulatedSerial serial(emulator);
+		MiniMaestro maestro(serial);
+		maestro.setTarget(2, 6000);
+		expect("compact getPosition(2)", 6000, maestro.getPosition(2));
+		uint16_t targets[3] = {4000, 5000, 7000};
+		maestro.setMultiTarget(3, 5, targets);
+		expect("setMultiTarget channel 5", 4000, maestro.getPosition(5));
+		expect("setMultiTarget channel 7", 7000, maestro.getPosition(7));
+		maestro.setPWM(1000, 4800);
+		expect("setPWM on time", 1000, emulator.getPwmOnTime());
+		expect("setPWM period", 4800, emulator.getPwmPeriod());
+		expect("getScriptStatus before restartScript", 1, maestro.getScriptStatus());
+		maestro.restartScript(0);
+		expect("getScriptStatus after restartScript", 0, maestro.getScriptStatus());
+		maestro.stopScript();
+		expect("getMovingState with no limits", 0, maestro.getMovingState());
+		maestro.setTarget(30, 6000);
+		expect("getErrors after a bad channel", MAESTRO_SERIAL_PROTOCOL_ERROR, maestro.getErrors());
+		expect("getErrors clears the register", 0, maestro.getErrors());
+	}
+
+	{
+		// Pololu protocol with CRC, the driver computes the CRC
+		SB_MaestroEmulator emulator(12, 12, true);
+		SB_EmulatedSerial serial(emulator);
+		MiniMaestro maestro(serial, Maestro::noResetPin, 12, true);
+		maestro.setTarget(1, 7000);
+		expect("Pololu + CRC getPosition(1)", 7000, maestro.getPosition(1));
+		expect("Pololu + CRC errors", 0, maestro.getErrors());
+
+		// A packet for device 13 shares the line but isn't ours
+		MiniMaestro other(serial, Maestro::noResetPin, 13, true);
+		other.setTarget(1, 4000);
+		expect("packet for another device is ignored", 7000, maestro.getPosition(1));
+
+		// Corrupt the CRC by hand: 0x84 channel 1 target 5000 with a bad CRC byte
+		const uint8_t corrupted[] = {0x84, 0x01, 0x08, 0x27, 0x00};
+		SB_MaestroEmulator compact(12, 12, true);
+		feed(compact, corrupted, sizeof(corrupted), 0);
+		expect("bad CRC sets the CRC error bit", MAESTRO_SERIAL_CRC_ERROR, compact.peekErrors());
+		expect("bad CRC packet isn't executed", 0, compact.getTarget(1));
+	}
+
+	{
+		// The Micro Maestro doesn't know setMultiTarget
+		SB_MaestroEmulator emulator(6);
+		SB_EmulatedSerial serial(emulator);
+		MiniMaestro maestro(serial);
+		uint16_t targets[2] = {6000, 6000};
+		maestro.setMultiTarget(2, 0, targets);
+		expect("setMultiTarget on a Micro Maestro", MAESTRO_SERIAL_PROTOCOL_ERROR, maestro.getErrors());
+	}
+
+	{
+		// Speed is 0.25 us per 10 ms, so speed 20 moves 40 quarter-us per 20 ms frame
+		SB_MaestroEmulator emulator;
+		const uint8_t start[] = {0x84, 0x00, 0x70, 0x2E};  // target 6000
+		const uint8_t speed[] = {0x87, 0x00, 0x14, 0x00};  // speed 20
+		const uint8_t target[] = {0x84, 0x00, 0x10, 0x2F}; // target 6032
+		feed(emulator, start, sizeof(start), 0);
+		feed(emulator, speed, sizeof(speed), 0);
+		feed(emulator, target, sizeof(target), 1000);
+		expect("speed limited move hasn't started before the frame", 6000, emulator.getPosition(0));
+		emulator.update(20000);
+		expect("position after one frame at speed 20", 6032, emulator.getPosition(0));
+		const uint8_t far[] = {0x84, 0x00, 0x00, 0x3E}; // target 7936
+		feed(emulator, far, sizeof(far), 20000);
+		emulator.update(60000);
+		expect("position after two more frames", 6112, emulator.getPosition(0));
+		expect("still moving", true, emulator.isMoving());
+
+		const uint8_t acceleration[] = {0x89, 0x01, 0x08, 0x00}; // 8 -> 1 speed unit per tick
+		const uint8_t onePos[] = {0x84, 0x01, 0x70, 0x2E};
+		const uint8_t oneTarget[] = {0x84, 0x01, 0x00, 0x3E};
+		feed(emulator, onePos, sizeof(onePos), 60000);
+		feed(emulator, acceleration, sizeof(acceleration), 60000);
+		feed(emulator, oneTarget, sizeof(oneTarget), 60000);
+		emulator.update(80000);
+		// velocity ramps 1 then 2 over the frame's two 10 ms ticks
+		expect("accelerated position after one frame", 6003, emulator.getPosition(1));
+	}
+
+	{
+		// Response latency and baud pacing
+		SB_MaestroEmulator emulator;
+		emulator.setResponseLatency(500);
+		emulator.setBaud(10000); // 1 ms a byte
+		const uint8_t query[] = {0x90, 0x00};
+		feed(emulator, query, sizeof(query), 0);
+		expect("response bytes ready at 1400 us", 0, emulator.responseAvailable(1400));
+		expect("response bytes ready at 1500 us", 1, emulator.responseAvailable(1500));
+		expect("response bytes ready at 2500 us", 2, emulator.responseAvailable(2500));
+		expect("getPosition service time", 2500, emulator.getCommandStats(0x90).maxServiceUs);
+
+		SB_MaestroEmulator lossy;
+		lossy.setLossRates(1.0f, 0.0f);
+		const uint8_t set[] = {0x84, 0x00, 0x70, 0x2E};
+		feed(lossy, set, sizeof(set), 0);
+		expect("every received byte lost", 4, lossy.getRxBytesLost());
+		expect("nothing executed", 0, lossy.getTarget(0));
+	}
+
+	Serial.print("Failures: ");
+	Serial.println(failures);
+	Serial.flush();
+	return failures;
+}
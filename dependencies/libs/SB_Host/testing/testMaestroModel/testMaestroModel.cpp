@@ -0,0 +1,132 @@
+/**
+ * Tests SB_MaestroModel (in SB_Servo) against emulators of each size: batches
+ * go as one setMultiTarget on a Mini, as back to back setTargets in one write
+ * on a Micro (which rejects setMultiTarget), in either protocol and with CRC,
+ * and channels are checked against the model by SB_Servo and SB_FrameDispatcher.
+ *
+ * Expected and actual values are printed side by side, the exit code is the
+ * number of mismatches.
+ */
+
+#include <Arduino.h>
+#include <PololuMaestro.h>
+#include <SB_EmulatedSerial.hpp>
+#include <SB_FrameDispatcher.hpp>
+#include <SB_MaestroModel.hpp>
+#include <SB_Servo.hpp>
+#include "../SB_Expect.h"
+
+/**
+ * Counts the writes that hand over more than one byte at a time
+ */
+class CountingSerial : public SB_EmulatedSerial {
+	public:
+		uint32_t bufferWrites = 0;
+
+		explicit CountingSerial(SB_MaestroEmulator &maestro) : SB_EmulatedSerial(maestro) {}
+		size_t write(const uint8_t *buffer, size_t size) override {
+			bufferWrites++;
+			return Print::write(buffer, size);
+		}
+		using SB_EmulatedSerial::write;
+};
+
+static uint32_t commands(SB_MaestroEmulator &emulator, uint8_t commandByte) {
+	return emulator.getCommandStats(commandByte).count;
+}
+
+int main() {
+	expect("forChannels(6)", (long) &SB_MaestroModel::micro6, (long) SB_MaestroModel::forChannels(6));
+	expect("forChannels(18)", (long) &SB_MaestroModel::mini18, (long) SB_MaestroModel::forChannels(18));
+	expect("forChannels(8)", 0, (long) SB_MaestroModel::forChannels(8));
+	expect("micro has no multi target", false, SB_MaestroModel::micro6.multiTarget);
+	expect("micro has no PWM", false, SB_MaestroModel::micro6.hasPwm());
+	expect("mini 12 PWM channel", 8, SB_MaestroModel::mini12.pwmChannel);
+	expect("mini 12 has channel 11", true, SB_MaestroModel::mini12.hasChannel(11));
+	expect("mini 12 hasn't channel 12", false, SB_MaestroModel::mini12.hasChannel(12));
+
+	uint16_t targets[MAESTRO_MAX_CHANNELS];
+	for (int i = 0; i < MAESTRO_MAX_CHANNELS; i++) {
+		targets[i] = 4000 + 100 * i;
+	}
+
+	{
+		// A Mini gets one setMultiTarget
+		SB_MaestroEmulator emulator(12);
+		SB_EmulatedSerial serial(emulator);
+		MiniMaestro maestro(serial);
+		SB_MaestroModel::mini12.setTargets(maestro, 4, 2, targets);
+		expect("mini: setMultiTarget commands", 1, commands(emulator, 0x9F));
+		expect("mini: setTarget commands", 0, commands(emulator, 0x84));
+		expect("mini: last target", 4300, maestro.getPosition(5));
+		expect("mini: no errors", 0, maestro.getErrors());
+
+		// Past the last channel is dropped, not sent
+		SB_MaestroModel::mini12.setTargets(maestro, 4, 10, targets);
+		expect("mini: clamped to channel 11", 4100, maestro.getPosition(11));
+		expect("mini: clamped, no errors", 0, maestro.getErrors());
+	}
+
+	{
+		// What the model is for: a Micro doesn't know setMultiTarget
+		SB_MaestroEmulator emulator(6);
+		SB_EmulatedSerial serial(emulator);
+		MiniMaestro maestro(serial);
+		maestro.setMultiTarget(3, 0, targets);
+		expect("micro: setMultiTarget is a protocol error", MAESTRO_SERIAL_PROTOCOL_ERROR, maestro.getErrors());
+	}
+
+	for (int variant = 0; variant < 3; variant++) {
+		// Compact, Pololu, Pololu with CRC
+		bool pololu = variant > 0;
+		bool crc = variant == 2;
+		SB_MaestroEmulator emulator(6, 12, crc);
+		CountingSerial serial(emulator);
+		MiniMaestro maestro(serial, Maestro::noResetPin, pololu ? 12 : Maestro::deviceNumberDefault, crc);
+		SB_MaestroModel::micro6.setTargets(maestro, 6, 0, targets);
+		expect("micro: setTarget commands", 6, commands(emulator, 0x84));
+		expect("micro: setMultiTarget commands", 0, commands(emulator, 0x9F));
+		expect("micro: one write", 1, serial.bufferWrites);
+		expect("micro: bytes", 6 * (4 + (pololu ? 2 : 0) + (crc ? 1 : 0)), serial.getBytesWritten());
+		expect("micro: first target", 4000, maestro.getPosition(0));
+		expect("micro: last target", 4500, maestro.getPosition(5));
+		expect("micro: no errors", 0, maestro.getErrors());
+	}
+
+	{
+		// The dispatcher batches the same way, and rejects channels the model hasn't got
+		SB_MaestroEmulator emulator(6);
+		SB_EmulatedSerial serial(emulator);
+		MiniMaestro maestro(serial);
+		SB_FrameDispatcher dispatcher(maestro, 115200);
+		dispatcher.setModel(SB_MaestroModel::micro6);
+		dispatcher.setTarget(6, 6000);
+		expect("dispatcher: channel 6 on a micro", DISPATCH_CHANNEL_ERROR_BIT, dispatcher.getErrorCode());
+		dispatcher.clearErrorCode();
+		dispatcher.setPhase(micros());
+		dispatcher.setTarget(1, 5000);
+		dispatcher.setTarget(2, 5500);
+		dispatcher.setTarget(3, 6500);
+		dispatcher.flush();
+		expect("dispatcher: sent", 3, dispatcher.getSentTargets());
+		expect("dispatcher: as setTargets", 3, commands(emulator, 0x84));
+		expect("dispatcher: target landed", 6500, maestro.getPosition(3));
+		expect("dispatcher: no errors", 0, maestro.getErrors());
+	}
+
+	// SB_Servo checks channels against the model it's told about
+	{
+		SB_Servo servo(9);
+		expect("servo: channel 9 on the default mini 12", 0, servo.getErrorCode() & CHANNEL_ERROR_BIT);
+		SB_Servo::setMaestroModel(SB_MaestroModel::micro6);
+		SB_Servo micro(9);
+		expect("servo: channel 9 on a micro", CHANNEL_ERROR_BIT, micro.getErrorCode() & CHANNEL_ERROR_BIT);
+		SB_Servo::setMaestroModel(SB_MaestroModel::mini24);
+		SB_Servo mini(23);
+		expect("servo: channel 23 on a mini 24", 0, mini.getErrorCode() & CHANNEL_ERROR_BIT);
+	}
+
+	Serial.print("Failures: ");
+	Serial.println(failures);
+	return failures;
+}
@@ -0,0 +1,238 @@
+/**
+ * Tests SB_PacketPool and SB_PacketQueue (in SB_Servo): every packet handed
+ * out once and back, exhaustion and the high-water mark counted, packets from
+ * elsewhere refused, targets queued in every protocol mode landing on the
+ * emulator the same as setTarget() sends them, and not one heap allocation
+ * doing it. Then four threads standing in for interrupts hammer one pool and
+ * queue while another sends, with nothing lost, duplicated or reordered.
+ *
+ * Expected and actual values are printed side by side, the exit code is the
+ * number of mismatches.
+ */
+
+#include <Arduino.h>
+#include <PololuMaestro.h>
+#include <SB_EmulatedSerial.hpp>
+#include <SB_PacketPool.hpp>
+#include <SB_Servo.hpp>
+#include <SB_Simulation.hpp>
+#include "../SB_Expect.h"
+
+#include <new>
+#include <thread>
+#include <vector>
+
+// Every allocation in the program, to show the pool paths don't make any
+static std::atomic<uint32_t> allocations{0};
+
+void *operator new(size_t size) {
+	allocations++;
+	void *memory = malloc(size ? size : 1);
+	if (!memory) {
+		throw std::bad_alloc();
+	}
+	return memory;
+}
+
+void operator delete(void *memory) noexcept {
+	free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept {
+	free(memory);
+}
+
+/**
+ * Keeps the compact setTargets written to it: the newest sequence number seen
+ * on each channel, and whether any arrived out of order
+ */
+class TargetCheck : public Stream {
+	public:
+		uint8_t packet[4];
+		uint8_t length = 0;
+		uint16_t newest[MAESTRO_MAX_CHANNELS] = {0};
+		uint32_t targets = 0;
+		bool inOrder = true;
+		bool wellFormed = true;
+
+		size_t write(uint8_t byte) override {
+			if (length == 0 && byte != 0x84) {
+				wellFormed = false;
+				return 1;
+			}
+			packet[length++] = byte;
+			if (length == 4) {
+				uint16_t target = packet[2] | (packet[3] << 7);
+				uint8_t channel = packet[1];
+				inOrder &= target > newest[channel];
+				newest[channel] = target;
+				targets++;
+				length = 0;
+			}
+			return 1;
+		}
+		int available() override { return 0; }
+		int read() override { return -1; }
+		int peek() override { return -1; }
+};
+
+#define PRODUCERS 4
+#define PUSHES_PER_PRODUCER 16000 // targets are 14 bits
+
+int main() {
+	{
+		SB_PacketPool pool;
+		SB_MaestroPacket *packets[PACKET_POOL_SIZE];
+		bool distinct = true;
+		for (int i = 0; i < PACKET_POOL_SIZE; i++) {
+			packets[i] = pool.acquire();
+			distinct &= packets[i] != nullptr && pool.owns(packets[i]);
+			for (int j = 0; j < i; j++) {
+				distinct &= packets[i] != packets[j];
+			}
+		}
+		expect("pool: every packet handed out once", true, distinct);
+		expect("pool: in use", PACKET_POOL_SIZE, pool.getInUse());
+		expect("pool: none left", 0, pool.acquire() == nullptr ? 0 : 1);
+		expect("pool: exhaustion counted", 1, pool.getExhausted());
+		for (int i = 0; i < PACKET_POOL_SIZE; i++) {
+			pool.release(packets[i]);
+		}
+		expect("pool: all back", 0, pool.getInUse());
+		expect("pool: high water", PACKET_POOL_SIZE, pool.getHighWater());
+		pool.resetHighWater();
+		pool.release(pool.acquire());
+		expect("pool: high water from now", 1, pool.getHighWater());
+
+		SB_MaestroPacket stranger;
+		pool.release(&stranger);
+		pool.release((SB_MaestroPacket *) ((uint8_t *) packets[0] + 1));
+		expect("pool: strangers refused", 2, pool.getBadReleases());
+		expect("pool: strangers not taken in", 0, pool.getInUse());
+		int handedOut = 0;
+		while (SB_MaestroPacket *packet = pool.acquire()) {
+			handedOut++;
+			(void) packet;
+		}
+		expect("pool: still its own packets", PACKET_POOL_SIZE, handedOut);
+	}
+
+	{
+		// Queued targets land like setTarget()'s, in every protocol mode
+		SB_Simulation simulation;
+		simulation.makeCurrent();
+		struct Mode { const char *name; uint8_t device; bool crc; };
+		const Mode modes[] = {{"compact", Maestro::deviceNumberDefault, false},
+				{"compact crc", Maestro::deviceNumberDefault, true},
+				{"pololu", 12, false}, {"pololu crc", 12, true}};
+		for (const Mode &mode : modes) {
+			SB_MaestroEmulator emulator(12, 12, mode.crc);
+			SB_EmulatedSerial serial(emulator);
+			MiniMaestro maestro(serial, Maestro::noResetPin, mode.device, mode.crc);
+			SB_PacketPool pool;
+			SB_PacketQueue queue(pool);
+
+			uint8_t encoded[Maestro::maxEncodedSize];
+			uint8_t length = maestro.encodeSpeed(encoded, 2, 40);
+			maestro.writeEncoded(encoded, length);
+
+			uint32_t before = allocations;
+			bool pushed = true;
+			for (uint8_t channel = 0; channel < 12; channel++) {
+				pushed &= queue.pushTarget(maestro, channel, 4000 + 100 * channel);
+			}
+			pushed &= queue.pushTarget(maestro, 3, 7000); // the later one wins
+			uint32_t sent = queue.send(maestro);
+			uint32_t made = allocations - before;
+			simulation.advance(100000);
+			serial.deliver(micros());
+
+			bool landed = true;
+			for (uint8_t channel = 0; channel < 12; channel++) {
+				landed &= emulator.getTarget(channel) == (channel == 3 ? 7000 : 4000 + 100 * channel);
+			}
+			Serial.print(mode.name);
+			Serial.println(":");
+			expect("  queued", true, pushed);
+			expect("  sent in order", 13, sent);
+			expect("  landed", true, landed);
+			expect("  speed from encodeSpeed()", 40, emulator.getSpeed(2));
+			expect("  no errors", 0, emulator.peekErrors());
+			expect("  all back in the pool", 0, pool.getInUse());
+			expect("  no heap", 0, made);
+		}
+		SB_Simulation::clearCurrent();
+	}
+
+	{
+		// A full queue drops the target and says so, clear() gives them back
+		TargetCheck check;
+		MiniMaestro maestro(check);
+		SB_PacketPool pool;
+		SB_PacketQueue queue(pool);
+		int accepted = 0;
+		for (int i = 0; i < PACKET_POOL_SIZE + 5; i++) {
+			accepted += queue.pushTarget(maestro, 0, 1 + i);
+		}
+		expect("full: accepted", PACKET_POOL_SIZE, accepted);
+		expect("full: dropped counted", 5, pool.getExhausted());
+		expect("full: cleared", PACKET_POOL_SIZE, queue.clear());
+		expect("full: nothing written", 0, check.targets);
+		expect("full: empty", true, queue.isEmpty());
+		expect("full: all back", 0, pool.getInUse());
+	}
+
+	{
+		// Producers on their own threads, a consumer sending as they go. Each
+		// pushes rising targets on its own channel, retrying when the pool is out
+		TargetCheck check;
+		MiniMaestro maestro(check);
+		SB_PacketPool pool;
+		SB_PacketQueue queue(pool);
+		std::atomic<int> running{PRODUCERS};
+		std::vector<std::thread> producers;
+		for (uint8_t producer = 0; producer < PRODUCERS; producer++) {
+			producers.emplace_back([&, producer]() {
+				for (uint16_t i = 1; i <= PUSHES_PER_PRODUCER; i++) {
+					while (!queue.pushTarget(maestro, producer, i)) {
+						std::this_thread::yield();
+					}
+					// And some churn straight through the pool
+					if (SB_MaestroPacket *spare = pool.acquire()) {
+						pool.release(spare);
+					}
+				}
+				running--;
+			});
+		}
+		while (running > 0 || !queue.isEmpty()) {
+			queue.send(maestro);
+		}
+		for (std::thread &thread : producers) {
+			thread.join();
+		}
+		queue.send(maestro);
+
+		bool allArrived = true;
+		for (uint8_t producer = 0; producer < PRODUCERS; producer++) {
+			allArrived &= check.newest[producer] == PUSHES_PER_PRODUCER;
+		}
+		Serial.print("threads: pool ran out ");
+		Serial.print(pool.getExhausted());
+		Serial.print(" times, high water ");
+		Serial.println(pool.getHighWater());
+		expect("threads: every target written", PRODUCERS * PUSHES_PER_PRODUCER, check.targets);
+		expect("threads: each producer's in order", true, check.inOrder);
+		expect("threads: whole packets", true, check.wellFormed);
+		expect("threads: every newest arrived", true, allArrived);
+		expect("threads: pushes counted", PRODUCERS * PUSHES_PER_PRODUCER, queue.getPushes());
+		expect("threads: sent counted", PRODUCERS * PUSHES_PER_PRODUCER, queue.getSent());
+		expect("threads: all back", 0, pool.getInUse());
+		expect("threads: high water within the pool", true, pool.getHighWater() <= PACKET_POOL_SIZE);
+		expect("threads: no strangers", 0, pool.getBadReleases());
+	}
+
+	Serial.print("Failures: ");
+	Serial.println(failures);
+	return failures;
+}
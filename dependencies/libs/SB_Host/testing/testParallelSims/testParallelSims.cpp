@@ -0,0 +1,204 @@
+/**
+ * Tests what the parameter sweep leans on: the work-stealing pool running every
+ * job exactly once, Serial1 routed per thread so SB_Servos on different threads
+ * drive their own emulators, whole simulations on worker threads coming out the
+ * same as on one thread, and RC recordings surviving a save and load.
+ *
+ * Expected and actual values are printed side by side, the exit code is the
+ * number of mismatches.
+ */
+
+#include <Arduino.h>
+#include <SB_Servo.hpp>
+#include <SB_EmulatedSerial.hpp>
+#include <SB_RcRecording.hpp>
+#include <SB_Simulation.hpp>
+#include <SB_WorkStealingPool.hpp>
+#include "../SB_Expect.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define JOBS 200
+#define SIMULATIONS 8
+
+// SB_Servo numbers servos from a plain static counter
+static std::mutex servoConstruction;
+
+/**
+ * One second of a servo swept by a task, the emulator's final position and the
+ * number of bytes the driver wrote
+ */
+static void sweepServo(uint8_t channel, uint16_t speed, uint32_t *position, uint32_t *bytes) {
+	SB_Simulation simulation;
+	simulation.makeCurrent();
+	SB_MaestroEmulator emulator(12);
+	emulator.setBaud(115200);
+	SB_EmulatedSerial serial(emulator);
+	SB_HostSerialPort::routeThread(&serial);
+
+	MiniMaestro maestro(Serial1);
+	maestro.setSpeed(channel, speed);
+	SB_Servo *servo;
+	{
+		std::lock_guard<std::mutex> guard(servoConstruction);
+		servo = new SB_Servo(channel);
+	}
+	int step = 0;
+	simulation.every("sweep", 20000, [&]() {
+		servo->rotateToDegrees((step++ * 7) % 180);
+		servo->getCurrentDegrees();
+	});
+	simulation.run(1000000, []() {});
+	serial.flush();
+
+	*position = emulator.getPosition(channel);
+	*bytes = serial.getBytesWritten();
+	delete servo;
+	SB_HostSerialPort::routeThread(nullptr);
+	SB_Simulation::clearCurrent();
+}
+
+int main() {
+	// Every job runs once, including ones submitted from inside a job
+	{
+		SB_WorkStealingPool pool(4);
+		std::vector<std::atomic<int>> runs(JOBS * 2);
+		for (int i = 0; i < JOBS; i++) {
+			pool.submit([&pool, &runs, i]() {
+				runs[i]++;
+				pool.submit([&runs, i]() { runs[JOBS + i]++; });
+			});
+		}
+		pool.wait();
+		int once = 0;
+		for (auto &count : runs) {
+			once += count == 1;
+		}
+		expect("jobs run exactly once", JOBS * 2, once);
+		uint64_t executed = 0;
+		for (unsigned i = 0; i < pool.getThreadCount(); i++) {
+			executed += pool.getExecuted(i);
+		}
+		expect("jobs counted", JOBS * 2, executed);
+		expect("threads", 4, pool.getThreadCount());
+	}
+
+	// A job that queues more work on its own worker and then stays busy, the
+	// idle worker has to steal it
+	{
+		SB_WorkStealingPool pool(2);
+		std::atomic<int> done(0);
+		pool.submit([&pool, &done]() {
+			for (int i = 0; i < 20; i++) {
+				pool.submit([&done]() { done++; });
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		});
+		pool.wait();
+		expect("queued jobs done", 20, done);
+		expect("some jobs stolen", 1, pool.getStolen(0) + pool.getStolen(1) > 0);
+	}
+
+	// A worker of one pool submitting to a smaller one, its index is no use there
+	{
+		SB_WorkStealingPool big(4);
+		SB_WorkStealingPool small(1);
+		std::atomic<int> done(0);
+		for (int i = 0; i < 8; i++) {
+			// Busy long enough for every worker of the big pool to get one
+			big.submit([&small, &done]() {
+				std::this_thread::sleep_for(std::chrono::milliseconds(5));
+				small.submit([&done]() { done++; });
+			});
+		}
+		big.wait();
+		small.wait();
+		expect("jobs for another pool done", 8, done);
+		expect("all on the other pool's worker", 8, small.getExecuted(0));
+	}
+
+	// Servos on two threads, each thread's Serial1 reaching its own emulator
+	{
+		uint32_t positions[2];
+		uint32_t bytes[2];
+		std::thread first(sweepServo, 0, 0, &positions[0], &bytes[0]);
+		std::thread second(sweepServo, 3, 0, &positions[1], &bytes[1]);
+		first.join();
+		second.join();
+		uint32_t alone[2];
+		uint32_t aloneBytes[2];
+		sweepServo(0, 0, &alone[0], &aloneBytes[0]);
+		sweepServo(3, 0, &alone[1], &aloneBytes[1]);
+		expect("thread 1 position", alone[0], positions[0]);
+		expect("thread 2 position", alone[1], positions[1]);
+		expect("thread 1 bytes", aloneBytes[0], bytes[0]);
+		expect("thread 2 bytes", aloneBytes[1], bytes[1]);
+		expect("servo reached the emulator", 1, positions[0] != 0);
+	}
+	expect("main thread not routed", 1, SB_HostSerialPort::getRoute() == nullptr);
+
+	// Simulations on a pool match the same simulations run one after another
+	{
+		uint32_t serialPositions[SIMULATIONS];
+		uint32_t serialBytes[SIMULATIONS];
+		for (int i = 0; i < SIMULATIONS; i++) {
+			sweepServo(i % 4, 10 * i, &serialPositions[i], &serialBytes[i]);
+		}
+		uint32_t poolPositions[SIMULATIONS];
+		uint32_t poolBytes[SIMULATIONS];
+		{
+			SB_WorkStealingPool pool(3);
+			for (int i = 0; i < SIMULATIONS; i++) {
+				pool.submit([i, &poolPositions, &poolBytes]() {
+					sweepServo(i % 4, 10 * i, &poolPositions[i], &poolBytes[i]);
+				});
+			}
+		}
+		int same = 0;
+		for (int i = 0; i < SIMULATIONS; i++) {
+			same += serialPositions[i] == poolPositions[i] && serialBytes[i] == poolBytes[i];
+		}
+		expect("pool simulations deterministic", SIMULATIONS, same);
+	}
+
+	// Recordings
+	{
+		SB_RcRecording recording;
+		uint16_t first[2] = {1500, 1200};
+		uint16_t second[2] = {1900, 1250};
+		recording.add(0, first, 2);
+		recording.add(22000, second, 2);
+		recording.add(10000, first, 2);
+		expect("out of order row refused", RC_RECORDING_FORMAT_ERROR_BIT, recording.getErrorCode());
+		recording.clearErrorCode();
+		expect("rows", 2, recording.size());
+		expect("held before the second row", 1500, recording.widthAt(0, 21999));
+		expect("second row", 1900, recording.widthAt(0, 22000));
+		expect("held after the end", 1250, recording.widthAt(1, 1000000));
+		expect("missing channel neutral", RC_RECORDING_NEUTRAL_US, recording.widthAt(5, 0));
+
+		const char *path = "/tmp/testParallelSims.csv";
+		expect("saved", 1, recording.save(path));
+		SB_RcRecording loaded;
+		expect("loaded", 1, loaded.load(path));
+		expect("loaded channels", 2, loaded.getChannelCount());
+		expect("loaded duration", 22000, loaded.getDurationUs());
+		expect("loaded width", 1250, loaded.widthAt(1, 30000));
+		remove(path);
+
+		FILE *bad = fopen(path, "w");
+		fprintf(bad, "time_us,a,b\n0,1500,1500\n100,1500\n");
+		fclose(bad);
+		expect("short row refused", 0, loaded.load(path));
+		expect("short row error", RC_RECORDING_FORMAT_ERROR_BIT, loaded.getErrorCode());
+		remove(path);
+		expect("missing file", 0, loaded.load("/nonexistent/recording.csv"));
+	}
+
+	Serial.print("Failures: ");
+	Serial.println(failures);
+	return failures;
+}
@@ -0,0 +1,185 @@
+/**
+ * Tests SB_PollPlanner (in SB_Servo) against the emulator in virtual time:
+ * channels sitting on their targets backing off to the slow period, a ramping
+ * one read every frame while it moves and backing off again once it's there,
+ * twelve moving channels at 9600 baud kept to the budget and read in turn,
+ * and the readings' ages. Also SB_Servo's pollPositions() and
+ * getPolledDegrees().
+ *
+ * Expected and actual values are printed side by side, the exit code is the
+ * number of mismatches.
+ */
+
+#include <Arduino.h>
+#include <PololuMaestro.h>
+#include <SB_EmulatedSerial.hpp>
+#include <SB_HostSerial.hpp>
+#include <SB_PollPlanner.hpp>
+#include <SB_Servo.hpp>
+#include <SB_Simulation.hpp>
+#include "../SB_Expect.h"
+
+#define GET_POSITION 0x90
+
+int main() {
+	SB_Simulation simulation;
+	simulation.makeCurrent();
+
+	{
+		SB_MaestroEmulator emulator(12);
+		emulator.setBaud(115200);
+		SB_EmulatedSerial serial(emulator);
+		MiniMaestro maestro(serial);
+		// No baud, no budget
+		SB_PollPlanner planner(maestro);
+		expect("unread: no age", UINT32_MAX, planner.getAgeUs(0));
+		for (uint8_t channel = 0; channel < 4; channel++) {
+			planner.track(channel);
+			maestro.setTarget(channel, 6000);
+			planner.commanded(channel, 6000);
+		}
+
+		// Sitting still: backs off to a read a second
+		for (int ms = 0; ms < 10000; ms++) {
+			planner.update();
+			simulation.advance(1000);
+		}
+		bool slow = true;
+		bool fewReads = true;
+		for (uint8_t channel = 0; channel < 4; channel++) {
+			slow &= planner.getPeriodUs(channel) == POLL_DEFAULT_SLOW_US;
+			// Backing off from 20 ms to 1 s takes ten reads, then one a second
+			fewReads &= planner.getReads(channel) <= 10 + 10;
+		}
+		Serial.print("still: reads of channel 0 in 10 s ");
+		Serial.println(planner.getReads(0));
+		expect("still: slow period", true, slow);
+		expect("still: few reads", true, fewReads);
+		expect("still: position", 6000, planner.getReading(0).position);
+		expect("still: age", micros() - planner.getReading(0).readUs, planner.getAgeUs(0));
+		expect("still: age under the period", true, planner.getAgeUs(0) <= POLL_DEFAULT_SLOW_US);
+
+		// Ramping 500 us at 4 us a frame, 125 frames
+		maestro.setSpeed(0, 8);
+		maestro.setTarget(0, 8000);
+		planner.commanded(0, 8000);
+		expect("move: fast period", POLL_DEFAULT_FAST_US, planner.getPeriodUs(0));
+		uint32_t readsBefore = planner.getReads(0);
+		uint32_t otherBefore = planner.getReads(1);
+		uint32_t arrivedUs = 0;
+		uint32_t startUs = micros();
+		uint32_t maxAgeUs = 0;
+		bool tracking = true;
+		while (micros() - startUs < 4000000) {
+			planner.update();
+			serial.deliver(micros());
+			const SB_PollReading &reading = planner.getReading(0);
+			if (!arrivedUs) {
+				if (emulator.getPosition(0) == 8000) {
+					arrivedUs = micros() - startUs;
+				}
+				if (planner.getAgeUs(0) > maxAgeUs) {
+					maxAgeUs = planner.getAgeUs(0);
+				}
+				// No more than a fast period and a frame's step behind
+				tracking &= emulator.getPosition(0) - reading.position <= 2 * 16;
+			}
+			simulation.advance(1000);
+		}
+		uint32_t moveReads = planner.getReads(0) - readsBefore;
+		Serial.print("move: arrived after ms ");
+		Serial.print(arrivedUs / 1000);
+		Serial.print(", reads ");
+		Serial.print(moveReads);
+		Serial.print(", oldest reading us ");
+		Serial.println(maxAgeUs);
+		expect("move: took 125 frames", true, arrivedUs >= 2400000 && arrivedUs <= 2600000);
+		expect("move: read every frame", true, moveReads >= arrivedUs / POLL_DEFAULT_FAST_US - 2);
+		expect("move: reading kept fresh", true, maxAgeUs <= POLL_DEFAULT_FAST_US + 1000);
+		expect("move: reading follows", true, tracking);
+		// 1.5 s after arriving, 10 reads to back off and the rest a second apart
+		expect("move: backs off after", true, moveReads <= arrivedUs / POLL_DEFAULT_FAST_US + 12);
+		expect("move: still channels left alone", true, planner.getReads(1) - otherBefore <= 5);
+		expect("move: arrived", 8000, planner.getReading(0).position);
+		expect("no budget: nothing put off", 0, planner.getDeferred());
+		serial.flush();
+	}
+
+	{
+		// Twelve channels swinging back and forth at 9600 baud: 240 reads a
+		// second fit, a quarter of that for the budget
+		SB_MaestroEmulator emulator(12);
+		emulator.setBaud(9600);
+		SB_EmulatedSerial serial(emulator);
+		MiniMaestro maestro(serial);
+		SB_PollPlanner planner(maestro, 9600);
+		expect("budget: reads a second", 60, planner.getBudgetReadsPerSecond());
+		for (uint8_t channel = 0; channel < 12; channel++) {
+			planner.track(channel);
+			maestro.setSpeed(channel, 20);
+		}
+		uint32_t startUs = micros();
+		uint32_t queriesBefore = emulator.getCommandStats(GET_POSITION).count;
+		for (int ms = 0; ms < 5000; ms++) {
+			if (ms % 500 == 0) {
+				uint16_t target = ms % 1000 ? 4000 : 8000;
+				for (uint8_t channel = 0; channel < 12; channel++) {
+					maestro.setTarget(channel, target);
+					planner.commanded(channel, target);
+				}
+			}
+			planner.update();
+			simulation.advance(1000);
+		}
+		serial.flush();
+		uint32_t elapsedUs = micros() - startUs;
+		uint32_t queries = emulator.getCommandStats(GET_POSITION).count - queriesBefore;
+		uint32_t least = UINT32_MAX;
+		uint32_t most = 0;
+		for (uint8_t channel = 0; channel < 12; channel++) {
+			uint32_t reads = planner.getReads(channel);
+			least = reads < least ? reads : least;
+			most = reads > most ? reads : most;
+		}
+		Serial.print("budget: reads ");
+		Serial.print(planner.getReads());
+		Serial.print(" in ms ");
+		Serial.print(elapsedUs / 1000);
+		Serial.print(", per channel ");
+		Serial.print(least);
+		Serial.print(" to ");
+		Serial.println(most);
+		expect("budget: every read sent", planner.getReads(), queries);
+		expect("budget: kept to", true, planner.getReads() <= 60 * elapsedUs / 1000000 + POLL_BURST_READS);
+		expect("budget: used", true, planner.getReads() >= 60 * elapsedUs / 1000000 - 12);
+		expect("budget: put off", true, planner.getDeferred() > 0);
+		expect("budget: each in turn", true, most - least <= 1);
+	}
+
+	{
+		// SB_Servo's planner, polled from the loop
+		SB_MaestroEmulator emulator(12);
+		emulator.setBaud(115200);
+		SB_EmulatedSerial serial(emulator);
+		SB_HostSerialPort::routeThread(&serial);
+		SB_Servo rudder(0);
+		uint32_t age = 0;
+		expect("servo: unread", -1, rudder.getPolledDegrees(&age));
+		expect("servo: unread age", UINT32_MAX, age);
+		rudder.rotateToDegrees(90);
+		uint32_t reads = 0;
+		for (int ms = 0; ms < 3000; ms++) {
+			reads += SB_Servo::pollPositions();
+			simulation.advance(1000);
+		}
+		expect("servo: polled", 90, rudder.getPolledDegrees(&age));
+		expect("servo: age", true, age <= POLL_DEFAULT_SLOW_US);
+		expect("servo: backed off", true, reads <= 3 + 10);
+		SB_HostSerialPort::routeThread(nullptr);
+	}
+
+	SB_Simulation::clearCurrent();
+	Serial.print("Failures: ");
+	Serial.println(failures);
+	return failures;
+}
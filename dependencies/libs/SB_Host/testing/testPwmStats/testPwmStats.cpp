@@ -0,0 +1,153 @@
+/**
+ * Tests the channel statistics in main/pwm_stats against the same numbers
+ * worked out in floating point from the widths the simulated receiver sent:
+ * count, mean, variance, min, max and histogram, pulses missed by a slow loop,
+ * and the snapshot and reset commands over a stream.
+ *
+ * Expected and actual values are printed side by side, the exit code is the
+ * number of mismatches.
+ */
+
+#include <Arduino.h>
+#include <SB_Simulation.hpp>
+#include "../SB_Expect.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "pwm_channel.h"
+#include "pwm_stats.h"
+
+pwmChannel CH2;
+pwmChannel CH3;
+
+#include "pwm_channel.ino"
+#include "pwm_stats.ino"
+
+/**
+ * Commands in, the printed snapshot out
+ */
+class BufferStream : public Stream {
+	public:
+		std::string input;
+		std::string output;
+
+		size_t write(uint8_t dataByte) override { output += (char) dataByte; return 1; }
+		int available() override { return input.size(); }
+		int read() override {
+			if (input.empty()) {
+				return -1;
+			}
+			int c = (uint8_t) input[0];
+			input.erase(0, 1);
+			return c;
+		}
+		int peek() override { return input.empty() ? -1 : (uint8_t) input[0]; }
+};
+
+int main() {
+	SB_Simulation simulation;
+	simulation.makeCurrent();
+
+	// CH2 a noisy stick, CH3 steady with the odd glitch
+	std::vector<int> sent2;
+	std::vector<int> sent3;
+	SB_RcPulseGenerator ch2(simulation, CH2_PIN, 22000, [&](uint64_t nowUs) {
+		int width = 1500 + (int) (300 * sin(nowUs / 700000.0)) + (int) (nowUs / 22000 * 7919 % 41) - 20;
+		sent2.push_back(width);
+		return (uint16_t) width;
+	});
+	SB_RcPulseGenerator ch3(simulation, CH3_PIN, 22000, [&](uint64_t nowUs) {
+		int width = nowUs / 22000 % 50 == 7 ? 2400 : 1100;
+		sent3.push_back(width);
+		return (uint16_t) width;
+	});
+	initPWM();
+	ch2.start(100);
+	ch3.start(5000);
+	simulation.setLoopCost(500);
+	simulation.run(10000000, []() { pwmStatsUpdate(); });
+	// The last pulses may still be in flight
+	sent2.resize(CH2.pulses);
+	sent3.resize(CH3.pulses);
+
+	pwmStatsSnapshot snapshot;
+	pwmStatsTake(CH2_INDEX, snapshot);
+	double mean = 0;
+	for (int width : sent2) {
+		mean += width;
+	}
+	mean /= sent2.size();
+	double variance = 0;
+	for (int width : sent2) {
+		variance += (width - mean) * (width - mean);
+	}
+	variance /= sent2.size() - 1;
+	expect("count", sent2.size(), snapshot.count);
+	expect("none missed", 0, snapshot.missed);
+	expect("mean in 1/256 us", lround(mean * 256), snapshot.meanQ8);
+	expect("variance", lround(variance), snapshot.varianceUs2);
+	expect("min", *std::min_element(sent2.begin(), sent2.end()), snapshot.min);
+	expect("max", *std::max_element(sent2.begin(), sent2.end()), snapshot.max);
+	uint32_t bins[PWM_STATS_BINS] = {0};
+	for (int width : sent2) {
+		bins[pwmStatsBin(width)]++;
+	}
+	int binMismatches = 0;
+	uint32_t binTotal = 0;
+	for (int bin = 0; bin < PWM_STATS_BINS; bin++) {
+		binMismatches += bins[bin] != snapshot.histogram[bin];
+		binTotal += snapshot.histogram[bin];
+	}
+	expect("histogram bins", 0, binMismatches);
+	expect("histogram total", snapshot.count, binTotal);
+
+	pwmStatsTake(CH3_INDEX, snapshot);
+	expect("glitches in the top bin", std::count(sent3.begin(), sent3.end(), 2400),
+			snapshot.histogram[PWM_STATS_BINS - 1]);
+	expect("steady in its bin", std::count(sent3.begin(), sent3.end(), 1100), snapshot.histogram[pwmStatsBin(1100)]);
+	expect("steady max", 2400, snapshot.max);
+
+	// A loop slower than the frames misses pulses, and says so
+	pwmStatsReset();
+	uint32_t before = CH2.pulses;
+	simulation.setLoopCost(50000);
+	simulation.run(1100000, []() { pwmStatsUpdate(); });
+	pwmStatsUpdate();
+	pwmStatsTake(CH2_INDEX, snapshot);
+	expect("sampled and missed add up", CH2.pulses - before, snapshot.count + snapshot.missed);
+	expect("slow loop misses some", true, snapshot.missed > 0);
+
+	// Over a stream: 's' prints, 'S' prints and resets, 'r' resets
+	BufferStream link;
+	link.input = "xs";
+	expect("unknown command ignored", 0, pwmStatsCommand(link));
+	expect("snapshot command", 's', pwmStatsCommand(link));
+	expect("one line a channel", 2, std::count(link.output.begin(), link.output.end(), '\n'));
+	expect("CH2 line", 0, link.output.find("CH2 n="));
+	expect("histogram printed", true, link.output.find("hist=") != std::string::npos);
+	expect("nothing waiting", 0, pwmStatsCommand(link));
+
+	link.input = "S";
+	link.output.clear();
+	pwmStatsCommand(link);
+	pwmStatsTake(CH2_INDEX, snapshot);
+	expect("snapshot then reset", 0, snapshot.count);
+	expect("printed before the reset", true, link.output.find("CH2 n=0 ") == std::string::npos);
+	simulation.setLoopCost(500);
+	simulation.run(100000, []() { pwmStatsUpdate(); });
+	pwmStatsTake(CH2_INDEX, snapshot);
+	expect("counting again after the reset", true, snapshot.count >= 4);
+	expect("nothing missed across the reset", 0, snapshot.missed);
+	link.input = "r";
+	pwmStatsCommand(link);
+	pwmStatsTake(CH2_INDEX, snapshot);
+	expect("reset command", 0, snapshot.count);
+
+	SB_Simulation::clearCurrent();
+	Serial.print("Failures: ");
+	Serial.println(failures);
+	return failures;
+}
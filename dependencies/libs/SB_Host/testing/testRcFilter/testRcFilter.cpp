@@ -0,0 +1,177 @@
+/**
+ * Tests SB_RcFilter (in SB_Servo): the portable DSP instructions against what
+ * the ARM reference says they do, the packed path bit-exact with the scalar one
+ * over random and glitchy input for every window and a spread of IIR weights,
+ * and the filter's response to steps and out of range widths.
+ *
+ * Expected and actual values are printed side by side, the exit code is the
+ * number of mismatches.
+ */
+
+#include <Arduino.h>
+#include <SB_RcFilter.hpp>
+#include "../SB_Expect.h"
+
+#include <random>
+
+/**
+ * Widths like the AR620's with noise, plus the occasional glitch: a missed
+ * edge (a whole frame), a pwmValue from before the first pulse, a negative one
+ */
+static int width(std::mt19937 &random, int channel, uint32_t frame) {
+	std::uniform_int_distribution<int> noise(-12, 12);
+	std::uniform_int_distribution<int> glitch(0, 199);
+	switch (glitch(random)) {
+		case 0: return 20000 + noise(random);
+		case 1: return (int) (frame * 20000u + 123456789u);
+		case 2: return -(int) frame;
+		case 3: return 0;
+	}
+	int stick = 1500 + (int) (500 * sin(frame / (40.0 + 7 * channel)));
+	return stick + noise(random);
+}
+
+/**
+ * Runs a filter of each path over the same frames
+ * @return frames where any channel differs
+ */
+static int disagreements(uint8_t channels, uint8_t windowShift, uint16_t alpha, uint32_t frames) {
+	SB_RcFilter packed(channels, windowShift, alpha);
+	SB_RcFilter scalar(channels, windowShift, alpha);
+	std::mt19937 random(channels * 1000 + windowShift * 100 + alpha);
+	int mismatches = 0;
+	for (uint32_t frame = 0; frame < frames; frame++) {
+		int widths[RC_FILTER_MAX_CHANNELS];
+		for (uint8_t c = 0; c < channels; c++) {
+			widths[c] = width(random, c, frame);
+		}
+		int packedOut[RC_FILTER_MAX_CHANNELS];
+		int scalarOut[RC_FILTER_MAX_CHANNELS];
+		packed.filter(widths, packedOut);
+		scalar.filterScalar(widths, scalarOut);
+		if (memcmp(packedOut, scalarOut, channels * sizeof(int)) != 0) {
+			mismatches++;
+		}
+		if (frame == frames / 2) {
+			packed.reset();
+			scalar.reset();
+		}
+	}
+	return mismatches;
+}
+
+int main() {
+	Serial.print("DSP instructions: ");
+	Serial.println(SB_RcFilter::usesDSP() ? "yes" : "portable");
+
+	// Portable instructions, per the ARMv7-M reference: lanes wrap independently,
+	// SMUAD is the sum of the two signed lane products
+	expect("sadd16 lanes", 0x00050003, SB_RcFilter::sadd16(0x00020001, 0x00030002));
+	expect("sadd16 wraps per lane", 0x00018000, SB_RcFilter::sadd16(0x00007FFF, 0x00010001));
+	expect("sadd16 no carry between lanes", 0x00000000, SB_RcFilter::sadd16(0x0000FFFF, 0x00000001));
+	expect("ssub16 negative lanes", 0xFFFF0001, SB_RcFilter::ssub16(0x00010003, 0x00020002));
+	expect("smuad signed", -6 + 20, SB_RcFilter::smuad(0x0004FFFE, 0x00050003));
+	expect("smuad extremes", 2 * 32768 * 32767, (long) SB_RcFilter::smuad(0x80008000, 0x80018001));
+
+	// Bit-exact over every window, channel counts odd and even, and weights
+	// from barely smoothing to not at all
+	const uint16_t alphas[] = {1, 37, 1024, 4096, 8192, 12345, 16383, RC_FILTER_ALPHA_ONE};
+	int mismatches = 0;
+	for (uint8_t channels = 1; channels <= RC_FILTER_MAX_CHANNELS; channels++) {
+		for (uint8_t shift = 0; shift <= RC_FILTER_MAX_WINDOW_SHIFT; shift++) {
+			for (uint16_t alpha : alphas) {
+				mismatches += disagreements(channels, shift, alpha, 4000);
+			}
+		}
+	}
+	expect("packed and scalar frames differing", 0, mismatches);
+
+	// Switching paths mid stream is seamless, they share the state
+	{
+		SB_RcFilter mixed(6, 3, 3000);
+		SB_RcFilter scalar(6, 3, 3000);
+		std::mt19937 random(7);
+		int differing = 0;
+		for (uint32_t frame = 0; frame < 1000; frame++) {
+			int widths[6];
+			for (uint8_t c = 0; c < 6; c++) {
+				widths[c] = width(random, c, frame);
+			}
+			int mixedOut[6];
+			int scalarOut[6];
+			if (frame % 3) {
+				mixed.filter(widths, mixedOut);
+			} else {
+				mixed.filterScalar(widths, mixedOut);
+			}
+			scalar.filterScalar(widths, scalarOut);
+			differing += memcmp(mixedOut, scalarOut, sizeof(mixedOut)) != 0;
+		}
+		expect("mixed paths differing", 0, differing);
+	}
+
+	// Primed from the first frame, a held stick comes straight through
+	{
+		SB_RcFilter filter(6, 2, 4096);
+		int widths[6] = {1000, 1250, 1500, 1751, 2000, 1499};
+		int out[6];
+		filter.filter(widths, out);
+		expect("first frame low", 1000, out[0]);
+		expect("first frame odd", 1751, out[3]);
+		for (int i = 0; i < 10; i++) {
+			filter.filter(widths, out);
+		}
+		expect("held high", 2000, out[4]);
+		expect("held near center", 1499, out[5]);
+	}
+
+	// A step takes the window to get through the average, then the IIR closes in
+	{
+		SB_RcFilter filter(2, 2, RC_FILTER_ALPHA_ONE);
+		int widths[2] = {1000, 2000};
+		int out[2];
+		filter.filter(widths, out);
+		widths[0] = 2000;
+		filter.filter(widths, out);
+		expect("quarter of the step", 1250, out[0]);
+		filter.filter(widths, out);
+		filter.filter(widths, out);
+		expect("three quarters", 1750, out[0]);
+		filter.filter(widths, out);
+		expect("through the window", 2000, out[0]);
+
+		SB_RcFilter slow(1, 0, RC_FILTER_ALPHA_ONE / 2);
+		int step = 1000;
+		slow.filter(&step, out);
+		step = 2000;
+		slow.filter(&step, out);
+		expect("half way in one frame", 1500, out[0]);
+		for (int i = 0; i < 30; i++) {
+			slow.filter(&step, out);
+		}
+		expect("settles on the step", 2000, out[0]);
+	}
+
+	// Garbage widths saturate instead of wrapping
+	{
+		SB_RcFilter filter(2, 0, RC_FILTER_ALPHA_ONE);
+		int widths[2] = {1500 + 100000, 1500 - 100000};
+		int out[2];
+		filter.filter(widths, out);
+		expect("saturated high", 1500 + 2047, out[0]);
+		expect("saturated low", 1500 - 2048, out[1]);
+	}
+
+	// Bad configuration is clamped and flagged
+	{
+		SB_RcFilter filter(RC_FILTER_MAX_CHANNELS + 1, RC_FILTER_MAX_WINDOW_SHIFT + 1, 0);
+		expect("bad configuration",
+				RC_FILTER_CHANNEL_ERROR_BIT | RC_FILTER_WINDOW_ERROR_BIT | RC_FILTER_ALPHA_ERROR_BIT,
+				filter.getErrorCode());
+		expect("channels clamped", RC_FILTER_MAX_CHANNELS, filter.getChannels());
+	}
+
+	Serial.print("Failures: ");
+	Serial.println(failures);
+	return failures;
+}
@@ -0,0 +1,144 @@
+/**
+ * Tests SB_Servo's readback elision against the emulator in virtual time: a
+ * loop calling getCurrentDegrees() on two servos every millisecond. Sitting
+ * still they're answered from the targets sent, with a getPosition() only on
+ * the verification schedule; while one ramps to a new target it's read and
+ * follows the Maestro's output, and one getMovingState() saying nothing moves
+ * ends that. An output moved behind SB_Servo's back is caught by the next
+ * verification read, and with elision off every call reads.
+ *
+ * Expected and actual values are printed side by side, the exit code is the
+ * number of mismatches.
+ */
+
+#include <Arduino.h>
+#include <PololuMaestro.h>
+#include <SB_EmulatedSerial.hpp>
+#include <SB_HostSerial.hpp>
+#include <SB_Servo.hpp>
+#include <SB_Simulation.hpp>
+#include "../SB_Expect.h"
+
+#define GET_POSITION 0x90
+#define GET_MOVING_STATE 0x93
+#define RUN_MS 2000
+
+static uint32_t queries(SB_MaestroEmulator &emulator, uint8_t command) {
+	return emulator.getCommandStats(command).count;
+}
+
+int main() {
+	SB_Simulation simulation;
+	simulation.makeCurrent();
+
+	SB_MaestroEmulator emulator(12);
+	emulator.setBaud(115200);
+	SB_EmulatedSerial serial(emulator);
+	SB_HostSerialPort::routeThread(&serial);
+	SB_Servo rudder(0);
+	SB_Servo sail(1);
+
+	rudder.rotateToDegrees(90);
+	sail.rotateToDegrees(45);
+	simulation.advance(100000);
+
+	{
+		// Sitting still: the targets sent, a getPosition() per servo a second
+		uint32_t positionsBefore = queries(emulator, GET_POSITION);
+		bool right = true;
+		for (uint32_t ms = 0; ms < RUN_MS; ms++) {
+			right &= rudder.getCurrentDegrees() == 90;
+			right &= sail.getCurrentDegrees() == 45;
+			simulation.advance(1000);
+		}
+		uint32_t positions = queries(emulator, GET_POSITION) - positionsBefore;
+		Serial.print("still: getPositions sent ");
+		Serial.println(positions);
+		expect("still: every answer right", true, right);
+		expect("still: read on the verification schedule", true,
+				positions <= 2 * (RUN_MS * 1000 / READBACK_VERIFY_US + 1));
+		expect("still: read at all", true, positions >= 2 * (RUN_MS * 1000 / READBACK_VERIFY_US));
+		expect("still: reads and elided reads add up", 2 * RUN_MS,
+				SB_Servo::getElidedReads() + positions);
+	}
+
+	{
+		// Ramping at 4 us a frame from 90 to 135 degrees, 500 us of target
+		// takes 125 frames; read all the way and following the output
+		MiniMaestro(serial).setSpeed(0, 8);
+		rudder.rotateToDegrees(135);
+		uint32_t positionsBefore = queries(emulator, GET_POSITION);
+		uint32_t movingBefore = queries(emulator, GET_MOVING_STATE);
+		uint32_t elidedBefore = SB_Servo::getElidedReads();
+		bool following = true;
+		uint32_t startUs = micros();
+		uint32_t arrivedMs = 0;
+		uint32_t loopsToArrive = 0;
+		for (uint32_t ms = 0; ms < RUN_MS * 3; ms++) {
+			float degrees = rudder.getCurrentDegrees();
+			serial.deliver(micros());
+			float output = 180.0f * (emulator.getPosition(0) - 2000) / (10000 - 2000);
+			// Within a frame's step of the Maestro's output
+			following &= degrees <= output + 1 && degrees >= output - 1;
+			if (!arrivedMs && emulator.getPosition(0) == emulator.getTarget(0)) {
+				// Reads take time of their own, so the loop runs slower than a ms
+				arrivedMs = (micros() - startUs) / 1000;
+				loopsToArrive = ms;
+			}
+			sail.getCurrentDegrees();
+			simulation.advance(1000);
+		}
+		uint32_t positions = queries(emulator, GET_POSITION) - positionsBefore;
+		uint32_t moving = queries(emulator, GET_MOVING_STATE) - movingBefore;
+		Serial.print("moving: arrived after ms ");
+		Serial.print(arrivedMs);
+		Serial.print(", getPositions ");
+		Serial.print(positions);
+		Serial.print(", getMovingStates ");
+		Serial.println(moving);
+		expect("moving: follows the output", true, following);
+		expect("moving: took 125 frames", true, arrivedMs >= 120 * 20 && arrivedMs <= 130 * 20);
+		expect("moving: rudder read while it moved", true, positions >= loopsToArrive);
+		// One getMovingState() a frame while it moved, and reads for a frame after
+		expect("moving: a getMovingState() a frame", true, moving <= arrivedMs / 20 + 2);
+		expect("moving: reads stop once there", true,
+				positions <= loopsToArrive + 20 + 2 * (RUN_MS * 3 * 1000 / READBACK_VERIFY_US + 1));
+		expect("moving: sail still elided", true, SB_Servo::getElidedReads() - elidedBefore >= RUN_MS * 3 - 10);
+		expect("moving: arrived", 135, rudder.getCurrentDegrees());
+	}
+
+	{
+		// Moved behind SB_Servo's back: caught at the next verification read
+		MiniMaestro other(serial);
+		other.setTarget(1, 6000);
+		simulation.advance(100000);
+		expect("outside: not read yet", 45, sail.getCurrentDegrees());
+		uint32_t caughtMs = 0;
+		for (uint32_t ms = 0; ms < RUN_MS && !caughtMs; ms++) {
+			if (sail.getCurrentDegrees() == 90) {
+				caughtMs = ms;
+			}
+			simulation.advance(1000);
+		}
+		expect("outside: caught within the verification interval", true,
+				caughtMs > 0 && caughtMs <= READBACK_VERIFY_US / 1000);
+	}
+
+	{
+		// Off: every call a getPosition()
+		SB_Servo::setReadbackElision(false);
+		uint32_t positionsBefore = queries(emulator, GET_POSITION);
+		for (int i = 0; i < 100; i++) {
+			rudder.getCurrentDegrees();
+			simulation.advance(1000);
+		}
+		expect("off: every call read", 100, queries(emulator, GET_POSITION) - positionsBefore);
+		SB_Servo::setReadbackElision(true);
+	}
+
+	SB_HostSerialPort::routeThread(nullptr);
+	SB_Simulation::clearCurrent();
+	Serial.print("Failures: ");
+	Serial.println(failures);
+	return failures;
+}
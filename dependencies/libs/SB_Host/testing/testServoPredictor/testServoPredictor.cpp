@@ -0,0 +1,235 @@
+/**
+ * Tests SB_ServoPredictor (in SB_Servo): the dead time and rate model worked
+ * through by hand, readings correcting it, and against the emulator in virtual
+ * time: a model identified from a servo's own getPosition() log tracks the
+ * Maestro's output far closer than the last target or the last reading do,
+ * without reading it, and its prediction runs the dead time ahead of it.
+ *
+ * Expected and actual values are printed side by side, the exit code is the
+ * number of mismatches.
+ */
+
+#include <Arduino.h>
+#include <PololuMaestro.h>
+#include <SB_EmulatedSerial.hpp>
+#include <SB_HostSerial.hpp>
+#include <SB_Servo.hpp>
+#include <SB_ServoPredictor.hpp>
+#include <SB_Simulation.hpp>
+#include "../SB_Expect.h"
+
+#include <vector>
+
+#define SPEED 20 // quarter us per 10 ms, 2000 quarter us a second
+
+int main() {
+	SB_Simulation simulation;
+	simulation.makeCurrent();
+
+	{
+		// 30 ms dead time, then 4000 quarter us a second
+		SB_ServoModel model;
+		model.delayUs = 30000;
+		model.rate = 4000;
+		SB_ServoPredictor predictor(model);
+		uint32_t t = 1000000;
+		expect("model: nothing before the first target", 0, predictor.estimate(t));
+		predictor.commanded(t, 6000);
+		predictor.commanded(t + 1000, 8000);
+		expect("model: still there inside the dead time", 6000, predictor.estimate(t + 30000));
+		expect("model: half way", 7000, predictor.estimate(t + 31000 + 250000));
+		expect("model: arrived", 8000, predictor.estimate(t + 31000 + 500000));
+		SB_ServoPredictor ahead(model);
+		ahead.commanded(t, 6000);
+		ahead.commanded(t + 1000, 8000);
+		expect("model: prediction skips the dead time", 7000, ahead.predict(t + 1000 + 250000));
+		expect("model: while the estimate is behind", 7000 - 30000 * 4000 / 1000000, ahead.estimate(t + 1000 + 250000));
+		expect("model: and is there first", 8000, ahead.predict(t + 1000 + 500000));
+
+		// A reading 10 short of the model holds both 10 short
+		predictor.measured(t + 600000, 7990);
+		expect("correct: estimate", 7990, predictor.estimate(t + 700000));
+		expect("correct: prediction", 7990, predictor.predict(t + 700000));
+		predictor.commanded(t + 700000, 6000);
+		expect("correct: carried into the next move", 5990, predictor.predict(t + 2000000));
+
+		// Back and forth inside the dead time
+		SB_ServoPredictor quick(model);
+		quick.commanded(t, 6000);
+		quick.commanded(t + 50000, 6400);
+		quick.commanded(t + 100000, 6000);
+		expect("reversal: goes toward the first", 6200, quick.estimate(t + 130000));
+		expect("reversal: then back", 6100, quick.estimate(t + 155000));
+		expect("reversal: and stops", 6000, quick.estimate(t + 500000));
+
+		// Left alone for an hour, longer than half the micros() wrap, and
+		// across the wrap itself
+		SB_ServoPredictor idle(model);
+		uint32_t late = UINT32_MAX - 100000;
+		idle.commanded(late, 6000);
+		idle.commanded(late + 1000, 8000);
+		uint32_t hour = 3600000000u;
+		expect("idle: caught up after an hour", 8000, idle.estimate(late + hour));
+		idle.commanded(late + hour, 6000);
+		expect("idle: moves again", 7000, idle.estimate(late + hour + 30000 + 500000 / 2));
+		SB_ServoPredictor wrapping(model);
+		wrapping.commanded(late, 6000);
+		wrapping.commanded(late + 1000, 8000);
+		expect("wrap: half way over the wrap", 7000, wrapping.estimate(late + 31000 + 250000));
+
+		// A shorter dead time, the target it's now past takes over straight away
+		SB_ServoPredictor shorter(model);
+		shorter.commanded(t, 6000);
+		shorter.commanded(t + 1000, 8000);
+		shorter.estimate(t + 20000);
+		SB_ServoModel quicker = model;
+		quicker.delayUs = 10000;
+		shorter.setModel(quicker);
+		expect("shorter dead time: moving from now", 6000 + 10000 * 4000 / 1000000, shorter.estimate(t + 30000));
+
+		// No model at all is just the last target
+		SB_ServoPredictor none;
+		none.commanded(t, 5000);
+		none.commanded(t + 10, 7000);
+		expect("no model: the target", 7000, none.estimate(t + 10));
+
+		// Too many on the way at once
+		SB_ServoPredictor busy(model);
+		for (int i = 0; i < PREDICTOR_HISTORY + 1; i++) {
+			busy.commanded(t + i * 100, 6000 + i);
+		}
+		expect("history: bit", PREDICTOR_HISTORY_BIT, busy.getErrorCode());
+		expect("history: the last still arrives", 6000 + PREDICTOR_HISTORY, busy.estimate(t + 1000000));
+
+		// Identified back from readings of the model itself, every 4 ms
+		SB_ServoPredictor truth(model);
+		std::vector<SB_LagSample> samples;
+		int targets[] = {6000, 7000, 5200, 5600, 8000};
+		uint32_t now = t;
+		for (int target : targets) {
+			truth.commanded(now, target);
+			samples.push_back({now, (uint16_t) target, 0});
+			for (int i = 0; i < 200; i++) {
+				samples.push_back({now, (uint16_t) target, (uint16_t) truth.estimate(now)});
+				now += 4000;
+			}
+			now += 1300;
+		}
+		SB_ServoModel found;
+		expect("identify model: works", true, SB_ServoPredictor::identify(samples.data(), samples.size(), found));
+		expect("identify model: rate", model.rate, found.rate);
+		expect("identify model: dead time within 1 ms", true, abs((long) found.delayUs - (long) model.delayUs) <= 1000);
+		SB_ServoModel untouched;
+		expect("identify: nothing to go on", false, SB_ServoPredictor::identify(samples.data(), 1, untouched));
+
+		SB_LagSample small[3];
+		none.startLog(small, 3);
+		for (int i = 0; i < 4; i++) {
+			none.measured(t + i, 6000);
+		}
+		expect("log: full", 3, none.getLogLength());
+		expect("log: bit", PREDICTOR_LOG_FULL_BIT, none.getErrorCode());
+		expect("log: reading target", 7000, small[0].target);
+		expect("log: reading position", 6000, small[0].position);
+	}
+
+	{
+		// Against the emulator: the Maestro ramps the channel at SPEED on its 20 ms frames
+		SB_MaestroEmulator emulator(12);
+		emulator.setBaud(115200);
+		SB_EmulatedSerial serial(emulator);
+		SB_HostSerialPort::routeThread(&serial);
+		MiniMaestro direct(SB_Servo::getMaestroTap());
+		direct.setSpeed(0, SPEED);
+		SB_Servo rudder(0);
+		SB_ServoPredictor predictor;
+		rudder.setPredictor(&predictor);
+		rudder.rotateToDegrees(90);
+		serial.flush();
+
+		// Identify: steps of different sizes at odd times, read every 5 ms
+		std::vector<SB_LagSample> samples(4000);
+		predictor.startLog(samples.data(), samples.size());
+		float steps[] = {45, 120, 100, 30, 150, 60, 75, 135, 90};
+		for (float degrees : steps) {
+			simulation.advance(3700);
+			rudder.rotateToDegrees(degrees);
+			rudder.getCurrentDegrees();
+			for (int i = 0; i < 240; i++) {
+				simulation.advance(5000);
+				rudder.getCurrentDegrees();
+			}
+		}
+		predictor.stopLog();
+		expect("identify: log didn't fill", 0, predictor.getErrorCode());
+		SB_ServoModel model;
+		expect("identify: works", true, SB_ServoPredictor::identify(samples.data(), predictor.getLogLength(), model));
+		Serial.print("identified delay us: ");
+		Serial.print(model.delayUs);
+		Serial.print(" rate: ");
+		Serial.println(model.rate);
+		expect("identify: rate within 3%", true, abs((long) model.rate - SPEED * 100) < SPEED * 3);
+		expect("identify: dead time under a frame", true, model.delayUs < 20000);
+		predictor.setModel(model);
+
+		// Track: moves without readings, the estimate against the Maestro every ms
+		long predictorError = 0;
+		long targetError = 0;
+		long readingError = 0;
+		long aheadError = 0;
+		long samplesTaken = 0;
+		bool settled = true;
+		std::vector<int> predictions;
+		std::vector<int> truth;
+		float moves[] = {20, 160, 110, 50, 140};
+		rudder.getCurrentDegrees();
+		for (float degrees : moves) {
+			simulation.advance(6300);
+			int reading = emulator.getPosition(0); // as of the last getCurrentDegrees()
+			rudder.rotateToDegrees(degrees);
+			for (int i = 0; i < 3500; i++) {
+				simulation.advance(1000);
+				serial.deliver(simulation.now());
+				int actual = emulator.getPosition(0);
+				predictorError += abs(predictor.estimate(micros()) - actual);
+				targetError += abs(emulator.getTarget(0) - actual);
+				readingError += abs(reading - actual);
+				predictions.push_back(predictor.predict(micros()));
+				truth.push_back(actual);
+				samplesTaken++;
+			}
+			settled &= fabsf(rudder.getEstimatedDegrees() - degrees) < .5f && fabsf(rudder.getPredictedDegrees() - degrees) < .5f;
+		}
+		expect("track: SB_Servo's degrees settle on each move", true, settled);
+		long predicted = predictorError / samplesTaken;
+		Serial.print("mean error, quarter us: predictor ");
+		Serial.print(predicted);
+		Serial.print(" last target ");
+		Serial.print(targetError / samplesTaken);
+		Serial.print(" last reading ");
+		Serial.println(readingError / samplesTaken);
+		expect("track: within a frame's ramp", true, predicted <= SPEED * 2);
+		expect("track: a tenth of the last target's error", true, predicted * 10 < targetError / samplesTaken);
+		expect("track: a tenth of the last reading's error", true, predicted * 10 < readingError / samplesTaken);
+		expect("track: no readings taken", 0, predictor.getErrorCode());
+
+		// The prediction is the output the dead time from now
+		size_t lead = (model.delayUs + 500) / 1000;
+		for (size_t i = 0; i + lead < truth.size(); i++) {
+			aheadError += abs(predictions[i] - truth[i + lead]);
+		}
+		expect("predict: the output a dead time on, within a frame's ramp", true,
+				aheadError / (long) (truth.size() - lead) <= SPEED * 2);
+
+		// A stalled servo shows up at the next reading
+		predictor.measured(micros(), 6000);
+		expect("stall: estimate follows the reading", 6000, predictor.estimate(micros()));
+
+		SB_HostSerialPort::routeThread(nullptr);
+	}
+
+	SB_Simulation::clearCurrent();
+	Serial.print("Failures: ");
+	Serial.println(failures);
+	return failures;
+}
@@ -0,0 +1,292 @@
+/**
+ * Tests the virtual-time runtime and the trace export: the pwm_channel ISRs from
+ * main/ measuring simulated RC pulses, interrupt masking, scheduler tasks, the
+ * driver talking to the emulator in virtual time, and the trace written as JSON
+ * and read back from its binary form. Build with -DSB_MAESTRO_TRACE to check
+ * the packet encoding spans as well.
+ *
+ * Expected and actual values are printed side by side, the exit code is the
+ * number of mismatches.
+ */
+
+#include <Arduino.h>
+#include <PololuMaestro.h>
+#include <SB_EmulatedSerial.hpp>
+#include <SB_Simulation.hpp>
+#include <SB_Trace.hpp>
+#include "../SB_Expect.h"
+
+#include "pwm_channel.h"
+
+pwmChannel CH2;
+pwmChannel CH3;
+
+#include "pwm_channel.ino"
+
+static int changes = 0;
+
+static void countChange() {
+	changes++;
+}
+
+/**
+ * A loose lead: the pin toggling every periodUs until untilUs
+ */
+struct NoiseSource {
+	SB_Simulation &simulation;
+	uint8_t pin;
+	uint64_t untilUs;
+	uint32_t periodUs;
+
+	void tick() {
+		if (simulation.now() >= untilUs) {
+			return;
+		}
+		simulation.setPin(pin, !simulation.getPin(pin));
+		simulation.after(periodUs, [this]() { tick(); });
+	}
+};
+
+/**
+ * CH3 picks up 300 ms of noise at 166 kHz between good pulses
+ */
+static void stormRun(const pwmCaptureBackend &backend) {
+	SB_Simulation simulation;
+	simulation.makeCurrent();
+	CH2 = pwmChannel();
+	CH3 = pwmChannel();
+
+	SB_RcPulseGenerator ch2(simulation, CH2_PIN, 22000, [](uint64_t) { return (uint16_t) 1234; });
+	SB_RcPulseGenerator ch3(simulation, CH3_PIN, 22000, [](uint64_t) { return (uint16_t) 1789; });
+	pwmBegin(backend);
+	ch2.start(100);
+	ch3.start(300);
+	delay(100);
+	Serial.println(backend.name);
+	expect("valid before the storm", 2, CH2.valid + CH3.valid);
+
+	ch3.stop();
+	delay(5);
+	NoiseSource noise{simulation, CH3_PIN, simulation.now() + 300000, 3};
+	noise.tick();
+	uint64_t isrs = simulation.getIsrCount();
+	uint32_t ch2Pulses = ch2.getPulses();
+	delay(150);
+	expect("storming channel invalid", 0, CH3.valid);
+	expect("storm counted", true, CH3.storms >= 1);
+	expect("other channel still valid", 1, CH2.valid);
+	expect("other channel still measured", 1234, CH2.pwmValue);
+	delay(150);
+	// CH2's two edges a pulse, and the budget once a backoff for CH3 instead of 100000 edges
+	uint64_t stormIsrs = simulation.getIsrCount() - isrs;
+	uint64_t ch2Isrs = 2 * (ch2.getPulses() - ch2Pulses + 1);
+	expect("storm ISRs within budget", true, stormIsrs <= ch2Isrs + PWM_EDGE_BUDGET * (300000 / PWM_STORM_BACKOFF_US + 2));
+	expect("masked and unmasked more than once", true, CH3.storms >= 2);
+
+	simulation.setPin(CH3_PIN, LOW);
+	ch3.start(1000);
+	delay(300);
+	expect("valid again after the storm", 1, CH3.valid);
+	expect("measured again after the storm", 1789, CH3.pwmValue);
+	expect("other channel never stormed", 0, CH2.storms);
+	expect("storm total", CH3.storms, pwmStorms());
+	SB_Simulation::clearCurrent();
+}
+
+/**
+ * CH2 pulses 1234 us wide while something masks interrupts for 200 us across
+ * every falling edge, like a long Serial ISR. Returns CH2's width as the
+ * backend measures it
+ */
+static int maskedFallWidth(const pwmCaptureBackend &backend) {
+	SB_Simulation simulation;
+	simulation.makeCurrent();
+	CH2 = pwmChannel();
+	CH3 = pwmChannel();
+	SB_RcPulseGenerator ch2(simulation, CH2_PIN, 22000, [](uint64_t) { return (uint16_t) 1234; });
+	expect(backend.name, true, pwmBegin(backend));
+	expect("backend in charge", true, pwmBackend() == &backend);
+	ch2.start(100);
+	simulation.every("mask", 22000, []() { noInterrupts(); }, 100 + 1234 - 100);
+	simulation.every("unmask", 22000, []() { interrupts(); }, 100 + 1234 + 100);
+	delay(100);
+	expect("valid with masked falls", 1, CH2.valid);
+	int width = CH2.pwmValue;
+	SB_Simulation::clearCurrent();
+	return width;
+}
+
+static size_t countTrack(const SB_Trace &trace, uint8_t track) {
+	size_t count = 0;
+	for (size_t i = 0; i < trace.size(); i++) {
+		if (trace.event(i).track == track) {
+			count++;
+		}
+	}
+	return count;
+}
+
+int main() {
+	SB_Trace trace;
+
+	{
+		SB_Simulation simulation;
+		simulation.makeCurrent();
+		SB_Trace::setCurrent(&trace);
+
+		SB_RcPulseGenerator ch2(simulation, CH2_PIN, 22000, [](uint64_t) { return (uint16_t) 1234; });
+		SB_RcPulseGenerator ch3(simulation, CH3_PIN, 22000, [](uint64_t) { return (uint16_t) 1789; });
+		initPWM();
+		ch2.start(100);
+		ch3.start(700); // overlaps CH2's pulse
+
+		expect("micros() starts at 0", 0, micros());
+		delay(100);
+		expect("micros() after delay(100)", 100000, micros());
+		expect("CH2 pulse width", 1234, CH2.pwmValue);
+		expect("CH3 pulse width", 1789, CH3.pwmValue);
+		expect("two ISRs a pulse", 2 * (ch2.getPulses() + ch3.getPulses()), simulation.getIsrCount());
+		simulation.advanceTo(110600); // CH2 rose at 110100
+		expect("digitalRead() of a pin mid-pulse", HIGH, digitalRead(CH2_PIN));
+
+		attachInterrupt(digitalPinToInterrupt(5), countChange, CHANGE);
+		noInterrupts();
+		simulation.setPin(5, HIGH);
+		expect("edge held while interrupts are off", 0, changes);
+		interrupts();
+		expect("held edge runs on interrupts()", 1, changes);
+		simulation.setPin(5, HIGH);
+		expect("no edge without a level change", 1, changes);
+		simulation.setPin(5, LOW);
+		expect("CHANGE fires on the falling edge too", 2, changes);
+
+		int runs = 0;
+		uint64_t start = simulation.now();
+		simulation.every("test task", 10000, [&]() { runs++; }, start);
+		simulation.advance(100000);
+		expect("10 ms task over 100 ms", 11, runs);
+
+		// The driver's spin on available() is what moves time while it waits
+		SB_MaestroEmulator emulator(12);
+		emulator.setBaud(115200); // 87 us a byte
+		SB_EmulatedSerial serial(emulator);
+		MiniMaestro maestro(serial);
+		maestro.setTarget(3, 6000);
+		uint32_t before = micros();
+		expect("getPosition in virtual time", 6000, maestro.getPosition(3));
+		// setTarget's 4 bytes still on the wire, then 2 out and 2 back
+		expect("getPosition round trip, us", 8 * 87, micros() - before);
+
+		int loops = 0;
+		simulation.setLoopCost(50);
+		simulation.run(1000, [&]() { loops++; });
+		expect("loop() calls in 1 ms at 50 us each", 20, loops);
+
+		SB_Trace::setCurrent(nullptr);
+		SB_Simulation::clearCurrent();
+	}
+
+	// Port capture: edges that arrive together share one ISR entry and one timestamp
+	{
+		SB_Simulation simulation;
+		simulation.makeCurrent();
+		CH2 = pwmChannel();
+		CH3 = pwmChannel();
+
+		SB_RcPulseGenerator ch2(simulation, CH2_PIN, 22000, [](uint64_t) { return (uint16_t) 1234; });
+		SB_RcPulseGenerator ch3(simulation, CH3_PIN, 22000, [](uint64_t) { return (uint16_t) 1789; });
+		expect("port capture set up", true, initPWMPort());
+		ch2.start(100);
+		ch3.start(100); // rises with CH2
+		delay(100);
+		expect("port CH2 pulse width", 1234, CH2.pwmValue);
+		expect("port CH3 pulse width", 1789, CH3.pwmValue);
+		expect("shared rising edge timestamp", CH2.riseTime, CH3.riseTime);
+		// One shared rise, two separate falls
+		expect("three port ISRs a frame", 3 * ch2.getPulses(), simulation.getIsrCount());
+
+		ch2.stop();
+		ch3.stop();
+		delay(25);
+		uint64_t isrs = simulation.getIsrCount();
+		noInterrupts();
+		simulation.setPin(CH2_PIN, HIGH);
+		simulation.advance(30);
+		simulation.setPin(CH3_PIN, HIGH);
+		simulation.advance(30);
+		expect("port edges held while interrupts are off", isrs, simulation.getIsrCount());
+		interrupts();
+		expect("held edges take one entry", isrs + 1, simulation.getIsrCount());
+		expect("held edges share the time of the entry", micros(), CH3.riseTime);
+		expect("both channels seen", CH2.riseTime, CH3.riseTime);
+		simulation.advance(40);
+		simulation.setPin(CH2_PIN, LOW);
+		simulation.advance(1);
+		expect("falling edge after the held ones", 40, CH2.pwmValue);
+		SB_Simulation::clearCurrent();
+	}
+
+	// Interrupt storms are cut off at the edge budget and recovered from
+	stormRun(pwmIsrCapture);
+	stormRun(pwmPortCapture);
+
+	// Capture backends: software timestamps are late by however long interrupts
+	// were masked, latched ones aren't
+	expect("ISR timestamps skewed by masking", 1234 + 100, maskedFallWidth(pwmIsrCapture));
+	expect("port timestamps skewed by masking", 1234 + 100, maskedFallWidth(pwmPortCapture));
+	expect("latched timestamps exact", 1234, maskedFallWidth(pwmTimerCapture));
+	stormRun(pwmTimerCapture);
+
+	expect("ISR spans recorded", true, countTrack(trace, TRACE_TRACK_ISR) > 0);
+	expect("task spans recorded", 11, countTrack(trace, TRACE_TRACK_TASK));
+	expect("tx byte spans recorded", 6, countTrack(trace, TRACE_TRACK_UART_TX));
+	expect("rx byte spans recorded", 2, countTrack(trace, TRACE_TRACK_UART_RX));
+	expect("blocked read recorded", 1, countTrack(trace, TRACE_TRACK_BLOCKED));
+	expect("command spans recorded", true, countTrack(trace, TRACE_TRACK_MAESTRO) >= 2);
+#ifdef SB_MAESTRO_TRACE
+	expect("encode spans recorded", 2, countTrack(trace, TRACE_TRACK_ENCODE));
+#endif
+
+	FILE *json = tmpfile();
+	expect("JSON written", true, trace.writeJson(json));
+	expect("JSON not empty", true, ftell(json) > 1000);
+	fclose(json);
+
+	FILE *binary = tmpfile();
+	expect("binary written", true, trace.writeBinary(binary));
+	rewind(binary);
+	SB_Trace loaded;
+	expect("binary loaded", true, loaded.load(binary));
+	fclose(binary);
+	expect("same number of events", trace.size(), loaded.size());
+	bool same = trace.size() == loaded.size();
+	for (size_t i = 0; same && i < trace.size(); i++) {
+		const SB_TraceEvent &a = trace.event(i);
+		const SB_TraceEvent &b = loaded.event(i);
+		same = a.timeNs == b.timeNs && a.durationNs == b.durationNs && a.track == b.track &&
+			a.phase == b.phase && a.value == b.value && strcmp(trace.name(a.name), loaded.name(b.name)) == 0;
+	}
+	expect("events identical after the round trip", true, same);
+
+	SB_Trace garbage;
+	FILE *notTrace = tmpfile();
+	fputs("{\"traceEvents\":[]}", notTrace);
+	rewind(notTrace);
+	expect("JSON isn't a binary trace", false, garbage.load(notTrace));
+	expect("format error bit", TRACE_FORMAT_ERROR_BIT, garbage.getErrorCode());
+	fclose(notTrace);
+
+	SB_Trace small;
+	small.setCapacity(2);
+	small.span(TRACE_TRACK_TASK, "a", 0, 1);
+	small.span(TRACE_TRACK_TASK, "b", 1, 1);
+	small.span(TRACE_TRACK_TASK, "c", 2, 1);
+	expect("capacity caps the events", 2, small.size());
+	expect("dropped events counted", 1, small.getDropped());
+	expect("full error bit", TRACE_FULL_ERROR_BIT, small.getErrorCode());
+
+	Serial.print("Failures: ");
+	Serial.println(failures);
+	Serial.flush();
+	return failures;
+}
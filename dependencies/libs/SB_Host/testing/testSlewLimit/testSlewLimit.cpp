@@ -0,0 +1,168 @@
+/**
+ * Tests SB_Servo's slew limiting against the emulator in virtual time: the
+ * targets the emulated Maestro receives from a servo updated every millisecond
+ * must stay within the rate and acceleration limits, stop exactly on the target
+ * without overshooting it, only go out when they've moved a whole step, and
+ * follow limits changed in the middle of a move.
+ *
+ * Expected and actual values are printed side by side, the exit code is the
+ * number of mismatches.
+ */
+
+#include <Arduino.h>
+#include <PololuMaestro.h>
+#include <SB_EmulatedSerial.hpp>
+#include <SB_HostSerial.hpp>
+#include <SB_Servo.hpp>
+#include <SB_Simulation.hpp>
+#include "../SB_Expect.h"
+
+#include <vector>
+
+#define SETTARGET 0x84
+
+/**
+ * The emulator's target for channel 0 every millisecond while a servo's update()
+ * runs, until durationUs has passed. Targets land a wire time after they're sent
+ */
+struct Run {
+	std::vector<int> targets;
+	uint32_t arrivedMs = 0; // when the servo stopped slewing
+};
+
+static Run follow(SB_Simulation &simulation, SB_EmulatedSerial &serial, SB_Servo &servo, uint64_t durationUs) {
+	Run run;
+	uint64_t start = simulation.now();
+	while (simulation.now() - start < durationUs) {
+		// Not flush(), waiting out the wire time would stretch the tick
+		simulation.advance(1000);
+		servo.update();
+		serial.deliver(simulation.now());
+		run.targets.push_back(serial.getEmulator().getTarget(0));
+		if (run.arrivedMs == 0 && !servo.isSlewing()) {
+			run.arrivedMs = run.targets.size();
+		}
+	}
+	return run;
+}
+
+/**
+ * @return the largest change in target over any window of windowMs
+ */
+static int largestChange(const std::vector<int> &targets, size_t windowMs) {
+	int largest = 0;
+	for (size_t i = windowMs; i < targets.size(); i++) {
+		largest = std::max(largest, abs(targets[i] - targets[i - windowMs]));
+	}
+	return largest;
+}
+
+/**
+ * @return the largest change between the moves of two windows of windowMs in a
+ * row, about the acceleration times windowMs squared
+ */
+static int largestSecondDifference(const std::vector<int> &targets, size_t windowMs) {
+	int largest = 0;
+	for (size_t i = 2 * windowMs; i < targets.size(); i++) {
+		largest = std::max(largest, abs(targets[i] - 2 * targets[i - windowMs] + targets[i - 2 * windowMs]));
+	}
+	return largest;
+}
+
+int main() {
+	SB_Simulation simulation;
+	simulation.makeCurrent();
+	SB_MaestroEmulator emulator(12);
+	emulator.setBaud(115200);
+	SB_EmulatedSerial serial(emulator);
+	SB_HostSerialPort::routeThread(&serial);
+
+	// 500-2500 us over 180 degrees, 400/9 quarter us a degree
+	SB_Servo servo(0);
+	servo.rotateToDegrees(0);
+	serial.flush();
+	expect("unlimited: target straight away", 2000, emulator.getTarget(0));
+	expect("unlimited: not slewing", false, servo.isSlewing());
+
+	// 90 degrees/s is 4000 quarter us/s, 360 degrees/s^2 is 16000 quarter us/s^2:
+	// a quarter second speeding up and slowing down, 1.75 s at full speed between
+	servo.setSlewLimits(90, 360);
+	uint32_t before = emulator.getCommandStats(SETTARGET).count;
+	servo.rotateToDegrees(180);
+	serial.flush();
+	expect("limited: nothing sent yet", before, emulator.getCommandStats(SETTARGET).count);
+	Run run = follow(simulation, serial, servo, 2600000);
+	expect("limited: reaches the target", 10000, run.targets.back());
+	expect("limited: never past it", 10000, *std::max_element(run.targets.begin(), run.targets.end()));
+	// A little early, each tick moves at the speed it could stop from at its start
+	expect("limited: arrives after about 2.25 s", true, run.arrivedMs >= 2220 && run.arrivedMs <= 2260);
+	expect("limited: no faster than the rate", true, largestChange(run.targets, 100) <= 400 + SLEW_DEFAULT_STEP);
+	expect("limited: cruises at the rate", true, largestChange(run.targets, 100) >= 400 - SLEW_DEFAULT_STEP);
+	// 16000 quarter us/s^2 covers 20 quarter us in the first 50 ms, and changes the
+	// distance covered in 50 ms by 40 quarter us from one 50 ms to the next
+	expect("limited: speeds up gently", true, run.targets[49] - 2000 <= 20 + SLEW_DEFAULT_STEP);
+	expect("limited: no harder than the acceleration", true,
+			largestSecondDifference(run.targets, 50) <= 40 + 2 * SLEW_DEFAULT_STEP);
+	uint32_t sent = emulator.getCommandStats(SETTARGET).count - before;
+	expect("limited: a target every step at most", true, sent <= 8000 / SLEW_DEFAULT_STEP + 1);
+	expect("limited: no errors", 0, servo.getErrorCode());
+
+	// Coarser steps, fewer targets
+	servo.setSlewStep(40);
+	before = emulator.getCommandStats(SETTARGET).count;
+	servo.rotateToDegrees(0);
+	run = follow(simulation, serial, servo, 2600000);
+	sent = emulator.getCommandStats(SETTARGET).count - before;
+	expect("10 us steps: back at the start", 2000, run.targets.back());
+	expect("10 us steps: a target every 40 quarter us at most", true, sent <= 8000 / 40 + 1);
+	int smallest = 8000;
+	for (size_t i = 1; i < run.arrivedMs - 1; i++) {
+		if (run.targets[i] != run.targets[i - 1]) {
+			smallest = std::min(smallest, abs(run.targets[i] - run.targets[i - 1]));
+		}
+	}
+	expect("10 us steps: none smaller, bar the last", true, smallest >= 40);
+	servo.setSlewStep(SLEW_DEFAULT_STEP);
+
+	// Rate only, no acceleration limit: straight to full speed
+	servo.setSlewLimits(180, 0);
+	servo.rotateToDegrees(90);
+	run = follow(simulation, serial, servo, 600000);
+	expect("rate only: reaches 90", 6000, run.targets.back());
+	expect("rate only: full speed from the start", true, run.targets[49] - 2000 >= 400 - 2 * SLEW_DEFAULT_STEP);
+	expect("rate only: arrives after 0.5 s", true, run.arrivedMs >= 499 && run.arrivedMs <= 502);
+
+	// Changed mid move: twice the rate gets there sooner, turning limiting off gets there now
+	servo.setSlewLimits(45, 0);
+	servo.rotateToDegrees(0);
+	run = follow(simulation, serial, servo, 500000);
+	expect("a quarter of the way at 45 degrees/s", true, abs(run.targets.back() - 5000) <= 2 * SLEW_DEFAULT_STEP);
+	servo.setSlewLimits(90, 0);
+	run = follow(simulation, serial, servo, 900000);
+	expect("the rest at 90 degrees/s", true, run.arrivedMs >= 749 && run.arrivedMs <= 752);
+	servo.rotateToDegrees(180);
+	run = follow(simulation, serial, servo, 200000);
+	servo.setSlewLimits(0, 0);
+	serial.flush();
+	expect("limits off mid move: there at once", 10000, emulator.getTarget(0));
+	expect("limits off mid move: not slewing", false, servo.isSlewing());
+
+	// Reversing mid move slows down first, and still lands exactly
+	servo.setSlewLimits(90, 360);
+	servo.rotateToDegrees(0);
+	follow(simulation, serial, servo, 1000000);
+	servo.rotateToDegrees(170);
+	run = follow(simulation, serial, servo, 3000000);
+	int lowest = *std::min_element(run.targets.begin(), run.targets.end());
+	expect("reversal: carries on past the turn", true, lowest < run.targets[0]);
+	expect("reversal: lands on the new target", 2000 + 170 * 400 / 9, run.targets.back());
+
+	servo.setSlewLimits(-1, 0);
+	expect("negative limit", SLEW_ERROR_BIT, servo.getErrorCode());
+
+	SB_HostSerialPort::routeThread(nullptr);
+	SB_Simulation::clearCurrent();
+	Serial.print("Failures: ");
+	Serial.println(failures);
+	return failures;
+}
@@ -0,0 +1,235 @@
+/**
+ * Tests SB_StreamTap (in SB_Servo) and SB_TapReplay in virtual time: the bytes
+ * SB_Servo exchanges with the emulator come back out of the log with their times,
+ * across long gaps and after the caller's ring has wrapped, replaying the log into a
+ * fresh emulator reproduces the Maestro's targets and every answer, and the
+ * bus occupancy costed for other encodings and batching adds up.
+ *
+ * Expected and actual values are printed side by side, the exit code is the
+ * number of mismatches.
+ */
+
+#include <Arduino.h>
+#include <PololuMaestro.h>
+#include <SB_EmulatedSerial.hpp>
+#include <SB_HostSerial.hpp>
+#include <SB_Servo.hpp>
+#include <SB_Simulation.hpp>
+#include <SB_StreamTap.hpp>
+#include <SB_TapReplay.hpp>
+#include "../SB_Expect.h"
+
+#include <thread>
+#include <vector>
+
+#define RING_ENTRIES 4096
+
+static uint8_t ring[RING_ENTRIES * TAP_ENTRY_BYTES];
+
+/**
+ * Collects what dump() writes
+ */
+class ByteLog : public Print {
+	public:
+		std::vector<uint8_t> bytes;
+		size_t write(uint8_t dataByte) override {
+			bytes.push_back(dataByte);
+			return 1;
+		}
+		using Print::write;
+};
+
+/**
+ * Takes anything, never answers
+ */
+class NullStream : public Stream {
+	public:
+		int available() override { return 0; }
+		int read() override { return -1; }
+		int peek() override { return -1; }
+		size_t write(uint8_t) override { return 1; }
+		using Print::write;
+};
+
+int main() {
+	SB_Simulation simulation;
+	simulation.makeCurrent();
+
+	{
+		// Times survive gaps of every size, down to the microsecond
+		SB_MaestroEmulator emulator(12);
+		emulator.setBaud(115200);
+		SB_EmulatedSerial serial(emulator);
+		SB_StreamTap tap(serial);
+		MiniMaestro maestro(tap);
+		expect("unstarted: nothing logged", 0, tap.getLoggedBytes());
+		tap.start(ring, sizeof(ring), 115200);
+		std::vector<uint32_t> sentUs;
+		uint32_t gaps[] = {0, 40, 63, 64, 5000, 16383, 16384, 40000, 20000000, 123456789};
+		for (uint32_t gap : gaps) {
+			simulation.advance(gap);
+			sentUs.push_back(micros());
+			maestro.setTarget(1, 4000 + gap % 4000);
+		}
+		simulation.advance(500);
+		uint16_t position = maestro.getPosition(1);
+		tap.stop();
+		maestro.setTarget(1, 6000); // not recorded
+
+		ByteLog log;
+		size_t dumped = tap.dump(log);
+		expect("dump: all of it", log.bytes.size(), dumped);
+		SB_TapReplay replay;
+		expect("gaps: loads", true, replay.load(log.bytes.data(), log.bytes.size()));
+		const std::vector<SB_TapByte> &bytes = replay.getBytes();
+		expect("gaps: bytes written", 4 * 10 + 2, tap.getBytesWritten() - 4);
+		expect("gaps: bytes logged", 4 * 10 + 2 + 2, bytes.size());
+		expect("gaps: logged count", bytes.size(), tap.getLoggedBytes());
+		bool timesRight = true;
+		for (int i = 0; i < 10; i++) {
+			for (int j = 0; j < 4; j++) {
+				timesRight &= bytes[4 * i + j].timeUs == sentUs[i] && bytes[4 * i + j].direction == TAP_TX;
+			}
+		}
+		expect("gaps: setTarget times", true, timesRight);
+		expect("gaps: first byte", 0x84, bytes[0].value);
+		expect("gaps: answer read", TAP_RX, bytes[42].direction);
+		expect("gaps: answer", position, bytes[42].value | (bytes[43].value << 8));
+		expect("gaps: baud kept", 115200, replay.getBaud());
+		expect("gaps: packets", 11, replay.getPacketCount());
+		expect("gaps: no errors", 0, tap.getErrorCode());
+	}
+
+	{
+		// A full ring loses the oldest bytes and keeps the times of the rest
+		NullStream null;
+		SB_StreamTap tap(null);
+		tap.start(ring, sizeof(ring));
+		uint32_t extra = 1000;
+		std::vector<uint32_t> times;
+		for (uint32_t i = 0; i < RING_ENTRIES + extra; i++) {
+			simulation.advance(i % 7 == 0 ? 100 : 3); // some gaps take an entry of their own
+			times.push_back(micros());
+			tap.write((uint8_t) i);
+		}
+		ByteLog log;
+		tap.dump(log);
+		SB_TapReplay replay;
+		replay.load(log.bytes.data(), log.bytes.size());
+		const std::vector<SB_TapByte> &bytes = replay.getBytes();
+		size_t lost = RING_ENTRIES + extra - bytes.size();
+		expect("ring: overwritten counted", lost, tap.getOverwritten());
+		expect("ring: overwrite bit", TAP_OVERWRITE_BIT, tap.getErrorCode());
+		expect("ring: newest kept", (uint8_t) (RING_ENTRIES + extra - 1), bytes.back().value);
+		expect("ring: newest time", times.back(), bytes.back().timeUs);
+		expect("ring: oldest time", times[lost], bytes.front().timeUs);
+		expect("ring: oldest value", (uint8_t) lost, bytes.front().value);
+
+		tap.start(nullptr, 0);
+		tap.write(1);
+		expect("no ring: refused", TAP_BUFFER_BIT, tap.getErrorCode() & TAP_BUFFER_BIT);
+		expect("no ring: not recording", false, tap.isRecording());
+		ByteLog empty;
+		expect("no ring: header only", TAP_HEADER_BYTES, tap.dump(empty));
+	}
+
+	{
+		// SB_Servo's traffic replayed into a fresh emulator: same targets, same answers
+		SB_MaestroEmulator emulator(12);
+		emulator.setBaud(115200);
+		SB_EmulatedSerial serial(emulator);
+		SB_HostSerialPort::routeThread(&serial);
+		SB_StreamTap &tap = SB_Servo::getMaestroTap();
+		SB_StreamTap *elsewhere = nullptr;
+		std::thread([&elsewhere]() { elsewhere = &SB_Servo::getMaestroTap(); }).join();
+		expect("servo: a tap per thread", true, elsewhere != &tap);
+		tap.start(ring, sizeof(ring), 115200);
+		// Every getCurrentDegrees() a getPosition(), for answers to compare
+		SB_Servo::setReadbackElision(false);
+		SB_Servo rudder(0);
+		SB_Servo sail(3);
+		for (int i = 0; i < 20; i++) {
+			rudder.rotateToDegrees(i * 9);
+			sail.rotateToDegrees(180 - i * 9);
+			simulation.advance(20000);
+			rudder.getCurrentDegrees();
+		}
+		serial.flush();
+		tap.stop();
+		SB_Servo::setReadbackElision(true);
+		SB_HostSerialPort::routeThread(nullptr);
+
+		ByteLog log;
+		tap.dump(log);
+		SB_TapReplay replay;
+		replay.load(log.bytes.data(), log.bytes.size());
+		SB_MaestroEmulator fresh(12);
+		fresh.setBaud(115200);
+		SB_TapReplayResult result = replay.replay(fresh);
+		expect("replay: bytes written", tap.getBytesWritten(), result.txBytes);
+		expect("replay: answers read", 40, result.rxBytes);
+		expect("replay: answers match", result.rxBytes, result.matchedBytes);
+		expect("replay: no mismatch", -1, result.firstMismatch);
+		expect("replay: rudder target", emulator.getTarget(0), fresh.getTarget(0));
+		expect("replay: sail target", emulator.getTarget(3), fresh.getTarget(3));
+		expect("replay: setTargets", emulator.getCommandStats(0x84).count, fresh.getCommandStats(0x84).count);
+		expect("replay: no errors", 0, fresh.peekErrors());
+
+		// The same log against a Maestro expecting CRC shows where it went wrong
+		SB_MaestroEmulator crc(12, 12, true);
+		crc.setBaud(115200);
+		result = replay.replay(crc);
+		expect("replay: CRC Maestro disagrees from the first answer", 0, result.firstMismatch);
+		expect("replay: CRC Maestro reports errors", true, crc.peekErrors() != 0);
+	}
+
+	{
+		// Costing other encodings: six servos every 20 ms for a second, one of
+		// them set twice a frame, each target its own compact packet
+		NullStream null;
+		SB_StreamTap tap(null);
+		MiniMaestro maestro(tap);
+		tap.start(ring, sizeof(ring), 115200);
+		for (int frame = 0; frame < 50; frame++) {
+			for (int channel = 0; channel < 6; channel++) {
+				maestro.setTarget(channel, 6000 + frame);
+				simulation.advance(50);
+			}
+			maestro.setTarget(0, 6100 + frame);
+			simulation.advance(20000 - 300);
+		}
+		ByteLog log;
+		tap.dump(log);
+		SB_TapReplay replay;
+		replay.load(log.bytes.data(), log.bytes.size());
+
+		SB_TapOccupancy recorded = replay.occupancy();
+		expect("cost: recorded packets", 350, recorded.packets);
+		expect("cost: recorded bytes", 350 * 4, recorded.txBytes);
+		// 87 us a byte at 115200, the last frame's 7 packets clear the line 7 * 4 * 87 us after it started
+		expect("cost: recorded busy, per mille", 1400 * 87 * 1000 / (49 * 20000 + 7 * 4 * 87),
+				(long) (1000 * recorded.busyFraction));
+		// The repeat's last byte, written 300 us into the frame, waits for the 27 bytes ahead of it
+		expect("cost: bytes queue behind each other", 27 * 87 - 300, recorded.maxQueueUs);
+		SB_TapOccupancy compact = replay.reencoded(false, false, 0);
+		expect("cost: compact as recorded", recorded.txBytes, compact.txBytes);
+		expect("cost: Pololu", 350 * 6, replay.reencoded(true, false, 0).txBytes);
+		expect("cost: Pololu with CRC", 350 * 7, replay.reencoded(true, true, 0).txBytes);
+		// Each frame's 7 targets in one setMultiTarget of 6, the repeat conflated
+		SB_TapOccupancy batched = replay.reencoded(false, false, 1000);
+		expect("cost: batched packets", 50, batched.packets);
+		expect("cost: batched bytes", 50 * (3 + 12), batched.txBytes);
+		expect("cost: conflated", 50, batched.conflatedTargets);
+		// A 100 us window splits the frame: channels 0 and 1, then 2 and 3, then 4 and 5, then 0
+		SB_TapOccupancy split = replay.reencoded(false, false, 100);
+		expect("cost: short window packets", 50 * 4, split.packets);
+		expect("cost: short window bytes", 50 * (3 * 7 + 4), split.txBytes);
+		// Slower link, the same bytes take longer
+		expect("cost: at 9600 the line queues", true, replay.reencoded(true, true, 0, 9600).maxQueueUs > 0);
+	}
+
+	SB_Simulation::clearCurrent();
+	Serial.print("Failures: ");
+	Serial.println(failures);
+	return failures;
+}
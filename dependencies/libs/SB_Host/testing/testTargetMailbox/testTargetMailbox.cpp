@@ -0,0 +1,212 @@
+/**
+ * Tests SB_TargetMailbox (in SB_Servo) against the emulator in virtual time: a
+ * loop setting four channels every millisecond over a 9600 baud link, which
+ * carries a setTarget every 4.2 ms. Written straight to the Maestro the targets
+ * it outputs fall further and further behind; through the mailbox they stay
+ * within a round of the channels of the newest, every channel gets its turn and
+ * the replaced targets are counted. Also SB_Servo's own mailbox, and
+ * setMultipleTargets() not being undone by a target left waiting, and turning
+ * away batches it can't send.
+ *
+ * Expected and actual values are printed side by side, the exit code is the
+ * number of mismatches.
+ */
+
+#include <Arduino.h>
+#include <PololuMaestro.h>
+#include <SB_EmulatedSerial.hpp>
+#include <SB_HostSerial.hpp>
+#include <SB_Servo.hpp>
+#include <SB_Simulation.hpp>
+#include <SB_TargetMailbox.hpp>
+#include "../SB_Expect.h"
+
+#include <vector>
+
+#define CHANNELS 4
+#define RUN_MS 2000
+
+/**
+ * Each target is 4000 plus the ms it was set at, so how stale the Maestro's
+ * target is can be read straight off it
+ */
+struct Staleness {
+	uint32_t maxMs = 0;
+	uint32_t lastMs = 0;
+	void sample(SB_EmulatedSerial &serial, uint32_t nowMs) {
+		serial.deliver(micros());
+		for (uint8_t channel = 0; channel < CHANNELS; channel++) {
+			uint16_t target = serial.getEmulator().getTarget(channel);
+			uint32_t staleMs = target ? nowMs - (target - 4000) : nowMs;
+			if (staleMs > maxMs) {
+				maxMs = staleMs;
+			}
+			lastMs = staleMs;
+		}
+	}
+};
+
+int main() {
+	SB_Simulation simulation;
+	simulation.makeCurrent();
+
+	uint32_t directStaleMs;
+	{
+		// Straight to the Maestro: every target queues behind the ones before it
+		SB_MaestroEmulator emulator(12);
+		emulator.setBaud(9600);
+		SB_EmulatedSerial serial(emulator);
+		MiniMaestro maestro(serial);
+		Staleness staleness;
+		for (uint32_t ms = 0; ms < RUN_MS; ms++) {
+			for (uint8_t channel = 0; channel < CHANNELS; channel++) {
+				maestro.setTarget(channel, 4000 + ms);
+			}
+			simulation.advance(1000);
+			staleness.sample(serial, ms + 1);
+		}
+		directStaleMs = staleness.lastMs;
+		Serial.print("direct: stale by ms at the end ");
+		Serial.println(directStaleMs);
+		expect("direct: falls behind by most of the run", true, directStaleMs > RUN_MS / 2);
+		serial.flush();
+	}
+
+	{
+		// Through the mailbox
+		SB_MaestroEmulator emulator(12);
+		emulator.setBaud(9600);
+		SB_EmulatedSerial serial(emulator);
+		MiniMaestro maestro(serial);
+		SB_TargetMailbox mailbox(maestro, 9600);
+		Staleness staleness;
+		uint32_t sentBefore = 0;
+		for (uint32_t ms = 0; ms < RUN_MS; ms++) {
+			for (uint8_t channel = 0; channel < CHANNELS; channel++) {
+				mailbox.post(channel, 4000 + ms);
+			}
+			simulation.advance(1000);
+			mailbox.update();
+			staleness.sample(serial, ms + 1);
+			if (ms == RUN_MS / 2) {
+				sentBefore = mailbox.getSent();
+			}
+		}
+		Serial.print("mailbox: stale by ms at most ");
+		Serial.print(staleness.maxMs);
+		Serial.print(", latency us at most ");
+		Serial.println(mailbox.getMaxLatencyUs());
+		// A round of four channels and the two targets of backlog ahead of it, 4.2 ms each
+		uint32_t boundUs = (CHANNELS + 2) * 4 * mailbox.getByteTimeUs();
+		expect("mailbox: latency bounded", true, mailbox.getMaxLatencyUs() <= boundUs);
+		expect("mailbox: Maestro never that stale", true, staleness.maxMs <= boundUs / 1000 + 2);
+		expect("mailbox: every target accounted", mailbox.getPosted(),
+				mailbox.getSent() + mailbox.getConflated() + mailbox.getPendingCount());
+		expect("mailbox: most replaced", true, mailbox.getConflated() > mailbox.getPosted() * 3 / 4);
+		// The link's whole capacity still used, 1000 ms / 4.2 ms a target
+		uint32_t sentAfter = mailbox.getSent() - sentBefore;
+		expect("mailbox: line kept busy", true, sentAfter >= 1000 * 1000 / (4 * mailbox.getByteTimeUs()) - 2);
+		bool fair = true;
+		for (uint8_t channel = 1; channel < CHANNELS; channel++) {
+			long difference = (long) mailbox.getConflated(channel) - (long) mailbox.getConflated(0);
+			fair &= difference < 3 && difference > -3;
+		}
+		expect("mailbox: each channel its turn", true, fair);
+
+		mailbox.flush();
+		expect("mailbox: flush() leaves nothing waiting", 0, mailbox.getPendingCount());
+		serial.flush();
+		for (uint8_t channel = 0; channel < CHANNELS; channel++) {
+			expect("mailbox: newest target arrives", 4000 + RUN_MS - 1, emulator.getTarget(channel));
+		}
+		expect("mailbox: no errors", 0, mailbox.getErrorCode());
+		mailbox.post(MAILBOX_MAX_CHANNELS, 6000);
+		expect("mailbox: channel out of range", MAILBOX_CHANNEL_ERROR_BIT, mailbox.getErrorCode());
+
+		// Without a baud it sends straight away
+		SB_TargetMailbox passThrough(maestro);
+		for (int i = 0; i < 10; i++) {
+			passThrough.post(5, 5000 + i);
+		}
+		expect("no baud: nothing held", 10, passThrough.getSent());
+		expect("no baud: nothing replaced", 0, passThrough.getConflated());
+	}
+
+	{
+		// SB_Servo's mailbox, told the baud by negotiateMaestroBaud()
+		SB_MaestroEmulator emulator(12);
+		emulator.setBaud(9600);
+		SB_EmulatedSerial serial(emulator);
+		SB_HostSerialPort::routeThread(&serial);
+		SB_TargetMailbox &mailbox = SB_Servo::getTargetMailbox();
+		expect("servo: negotiated", 9600, SB_Servo::negotiateMaestroBaud([](uint32_t baud) {
+			SB_EmulatedSerial *serial = (SB_EmulatedSerial *) SB_HostSerialPort::getRoute();
+			serial->begin(baud);
+			return true;
+		}));
+		SB_Servo rudder(0);
+		SB_Servo sail(1);
+		uint32_t conflatedBefore = mailbox.getConflated();
+		for (int i = 0; i < 200; i++) {
+			rudder.rotateToDegrees(i % 180);
+			sail.rotateToDegrees(180 - i % 180);
+			simulation.advance(1000);
+			rudder.update();
+		}
+		expect("servo: targets replaced", true, mailbox.getConflated() > conflatedBefore);
+		rudder.getCurrentDegrees();
+		mailbox.update();
+		serial.flush();
+		expect("servo: newest rudder target", 2000 + (10000 - 2000) * 19 / 180, emulator.getTarget(0));
+		expect("servo: newest sail target", 2000 + (10000 - 2000) * (180 - 19) / 180, emulator.getTarget(1));
+
+		// A target left waiting doesn't undo setMultipleTargets()
+		simulation.advance(100000);
+		mailbox.lineClear();
+		rudder.rotateToDegrees(10);
+		rudder.rotateToDegrees(20);
+		sail.rotateToDegrees(30);
+		expect("multi: targets waiting", true, mailbox.getPendingCount() > 0);
+		SB_Servo::setMultipleTargets({rudder, sail}, {90, 90});
+		expect("multi: withdrawn", 0, mailbox.getPendingCount());
+		simulation.advance(100000);
+		rudder.update();
+		serial.flush();
+		expect("multi: rudder", 6000, emulator.getTarget(0));
+		expect("multi: sail", 6000, emulator.getTarget(1));
+
+		// The batch is on the line like any other write, a target right behind it waits
+		mailbox.lineClear();
+		SB_Servo::setMultipleTargets({rudder, sail}, {80, 80});
+		rudder.rotateToDegrees(70);
+		expect("multi: target behind a batch waits", 1, mailbox.getPendingCount());
+		simulation.advance(100000);
+		rudder.update();
+		serial.flush();
+		expect("multi: target behind a batch arrives", 2000 + (10000 - 2000) * 70 / 180, emulator.getTarget(0));
+
+		// Channels out of order, or off the maestro, are turned away before anything is touched
+		rudder.rotateToDegrees(45);
+		int pending = mailbox.getPendingCount();
+		SB_Servo *backwards[] = {&sail, &rudder};
+		float zeros[] = {0, 0};
+		SB_Servo::setMultipleTargets(backwards, zeros, 2);
+		expect("multi: out of order left the mailbox", pending, mailbox.getPendingCount());
+		expect("multi: out of order error", CHANNEL_ERROR_BIT, sail.getErrorCode() & CHANNEL_ERROR_BIT);
+		SB_Servo stray(40);
+		SB_Servo *offMaestro[] = {&stray};
+		SB_Servo::setMultipleTargets(offMaestro, zeros, 1);
+		expect("multi: off the maestro error", CHANNEL_ERROR_BIT, stray.getErrorCode() & CHANNEL_ERROR_BIT);
+		simulation.advance(100000);
+		rudder.update();
+		serial.flush();
+		expect("multi: out of order sail untouched", 2000 + (10000 - 2000) * 80 / 180, emulator.getTarget(1));
+		expect("multi: rudder's own target", 2000 + (10000 - 2000) * 45 / 180, emulator.getTarget(0));
+		SB_HostSerialPort::routeThread(nullptr);
+	}
+
+	SB_Simulation::clearCurrent();
+	Serial.print("Failures: ");
+	Serial.println(failures);
+	return failures;
+}
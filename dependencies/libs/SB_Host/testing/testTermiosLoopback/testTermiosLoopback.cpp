@@ -0,0 +1,117 @@
+/**
+ * End to end test of the Linux serial path through a pseudo-terminal pair.
+ *
+ * A thread on the master side of the pty plays a (very) small Maestro that only
+ * knows compact-protocol setTarget, getPosition and getMovingState. The MiniMaestro and SB_Servo
+ * code on the slave side is the same code that runs on the Teensy.
+ *
+ * Like the sketches in SB_Servo/testing, expected and actual values are printed
+ * side by side; the exit code is the number of mismatches.
+ */
+
+#include <Arduino.h>
+#include <PololuMaestro.h>
+#include <SB_Servo.hpp>
+#include <SB_PtyPair.hpp>
+#include "../SB_Expect.h"
+
+#include <atomic>
+#include <chrono>
+#include <poll.h>
+#include <thread>
+#include <unistd.h>
+
+static SB_PtyPair pty;
+static std::atomic<bool> running{true};
+static std::atomic<uint16_t> positions[NUM_MAESTRO_CHANNELS];
+
+// Answers setTarget by jumping straight to the target, getPosition with the position
+// and getMovingState with nothing moving
+static void fakeMaestro() {
+	uint8_t packet[4];
+	int length = 0;
+	while (running) {
+		struct pollfd master = {pty.getMasterFd(), POLLIN, 0};
+		if (poll(&master, 1, 10) <= 0) {
+			continue;
+		}
+		uint8_t dataByte;
+		while (::read(pty.getMasterFd(), &dataByte, 1) == 1) {
+			if (dataByte & 0x80) {
+				length = 0;
+			}
+			packet[length++] = dataByte;
+			if (packet[0] == 0x84 && length == 4) {
+				positions[packet[1]] = packet[2] | (packet[3] << 7);
+				length = 0;
+			} else if (packet[0] == 0x90 && length == 2) {
+				uint8_t response[2] = {(uint8_t) (positions[packet[1]] & 0xFF),
+					(uint8_t) (positions[packet[1]] >> 8)};
+				::write(pty.getMasterFd(), response, 2);
+				length = 0;
+			} else if (packet[0] == 0x93) {
+				uint8_t response = 0;
+				::write(pty.getMasterFd(), &response, 1);
+				length = 0;
+			} else if (length == 4) {
+				length = 0;
+			}
+		}
+	}
+}
+
+int main() {
+	if (!pty.open()) {
+		Serial.println("Couldn't allocate a pty");
+		return 1;
+	}
+	std::thread maestroThread(fakeMaestro);
+
+	SB_TermiosStream port(pty.getSlavePath());
+	expect("begin() at 115200", true, port.begin(115200));
+	expect("begin() error code", 0, port.getErrorCode());
+
+	SB_TermiosStream badBaud(pty.getSlavePath());
+	expect("begin() at 12345 baud", false, badBaud.begin(12345));
+	expect("bad baud error code", TERMIOS_BAUD_ERROR_BIT, badBaud.getErrorCode());
+
+	SB_TermiosStream noDevice("/dev/this/does/not/exist");
+	expect("begin() on a missing device", false, noDevice.begin(9600));
+	expect("missing device error code", TERMIOS_OPEN_ERROR_BIT, noDevice.getErrorCode());
+
+	MiniMaestro maestro(port);
+
+	// A write nobody reads back after still has to reach the Maestro
+	maestro.setTarget(5, 7000);
+	for (int waited = 0; waited < 100 && positions[5] != 7000; waited++) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	expect("lone setTarget(5, 7000) seen without a read", 7000, positions[5].load());
+
+	maestro.setTarget(0, 6000);
+	expect("getPosition(0) after setTarget(0, 6000)", 6000, maestro.getPosition(0));
+	maestro.setTarget(3, 4000);
+	maestro.setTarget(4, 8000);
+	expect("getPosition(3) after two buffered setTargets", 4000, maestro.getPosition(3));
+	expect("getPosition(4) after two buffered setTargets", 8000, maestro.getPosition(4));
+
+	// Nothing has been asked for, so nothing should be waiting
+	expect("waitReadable() with nothing pending", false, port.waitReadable(20));
+	expect("port error code", 0, port.getErrorCode());
+
+	// SB_Servo is hard wired to Serial1, point it at the pty and it runs unchanged
+	Serial1.begin(pty.getSlavePath(), 9600);
+	SB_Servo servo(1);
+	servo.rotateToDegrees(90);
+	expect("SB_Servo degrees after rotateToDegrees(90)", 90, lround(servo.getCurrentDegrees()));
+	servo.rotateBy(-45);
+	expect("SB_Servo degrees after rotateBy(-45)", 45, lround(servo.getCurrentDegrees()));
+	expect("SB_Servo error code", 0, servo.getErrorCode());
+
+	running = false;
+	maestroThread.join();
+	Serial.print("Failures: ");
+	Serial.println(failures);
+	Serial.flush();
+	return failures;
+}
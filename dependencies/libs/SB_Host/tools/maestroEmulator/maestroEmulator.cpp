@@ -0,0 +1,174 @@
+/**
+ * Standalone Maestro emulator served over a pseudo-terminal.
+ *
+ * Allocates a pty, prints the slave device path, and answers on it like a Maestro
+ * would, so anything that opens that path (SB_TermiosStream, Serial1 with
+ * SB_SERIAL1 pointed at it, the Maestro Control Center's serial tools...) is
+ * talking to a real tty rather than an in-process object.
+ *
+ * Usage: maestroEmulator [options]
+ * 		--channels N     6 (Micro), 12, 18 or 24 (Mini), default 24
+ * 		--device N       device number for the Pololu protocol, default 12
+ * 		--crc            require a CRC7 byte on every packet
+ * 		--latency-us N   extra delay before each response
+ * 		--baud N         pace response bytes at this baud's wire time
+ * 		--rx-loss P      drop each received byte with probability P
+ * 		--tx-loss P      drop each response byte with probability P
+ * 		--seed N         seed for the loss injection
+ * 		--frame-us N     servo frame period, default 20000
+ * 		--log FILE       per-command service time CSV
+ * 		--link PATH      also make PATH a symlink to the slave device
+ *
+ * On SIGINT/SIGTERM it prints per-command service time statistics to stderr.
+ */
+
+#include <Arduino.h>
+#include <SB_MaestroEmulator.hpp>
+#include <SB_PtyPair.hpp>
+
+#include <cerrno>
+#include <csignal>
+#include <getopt.h>
+#include <poll.h>
+#include <unistd.h>
+#include <vector>
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void requestStop(int) {
+	stopRequested = 1;
+}
+
+int main(int argc, char **argv) {
+	int channels = EMULATOR_MAX_CHANNELS;
+	int device = EMULATOR_DEFAULT_DEVICE_NUMBER;
+	bool crc = false;
+	unsigned long latencyUs = 0;
+	unsigned long baud = 0;
+	float rxLoss = 0;
+	float txLoss = 0;
+	unsigned long seed = 1;
+	unsigned long frameUs = EMULATOR_FRAME_PERIOD_US;
+	const char *logPath = nullptr;
+	const char *linkPath = nullptr;
+
+	static const struct option options[] = {
+		{"channels", required_argument, nullptr, 'c'},
+		{"device", required_argument, nullptr, 'd'},
+		{"crc", no_argument, nullptr, 'r'},
+		{"latency-us", required_argument, nullptr, 'l'},
+		{"baud", required_argument, nullptr, 'b'},
+		{"rx-loss", required_argument, nullptr, 'x'},
+		{"tx-loss", required_argument, nullptr, 't'},
+		{"seed", required_argument, nullptr, 's'},
+		{"frame-us", required_argument, nullptr, 'f'},
+		{"log", required_argument, nullptr, 'o'},
+		{"link", required_argument, nullptr, 'k'},
+		{nullptr, 0, nullptr, 0}
+	};
+	int option;
+	while ((option = getopt_long(argc, argv, "", options, nullptr)) != -1) {
+		switch (option) {
+			case 'c': channels = atoi(optarg); break;
+			case 'd': device = atoi(optarg); break;
+			case 'r': crc = true; break;
+			case 'l': latencyUs = strtoul(optarg, nullptr, 10); break;
+			case 'b': baud = strtoul(optarg, nullptr, 10); break;
+			case 'x': rxLoss = atof(optarg); break;
+			case 't': txLoss = atof(optarg); break;
+			case 's': seed = strtoul(optarg, nullptr, 10); break;
+			case 'f': frameUs = strtoul(optarg, nullptr, 10); break;
+			case 'o': logPath = optarg; break;
+			case 'k': linkPath = optarg; break;
+			default:
+				fprintf(stderr, "see the top of maestroEmulator.cpp for usage\n");
+				return 2;
+		}
+	}
+	if (channels != 6 && channels != 12 && channels != 18 && channels != 24) {
+		fprintf(stderr, "--channels must be 6, 12, 18 or 24\n");
+		return 2;
+	}
+
+	SB_MaestroEmulator maestro(channels, device, crc);
+	maestro.setResponseLatency(latencyUs);
+	maestro.setBaud(baud);
+	maestro.setLossRates(rxLoss, txLoss);
+	maestro.setSeed(seed);
+	maestro.setFrame(frameUs, 0);
+
+	FILE *log = nullptr;
+	if (logPath) {
+		log = fopen(logPath, "w");
+		if (!log) {
+			perror(logPath);
+			return 1;
+		}
+		maestro.setCommandLog(log);
+	}
+
+	SB_PtyPair pty;
+	if (!pty.open()) {
+		perror("couldn't allocate a pty");
+		return 1;
+	}
+	if (linkPath) {
+		unlink(linkPath);
+		if (symlink(pty.getSlavePath(), linkPath) < 0) {
+			perror(linkPath);
+			return 1;
+		}
+	}
+	printf("%s\n", pty.getSlavePath());
+	fflush(stdout);
+
+	signal(SIGINT, requestStop);
+	signal(SIGTERM, requestStop);
+
+	std::vector<uint8_t> outgoing; // responses the pty wouldn't take yet
+	uint8_t buffer[256];
+	while (!stopRequested) {
+		uint32_t now = micros();
+		maestro.update(now);
+
+		size_t ready;
+		while ((ready = maestro.takeResponse(buffer, sizeof(buffer), now)) > 0) {
+			outgoing.insert(outgoing.end(), buffer, buffer + ready);
+		}
+		if (!outgoing.empty()) {
+			ssize_t written = ::write(pty.getMasterFd(), outgoing.data(), outgoing.size());
+			if (written > 0) {
+				outgoing.erase(outgoing.begin(), outgoing.begin() + written);
+			}
+		}
+
+		// Sleep until there's input, the pty takes what's left over, or the
+		// emulator has something to do
+		int32_t waitUs = (int32_t) (maestro.nextEventUs() - micros());
+		if (waitUs < 0) {
+			waitUs = 0;
+		}
+		struct timespec timeout = {waitUs / 1000000, (waitUs % 1000000) * 1000L};
+		short events = outgoing.empty() ? POLLIN : POLLIN | POLLOUT;
+		struct pollfd master = {pty.getMasterFd(), events, 0};
+		if (ppoll(&master, 1, &timeout, nullptr) <= 0 || !(master.revents & POLLIN)) {
+			continue;
+		}
+
+		ssize_t received;
+		while ((received = ::read(pty.getMasterFd(), buffer, sizeof(buffer))) > 0) {
+			for (ssize_t i = 0; i < received; i++) {
+				maestro.receive(buffer[i], micros());
+			}
+		}
+	}
+
+	maestro.printStats(stderr);
+	if (log) {
+		fclose(log);
+	}
+	if (linkPath) {
+		unlink(linkPath);
+	}
+	return 0;
+}
@@ -0,0 +1,119 @@
+/**
+ * Converts a SB_FlightRecorder log (a SB_SpiFlashSink dump(), or any file of
+ * its blocks) into CSV, one row a record:
+ * 		run,time_us,type,channel,value
+ *
+ * Blocks are put in order by sequence number, so a flash ring that wrapped comes
+ * out oldest first. Times are micros() at the recording, carried past the 32 bit
+ * wrap within a run. Missing and damaged blocks are reported on stderr, erased
+ * ones are skipped quietly.
+ *
+ * Usage: recorderToCsv log.bin [log.csv]
+ * 		writes to stdout when no output file is given
+ */
+
+#include <SB_FlightRecorder.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+struct Block {
+	uint32_t sequence;
+	uint8_t run;
+	std::vector<SB_RecordEntry> entries;
+};
+
+static const char *typeName(uint8_t type) {
+	switch (type) {
+		case RECORD_RC: return "rc";
+		case RECORD_SERVO: return "servo";
+		case RECORD_FAULT: return "fault";
+		case RECORD_MARK: return "mark";
+		default: return "other";
+	}
+}
+
+static bool erased(const uint8_t *block) {
+	for (int i = 0; i < RECORDER_BLOCK_BYTES; i++) {
+		if (block[i] != 0xFF) {
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "usage: %s log.bin [log.csv]\n", argv[0]);
+		return 2;
+	}
+
+	FILE *in = fopen(argv[1], "rb");
+	if (!in) {
+		perror(argv[1]);
+		return 1;
+	}
+	std::vector<Block> blocks;
+	uint8_t raw[RECORDER_BLOCK_BYTES];
+	SB_RecordEntry entries[RECORDER_MAX_RECORDS];
+	long offset = 0;
+	int damaged = 0;
+	while (fread(raw, 1, sizeof(raw), in) == sizeof(raw)) {
+		Block block;
+		int count = SB_FlightRecorder::decodeBlock(raw, block.sequence, block.run, entries);
+		if (count >= 0) {
+			block.entries.assign(entries, entries + count);
+			blocks.push_back(std::move(block));
+		} else if (!erased(raw)) {
+			fprintf(stderr, "damaged block at offset %ld\n", offset);
+			damaged++;
+		}
+		offset += sizeof(raw);
+	}
+	fclose(in);
+	if (blocks.empty()) {
+		fprintf(stderr, "%s: no flight recorder blocks\n", argv[1]);
+		return 1;
+	}
+
+	FILE *out = argc == 3 ? fopen(argv[2], "w") : stdout;
+	if (!out) {
+		perror(argv[2]);
+		return 1;
+	}
+	std::sort(blocks.begin(), blocks.end(), [](const Block &a, const Block &b) { return a.sequence < b.sequence; });
+	fprintf(out, "run,time_us,type,channel,value\n");
+	size_t records = 0;
+	uint32_t missing = 0;
+	uint64_t timeUs = 0;
+	uint32_t lastUs = 0;
+	for (size_t i = 0; i < blocks.size(); i++) {
+		const Block &block = blocks[i];
+		bool newRun = i == 0 || block.run != blocks[i - 1].run;
+		if (i > 0 && block.sequence - blocks[i - 1].sequence > 1) {
+			uint32_t gap = block.sequence - blocks[i - 1].sequence - 1;
+			fprintf(stderr, "blocks %lu to %lu missing\n", (unsigned long) blocks[i - 1].sequence + 1,
+					(unsigned long) block.sequence - 1);
+			missing += gap;
+		}
+		for (const SB_RecordEntry &entry : block.entries) {
+			if (newRun) {
+				timeUs = entry.timeUs;
+				newRun = false;
+			} else {
+				timeUs += (int32_t) (entry.timeUs - lastUs);
+			}
+			lastUs = entry.timeUs;
+			fprintf(out, "%u,%llu,%s,%u,%ld\n", block.run, (unsigned long long) timeUs, typeName(entry.type),
+					entry.channel, (long) entry.value);
+			records++;
+		}
+	}
+	if (out != stdout) {
+		fclose(out);
+	}
+	fprintf(stderr, "%zu records in %zu blocks, %lu missing, %d damaged\n", records, blocks.size(),
+			(unsigned long) missing, damaged);
+	return 0;
+}
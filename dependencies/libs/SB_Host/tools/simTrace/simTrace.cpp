@@ -0,0 +1,127 @@
+/**
+ * Runs the RC-in, Maestro-out control loop in virtual time and writes a trace
+ * of it, to see where the time between a stick movement and a servo pulse goes.
+ *
+ * The pwm_channel ISRs from main/ measure two simulated AR620 channels, a 20 ms
+ * scheduler task turns CH2 and CH3 into targets for channels 0 and 1 and reads
+ * channel 0 back, and the Maestro on the other end is a SB_MaestroEmulator
+ * behind a SB_EmulatedSerial with wire time at the given baud.
+ *
+ * Usage: simTrace [options]
+ * 		--duration-ms N  how long to simulate, default 1000
+ * 		--baud N         serial link baud, default 115200, 0 for no wire time
+ * 		--speed N        Maestro speed limit on channel 0, default 0 (none)
+ * 		--json FILE      Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev)
+ * 		--binary FILE    compact binary trace, tools/traceToJson converts it
+ *
+ * Build from dependencies/libs with -DSB_MAESTRO_TRACE (so packet encoding shows
+ * up) and -I../../main (for pwm_channel), see SB_Host/README.md.
+ */
+
+#include <Arduino.h>
+#include <PololuMaestro.h>
+#include <SB_EmulatedSerial.hpp>
+#include <SB_Simulation.hpp>
+#include <SB_Trace.hpp>
+
+#include <getopt.h>
+
+#include "pwm_channel.h"
+
+pwmChannel CH2;
+pwmChannel CH3;
+
+#include "pwm_channel.ino"
+
+#define RC_FRAME_US 22000
+#define CONTROL_PERIOD_US 20000
+
+int main(int argc, char **argv) {
+	unsigned long durationMs = 1000;
+	unsigned long baud = 115200;
+	unsigned long speed = 0;
+	const char *jsonPath = nullptr;
+	const char *binaryPath = nullptr;
+
+	static const struct option options[] = {
+		{"duration-ms", required_argument, nullptr, 'd'},
+		{"baud", required_argument, nullptr, 'b'},
+		{"speed", required_argument, nullptr, 's'},
+		{"json", required_argument, nullptr, 'j'},
+		{"binary", required_argument, nullptr, 'o'},
+		{nullptr, 0, nullptr, 0}
+	};
+	int option;
+	while ((option = getopt_long(argc, argv, "", options, nullptr)) != -1) {
+		switch (option) {
+			case 'd': durationMs = strtoul(optarg, nullptr, 10); break;
+			case 'b': baud = strtoul(optarg, nullptr, 10); break;
+			case 's': speed = strtoul(optarg, nullptr, 10); break;
+			case 'j': jsonPath = optarg; break;
+			case 'o': binaryPath = optarg; break;
+			default:
+				fprintf(stderr, "usage: %s [--duration-ms N] [--baud N] [--speed N] [--json FILE] [--binary FILE]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (!jsonPath && !binaryPath) {
+		jsonPath = "simTrace.json";
+	}
+
+	SB_Simulation simulation;
+	SB_Trace trace;
+	simulation.makeCurrent();
+	SB_Trace::setCurrent(&trace);
+
+	SB_MaestroEmulator emulator(12);
+	emulator.setBaud(baud);
+	SB_EmulatedSerial serial(emulator);
+	MiniMaestro maestro(serial);
+	if (speed) {
+		maestro.setSpeed(0, speed);
+	}
+
+	// CH2 sweeps the right stick back and forth every 2 s, CH3 flicks between two positions
+	SB_RcPulseGenerator ch2(simulation, CH2_PIN, RC_FRAME_US, [](uint64_t nowUs) {
+		return (uint16_t) (1500 + 400 * sin(2 * M_PI * nowUs / 2e6));
+	});
+	SB_RcPulseGenerator ch3(simulation, CH3_PIN, RC_FRAME_US, [](uint64_t nowUs) {
+		return (uint16_t) ((nowUs / 500000) % 2 ? 1900 : 1100);
+	});
+	initPWM();
+	ch2.start(1000);
+	ch3.start(3500);
+
+	uint32_t lastPosition = 0;
+	simulation.every("control", CONTROL_PERIOD_US, [&]() {
+		if (CH2.pwmValue > 0) {
+			maestro.setTarget(0, CH2.pwmValue * 4);
+		}
+		if (CH3.pwmValue > 0) {
+			maestro.setTarget(1, CH3.pwmValue * 4);
+		}
+		lastPosition = maestro.getPosition(0);
+	}, CONTROL_PERIOD_US);
+
+	simulation.run((uint64_t) durationMs * 1000, []() {});
+
+	SB_Trace::setCurrent(nullptr);
+	SB_Simulation::clearCurrent();
+
+	printf("%lu ms simulated: %llu ISRs, %llu control runs, %u pulses on CH2, last position %lu\n",
+			durationMs, (unsigned long long) simulation.getIsrCount(),
+			(unsigned long long) simulation.getTaskRuns(), ch2.getPulses(), (unsigned long) lastPosition);
+	printf("%zu trace events", trace.size());
+	if (trace.getDropped()) {
+		printf(" (%u dropped)", trace.getDropped());
+	}
+	printf("\n");
+
+	if (jsonPath && trace.writeJson(jsonPath)) {
+		printf("wrote %s\n", jsonPath);
+	}
+	if (binaryPath && trace.writeBinary(binaryPath)) {
+		printf("wrote %s\n", binaryPath);
+	}
+	return trace.getErrorCode() & TRACE_WRITE_ERROR_BIT ? 1 : 0;
+}
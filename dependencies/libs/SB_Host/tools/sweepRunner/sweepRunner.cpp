@@ -0,0 +1,407 @@
+/**
+ * Runs the servo control loop over a grid of tuning parameters, one virtual-time
+ * simulation per combination, spread over every core with a SB_WorkStealingPool,
+ * and writes one CSV row of metrics per combination.
+ *
+ * Each simulation is the real code: the pwm_channel ISRs from main/ measure CH2
+ * and CH3 replayed from an RC recording, a control task filters them and moves
+ * two SB_Servos (rudder on Maestro channel 0, sail on 1) through Serial1, which
+ * is routed to that simulation's own SB_MaestroEmulator.
+ *
+ * Usage: sweepRunner [options]
+ * 		--rc FILE          recorded RC input (SB_RcRecording CSV, CH2 then CH3),
+ * 		                   default a built-in set of stick maneuvers
+ * 		--write-rc FILE    save the built-in maneuvers as a recording and exit
+ * 		--duration-ms N    per simulation, default the length of the recording
+ * 		--speeds LIST      Maestro speed limits, default 0,20,60
+ * 		--accels LIST      Maestro acceleration limits, default 0,4
+ * 		--windows LIST     moving average length over RC samples, default 1,4
+ * 		--periods-ms LIST  control task periods, default 10,20,40
+ * 		--bauds LIST       serial link baud rates, default 9600,115200
+ * 		--readback N       getCurrentDegrees() every N control runs, 0 for never, default 5
+ * 		--threads N        worker threads, default one per hardware thread
+ * 		--out FILE         the CSV, default stdout
+ * LISTs are comma separated.
+ *
+ * The columns (times in microseconds):
+ * 		sample_age_us      how old the newest RC measurement was when the control task used it
+ * 		pulse_latency_us   setTarget arriving at the Maestro to the first servo frame that carries it
+ * 		input_to_pulse_us  end of the RC pulse to the first servo frame carrying the command made from it
+ * 		overshoot_us       furthest the output pulse got past where the stick said, in the direction it was moving
+ * 		rms_error_us       output pulse against the stick, sampled every servo frame
+ * 		tx/rx_utilization  share of the link's time spent sending bytes each way
+ * 		wall_ms            host time the simulation took
+ * A summary (simulations per second, jobs each worker ran and stole) goes to stderr.
+ */
+
+#include <Arduino.h>
+#include <PololuMaestro.h>
+#include <SB_Servo.hpp>
+#include <SB_EmulatedSerial.hpp>
+#include <SB_RcRecording.hpp>
+#include <SB_Simulation.hpp>
+#include <SB_WorkStealingPool.hpp>
+
+#include <chrono>
+#include <getopt.h>
+#include <mutex>
+
+#include "pwm_channel.h"
+
+// One of each per simulation thread, the ISRs below only ever see their own thread's
+thread_local pwmChannel CH2;
+thread_local pwmChannel CH3;
+
+#include "pwm_channel.ino"
+
+#define RC_FRAME_US 22000
+#define SAMPLE_PERIOD_US EMULATOR_FRAME_PERIOD_US
+#define MAX_FILTER_WINDOW 32
+#define SERVO_COUNT 2
+#define RUN_HISTORY 4 // control runs remembered for matching commands to the input they came from
+
+struct SweepConfig {
+	uint16_t speed;
+	uint16_t acceleration;
+	uint8_t window;
+	uint32_t periodUs;
+	uint32_t baud;
+};
+
+struct SweepResult {
+	uint32_t commands = 0;
+	double sampleAgeUs = 0;
+	double pulseLatencyUs = 0;
+	double inputToPulseUs = 0;
+	double overshootUs = 0;
+	double rmsErrorUs = 0;
+	double txUtilization = 0;
+	double rxUtilization = 0;
+	int servoErrors = 0;
+	double wallMs = 0;
+};
+
+// SB_Servo numbers servos from a plain static counter
+static std::mutex servoConstruction;
+
+/**
+ * Where the stick says the servo should be, in Maestro quarter-microseconds.
+ * 1000-2000 us of stick maps onto SB_Servo's default 0-180 degrees, which is
+ * 500-2500 us of servo pulse
+ */
+static double idealTarget(uint16_t stickUs) {
+	double clamped = constrain((double) stickUs, 1000.0, 2000.0);
+	return 4 * (2 * clamped - 1500);
+}
+
+static float stickToDegrees(double stickUs) {
+	return (float) ((constrain(stickUs, 1000.0, 2000.0) - 1000) * 180 / 1000);
+}
+
+static SweepResult simulate(const SweepConfig &config, const SB_RcRecording &recording,
+		uint64_t durationUs, uint32_t readbackEvery) {
+	auto wallStart = std::chrono::steady_clock::now();
+	SweepResult result;
+
+	SB_Simulation simulation;
+	simulation.makeCurrent();
+	CH2.riseTime = 0;
+	CH2.pwmValue = 0;
+	CH3.riseTime = 0;
+	CH3.pwmValue = 0;
+
+	SB_MaestroEmulator emulator(12);
+	emulator.setBaud(config.baud);
+	SB_EmulatedSerial serial(emulator);
+	SB_HostSerialPort::routeThread(&serial);
+
+	SB_RcPulseGenerator ch2(simulation, CH2_PIN, RC_FRAME_US,
+			[&recording](uint64_t nowUs) { return recording.widthAt(0, nowUs); });
+	SB_RcPulseGenerator ch3(simulation, CH3_PIN, RC_FRAME_US,
+			[&recording](uint64_t nowUs) { return recording.widthAt(1, nowUs); });
+	initPWM();
+	ch2.start(0);
+	ch3.start(RC_FRAME_US / 2);
+
+	MiniMaestro maestro(Serial1);
+	std::unique_ptr<SB_Servo> servos[SERVO_COUNT];
+	{
+		std::lock_guard<std::mutex> guard(servoConstruction);
+		for (int i = 0; i < SERVO_COUNT; i++) {
+			servos[i].reset(new SB_Servo(i));
+		}
+	}
+	for (uint8_t i = 0; i < SERVO_COUNT; i++) {
+		maestro.setSpeed(i, config.speed);
+		maestro.setAcceleration(i, config.acceleration);
+	}
+
+	// Control: a moving average of the last window RC samples to each servo
+	volatile int *inputs[SERVO_COUNT] = {&CH2.pwmValue, &CH3.pwmValue};
+	SB_RcPulseGenerator *generators[SERVO_COUNT] = {&ch2, &ch3};
+	int history[SERVO_COUNT][MAX_FILTER_WINDOW] = {{0}};
+	uint8_t filled = 0;
+	uint8_t next = 0;
+	uint32_t runs = 0;
+	double totalSampleAgeUs = 0;
+	// The latest control runs' times and the RC measurements they used, per servo
+	uint64_t commandUs[SERVO_COUNT][RUN_HISTORY] = {{0}};
+	uint64_t inputUs[SERVO_COUNT][RUN_HISTORY] = {{0}};
+	uint8_t newestRun = 0;
+	simulation.every("control", config.periodUs, [&]() {
+		if (CH2.pwmValue == 0 || CH3.pwmValue == 0) {
+			return; // nothing measured yet
+		}
+		for (int i = 0; i < SERVO_COUNT; i++) {
+			history[i][next] = *inputs[i];
+		}
+		next = (next + 1) % config.window;
+		if (filled < config.window) {
+			filled++;
+		}
+		newestRun = (newestRun + 1) % RUN_HISTORY;
+		for (int i = 0; i < SERVO_COUNT; i++) {
+			long sum = 0;
+			for (uint8_t j = 0; j < filled; j++) {
+				sum += history[i][j];
+			}
+			commandUs[i][newestRun] = simulation.now();
+			inputUs[i][newestRun] = generators[i]->getLastFallUs();
+			totalSampleAgeUs += commandUs[i][newestRun] - inputUs[i][newestRun];
+			servos[i]->rotateToDegrees(stickToDegrees((double) sum / filled));
+			result.commands++;
+		}
+		if (readbackEvery && ++runs % readbackEvery == 0) {
+			for (int i = 0; i < SERVO_COUNT; i++) {
+				servos[i]->getCurrentDegrees();
+			}
+		}
+	}, config.periodUs);
+
+	// Measurement: the output pulse on every servo frame against the stick
+	double lastPosition[SERVO_COUNT] = {0};
+	uint32_t samples = 0;
+	double squaredError = 0;
+	uint32_t seenCommandUs[SERVO_COUNT] = {0};
+	uint32_t carried = 0;
+	double totalInputToPulseUs = 0;
+	simulation.every("sample", SAMPLE_PERIOD_US, [&]() {
+		serial.deliver(simulation.now());
+		for (uint8_t i = 0; i < SERVO_COUNT; i++) {
+			// A target that arrived since the last frame went out on this one,
+			// it came from the newest control run that started before it arrived
+			uint32_t arrivedUs = emulator.getCommandedUs(i);
+			if (arrivedUs != seenCommandUs[i]) {
+				seenCommandUs[i] = arrivedUs;
+				for (uint8_t back = 0; back < RUN_HISTORY; back++) {
+					uint8_t run = (newestRun + RUN_HISTORY - back) % RUN_HISTORY;
+					if (commandUs[i][run] != 0 && commandUs[i][run] <= arrivedUs) {
+						totalInputToPulseUs += simulation.now() - inputUs[i][run];
+						carried++;
+						break;
+					}
+				}
+			}
+
+			double position = emulator.getPosition(i);
+			if (position == 0) {
+				continue; // not commanded yet
+			}
+			double errorUs = (position - idealTarget(recording.widthAt(i, simulation.now()))) / 4;
+			squaredError += errorUs * errorUs;
+			samples++;
+			// Only while the output moves: a stick step leaves a still servo
+			// behind, not past
+			if (lastPosition[i] != 0 && position != lastPosition[i]) {
+				int direction = position > lastPosition[i] ? 1 : -1;
+				if (direction * errorUs > result.overshootUs) {
+					result.overshootUs = direction * errorUs;
+				}
+			}
+			lastPosition[i] = position;
+		}
+	}, SAMPLE_PERIOD_US);
+
+	simulation.run(durationUs, []() {});
+
+	if (result.commands) {
+		result.sampleAgeUs = totalSampleAgeUs / result.commands;
+	}
+	if (emulator.getPulseUpdates()) {
+		result.pulseLatencyUs = (double) emulator.getTotalPulseLatencyUs() / emulator.getPulseUpdates();
+	}
+	if (carried) {
+		result.inputToPulseUs = totalInputToPulseUs / carried;
+	}
+	if (samples) {
+		result.rmsErrorUs = sqrt(squaredError / samples);
+	}
+	double byteTimeUs = emulator.getByteTimeUs();
+	result.txUtilization = serial.getBytesWritten() * byteTimeUs / durationUs;
+	result.rxUtilization = serial.getBytesRead() * byteTimeUs / durationUs;
+	for (int i = 0; i < SERVO_COUNT; i++) {
+		result.servoErrors |= servos[i]->getErrorCode();
+	}
+
+	SB_HostSerialPort::routeThread(nullptr);
+	SB_Simulation::clearCurrent();
+	result.wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wallStart).count();
+	return result;
+}
+
+/**
+ * Stick work a helmsman might do in a minute, squeezed into 20 s: holds, hard
+ * over steps, a slow sweep and small corrections on the rudder (CH2), slow
+ * trimming on the sail (CH3)
+ */
+static void builtInManeuvers(SB_RcRecording &recording) {
+	for (uint64_t t = 0; t <= 20000000; t += RC_FRAME_US) {
+		double seconds = t / 1e6;
+		double rudder;
+		if (seconds < 2) {
+			rudder = 1500;
+		} else if (seconds < 5) {
+			rudder = 1900;
+		} else if (seconds < 8) {
+			rudder = 1100;
+		} else if (seconds < 14) {
+			rudder = 1500 + 400 * sin(2 * M_PI * (seconds - 8) / 3);
+		} else {
+			rudder = 1500 + 60 * sin(2 * M_PI * seconds * 1.5);
+		}
+		double sail = 1200 + 600 * (0.5 - 0.5 * cos(2 * M_PI * seconds / 20));
+		uint16_t widths[2] = {(uint16_t) lround(rudder), (uint16_t) lround(sail)};
+		recording.add(t, widths, 2);
+	}
+}
+
+static std::vector<unsigned long> parseList(const char *text) {
+	std::vector<unsigned long> values;
+	char *end;
+	while (*text) {
+		values.push_back(strtoul(text, &end, 10));
+		if (end == text) {
+			break;
+		}
+		text = *end == ',' ? end + 1 : end;
+	}
+	return values;
+}
+
+int main(int argc, char **argv) {
+	const char *rcPath = nullptr;
+	const char *writeRcPath = nullptr;
+	const char *outPath = nullptr;
+	unsigned long durationMs = 0;
+	unsigned long readback = 5;
+	unsigned threads = 0;
+	std::vector<unsigned long> speeds = {0, 20, 60};
+	std::vector<unsigned long> accels = {0, 4};
+	std::vector<unsigned long> windows = {1, 4};
+	std::vector<unsigned long> periodsMs = {10, 20, 40};
+	std::vector<unsigned long> bauds = {9600, 115200};
+
+	static const struct option options[] = {
+		{"rc", required_argument, nullptr, 'r'},
+		{"write-rc", required_argument, nullptr, 'w'},
+		{"duration-ms", required_argument, nullptr, 'd'},
+		{"speeds", required_argument, nullptr, 's'},
+		{"accels", required_argument, nullptr, 'a'},
+		{"windows", required_argument, nullptr, 'n'},
+		{"periods-ms", required_argument, nullptr, 'p'},
+		{"bauds", required_argument, nullptr, 'b'},
+		{"readback", required_argument, nullptr, 'k'},
+		{"threads", required_argument, nullptr, 't'},
+		{"out", required_argument, nullptr, 'o'},
+		{nullptr, 0, nullptr, 0}
+	};
+	int option;
+	while ((option = getopt_long(argc, argv, "", options, nullptr)) != -1) {
+		switch (option) {
+			case 'r': rcPath = optarg; break;
+			case 'w': writeRcPath = optarg; break;
+			case 'd': durationMs = strtoul(optarg, nullptr, 10); break;
+			case 's': speeds = parseList(optarg); break;
+			case 'a': accels = parseList(optarg); break;
+			case 'n': windows = parseList(optarg); break;
+			case 'p': periodsMs = parseList(optarg); break;
+			case 'b': bauds = parseList(optarg); break;
+			case 'k': readback = strtoul(optarg, nullptr, 10); break;
+			case 't': threads = strtoul(optarg, nullptr, 10); break;
+			case 'o': outPath = optarg; break;
+			default:
+				fprintf(stderr, "see the top of sweepRunner.cpp for the options\n");
+				return 2;
+		}
+	}
+
+	SB_RcRecording recording;
+	if (rcPath) {
+		if (!recording.load(rcPath) || recording.getChannelCount() < 2) {
+			fprintf(stderr, "%s: not a recording with CH2 and CH3 columns\n", rcPath);
+			return 1;
+		}
+	} else {
+		builtInManeuvers(recording);
+	}
+	if (writeRcPath) {
+		return recording.save(writeRcPath) ? 0 : 1;
+	}
+	uint64_t durationUs = durationMs ? durationMs * 1000 : recording.getDurationUs();
+
+	std::vector<SweepConfig> configs;
+	for (unsigned long speed : speeds) {
+		for (unsigned long accel : accels) {
+			for (unsigned long window : windows) {
+				for (unsigned long periodMs : periodsMs) {
+					for (unsigned long baud : bauds) {
+						if (window < 1 || window > MAX_FILTER_WINDOW || periodMs == 0) {
+							continue;
+						}
+						configs.push_back({(uint16_t) speed, (uint16_t) accel, (uint8_t) window,
+								(uint32_t) periodMs * 1000, (uint32_t) baud});
+					}
+				}
+			}
+		}
+	}
+
+	FILE *out = outPath ? fopen(outPath, "w") : stdout;
+	if (!out) {
+		perror(outPath);
+		return 1;
+	}
+
+	std::vector<SweepResult> results(configs.size());
+	auto wallStart = std::chrono::steady_clock::now();
+	SB_WorkStealingPool pool(threads);
+	for (size_t i = 0; i < configs.size(); i++) {
+		pool.submit([&, i]() { results[i] = simulate(configs[i], recording, durationUs, readback); });
+	}
+	pool.wait();
+	double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wallStart).count();
+
+	fprintf(out, "speed,acceleration,window,period_ms,baud,commands,sample_age_us,pulse_latency_us,"
+			"input_to_pulse_us,overshoot_us,rms_error_us,tx_utilization,rx_utilization,servo_errors,wall_ms\n");
+	for (size_t i = 0; i < configs.size(); i++) {
+		const SweepConfig &c = configs[i];
+		const SweepResult &r = results[i];
+		fprintf(out, "%u,%u,%u,%lu,%lu,%lu,%.1f,%.1f,%.1f,%.1f,%.1f,%.4f,%.4f,0x%02X,%.1f\n",
+				c.speed, c.acceleration, c.window, (unsigned long) c.periodUs / 1000, (unsigned long) c.baud,
+				(unsigned long) r.commands, r.sampleAgeUs, r.pulseLatencyUs, r.inputToPulseUs,
+				r.overshootUs, r.rmsErrorUs, r.txUtilization, r.rxUtilization, r.servoErrors, r.wallMs);
+	}
+	if (outPath) {
+		fclose(out);
+	}
+
+	double simulatedS = configs.size() * (durationUs / 1e6);
+	fprintf(stderr, "%zu simulations of %.1f s on %u threads in %.0f ms: %.1f simulations/s, %.0fx real time\n",
+			configs.size(), durationUs / 1e6, pool.getThreadCount(), wallMs,
+			configs.size() * 1000.0 / wallMs, simulatedS * 1000.0 / wallMs);
+	for (unsigned i = 0; i < pool.getThreadCount(); i++) {
+		fprintf(stderr, "  worker %u: ran %llu, stole %llu\n", i,
+				(unsigned long long) pool.getExecuted(i), (unsigned long long) pool.getStolen(i));
+	}
+	return 0;
+}
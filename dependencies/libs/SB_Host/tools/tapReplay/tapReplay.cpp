@@ -0,0 +1,99 @@
+/**
+ * Replays a Maestro traffic log (SB_StreamTap::dump()) into the emulator and
+ * prints what the Maestro ended up with, whether its answers match the ones
+ * recorded, and how busy the transmit line was against how busy it would have
+ * been with other encodings and batching.
+ *
+ * Usage: tapReplay log.bin [options]
+ * 		--baud N         the link's baud, defaults to the one in the log
+ * 		--channels N     the Maestro's channels, default 12
+ * 		--device N       its device number, default 12
+ * 		--crc            it expects CRC bytes
+ * 		--batch-us LIST  batch windows to cost, default 0,1000,5000,20000
+ */
+
+#include <SB_MaestroEmulator.hpp>
+#include <SB_TapReplay.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+static void printOccupancy(const char *encoding, uint32_t batchUs, const SB_TapOccupancy &occupancy) {
+	printf("%-14s %8lu %8lu %8llu %9lu %7.2f%% %10lu\n", encoding, (unsigned long) batchUs,
+			(unsigned long) occupancy.packets, (unsigned long long) occupancy.txBytes,
+			(unsigned long) occupancy.conflatedTargets, 100 * occupancy.busyFraction,
+			(unsigned long) occupancy.maxQueueUs);
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s log.bin [--baud N] [--channels N] [--device N] [--crc] [--batch-us LIST]\n",
+				argv[0]);
+		return 2;
+	}
+	uint32_t baud = 0;
+	uint8_t channels = 12;
+	uint8_t device = EMULATOR_DEFAULT_DEVICE_NUMBER;
+	bool crc = false;
+	std::vector<uint32_t> windows = {0, 1000, 5000, 20000};
+	for (int i = 2; i < argc; i++) {
+		if (!strcmp(argv[i], "--crc")) {
+			crc = true;
+		} else if (i + 1 < argc && !strcmp(argv[i], "--baud")) {
+			baud = strtoul(argv[++i], nullptr, 10);
+		} else if (i + 1 < argc && !strcmp(argv[i], "--channels")) {
+			channels = atoi(argv[++i]);
+		} else if (i + 1 < argc && !strcmp(argv[i], "--device")) {
+			device = atoi(argv[++i]);
+		} else if (i + 1 < argc && !strcmp(argv[i], "--batch-us")) {
+			windows.clear();
+			for (char *item = strtok(argv[++i], ","); item; item = strtok(nullptr, ",")) {
+				windows.push_back(strtoul(item, nullptr, 10));
+			}
+		} else {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 2;
+		}
+	}
+
+	SB_TapReplay log;
+	if (!log.load(argv[1])) {
+		fprintf(stderr, "%s: %s\n", argv[1],
+				log.getErrorCode() & TAP_REPLAY_OPEN_ERROR_BIT ? "can't read it" : "not a SB_StreamTap log");
+		return 1;
+	}
+	if (baud == 0) {
+		baud = log.getBaud();
+	}
+	printf("%zu bytes logged over %.3f s, %zu packets, %lu baud\n", log.getBytes().size(), log.getDurationUs() / 1e6,
+			log.getPacketCount(), (unsigned long) baud);
+
+	SB_MaestroEmulator emulator(channels, device, crc);
+	emulator.setBaud(baud);
+	SB_TapReplayResult result = log.replay(emulator);
+	printf("replayed %lu bytes, the emulator answered %lu of the %lu read, %lu the same",
+			(unsigned long) result.txBytes, (unsigned long) result.answeredBytes, (unsigned long) result.rxBytes,
+			(unsigned long) result.matchedBytes);
+	if (result.firstMismatch >= 0) {
+		printf(", differing from read byte %ld", result.firstMismatch);
+	}
+	printf("\nerrors 0x%04x\n", emulator.peekErrors());
+	for (uint8_t channel = 0; channel < channels; channel++) {
+		if (emulator.getTarget(channel)) {
+			printf("channel %u target %u\n", channel, emulator.getTarget(channel));
+		}
+	}
+
+	printf("\n%-14s %8s %8s %8s %9s %8s %10s\n", "encoding", "batch_us", "packets", "bytes", "conflated", "busy",
+			"queue_us");
+	printOccupancy("as recorded", 0, log.occupancy(baud));
+	const char *names[] = {"compact", "compact+crc", "pololu", "pololu+crc"};
+	for (uint32_t window : windows) {
+		for (int encoding = 0; encoding < 4; encoding++) {
+			printOccupancy(names[encoding], window, log.reencoded(encoding >= 2, encoding % 2, window, baud));
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,37 @@
+/**
+ * Converts a binary trace (SB_Trace::writeBinary()) into Chrome trace-event JSON.
+ *
+ * Usage: traceToJson trace.sbt [trace.json]
+ * 		writes to stdout when no output file is given
+ */
+
+#include <SB_Trace.hpp>
+
+#include <cstdio>
+
+int main(int argc, char **argv) {
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "usage: %s trace.sbt [trace.json]\n", argv[0]);
+		return 2;
+	}
+
+	FILE *in = fopen(argv[1], "rb");
+	if (!in) {
+		perror(argv[1]);
+		return 1;
+	}
+	SB_Trace trace;
+	bool loaded = trace.load(in);
+	fclose(in);
+	if (!loaded) {
+		fprintf(stderr, "%s: not a SB_Trace binary trace\n", argv[1]);
+		return 1;
+	}
+
+	bool written = argc == 3 ? trace.writeJson(argv[2]) : trace.writeJson(stdout);
+	if (!written) {
+		fprintf(stderr, "writing the JSON failed\n");
+		return 1;
+	}
+	return 0;
+}
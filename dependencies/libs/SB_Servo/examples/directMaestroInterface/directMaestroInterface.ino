@@ -5,6 +5,9 @@
 
 	If you have a 0-180* servo w/ 500-2500 us, you would type 2000 in the Serial
 	monitor to move to 0* 
+
+	Numbers are read with SB_CommandParser as they arrive, so end each with a
+	newline (set the Serial Monitor to send one); the loop never waits on it.
 	Needs: minimaestro, teensy 3.2, 5V power supply for maestro
 
 	Connections are as follows: Maestro Rx -> teensy Tx
@@ -12,21 +15,30 @@
 	Teensy and Maestro both connected to power supply's ground. 
 	Maestro Vin -> powersupply 5V
 	Teensy connected via usb
+	The maestro's baud is negotiated at startup, it prints the rate it settled on
 	1 servo attached to the maestro's first slot
 
 	AHJ
 */
 #include <PololuMaestro.h>
+#include <SB_CommandParser.hpp>
 #include <vector> 
 MiniMaestro maestro(Serial1);
+SB_CommandParser parser;
+SB_Command command;
 
 void setup() {
   Serial.begin(9600);
-  Serial1.begin(9600);
+  uint32_t baud = maestro.negotiateBaud([](uint32_t rate) { Serial1.begin(rate); return true; });
+  Serial.print("maestro baud: ");
+  Serial.println(baud);
 } 
 
 void loop() {
- if (Serial.available()) {
+ while (Serial.available()) {
+  if (!parser.feed(Serial.read(), command) || command.letter != 't') {
+    continue;
+  }
   
 	/** Some stuff for testing the set multi target method on the maestro
     maestro.setTarget(0, 10000);
@@ -38,8 +50,8 @@ void loop() {
     // *targetPtr = &targets;
     maestro.setMultiTarget(2, 0, &targets[0]);
     */
-    int val = Serial.parseInt();
-    maestro.setTarget(0, val);
+    int val = command.values[1] / 100;
+    maestro.setTarget(command.values[0] / 100, val);
     int pos = maestro.getPosition(0);
     Serial.print("Position: ");
     Serial.println(pos);
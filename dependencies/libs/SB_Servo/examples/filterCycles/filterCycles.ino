@@ -0,0 +1,91 @@
+/**
+ * Measures CPU cycles per frame of six RC channels through SB_RcFilter, the
+ * packed path (SADD16/SSUB16/SMUAD) against the scalar one, and checks the two
+ * agree bit for bit on the real instructions.
+ *
+ * Cycles are counted with the ARM DWT cycle counter, so this needs a Teensy 3.x
+ * or 4.x. No receiver needed, the widths are made up. Open the Serial Monitor
+ * at any baud to read the results.
+ *
+ * AHJ
+ */
+#include <SB_RcFilter.hpp>
+
+#define CHANNELS 6
+
+const uint32_t frames = 10000;
+int widths[64][CHANNELS];
+volatile uint32_t checksum = 0; // so the results can't be optimized away
+
+uint32_t frameCycles(SB_RcFilter &filter, bool packed) {
+	int out[CHANNELS];
+	uint32_t start = ARM_DWT_CYCCNT;
+	for (uint32_t i = 0; i < frames; i++) {
+		if (packed) {
+			filter.filter(widths[i & 63], out);
+		} else {
+			filter.filterScalar(widths[i & 63], out);
+		}
+		checksum = checksum * 31 + out[i % CHANNELS];
+	}
+	return (ARM_DWT_CYCCNT - start) / frames;
+}
+
+/**
+ * @return frames where the two paths differ, over widths with glitches in
+ */
+uint32_t disagreements(uint8_t windowShift, uint16_t alpha) {
+	SB_RcFilter packed(CHANNELS, windowShift, alpha);
+	SB_RcFilter scalar(CHANNELS, windowShift, alpha);
+	uint32_t mismatches = 0;
+	for (uint32_t i = 0; i < frames; i++) {
+		int in[CHANNELS];
+		for (int c = 0; c < CHANNELS; c++) {
+			in[c] = i % 97 == c ? (int) (i * 20011) : widths[(i * 7) & 63][c];
+		}
+		int packedOut[CHANNELS];
+		int scalarOut[CHANNELS];
+		packed.filter(in, packedOut);
+		scalar.filterScalar(in, scalarOut);
+		if (memcmp(packedOut, scalarOut, sizeof(packedOut)) != 0) {
+			mismatches++;
+		}
+	}
+	return mismatches;
+}
+
+void report(const char *what, uint8_t windowShift, uint16_t alpha) {
+	SB_RcFilter packed(CHANNELS, windowShift, alpha);
+	SB_RcFilter scalar(CHANNELS, windowShift, alpha);
+	Serial.print(what);
+	Serial.print(": packed ");
+	Serial.print(frameCycles(packed, true));
+	Serial.print(" cycles, scalar ");
+	Serial.print(frameCycles(scalar, false));
+	Serial.print(" cycles, frames differing (expected 0): ");
+	Serial.println(disagreements(windowShift, alpha));
+}
+
+void setup() {
+	Serial.begin(9600);
+	while (!Serial && millis() < 3000);
+
+	// Turn on the cycle counter
+	ARM_DEMCR |= ARM_DEMCR_TRCENA;
+	ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+
+	for (int i = 0; i < 64; i++) {
+		for (int c = 0; c < CHANNELS; c++) {
+			widths[i][c] = 1500 + (int) (400 * sin(i / (5.0 + c))) + (i * 7 + c * 13) % 9 - 4;
+		}
+	}
+
+	Serial.print("DSP instructions: ");
+	Serial.println(SB_RcFilter::usesDSP() ? "yes" : "no");
+	report("average 4, IIR 1/4", 2, RC_FILTER_ALPHA_ONE / 4);
+	report("average 16, IIR 1/16", 4, RC_FILTER_ALPHA_ONE / 16);
+	report("average only, 8", 3, RC_FILTER_ALPHA_ONE);
+}
+
+void loop() {
+}
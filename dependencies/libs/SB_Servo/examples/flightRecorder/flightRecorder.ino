@@ -0,0 +1,78 @@
+/**
+ * Records a sweep of six servos at 1 kHz into SPI flash with SB_FlightRecorder,
+ * and dumps the flash over USB on request.
+ *
+ * Wire a W25Qxx flash to the Teensy's SPI pins with chip select on FLASH_CS and
+ * a Maestro to Serial1. The recorder carries on after the last boot's blocks,
+ * the ring keeps the newest FLASH_BYTES - 4K.
+ *
+ * Serial Monitor commands:
+ * 		s -- print the recorder's counters and the longest loop
+ * 		d -- stop recording and send the raw flash. Capture it with
+ * 			 cat /dev/ttyACM0 > log.bin, then recorderToCsv log.bin log.csv
+ *
+ * AHJ
+ */
+#include <PololuMaestro.h>
+#include <SB_FlightRecorder.hpp>
+#include <SB_RecorderSinks.hpp>
+
+#define FLASH_CS 10
+#define FLASH_BYTES (1024ul * 1024)
+#define SERVOS 6
+
+SB_SpiFlashSink flash(FLASH_CS, 0, FLASH_BYTES);
+SB_FlightRecorder recorder(flash);
+MiniMaestro maestro(Serial1);
+bool recording = true;
+uint32_t lastTick = 0;
+uint32_t longestLoopUs = 0;
+
+void setup() {
+	Serial.begin(115200);
+	Serial1.begin(200000);
+	if (!flash.begin()) {
+		Serial.println("No flash on the SPI bus");
+		recording = false;
+		return;
+	}
+	recorder.setSequence(flash.getNextSequence(), flash.getNextRun());
+	recorder.log(RECORD_MARK, 0, 0);
+}
+
+void loop() {
+	uint32_t start = micros();
+	if (recording && start - lastTick >= 1000) {
+		lastTick = start;
+		for (int i = 0; i < SERVOS; i++) {
+			// 1000-2000 us, a slow triangle, phase shifted per servo
+			uint32_t phase = (start / 500 + i * 700) % 8000;
+			uint16_t target = 4000 + (phase < 4000 ? phase : 8000 - phase);
+			maestro.setTarget(i, target);
+			recorder.log(RECORD_SERVO, i, target, start);
+		}
+	}
+	recorder.service();
+
+	if (Serial.available()) {
+		char command = Serial.read();
+		if (command == 's') {
+			Serial.printf("logged %lu dropped %lu blocks %lu lost %lu errors %d longest loop %lu us\n",
+					(unsigned long) recorder.getLogged(), (unsigned long) recorder.getDropped(),
+					(unsigned long) recorder.getBlocksWritten(), (unsigned long) recorder.getBlocksLost(),
+					recorder.getErrorCode(), (unsigned long) longestLoopUs);
+		} else if (command == 'd') {
+			recording = false;
+			recorder.flush();
+			while (!recorder.isIdle()) {
+				recorder.service();
+			}
+			flash.dump(Serial);
+		}
+	}
+
+	uint32_t took = micros() - start;
+	if (recording && took > longestLoopUs) {
+		longestLoopUs = took;
+	}
+}
@@ -0,0 +1,80 @@
+/**
+ * Identifies a servo's lag with SB_ServoPredictor, then closes a control loop
+ * around the predicted position instead of reading the Maestro.
+ *
+ * setup() steps the servo on channel 0 between a few angles, reading its
+ * position every 5 ms, and identifies the dead time and rate from the log.
+ * loop() then follows a slow sine with a proportional controller at 50 Hz,
+ * fed getPredictedDegrees(), and reads the real position once a second to
+ * keep the prediction honest.
+ *
+ * The Maestro's speed limit for the channel is set to SPEED so there's a rate
+ * to find; 0 leaves it unlimited and only the dead time is left.
+ *
+ * AHJ
+ */
+#include <SB_Servo.hpp>
+#include <SB_ServoPredictor.hpp>
+
+#define SPEED 20 // quarter us per 10 ms
+#define GAIN 0.8f
+
+SB_Servo servo(0);
+SB_ServoPredictor predictor;
+SB_LagSample samples[2000];
+float command = 90;
+uint32_t lastTick = 0;
+uint32_t lastReading = 0;
+
+void setup() {
+	Serial.begin(115200);
+	Serial1.begin(115200);
+	MiniMaestro direct(Serial1);
+	direct.setSpeed(0, SPEED);
+
+	servo.setPredictor(&predictor);
+	servo.rotateToDegrees(90);
+	delay(3000);
+	predictor.startLog(samples, 2000);
+	float steps[] = {45, 120, 100, 30, 150, 90};
+	for (float degrees : steps) {
+		servo.rotateToDegrees(degrees);
+		servo.getCurrentDegrees();
+		for (int i = 0; i < 300; i++) {
+			delay(5);
+			servo.getCurrentDegrees();
+		}
+	}
+	predictor.stopLog();
+
+	SB_ServoModel model;
+	if (SB_ServoPredictor::identify(samples, predictor.getLogLength(), model)) {
+		predictor.setModel(model);
+	}
+	Serial.print("Dead time us: ");
+	Serial.print(predictor.getModel().delayUs);
+	Serial.print(" rate quarter us/s: ");
+	Serial.println(predictor.getModel().rate);
+}
+
+void loop() {
+	uint32_t now = millis();
+	if (now - lastTick < 20) {
+		return;
+	}
+	lastTick = now;
+	if (now - lastReading >= 1000) {
+		lastReading = now;
+		servo.getCurrentDegrees();
+	}
+	float reference = 90 + 60 * sin(now / 2000.0f);
+	float predicted = servo.getPredictedDegrees();
+	command = constrain(command + GAIN * (reference - predicted), 0, 180);
+	servo.rotateToDegrees(command);
+
+	Serial.print(reference);
+	Serial.print(',');
+	Serial.print(predicted);
+	Serial.print(',');
+	Serial.println(servo.getEstimatedDegrees());
+}
@@ -1,26 +1,35 @@
 #include <SB_Servo.hpp>
+#include <SB_ServoCommands.hpp>
 
 /**
 A very simple program to read off of the serial monitor and then rotate from there
 
+Type a number of degrees and a newline (set the Serial Monitor to send one) to
+rotate there, or any of SB_ServoCommands' commands: "p 0" prints where the servo
+is, "s 0 30" limits it to 30 degrees a second, "d" prints the stats. Commands
+are read as they arrive, so the loop never waits on the Serial Monitor.
+
+The maestro's link runs at the fastest baud it answers reliably at, set the
+maestro to a fixed baud or to detect it (and power both up together).
+
 AHJ
 */
 
 SB_Servo servo1(0);
+SB_Servo *servos[] = {&servo1};
+SB_ServoCommands commands(Serial, servos, 1);
+
 void setup() {
   // put your setup code here, to run once:
   Serial.begin(9600);
-  Serial1.begin(9600);
+  uint32_t baud = SB_Servo::negotiateMaestroBaud();
+  Serial.print("maestro baud: ");
+  Serial.println(baud);
 } 
 
 void loop() { 
-  if (Serial.available()) {
-    int goHere = Serial.parseInt();
-    servo1.rotateToDegrees(goHere);
-    delay(100); 
-    Serial.print("Expected degrees: ");
-    Serial.println(goHere);
-    Serial.print("Actual degrees: ");
-    Serial.println(servo1.getCurrentDegrees());
-  }
-} 
+  commands.poll();
+  servo1.update();
+  // Keeps the position "p 0" answers with fresh
+  SB_Servo::pollPositions();
+}
@@ -0,0 +1,184 @@
+/**
+ * Measures how long after a target is sent a real Maestro on Serial1 reports it
+ * back through getPosition, for each baud, protocol and batch size. The host
+ * version (SB_Host/benchmarks/targetLatency) does the same against the emulator.
+ *
+ * A poller keeps POLL_DEPTH getPosition queries for the last channel of the
+ * burst in flight the whole time, without waiting on the answers. At random
+ * moments a burst of new targets is sent (setTargets back to back, or one
+ * setMultiTarget) and timestamped with micros(), and the latency is the time to
+ * the first answer showing the new target.
+ *
+ * Wiring: Teensy TX1/RX1 to the Maestro's RX/TX, common ground, and the Maestro's
+ * RST to RESET_PIN. The Maestro's serial mode has to be "UART, detect baud rate":
+ * it only detects the baud once after a reset, so every baud starts with a reset
+ * and a 0xAA. Without a reset pin (RESET_PIN 255) only the first baud is used.
+ * CRC can't be switched from here, set MAESTRO_CRC to match the "Enable CRC" box
+ * in the Maestro Control Center. Nothing should be plugged into channels 0 to
+ * MAX_BATCH - 1 that mustn't move.
+ *
+ * Open the Serial Monitor at any baud to read the results.
+ *
+ * AHJ
+ */
+#include <BasicMaestro.h>
+
+#define RESET_PIN 255
+#define MAESTRO_CRC false
+#define DEVICE_NUMBER 12
+#define POLL_DEPTH 2
+#define TRIALS 200
+#define MAX_BATCH 12
+#define ANSWER_TIMEOUT_US 100000
+
+typedef BasicMaestro<decltype(Serial1)> Maestro1;
+
+const uint32_t bauds[] = {9600, 38400, 115200, 200000, 250000};
+const uint8_t batches[] = {1, 4, MAX_BATCH};
+
+uint32_t samples[TRIALS];
+uint32_t timeouts = 0;
+uint32_t randomState = 12345;
+
+void sortSamples(uint32_t count) {
+	// Insertion sort, TRIALS is small
+	for (uint32_t i = 1; i < count; i++) {
+		uint32_t value = samples[i];
+		uint32_t j = i;
+		for (; j > 0 && samples[j - 1] > value; j--) {
+			samples[j] = samples[j - 1];
+		}
+		samples[j] = value;
+	}
+}
+
+/**
+ * @return the number of trials that got an answer, their latencies in samples
+ */
+uint32_t measure(Maestro1 &maestro, uint8_t batch, bool multi) {
+	uint16_t targets[MAX_BATCH];
+	uint8_t watched = batch - 1;
+	uint8_t inFlight = 0;
+	int low = -1;
+	bool waiting = false;
+	uint16_t expected = 0;
+	uint32_t sentUs = 0;
+	uint32_t lastAnswerUs = micros();
+	uint32_t nextTargetUs = micros();
+	uint32_t count = 0;
+
+	for (uint32_t trial = 0; trial < TRIALS;) {
+		uint32_t now = micros();
+		if (!waiting && (int32_t) (now - nextTargetUs) >= 0) {
+			uint16_t target = 4000 + (trial * 2477) % 4000;
+			for (uint8_t i = 0; i < batch; i++) {
+				targets[i] = target + i;
+			}
+			expected = targets[watched];
+			sentUs = micros();
+			if (multi) {
+				maestro.setMultiTarget(batch, 0, targets);
+			} else {
+				for (uint8_t i = 0; i < batch; i++) {
+					maestro.setTarget(i, targets[i]);
+				}
+			}
+			waiting = true;
+		}
+		if (inFlight < POLL_DEPTH) {
+			maestro.requestPosition(watched);
+			inFlight++;
+		}
+		if (Serial1.available() <= 0) {
+			if (now - lastAnswerUs > ANSWER_TIMEOUT_US) {
+				// An answer was lost, start the poller over and give up on this trial
+				timeouts++;
+				delay(10);
+				while (Serial1.read() >= 0);
+				inFlight = 0;
+				low = -1;
+				lastAnswerUs = micros();
+				if (waiting) {
+					waiting = false;
+					trial++;
+				}
+			}
+			continue;
+		}
+		int value = Serial1.read();
+		lastAnswerUs = micros();
+		if (low < 0) {
+			low = value;
+			continue;
+		}
+		uint16_t position = low | (value << 8);
+		low = -1;
+		inFlight--;
+		if (waiting && position == expected) {
+			samples[count++] = lastAnswerUs - sentUs;
+			waiting = false;
+			trial++;
+			randomState = randomState * 1103515245 + 12345;
+			nextTargetUs = micros() + (randomState >> 8) % 20000;
+		}
+	}
+
+	// Let the last answers come home
+	delay(20);
+	while (Serial1.read() >= 0);
+	return count;
+}
+
+void report(uint32_t baud, bool pololu, uint8_t batch, bool multi, uint32_t count) {
+	char line[96];
+	if (count == 0) {
+		snprintf(line, sizeof(line), "%7lu  %-7s %-4s %5u  %-6s  no answers", (unsigned long) baud,
+				pololu ? "pololu" : "compact", MAESTRO_CRC ? "on" : "off", batch, multi ? "multi" : "single");
+		Serial.println(line);
+		return;
+	}
+	sortSamples(count);
+	snprintf(line, sizeof(line), "%7lu  %-7s %-4s %5u  %-6s %8lu %8lu %8lu %8lu", (unsigned long) baud,
+			pololu ? "pololu" : "compact", MAESTRO_CRC ? "on" : "off", batch, multi ? "multi" : "single",
+			(unsigned long) samples[(count - 1) / 2], (unsigned long) samples[(uint32_t) (0.90 * (count - 1))],
+			(unsigned long) samples[(uint32_t) (0.99 * (count - 1))], (unsigned long) samples[count - 1]);
+	Serial.println(line);
+}
+
+void setup() {
+	Serial.begin(9600);
+	while (!Serial && millis() < 3000);
+
+	Serial.println("target to getPosition latency, Maestro on Serial1 (us)");
+	Serial.println("   baud  proto   crc  batch  send        p50      p90      p99      max");
+	for (uint32_t baud : bauds) {
+		Serial1.begin(baud);
+		if (RESET_PIN != 255) {
+			Maestro1(Serial1, RESET_PIN).reset();
+		}
+		Serial1.write(0xAA); // the baud rate indication
+		delay(10);
+		while (Serial1.read() >= 0);
+
+		for (bool pololu : {false, true}) {
+			Maestro1 maestro(Serial1, Maestro1::noResetPin,
+					pololu ? DEVICE_NUMBER : Maestro1::deviceNumberDefault, MAESTRO_CRC);
+			for (uint8_t batch : batches) {
+				for (bool multi : {false, true}) {
+					if (multi && batch == 1) {
+						continue;
+					}
+					report(baud, pololu, batch, multi, measure(maestro, batch, multi));
+				}
+			}
+		}
+		if (RESET_PIN == 255) {
+			break;
+		}
+	}
+	Serial.print("answers lost: ");
+	Serial.println(timeouts);
+}
+
+void loop() {
+}
@@ -0,0 +1,174 @@
+/**
+ * Source file for SB_CommandParser.hpp
+ *
+ * AHJ
+ */
+
+#include "SB_CommandParser.hpp"
+
+static bool isSeparator(uint8_t dataByte) {
+	return dataByte == ' ' || dataByte == ',' || dataByte == '\t';
+}
+
+static int32_t get32(const uint8_t *at) {
+	return (int32_t) (at[0] | (at[1] << 8) | (at[2] << 16) | ((uint32_t) at[3] << 24));
+}
+
+static void put32(uint8_t *at, int32_t value) {
+	for (int i = 0; i < 4; i++) {
+		at[i] = (uint32_t) value >> (8 * i);
+	}
+}
+
+uint8_t SB_CommandParser::crc8(const uint8_t *data, size_t length) {
+	uint8_t crc = 0;
+	for (size_t i = 0; i < length; i++) {
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; bit++) {
+			crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+void SB_CommandParser::encodeFrame(uint8_t *frame, char letter, uint8_t index, int32_t first, int32_t second) {
+	frame[0] = COMMAND_FRAME_START;
+	frame[1] = letter;
+	frame[2] = index;
+	put32(frame + 3, first);
+	put32(frame + 7, second);
+	frame[COMMAND_FRAME_BYTES - 1] = crc8(frame + 1, COMMAND_FRAME_BYTES - 2);
+}
+
+void SB_CommandParser::startLine() {
+	pending.letter = 0;
+	pending.binary = false;
+	pending.count = 0;
+	inNumber = false;
+	state = LINE;
+}
+
+bool SB_CommandParser::endNumber() {
+	if (!digits || pending.count == COMMAND_MAX_VALUES) {
+		return false;
+	}
+	int32_t value = whole * 100 + hundredths;
+	pending.values[pending.count++] = negative ? -value : value;
+	inNumber = false;
+	return true;
+}
+
+void SB_CommandParser::fail() {
+	errorCode |= COMMAND_SYNTAX_BIT;
+	state = DISCARD;
+}
+
+bool SB_CommandParser::endLine(SB_Command &command) {
+	if (inNumber && !endNumber()) {
+		errorCode |= COMMAND_SYNTAX_BIT;
+		return false;
+	}
+	if (pending.letter == 0) {
+		// A bare number, servo 0's target
+		if (pending.count != 1) {
+			errorCode |= COMMAND_SYNTAX_BIT;
+			return false;
+		}
+		pending.letter = 't';
+		pending.values[1] = pending.values[0];
+		pending.values[0] = 0;
+		pending.count = 2;
+	}
+	command = pending;
+	return true;
+}
+
+bool SB_CommandParser::endFrame(SB_Command &command) {
+	state = IDLE;
+	if (crc8(frame + 1, COMMAND_FRAME_BYTES - 2) != frame[COMMAND_FRAME_BYTES - 1]) {
+		errorCode |= COMMAND_CRC_BIT;
+		return false;
+	}
+	command.letter = frame[1];
+	command.binary = true;
+	command.count = 3;
+	command.values[0] = frame[2] * 100;
+	command.values[1] = get32(frame + 3);
+	command.values[2] = get32(frame + 7);
+	return true;
+}
+
+bool SB_CommandParser::feed(uint8_t dataByte, SB_Command &command) {
+	if (state == FRAME) {
+		frame[frameLength++] = dataByte;
+		return frameLength == COMMAND_FRAME_BYTES && endFrame(command);
+	}
+	if (dataByte == COMMAND_FRAME_START) {
+		// A frame starts here, a line it cut into is dropped
+		if (state == LINE) {
+			errorCode |= COMMAND_SYNTAX_BIT;
+		}
+		state = FRAME;
+		frame[0] = dataByte;
+		frameLength = 1;
+		return false;
+	}
+	if (dataByte == '\n' || dataByte == '\r') {
+		// Blank lines, and the second half of \r\n, come through as nothing
+		bool complete = state == LINE && endLine(command);
+		state = IDLE;
+		return complete;
+	}
+	if (state == DISCARD) {
+		return false;
+	}
+	if (state == IDLE) {
+		if (isSeparator(dataByte)) {
+			return false;
+		}
+		startLine();
+		if ((dataByte >= 'a' && dataByte <= 'z') || (dataByte >= 'A' && dataByte <= 'Z')) {
+			pending.letter = dataByte | 0x20;
+			return false;
+		}
+		// Otherwise a bare number
+	}
+
+	if (isSeparator(dataByte)) {
+		if (inNumber && !endNumber()) {
+			fail();
+		}
+		return false;
+	}
+	if (!inNumber) {
+		inNumber = true;
+		digits = false;
+		negative = false;
+		decimals = -1;
+		whole = 0;
+		hundredths = 0;
+		if (dataByte == '-') {
+			negative = true;
+			return false;
+		}
+	}
+	if (dataByte >= '0' && dataByte <= '9') {
+		int digit = dataByte - '0';
+		digits = true;
+		if (decimals < 0) {
+			if (whole > (COMMAND_MAX_VALUE - digit) / 10) {
+				fail();
+				return false;
+			}
+			whole = whole * 10 + digit;
+		} else if (decimals < 2) {
+			hundredths += decimals == 0 ? digit * 10 : digit;
+			decimals++;
+		}
+	} else if (dataByte == '.' && decimals < 0) {
+		decimals = 0;
+	} else {
+		fail();
+	}
+	return false;
+}
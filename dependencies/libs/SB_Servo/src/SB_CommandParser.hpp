@@ -0,0 +1,106 @@
+/**
+ * Parses ground station commands a byte at a time, for SailBot 2021 @ Virginia
+ * Tech.
+ *
+ * Serial.parseInt() waits up to a second for the rest of a number, with the
+ * whole loop stopped behind it. SB_CommandParser is handed bytes as they come
+ * in and says when a whole command has arrived, so nothing ever waits on the
+ * serial port. It keeps no buffer and allocates nothing: numbers are built up
+ * digit by digit as they arrive.
+ *
+ * Two forms, which can be mixed on one port:
+ *
+ * 		Lines, for typing into the Serial Monitor (set it to send a newline):
+ * 			t 0 90      command letter, then up to 3 numbers, spaces or commas between
+ * 			s 1 45.5 90 numbers can have a sign and decimals, past two places are dropped
+ * 			90          a bare number is "t 0 <number>", what the old sketches took
+ *
+ * 		Binary frames, for a program on the other end, COMMAND_FRAME_BYTES each:
+ * 			0xA5, command letter, index, value (int32), value (int32), CRC-8
+ * 			the values are hundredths, little endian, the CRC (polynomial 0x07)
+ * 			covers the letter to the last value byte. 0xA5 never turns up in text,
+ * 			so it marks where a frame starts; frames are all the same length, so
+ * 			an 0xA5 inside one is just data
+ *
+ * Either way the command comes out as a letter and numbers in hundredths, so
+ * "t 0 90" and a frame {0xA5, 't', 0, 9000, 0, crc} are the same command. What
+ * the letters mean is up to whoever handles them, see SB_ServoCommands.
+ *
+ * By convention error codes are OR'd into errorCode like SB_Servo's.
+ *
+ * AHJ
+ */
+
+#ifndef SB_command_parser
+#define SB_command_parser
+
+#include <Arduino.h>
+
+#define COMMAND_FRAME_START 0xA5
+#define COMMAND_FRAME_BYTES 12
+#define COMMAND_MAX_VALUES 3
+#define COMMAND_MAX_VALUE 21474836 // whole part, so hundredths fit an int32
+
+#define COMMAND_SYNTAX_BIT 0x01 // a line that didn't parse, it was dropped
+#define COMMAND_CRC_BIT 0x02    // a frame with a bad CRC, it was dropped
+
+struct SB_Command {
+	char letter;
+	bool binary;   // came as a frame, so should be answered with one
+	uint8_t count; // numbers given
+	int32_t values[COMMAND_MAX_VALUES]; // hundredths
+};
+
+class SB_CommandParser {
+	private:
+		enum State : uint8_t { IDLE, LINE, DISCARD, FRAME };
+
+		int errorCode = 0;
+		State state = IDLE;
+
+		// Line: the number being built up
+		SB_Command pending;
+		bool inNumber = false;
+		bool digits = false; // seen any, "-" or "." alone isn't a number
+		bool negative = false;
+		int8_t decimals = -1; // decimal places seen, -1 before the point
+		int32_t whole = 0;
+		int32_t hundredths = 0;
+
+		// Frame: bytes so far, the start byte first
+		uint8_t frame[COMMAND_FRAME_BYTES];
+		uint8_t frameLength = 0;
+
+		void startLine();
+		bool endNumber();
+		bool endLine(SB_Command &command);
+		void fail();
+		bool endFrame(SB_Command &command);
+
+	public:
+		/**
+		 * Takes the next byte
+		 * @return true when it completes a command, which is then in command
+		 * @sets COMMAND_SYNTAX_BIT
+		 * @sets COMMAND_CRC_BIT
+		 */
+		bool feed(uint8_t dataByte, SB_Command &command);
+
+		/**
+		 * Drops whatever has been half received
+		 */
+		void reset() { state = IDLE; }
+
+		int getErrorCode() { return errorCode; }
+		void clearErrorCode() { errorCode = 0; }
+
+		/**
+		 * Builds a frame, for answering a binary command or for the other end
+		 * @param frame -- room for COMMAND_FRAME_BYTES
+		 */
+		static void encodeFrame(uint8_t *frame, char letter, uint8_t index, int32_t first, int32_t second);
+
+		static uint8_t crc8(const uint8_t *data, size_t length);
+};
+
+#endif
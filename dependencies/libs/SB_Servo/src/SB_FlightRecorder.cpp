@@ -0,0 +1,216 @@
+/**
+ * Source file for SB_FlightRecorder.hpp
+ *
+ * AHJ
+ */
+
+#include "SB_FlightRecorder.hpp"
+
+#include <string.h>
+
+static const uint8_t MAGIC[4] = {'S', 'B', 'F', 'R'};
+#define RECORD_PAD 0xFF
+
+static void put16(uint8_t *at, uint16_t value) {
+	at[0] = value;
+	at[1] = value >> 8;
+}
+
+static void put32(uint8_t *at, uint32_t value) {
+	put16(at, value);
+	put16(at + 2, value >> 16);
+}
+
+static uint16_t get16(const uint8_t *at) {
+	return at[0] | (at[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *at) {
+	return get16(at) | ((uint32_t) get16(at + 2) << 16);
+}
+
+/**
+ * CRC-16/CCITT, polynomial 0x1021, a bit at a time: a record is only a few bytes
+ */
+static uint16_t crc16(uint16_t crc, const uint8_t *data, size_t length) {
+	for (size_t i = 0; i < length; i++) {
+		crc ^= data[i] << 8;
+		for (int bit = 0; bit < 8; bit++) {
+			crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+/**
+ * Small magnitudes either side of 0 to small numbers: 0, -1, 1, -2 -> 0, 1, 2, 3
+ */
+static uint32_t zigzag(int32_t value) {
+	return ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value) {
+	return (int32_t) (value >> 1) ^ -(int32_t) (value & 1);
+}
+
+/**
+ * 7 bits a byte, low first, the top bit set on all but the last
+ * @return the bytes written, 1 to 5
+ */
+static int putVarint(uint8_t *at, uint32_t value) {
+	int length = 0;
+	while (value >= 0x80) {
+		at[length++] = value | 0x80;
+		value >>= 7;
+	}
+	at[length++] = value;
+	return length;
+}
+
+/**
+ * @return false if it runs past end or is longer than 5 bytes
+ */
+static bool getVarint(const uint8_t *&at, const uint8_t *end, uint32_t &value) {
+	value = 0;
+	for (int shift = 0; shift < 35; shift += 7) {
+		if (at >= end) {
+			return false;
+		}
+		uint8_t b = *at++;
+		value |= (uint32_t) (b & 0x7F) << shift;
+		if (!(b & 0x80)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool SB_FlightRecorder::startBlock(uint32_t timeUs) {
+	if (full[filling]) {
+		// The sink still has it
+		return false;
+	}
+	uint8_t *block = blocks[filling];
+	memcpy(block, MAGIC, sizeof(MAGIC));
+	put32(block + 4, sequence++);
+	put32(block + 8, timeUs);
+	used = RECORDER_HEADER_BYTES;
+	records = 0;
+	crc = 0xFFFF;
+	lastTimeUs = timeUs;
+	memset(lastValues, 0, sizeof(lastValues));
+	open = true;
+	return true;
+}
+
+void SB_FlightRecorder::closeBlock() {
+	uint8_t *block = blocks[filling];
+	put16(block + 12, used - RECORDER_HEADER_BYTES);
+	put16(block + 14, records);
+	block[16] = run;
+	block[17] = RECORDER_VERSION;
+	put16(block + 18, crc);
+	memset(block + used, RECORD_PAD, RECORDER_BLOCK_BYTES - used);
+	full[filling] = true;
+	filling ^= 1;
+	open = false;
+}
+
+bool SB_FlightRecorder::log(uint8_t type, uint8_t channel, int32_t value, uint32_t timeUs) {
+	if (type >= RECORDER_TYPES || channel >= RECORDER_CHANNELS) {
+		errorCode |= RECORDER_RECORD_BIT;
+		return false;
+	}
+	if (open && used + RECORDER_MAX_RECORD_BYTES > RECORDER_BLOCK_BYTES) {
+		closeBlock();
+	}
+	if (!open && !startBlock(timeUs)) {
+		dropped++;
+		errorCode |= RECORDER_OVERRUN_BIT;
+		return false;
+	}
+
+	uint8_t *record = blocks[filling] + used;
+	uint8_t *at = record;
+	*at++ = (type << 5) | channel;
+	// Signed, so a record timestamped a little before the last one still fits
+	at += putVarint(at, zigzag((int32_t) (timeUs - lastTimeUs)));
+	at += putVarint(at, zigzag((int32_t) ((uint32_t) value - (uint32_t) lastValues[type][channel])));
+	crc = crc16(crc, record, at - record);
+	used = at - blocks[filling];
+	records++;
+	lastTimeUs = timeUs;
+	lastValues[type][channel] = value;
+	logged++;
+	return true;
+}
+
+void SB_FlightRecorder::service() {
+	if (!full[writing] || !sink.ready()) {
+		return;
+	}
+	size_t length = sink.chunkBytes();
+	if (length > (size_t) (RECORDER_BLOCK_BYTES - written)) {
+		length = RECORDER_BLOCK_BYTES - written;
+	}
+	if (!sink.write(blocks[writing] + written, length)) {
+		// Give the block up rather than retry forever and drop everything after it
+		errorCode |= RECORDER_SINK_BIT;
+		blocksLost++;
+		written = RECORDER_BLOCK_BYTES;
+	} else {
+		written += length;
+		if (written == RECORDER_BLOCK_BYTES) {
+			blocksWritten++;
+		}
+	}
+	if (written == RECORDER_BLOCK_BYTES) {
+		full[writing] = false;
+		writing ^= 1;
+		written = 0;
+	}
+}
+
+void SB_FlightRecorder::flush() {
+	if (open && records > 0) {
+		closeBlock();
+	}
+}
+
+int SB_FlightRecorder::decodeBlock(const uint8_t *block, uint32_t &sequence, uint8_t &run, SB_RecordEntry *entries) {
+	if (memcmp(block, MAGIC, sizeof(MAGIC)) != 0) {
+		return -1;
+	}
+	sequence = get32(block + 4);
+	uint32_t timeUs = get32(block + 8);
+	uint16_t payload = get16(block + 12);
+	uint16_t count = get16(block + 14);
+	run = block[16];
+	if (block[17] != RECORDER_VERSION || payload > RECORDER_BLOCK_BYTES - RECORDER_HEADER_BYTES
+			|| count > RECORDER_MAX_RECORDS
+			|| crc16(0xFFFF, block + RECORDER_HEADER_BYTES, payload) != get16(block + 18)) {
+		return -1;
+	}
+
+	int32_t lastValues[RECORDER_TYPES][RECORDER_CHANNELS];
+	memset(lastValues, 0, sizeof(lastValues));
+	const uint8_t *at = block + RECORDER_HEADER_BYTES;
+	const uint8_t *end = at + payload;
+	for (int i = 0; i < count; i++) {
+		if (at >= end) {
+			return -1;
+		}
+		uint8_t header = *at++;
+		uint8_t type = header >> 5;
+		uint8_t channel = header & 0x1F;
+		uint32_t timeDelta, valueDelta;
+		if (type >= RECORDER_TYPES || !getVarint(at, end, timeDelta) || !getVarint(at, end, valueDelta)) {
+			return -1;
+		}
+		timeUs += (uint32_t) unzigzag(timeDelta);
+		int32_t value = (int32_t) ((uint32_t) lastValues[type][channel] + (uint32_t) unzigzag(valueDelta));
+		lastValues[type][channel] = value;
+		entries[i] = {timeUs, type, channel, value};
+	}
+	return at == end ? count : -1;
+}
@@ -0,0 +1,193 @@
+/**
+ * Black box flight recorder for SailBot 2021 @ Virginia Tech.
+ *
+ * log() packs a timestamped value (an RC pulse width, a servo target, a fault
+ * code, ...) into the block being filled in RAM, and returns straight away.
+ * There are two blocks: while one fills the other is written out, a chunk per
+ * service() call, to a SB_RecorderSink (SPI flash, see SB_RecorderSinks.hpp).
+ * A sink says when it can take the next chunk instead of making the caller
+ * wait for it, so service() costs at most one chunk's transfer and never waits
+ * on the sink's hardware. If the sink falls so far behind that both blocks are
+ * full, records are dropped and counted, never the loop held up.
+ *
+ * Records are small because most of them say little that's new: a one byte
+ * header (the type and channel), then the time since the previous record and
+ * the change in value since the last record of the same type and channel, both
+ * as zigzag varints. An RC channel holding steady at 45 Hz costs 4 bytes a
+ * record, a servo target creeping every millisecond 3.
+ *
+ * A block is a flash sector, big enough that the other block keeps filling
+ * through a sector erase (45 ms typical) at 30 KB/s without running out, and
+ * carries a CRC of its records so a torn or damaged one is thrown away rather
+ * than decoded into nonsense.
+ *
+ * Every block starts from scratch (its own base time, all previous values 0), so
+ * each one decodes without the others and a lost or damaged block only loses
+ * itself. SB_Host/tools/recorderToCsv turns a log into CSV.
+ *
+ * Block layout, RECORDER_BLOCK_BYTES bytes, numbers little endian:
+ * 		0  "SBFR"
+ * 		4  sequence number (uint32)
+ * 		8  base time in micros() (uint32)
+ * 		12 bytes of records (uint16)
+ * 		14 number of records (uint16)
+ * 		16 run number, which boot the block is from
+ * 		17 format version, 1
+ * 		18 CRC-16/CCITT of the records (uint16)
+ * 		20 records, then 0xFF to the end (the erased state of flash)
+ *
+ * log() is for loop() context, values measured in an ISR should be handed over
+ * to loop() first the way pwm_stats does.
+ *
+ * By convention error codes are OR'd into errorCode like SB_Servo's.
+ *
+ * AHJ
+ */
+
+#ifndef SB_flight_recorder
+#define SB_flight_recorder
+
+#include <Arduino.h>
+
+#define RECORDER_BLOCK_BYTES 4096 // a SPI flash sector
+#define RECORDER_HEADER_BYTES 20
+#define RECORDER_VERSION 1
+#define RECORDER_MAX_RECORD_BYTES 11 // header byte, and two 5 byte varints
+#define RECORDER_MAX_RECORDS ((RECORDER_BLOCK_BYTES - RECORDER_HEADER_BYTES) / 3)
+
+/**
+ * Record types, 3 bits. Type 7 is never written, a 0xFF header byte is padding
+ */
+#define RECORD_RC 0     // an RC pulse width, channel is the receiver channel, value in us
+#define RECORD_SERVO 1  // a servo target sent, channel is the Maestro channel, value in quarter us
+#define RECORD_FAULT 2  // an error code, channel says whose
+#define RECORD_MARK 3   // anything else worth a line in the log
+#define RECORDER_TYPES 7
+#define RECORDER_CHANNELS 32 // channels 0 to 31, 5 bits
+
+#define RECORDER_OVERRUN_BIT 0x01 // a record was dropped, both blocks were full
+#define RECORDER_SINK_BIT 0x02    // the sink failed a write, the block was lost
+#define RECORDER_RECORD_BIT 0x04  // a type or channel out of range
+
+/**
+ * Where full blocks go
+ */
+class SB_RecorderSink {
+	public:
+		virtual ~SB_RecorderSink() {}
+
+		/**
+		 * @return whether write() can be called now and will return without
+		 * waiting on the hardware. Called every service(), so it must be quick
+		 */
+		virtual bool ready() = 0;
+
+		/**
+		 * Starts writing chunkBytes() bytes (or fewer, the end of a block)
+		 * @return false if it failed
+		 */
+		virtual bool write(const uint8_t *data, size_t length) = 0;
+
+		/**
+		 * How much write() takes at a time, a flash page say. Divides
+		 * RECORDER_BLOCK_BYTES
+		 */
+		virtual size_t chunkBytes() const = 0;
+};
+
+/**
+ * One decoded record
+ */
+struct SB_RecordEntry {
+	uint32_t timeUs;
+	uint8_t type;
+	uint8_t channel;
+	int32_t value;
+};
+
+class SB_FlightRecorder {
+	private:
+		SB_RecorderSink &sink;
+		int errorCode = 0;
+
+		uint8_t blocks[2][RECORDER_BLOCK_BYTES];
+		bool full[2] = {false, false}; // closed and waiting for the sink
+		uint8_t filling = 0;           // the block log() writes into
+		bool open = false;             // it has a header
+		uint16_t used = 0;
+		uint16_t records = 0;
+		uint16_t crc = 0;
+		uint8_t writing = 0;           // the block service() writes out
+		uint16_t written = 0;          // bytes of it the sink has taken
+
+		uint32_t sequence = 0;
+		uint8_t run = 0;
+		uint32_t lastTimeUs = 0;
+		int32_t lastValues[RECORDER_TYPES][RECORDER_CHANNELS];
+
+		uint32_t logged = 0;
+		uint32_t dropped = 0;
+		uint32_t blocksWritten = 0;
+		uint32_t blocksLost = 0;
+
+		bool startBlock(uint32_t timeUs);
+		void closeBlock();
+
+	public:
+		explicit SB_FlightRecorder(SB_RecorderSink &sink) : sink(sink) {}
+
+		/**
+		 * Carries on from an earlier boot's log, so a sink that keeps blocks
+		 * across resets (SB_SpiFlashSink::getNextSequence()) can tell the runs
+		 * apart and order the blocks. Call it before the first log()
+		 */
+		void setSequence(uint32_t nextSequence, uint8_t runNumber) {
+			sequence = nextSequence;
+			run = runNumber;
+		}
+
+		/**
+		 * Records a value, timestamped now or at timeUs
+		 * @return false if it was dropped
+		 * @sets RECORDER_OVERRUN_BIT
+		 * @sets RECORDER_RECORD_BIT
+		 */
+		bool log(uint8_t type, uint8_t channel, int32_t value) { return log(type, channel, value, micros()); }
+		bool log(uint8_t type, uint8_t channel, int32_t value, uint32_t timeUs);
+
+		/**
+		 * Hands the sink the next chunk of a full block, if it's ready for one.
+		 * Call it every loop
+		 * @sets RECORDER_SINK_BIT
+		 */
+		void service();
+
+		/**
+		 * Closes the block being filled so service() writes it out now rather
+		 * than when it's full, e.g. after a fault or before powering down
+		 */
+		void flush();
+
+		/**
+		 * @return whether everything logged so far has gone to the sink
+		 */
+		bool isIdle() const { return !full[0] && !full[1] && !open; }
+
+		uint32_t getLogged() const { return logged; }
+		uint32_t getDropped() const { return dropped; }
+		uint32_t getBlocksWritten() const { return blocksWritten; }
+		uint32_t getBlocksLost() const { return blocksLost; }
+
+		int getErrorCode() { return errorCode; }
+		void clearErrorCode() { errorCode = 0; }
+
+		/**
+		 * Decodes one block as written to the sink
+		 * @param sequence, run -- the block's sequence and run numbers go here
+		 * @param entries -- room for RECORDER_MAX_RECORDS
+		 * @return the number of records, -1 if it isn't a valid block
+		 */
+		static int decodeBlock(const uint8_t *block, uint32_t &sequence, uint8_t &run, SB_RecordEntry *entries);
+};
+
+#endif
@@ -0,0 +1,263 @@
+/**
+ * Source file for SB_FrameDispatcher.hpp
+ *
+ * AHJ
+ */
+
+#include "SB_FrameDispatcher.hpp"
+
+// Bytes in a compact protocol command, before the per command overhead
+#define SET_TARGET_BYTES 4
+#define GET_POSITION_BYTES 2
+#define GET_MOVING_STATE_BYTES 1
+#define MULTI_TARGET_BYTES(count) (3 + 2 * (count))
+
+SB_FrameDispatcher::SB_FrameDispatcher(MiniMaestro &maestro, uint32_t baud, uint8_t overheadBytes,
+	uint32_t framePeriodUs) :
+		maestro(maestro),
+		framePeriodUs(framePeriodUs),
+		byteTimeUs(baud ? (10000000 + baud - 1) / baud : 0), // 10 bits a byte, 8N1
+		overheadBytes(overheadBytes),
+		windowUs(framePeriodUs) {}
+
+void SB_FrameDispatcher::setTarget(uint8_t channel, uint16_t target) {
+	if (!model->hasChannel(channel)) {
+		errorCode |= DISPATCH_CHANNEL_ERROR_BIT;
+		return;
+	}
+	uint32_t now = micros();
+	if (pendingCount == 0) {
+		batchAligned = isPhaseKnown();
+		batchFrameUs = frameAtOrAfter(now + (SET_TARGET_BYTES + overheadBytes) * byteTimeUs + marginUs);
+	}
+	if (pending[channel]) {
+		conflated++;
+	} else {
+		pending[channel] = true;
+		pendingCount++;
+	}
+	targets[channel] = target;
+	queuedUs[channel] = now;
+}
+
+uint32_t SB_FrameDispatcher::batchUs() const {
+	uint32_t bytes = 0;
+	for (uint8_t i = 0; i < DISPATCH_MAX_CHANNELS; i++) {
+		if (!pending[i]) {
+			continue;
+		}
+		uint8_t count = 1;
+		while (i + count < DISPATCH_MAX_CHANNELS && pending[i + count]) {
+			count++;
+		}
+		if (count == 1 || !model->multiTarget) {
+			bytes += count * (SET_TARGET_BYTES + overheadBytes);
+		} else {
+			bytes += MULTI_TARGET_BYTES(count) + overheadBytes;
+		}
+		i += count - 1;
+	}
+	return bytes * byteTimeUs;
+}
+
+uint32_t SB_FrameDispatcher::frameAtOrAfter(uint32_t timeUs) const {
+	uint32_t boundaryUs = anchorUs + windowUs / 2;
+	int32_t offset = (int32_t) (timeUs - boundaryUs) % (int32_t) framePeriodUs;
+	if (offset < 0) {
+		offset += framePeriodUs;
+	}
+	return offset == 0 ? timeUs : timeUs + (framePeriodUs - offset);
+}
+
+void SB_FrameDispatcher::rebase(uint32_t nowUs) {
+	uint32_t ahead = nowUs - anchorUs;
+	if ((int32_t) ahead > (int32_t) framePeriodUs) {
+		anchorUs += ahead / framePeriodUs * framePeriodUs;
+	}
+}
+
+uint32_t SB_FrameDispatcher::getNextFrameUs(uint32_t nowUs) const {
+	return frameAtOrAfter(nowUs);
+}
+
+uint32_t SB_FrameDispatcher::getFlushUs(uint32_t nowUs) const {
+	uint32_t sendUs = pendingCount ? batchUs() : (SET_TARGET_BYTES + overheadBytes) * byteTimeUs;
+	if (!isPhaseKnown()) {
+		return nowUs;
+	}
+	return frameAtOrAfter(nowUs + sendUs + marginUs) - sendUs - marginUs;
+}
+
+void SB_FrameDispatcher::update() {
+	uint32_t now = micros();
+	if (lastUpdateUs != 0) {
+		loopGapUs = now - lastUpdateUs;
+	}
+	lastUpdateUs = now;
+	rebase(now);
+
+	if (pendingCount == 0) {
+		return;
+	}
+	// Send now if the next update() would be too late for the frame the
+	// batch can still make from here
+	if (!isPhaseKnown() || (int32_t) (now + loopGapUs - getFlushUs(now)) >= 0) {
+		flush();
+	}
+}
+
+void SB_FrameDispatcher::flush() {
+	if (pendingCount == 0) {
+		return;
+	}
+	uint32_t now = micros();
+	uint32_t arrivalUs = now + batchUs();
+
+	if (isPhaseKnown()) {
+		uint32_t frameUs = frameAtOrAfter(arrivalUs + marginUs);
+		if (batchAligned && (int32_t) (frameUs - batchFrameUs) > 0) {
+			missedFrames++;
+		}
+		// Where each target would have landed had it gone out when it was queued
+		uint32_t aloneUs = (SET_TARGET_BYTES + overheadBytes) * byteTimeUs;
+		uint32_t waitUs = frameAtOrAfter(arrivalUs) - arrivalUs;
+		for (uint8_t i = 0; i < DISPATCH_MAX_CHANNELS; i++) {
+			if (pending[i]) {
+				uint32_t aloneArrivalUs = queuedUs[i] + aloneUs;
+				uint32_t aloneWaitUs = frameAtOrAfter(aloneArrivalUs) - aloneArrivalUs;
+				totalWaitUs += waitUs;
+				totalSavedUs += (int32_t) (aloneWaitUs - waitUs);
+				measuredTargets++;
+			}
+		}
+	}
+
+	// Contiguous channels go as one setMultiTarget(), or one write where there isn't one
+	for (uint8_t i = 0; i < DISPATCH_MAX_CHANNELS; i++) {
+		if (!pending[i]) {
+			continue;
+		}
+		uint8_t count = 1;
+		while (i + count < DISPATCH_MAX_CHANNELS && pending[i + count]) {
+			count++;
+		}
+		model->setTargets(maestro, count, i, &targets[i]);
+		for (uint8_t j = i; j < i + count; j++) {
+			pending[j] = false;
+		}
+		sentTargets += count;
+		i += count - 1;
+	}
+	pendingCount = 0;
+	flushes++;
+}
+
+void SB_FrameDispatcher::boundaryBetween(uint32_t startUs, uint32_t endUs) {
+	uint32_t width = endUs - startUs;
+	if (width == 0 || width >= framePeriodUs) {
+		return; // says nothing about the phase
+	}
+
+	// Let the estimate spread by however far the clocks could have drifted since
+	// the last observation
+	if (isPhaseKnown() && (int32_t) (startUs - lastObservedUs) > 0) {
+		uint32_t grow = (uint64_t) (startUs - lastObservedUs) * DISPATCH_DRIFT_PPM / 1000000;
+		anchorUs -= grow;
+		windowUs += 2 * grow;
+		if (windowUs > framePeriodUs) {
+			windowUs = framePeriodUs;
+		}
+	}
+	lastObservedUs = endUs;
+
+	if (!isPhaseKnown()) {
+		anchorUs = startUs;
+		windowUs = width;
+		return;
+	}
+
+	// The new window relative to the current one, which starts at 0. It can
+	// overlap as it is or a period earlier, keep the bigger overlap
+	int32_t offset = (int32_t) (startUs - anchorUs) % (int32_t) framePeriodUs;
+	if (offset < 0) {
+		offset += framePeriodUs;
+	}
+	int32_t bestLow = 0;
+	int32_t bestHigh = 0;
+	for (int32_t shift = 0; shift <= (int32_t) framePeriodUs; shift += framePeriodUs) {
+		int32_t low = offset - shift > 0 ? offset - shift : 0;
+		int32_t high = offset - shift + (int32_t) width;
+		if (high > (int32_t) windowUs) {
+			high = windowUs;
+		}
+		if (high - low > bestHigh - bestLow) {
+			bestLow = low;
+			bestHigh = high;
+		}
+	}
+
+	if (bestHigh <= bestLow) {
+		// Doesn't fit, something moved (a reset Maestro, a target sent between
+		// reads), start over from this observation
+		anchorUs = startUs;
+		windowUs = width;
+		phaseResets++;
+		return;
+	}
+	anchorUs += bestLow;
+	windowUs = bestHigh - bestLow;
+}
+
+void SB_FrameDispatcher::sample(Sample &last, uint16_t value, uint32_t beforeUs, uint32_t afterUs,
+		uint8_t queryBytes, uint8_t answerBytes, bool boundaryIfChanged) {
+	// The Maestro took the reading after the whole query arrived and before it
+	// started sending the answer
+	uint32_t earliestUs = beforeUs + queryBytes * byteTimeUs;
+	uint32_t latestUs = afterUs - answerBytes * byteTimeUs;
+	if ((int32_t) (latestUs - earliestUs) < 0) {
+		latestUs = earliestUs;
+	}
+	if (last.valid && value != last.value && boundaryIfChanged) {
+		boundaryBetween(last.earliestUs, latestUs + 1);
+	}
+	last.valid = true;
+	last.value = value;
+	last.earliestUs = earliestUs;
+}
+
+uint16_t SB_FrameDispatcher::observePosition(uint8_t channel) {
+	if (!model->hasChannel(channel)) {
+		errorCode |= DISPATCH_CHANNEL_ERROR_BIT;
+		return 0;
+	}
+	uint32_t before = micros();
+	uint16_t position = maestro.getPosition(channel);
+	uint32_t after = micros();
+	sample(positionSamples[channel], position, before, after,
+			GET_POSITION_BYTES + overheadBytes, 2, true);
+	return position;
+}
+
+uint8_t SB_FrameDispatcher::observeMovingState() {
+	uint32_t before = micros();
+	uint8_t moving = maestro.getMovingState();
+	uint32_t after = micros();
+	// Starting to move happens when a target arrives, only stopping is on a frame
+	sample(movingSample, moving, before, after,
+			GET_MOVING_STATE_BYTES + overheadBytes, 1, moving == 0);
+	return moving;
+}
+
+void SB_FrameDispatcher::setPhase(uint32_t boundaryUs) {
+	anchorUs = boundaryUs;
+	windowUs = 1;
+	lastObservedUs = boundaryUs;
+}
+
+float SB_FrameDispatcher::getAverageWaitUs() const {
+	return measuredTargets ? (float) totalWaitUs / measuredTargets : 0;
+}
+
+float SB_FrameDispatcher::getAverageSavedUs() const {
+	return measuredTargets ? (float) totalSavedUs / measuredTargets : 0;
+}
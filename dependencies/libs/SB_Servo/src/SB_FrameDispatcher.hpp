@@ -0,0 +1,230 @@
+/**
+ * Frame-aligned target dispatch for SailBot 2021 @ Virginia Tech.
+ *
+ * The Maestro only changes its servo pulses once per output period (20 ms by
+ * default), so a setTarget() that lands just after a frame boundary sits in the
+ * Maestro for almost a whole period before anything moves. The dispatcher
+ * queues targets instead (latest value wins per channel), and update() sends
+ * the whole batch, contiguous channels as one setMultiTarget() (back to back
+ * setTargets in one write on a model without it, see setModel()), at the last
+ * moment it can still finish arriving a margin before the next frame.
+ *
+ * It can only do that if it knows where the frames are. The period is
+ * configured, the phase is estimated from observations: a servo limited by a
+ * speed or acceleration setting only changes position on a frame boundary, so
+ * when two getPosition() reads of one differ, a boundary fell between them.
+ * Same for getMovingState() going from moving to stopped. Every observation
+ * narrows the window the boundaries can be in, and the window is widened a
+ * little over time to allow for the Maestro's clock drifting against ours.
+ * Until there's an estimate batches go out straight away.
+ *
+ * Call update() every loop. getFlushUs() says when the next batch goes out, so
+ * a control loop can read its sensors just before and get the freshest targets
+ * into the frame.
+ *
+ * By convention error codes are OR'd into errorCode like SB_Servo's.
+ *
+ * AHJ
+ */
+
+#ifndef SB_frame_dispatcher
+#define SB_frame_dispatcher
+
+#include <PololuMaestro.h>
+#include "SB_MaestroModel.hpp"
+
+#define DISPATCH_MAX_CHANNELS MAESTRO_MAX_CHANNELS
+
+#define DISPATCH_DEFAULT_FRAME_US 20000
+#define DISPATCH_DEFAULT_MARGIN_US 500 // how long before the frame a batch should have finished arriving
+#define DISPATCH_DRIFT_PPM 200         // how far the Maestro's clock may drift from ours
+
+#define DISPATCH_CHANNEL_ERROR_BIT 0x01 // a target for a channel the model doesn't have
+
+class SB_FrameDispatcher {
+	private:
+		MiniMaestro &maestro;
+		const SB_MaestroModel *model = &SB_MaestroModel::mini24;
+		const uint32_t framePeriodUs;
+		const uint32_t byteTimeUs;
+		const uint8_t overheadBytes; // per command: Pololu protocol header and CRC
+		uint32_t marginUs = DISPATCH_DEFAULT_MARGIN_US;
+
+		int errorCode = 0;
+
+		// Pending targets and when each was queued
+		uint16_t targets[DISPATCH_MAX_CHANNELS];
+		uint32_t queuedUs[DISPATCH_MAX_CHANNELS];
+		bool pending[DISPATCH_MAX_CHANNELS] = {false};
+		uint8_t pendingCount = 0;
+		bool batchAligned = false; // the phase was known when the batch's first target was queued
+		uint32_t batchFrameUs = 0; // the frame the batch could make then
+
+		// Frame boundaries are somewhere in anchorUs + [0, windowUs) + k * framePeriodUs.
+		// A window of a whole period means the phase isn't known
+		uint32_t anchorUs = 0;
+		uint32_t windowUs;
+		uint32_t lastObservedUs = 0;
+
+		// The last observation's read, for bracketing a change with the next one
+		struct Sample {
+			bool valid = false;
+			uint16_t value;
+			uint32_t earliestUs; // the Maestro took the reading no earlier than this
+		};
+		Sample positionSamples[DISPATCH_MAX_CHANNELS];
+		Sample movingSample;
+
+		uint32_t lastUpdateUs = 0;
+		uint32_t loopGapUs = 0; // time between the last two update() calls
+
+		uint32_t flushes = 0;
+		uint32_t sentTargets = 0;
+		uint32_t conflated = 0;
+		uint32_t missedFrames = 0;
+		uint32_t phaseResets = 0;
+		uint32_t measuredTargets = 0; // sent while the phase was known
+		uint64_t totalWaitUs = 0;
+		int64_t totalSavedUs = 0;
+
+		/**
+		 * Brings the anchor up to within a period of nowUs, so differences
+		 * against it never overflow
+		 */
+		void rebase(uint32_t nowUs);
+
+		/**
+		 * A frame boundary fell in [startUs, endUs), narrows the estimate
+		 */
+		void boundaryBetween(uint32_t startUs, uint32_t endUs);
+
+		/**
+		 * Records a read taken between beforeUs and afterUs, and if
+		 * boundaryIfChanged, a change from the previous read as a frame boundary
+		 */
+		void sample(Sample &last, uint16_t value, uint32_t beforeUs, uint32_t afterUs,
+				uint8_t queryBytes, uint8_t answerBytes, bool boundaryIfChanged);
+
+		/**
+		 * Wire time of the pending batch, in the commands flush() would send
+		 */
+		uint32_t batchUs() const;
+
+		/**
+		 * The first frame boundary at or after timeUs, by the current estimate
+		 */
+		uint32_t frameAtOrAfter(uint32_t timeUs) const;
+
+	public:
+		/**
+		 * @param maestro -- where batches go
+		 * @param baud -- the serial link's baud rate, for working out how long a batch takes to send,
+		 * 0 if it isn't known, batches are then timed as if they took no time on the wire
+		 * @param overheadBytes -- bytes each command carries besides its own: 0 for the compact
+		 * protocol, 2 for the Pololu protocol, one more with CRC enabled
+		 * @param framePeriodUs -- the Maestro's servo period, 20 ms unless changed in the Control Center
+		 */
+		SB_FrameDispatcher(MiniMaestro &maestro, uint32_t baud, uint8_t overheadBytes = 0,
+				uint32_t framePeriodUs = DISPATCH_DEFAULT_FRAME_US);
+
+		/**
+		 * Queues a target, replacing any still queued for the channel
+		 * @sets DISPATCH_CHANNEL_ERROR_BIT
+		 */
+		void setTarget(uint8_t channel, uint16_t target);
+
+		/**
+		 * Sends the batch if it's time. Call it every loop
+		 */
+		void update();
+
+		/**
+		 * Sends the batch now, whatever the frame timing
+		 */
+		void flush();
+
+		/**
+		 * Reads a channel's position and uses it to refine the frame phase. Only
+		 * meaningful for a channel limited by speed or acceleration that's
+		 * moving and isn't being retargeted between reads
+		 * @return the position, like MiniMaestro::getPosition()
+		 */
+		uint16_t observePosition(uint8_t channel);
+
+		/**
+		 * Reads the moving state and uses a moving to stopped change to refine
+		 * the frame phase
+		 * @return the moving state, like MiniMaestro::getMovingState()
+		 */
+		uint8_t observeMovingState();
+
+		/**
+		 * Sets the phase outright, e.g. from a scope on the servo line
+		 * @param boundaryUs -- a time in micros() when a frame started
+		 */
+		void setPhase(uint32_t boundaryUs);
+		void setMargin(uint32_t margin) { marginUs = margin; }
+
+		/**
+		 * Which Maestro the batches go to, a Mini Maestro 24 unless set. Decides
+		 * the channels setTarget() accepts and whether batches go as setMultiTarget
+		 */
+		void setModel(const SB_MaestroModel &maestroModel) { model = &maestroModel; }
+		const SB_MaestroModel &getModel() const { return *model; }
+
+		bool isPhaseKnown() const { return windowUs < framePeriodUs; }
+
+		/**
+		 * @return how far either side of the estimate a boundary could be, in us
+		 */
+		uint32_t getPhaseUncertaintyUs() const { return windowUs / 2; }
+
+		/**
+		 * @return the estimated start of the next frame after nowUs
+		 */
+		uint32_t getNextFrameUs(uint32_t nowUs) const;
+
+		/**
+		 * @return when update() will send the pending batch (or a batch of one
+		 * target, if nothing's pending)
+		 */
+		uint32_t getFlushUs(uint32_t nowUs) const;
+
+		uint32_t getFlushes() const { return flushes; }
+		uint32_t getSentTargets() const { return sentTargets; }
+
+		/**
+		 * Targets replaced by a newer one for the same channel before they were sent
+		 */
+		uint32_t getConflated() const { return conflated; }
+
+		/**
+		 * Batches that went out too late for the frame they were queued for,
+		 * because update() wasn't called in time
+		 */
+		uint32_t getMissedFrames() const { return missedFrames; }
+
+		/**
+		 * Observations that didn't fit the estimate, which was started over
+		 */
+		uint32_t getPhaseResets() const { return phaseResets; }
+
+		/**
+		 * @return the average time a sent target waits in the Maestro between
+		 * arriving and the frame that outputs it, by the phase estimate
+		 */
+		float getAverageWaitUs() const;
+
+		/**
+		 * @return the average time per sent target that it would have waited in
+		 * the Maestro had it been sent the moment it was queued, less the time
+		 * it actually waited
+		 */
+		float getAverageSavedUs() const;
+		int64_t getTotalSavedUs() const { return totalSavedUs; }
+
+		int getErrorCode() { return errorCode; }
+		void clearErrorCode() { errorCode = 0; }
+};
+
+#endif
@@ -0,0 +1,43 @@
+/**
+ * Source file for SB_MaestroModel.hpp, the numbers are from the Maestro
+ * User's Guide
+ *
+ * AHJ
+ */
+
+#include "SB_MaestroModel.hpp"
+
+const SB_MaestroModel SB_MaestroModel::micro6 = {"Micro Maestro 6", 6, false, MAESTRO_NO_PWM, 1024};
+const SB_MaestroModel SB_MaestroModel::mini12 = {"Mini Maestro 12", 12, true, 8, 8192};
+const SB_MaestroModel SB_MaestroModel::mini18 = {"Mini Maestro 18", 18, true, 12, 8192};
+const SB_MaestroModel SB_MaestroModel::mini24 = {"Mini Maestro 24", 24, true, 12, 8192};
+
+const SB_MaestroModel *SB_MaestroModel::forChannels(uint8_t channels) {
+	switch (channels) {
+		case 6: return &micro6;
+		case 12: return &mini12;
+		case 18: return &mini18;
+		case 24: return &mini24;
+		default: return nullptr;
+	}
+}
+
+uint8_t SB_MaestroModel::setTargets(MiniMaestro &maestro, uint8_t numberOfTargets, uint8_t firstChannel,
+		uint16_t *targets) const {
+	if (firstChannel >= channels || numberOfTargets == 0) {
+		return 0;
+	}
+	if (numberOfTargets > channels - firstChannel) {
+		numberOfTargets = channels - firstChannel;
+	}
+	if (numberOfTargets == 1) {
+		maestro.setTarget(firstChannel, targets[0]);
+		return 4;
+	} else if (multiTarget) {
+		maestro.setMultiTarget(numberOfTargets, firstChannel, targets);
+		return 3 + 2 * numberOfTargets;
+	} else {
+		maestro.setTargets(numberOfTargets, firstChannel, targets);
+		return 4 * numberOfTargets;
+	}
+}
@@ -0,0 +1,61 @@
+/**
+ * What each model of Maestro can do, for SailBot 2021 @ Virginia Tech.
+ *
+ * The Micro and Mini Maestros speak the same protocol, but not all of it:
+ * only the Minis know setMultiTarget and setPWM, the PWM output is on a
+ * different channel per model, and they differ in channel count and how much
+ * script they hold. A command one doesn't know is a protocol error on the
+ * Maestro, not a compile error here, so code that has to work with more than
+ * one model asks the model's descriptor instead of assuming a Mini Maestro.
+ *
+ * The descriptors are constants, one per model:
+ * 		SB_MaestroModel::micro6, mini12, mini18, mini24
+ *
+ * Batches of targets should go through setTargets(), which sends one
+ * setMultiTarget where the model has it and back to back setTargets in a single
+ * write where it doesn't.
+ *
+ * AHJ
+ */
+
+#ifndef SB_maestro_model
+#define SB_maestro_model
+
+#include <PololuMaestro.h>
+
+#define MAESTRO_MAX_CHANNELS 24 // the most any model has, for sizing buffers
+#define MAESTRO_NO_PWM 255      // pwmChannel of a model without a PWM output
+
+struct SB_MaestroModel {
+	const char *name;
+	uint8_t channels;
+	bool multiTarget;     // understands setMultiTarget
+	uint8_t pwmChannel;   // the channel setPWM drives, MAESTRO_NO_PWM for none
+	uint16_t scriptBytes; // room for the compiled script
+
+	static const SB_MaestroModel micro6;
+	static const SB_MaestroModel mini12;
+	static const SB_MaestroModel mini18;
+	static const SB_MaestroModel mini24;
+
+	/**
+	 * @return the model with this many channels, nullptr if there isn't one
+	 */
+	static const SB_MaestroModel *forChannels(uint8_t channels);
+
+	bool hasChannel(int channel) const { return channel >= 0 && channel < channels; }
+	bool hasPwm() const { return pwmChannel != MAESTRO_NO_PWM; }
+
+	/**
+	 * Sets the targets of a contiguous block of channels the fastest way the
+	 * model allows. Channels past the model's last are dropped
+	 *
+	 * @param maestro -- the Maestro to send to
+	 * @param numberOfTargets, firstChannel, targets -- like MiniMaestro::setMultiTarget()
+	 * @return the bytes written in the compact protocol, for SB_TargetMailbox::written()
+	 */
+	uint8_t setTargets(MiniMaestro &maestro, uint8_t numberOfTargets, uint8_t firstChannel,
+			uint16_t *targets) const;
+};
+
+#endif
@@ -0,0 +1,133 @@
+/**
+ * Source file for SB_PacketPool.hpp
+ *
+ * AHJ
+ */
+
+#include "SB_PacketPool.hpp"
+
+#define HEAD_INDEX(head) ((uint8_t) ((head) & 0xFF))
+#define HEAD_TAG_STEP 0x100
+
+SB_PacketPool::SB_PacketPool() {
+	for (uint8_t i = 0; i < PACKET_POOL_SIZE; i++) {
+		packets[i].next.store(i + 1 < PACKET_POOL_SIZE ? i + 1 : PACKET_POOL_NONE);
+	}
+	freeHead.store(0);
+}
+
+uint8_t SB_PacketPool::getIndex(const SB_MaestroPacket *packet) const {
+	// Compared as addresses, a pointer from elsewhere can't be subtracted
+	uintptr_t address = (uintptr_t) packet;
+	uintptr_t first = (uintptr_t) &packets[0];
+	if (address < first || address >= (uintptr_t) &packets[PACKET_POOL_SIZE] ||
+			(address - first) % sizeof(SB_MaestroPacket) != 0) {
+		return PACKET_POOL_NONE;
+	}
+	return (address - first) / sizeof(SB_MaestroPacket);
+}
+
+SB_MaestroPacket *SB_PacketPool::acquire() {
+	uint32_t head = freeHead.load(std::memory_order_acquire);
+	uint8_t index;
+	do {
+		index = HEAD_INDEX(head);
+		if (index == PACKET_POOL_NONE) {
+			exhausted.fetch_add(1, std::memory_order_relaxed);
+			return nullptr;
+		}
+		// If another context takes this packet first, next may be stale, but
+		// then the tag has moved on and the swap fails
+	} while (!freeHead.compare_exchange_weak(head,
+			((head + HEAD_TAG_STEP) & ~0xFFu) | packets[index].next.load(std::memory_order_relaxed),
+			std::memory_order_acquire, std::memory_order_acquire));
+
+	acquired.fetch_add(1, std::memory_order_relaxed);
+	uint32_t used = inUse.fetch_add(1, std::memory_order_relaxed) + 1;
+	uint32_t most = highWater.load(std::memory_order_relaxed);
+	while (used > most && !highWater.compare_exchange_weak(most, used, std::memory_order_relaxed)) {
+	}
+	SB_MaestroPacket *packet = &packets[index];
+	packet->length = 0;
+	packet->next.store(PACKET_POOL_NONE, std::memory_order_relaxed);
+	return packet;
+}
+
+void SB_PacketPool::release(SB_MaestroPacket *packet) {
+	uint8_t index = getIndex(packet);
+	if (index == PACKET_POOL_NONE) {
+		badReleases.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	inUse.fetch_sub(1, std::memory_order_relaxed);
+	uint32_t head = freeHead.load(std::memory_order_relaxed);
+	do {
+		packet->next.store(HEAD_INDEX(head), std::memory_order_relaxed);
+	} while (!freeHead.compare_exchange_weak(head, ((head + HEAD_TAG_STEP) & ~0xFFu) | index,
+			std::memory_order_release, std::memory_order_relaxed));
+}
+
+void SB_PacketQueue::push(SB_MaestroPacket *packet) {
+	uint8_t index = pool.getIndex(packet);
+	if (index == PACKET_POOL_NONE) {
+		pool.badReleases.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	// send() takes the whole stack at once, so there's nothing for a tag to guard
+	uint8_t head = pushed.load(std::memory_order_relaxed);
+	do {
+		packet->next.store(head, std::memory_order_relaxed);
+	} while (!pushed.compare_exchange_weak(head, index, std::memory_order_release, std::memory_order_relaxed));
+	pushes.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool SB_PacketQueue::pushTarget(Maestro &maestro, uint8_t channel, uint16_t target) {
+	SB_MaestroPacket *packet = pool.acquire();
+	if (!packet) {
+		return false;
+	}
+	packet->length = maestro.encodeTarget(packet->bytes, channel, target);
+	push(packet);
+	return true;
+}
+
+/**
+ * Takes everything pushed so far and turns it oldest first
+ */
+static uint8_t takeOldestFirst(std::atomic<uint8_t> &pushed, SB_MaestroPacket *packets) {
+	uint8_t newest = pushed.exchange(PACKET_POOL_NONE, std::memory_order_acquire);
+	uint8_t oldest = PACKET_POOL_NONE;
+	while (newest != PACKET_POOL_NONE) {
+		uint8_t next = packets[newest].next.load(std::memory_order_relaxed);
+		packets[newest].next.store(oldest, std::memory_order_relaxed);
+		oldest = newest;
+		newest = next;
+	}
+	return oldest;
+}
+
+uint32_t SB_PacketQueue::send(Maestro &maestro) {
+	uint32_t written = 0;
+	uint8_t index = takeOldestFirst(pushed, pool.packets);
+	while (index != PACKET_POOL_NONE) {
+		SB_MaestroPacket &packet = pool.packets[index];
+		index = packet.next.load(std::memory_order_relaxed);
+		maestro.writeEncoded(packet.bytes, packet.length);
+		pool.release(&packet);
+		written++;
+	}
+	sent += written;
+	return written;
+}
+
+uint32_t SB_PacketQueue::clear() {
+	uint32_t cleared = 0;
+	uint8_t index = takeOldestFirst(pushed, pool.packets);
+	while (index != PACKET_POOL_NONE) {
+		SB_MaestroPacket &packet = pool.packets[index];
+		index = packet.next.load(std::memory_order_relaxed);
+		pool.release(&packet);
+		cleared++;
+	}
+	return cleared;
+}
@@ -0,0 +1,147 @@
+/**
+ * Fixed storage for queued Maestro commands for SailBot 2021 @ Virginia Tech.
+ *
+ * Anything that holds commands to send later needs somewhere to keep them,
+ * and a std::vector or String grows on the heap, which on the Teensy means
+ * fragmentation and a malloc() that can't be called from an interrupt.
+ * SB_PacketPool is PACKET_POOL_SIZE packets set aside at compile time, each
+ * big enough for one encoded setTarget, setSpeed or setAcceleration (see
+ * Maestro::encodeTarget()). acquire() hands one out and release() takes it
+ * back, both O(1) and lock free: the free packets are a linked stack whose
+ * head is swapped in with a compare-and-swap, tagged so a packet taken and
+ * put back between one context's read and its swap can't fool it. An
+ * interrupt can take and return packets while the loop is in the middle of
+ * doing the same.
+ *
+ * It keeps count of what's in use, the most that ever were (the high-water
+ * mark, for sizing PACKET_POOL_SIZE) and how many times it ran out.
+ *
+ * SB_PacketQueue sends pool packets in the order they were pushed. push() is
+ * O(1), lock free and can be called from interrupts, send() runs in the loop,
+ * writes what's waiting and gives the packets back to the pool.
+ *
+ * AHJ
+ */
+
+#ifndef SB_packet_pool
+#define SB_packet_pool
+
+#include <PololuMaestro.h>
+#include <atomic>
+
+/**
+ * Packets in a pool, set with -DPACKET_POOL_SIZE=... At most 254
+ */
+#ifndef PACKET_POOL_SIZE
+#define PACKET_POOL_SIZE 32
+#endif
+
+#define PACKET_POOL_BYTES Maestro::maxEncodedSize
+#define PACKET_POOL_NONE 0xFF // no packet, ends the free stack and queues
+
+static_assert(PACKET_POOL_SIZE > 0 && PACKET_POOL_SIZE < PACKET_POOL_NONE, "PACKET_POOL_SIZE must be 1 to 254");
+
+/**
+ * One encoded command. next is the pool's and the queue's, leave it alone
+ */
+struct SB_MaestroPacket {
+	uint8_t bytes[PACKET_POOL_BYTES];
+	uint8_t length = 0;
+	std::atomic<uint8_t> next{PACKET_POOL_NONE}; // read by one context while another may be setting it
+};
+
+class SB_PacketPool {
+	private:
+		SB_MaestroPacket packets[PACKET_POOL_SIZE];
+
+		// Index of the first free packet in the low byte, a count of swaps
+		// above it so a head that was popped and pushed back looks different
+		std::atomic<uint32_t> freeHead;
+
+		std::atomic<uint32_t> inUse{0};
+		std::atomic<uint32_t> highWater{0};
+		std::atomic<uint32_t> acquired{0};
+		std::atomic<uint32_t> exhausted{0};
+		std::atomic<uint32_t> badReleases{0};
+
+		friend class SB_PacketQueue;
+
+	public:
+		SB_PacketPool();
+
+		/**
+		 * @return a packet, nullptr (and counted) if they're all in use
+		 */
+		SB_MaestroPacket *acquire();
+
+		/**
+		 * Gives a packet back. One that isn't this pool's is counted and ignored
+		 */
+		void release(SB_MaestroPacket *packet);
+
+		uint8_t getIndex(const SB_MaestroPacket *packet) const;
+		bool owns(const SB_MaestroPacket *packet) const { return getIndex(packet) != PACKET_POOL_NONE; }
+
+		uint32_t getCapacity() const { return PACKET_POOL_SIZE; }
+		uint32_t getInUse() const { return inUse.load(); }
+		uint32_t getHighWater() const { return highWater.load(); }
+		uint32_t getAcquired() const { return acquired.load(); }
+
+		/**
+		 * acquire() calls that found nothing free
+		 */
+		uint32_t getExhausted() const { return exhausted.load(); }
+
+		/**
+		 * release() and SB_PacketQueue::push() calls with a packet from somewhere else
+		 */
+		uint32_t getBadReleases() const { return badReleases.load(); }
+
+		/**
+		 * Starts the high-water mark again from what's in use now
+		 */
+		void resetHighWater() { highWater.store(inUse.load()); }
+};
+
+class SB_PacketQueue {
+	private:
+		SB_PacketPool &pool;
+		// Pushed since the last send(), newest first
+		std::atomic<uint8_t> pushed{PACKET_POOL_NONE};
+		std::atomic<uint32_t> pushes{0};
+		uint32_t sent = 0;
+
+	public:
+		SB_PacketQueue(SB_PacketPool &pool) : pool(pool) {}
+
+		/**
+		 * Queues one of the pool's packets. Safe from interrupts. One from
+		 * elsewhere is counted in the pool's getBadReleases() and ignored
+		 */
+		void push(SB_MaestroPacket *packet);
+
+		/**
+		 * Encodes a setTarget into a pool packet and queues it. Safe from
+		 * interrupts, the maestro's stream isn't touched
+		 * @return false if the pool had nothing free, the target is dropped
+		 */
+		bool pushTarget(Maestro &maestro, uint8_t channel, uint16_t target);
+
+		/**
+		 * Writes every packet queued so far, oldest first, and releases them.
+		 * Call it from the loop
+		 * @return how many were written
+		 */
+		uint32_t send(Maestro &maestro);
+
+		/**
+		 * Releases everything queued without writing it
+		 */
+		uint32_t clear();
+
+		bool isEmpty() const { return pushed.load() == PACKET_POOL_NONE; }
+		uint32_t getPushes() const { return pushes.load(); }
+		uint32_t getSent() const { return sent; }
+};
+
+#endif
@@ -0,0 +1,174 @@
+/**
+ * Source file for SB_PollPlanner.hpp
+ *
+ * AHJ
+ */
+
+#include "SB_PollPlanner.hpp"
+
+SB_PollPlanner::SB_PollPlanner(MiniMaestro &maestro, uint32_t baud, uint8_t budgetPercent) :
+		maestro(maestro),
+		budgetPercent(budgetPercent) {
+	setBaud(baud);
+}
+
+void SB_PollPlanner::setBaud(uint32_t baud) {
+	if (baud == 0 || budgetPercent == 0) {
+		readCostUs = 0;
+		return;
+	}
+	// 10 bits a byte (8N1), and a read may only take budgetPercent of the time
+	uint32_t wireUs = POLL_READ_BYTES * ((10000000 + baud - 1) / baud);
+	readCostUs = wireUs * 100 / budgetPercent;
+	creditUs = POLL_BURST_READS * readCostUs;
+	lastUpdateUs = micros();
+}
+
+void SB_PollPlanner::setPeriods(uint32_t fast, uint32_t slow) {
+	fastUs = fast ? fast : 1;
+	slowUs = slow > fastUs ? slow : fastUs;
+	for (uint8_t i = 0; i < POLL_MAX_CHANNELS; i++) {
+		if (channels[i].periodUs < fastUs) {
+			channels[i].periodUs = fastUs;
+		} else if (channels[i].periodUs > slowUs) {
+			channels[i].periodUs = slowUs;
+		}
+	}
+}
+
+void SB_PollPlanner::track(uint8_t channel) {
+	if (channel >= POLL_MAX_CHANNELS) {
+		errorCode |= POLL_CHANNEL_ERROR_BIT;
+		return;
+	}
+	Channel &tracking = channels[channel];
+	if (!tracking.tracked) {
+		tracking.tracked = true;
+		trackedCount++;
+	}
+	tracking.periodUs = fastUs;
+	tracking.dueUs = micros();
+}
+
+void SB_PollPlanner::untrack(uint8_t channel) {
+	if (channel < POLL_MAX_CHANNELS && channels[channel].tracked) {
+		channels[channel].tracked = false;
+		trackedCount--;
+	}
+}
+
+void SB_PollPlanner::commanded(uint8_t channel, uint16_t target) {
+	if (channel >= POLL_MAX_CHANNELS) {
+		errorCode |= POLL_CHANNEL_ERROR_BIT;
+		return;
+	}
+	Channel &commanding = channels[channel];
+	if (target == commanding.commanded) {
+		return;
+	}
+	commanding.commanded = target;
+	commanding.periodUs = fastUs;
+	uint32_t now = micros();
+	uint32_t dueUs = commanding.reading.valid ? commanding.reading.readUs + fastUs : now;
+	// Only ever sooner
+	if ((int32_t) (dueUs - commanding.dueUs) < 0) {
+		commanding.dueUs = dueUs;
+	}
+}
+
+int SB_PollPlanner::mostOverdue(uint32_t nowUs) const {
+	int most = -1;
+	uint32_t mostLateUs = 0;
+	for (uint8_t i = 0; i < POLL_MAX_CHANNELS; i++) {
+		const Channel &channel = channels[i];
+		if (!channel.tracked || (int32_t) (nowUs - channel.dueUs) < 0) {
+			continue;
+		}
+		uint32_t lateUs = nowUs - channel.dueUs;
+		// Late by more of its period: lateUs / periodUs > mostLateUs / most's period
+		if (most < 0 || (uint64_t) lateUs * channels[most].periodUs > (uint64_t) mostLateUs * channel.periodUs) {
+			most = i;
+			mostLateUs = lateUs;
+		}
+	}
+	return most;
+}
+
+void SB_PollPlanner::read(uint8_t channel) {
+	Channel &reading = channels[channel];
+	uint32_t beforeUs = micros();
+	uint32_t lateUs = beforeUs - reading.dueUs;
+	if (lateUs > maxLatenessUs) {
+		maxLatenessUs = lateUs;
+	}
+	uint16_t position = maestro.getPosition(channel);
+
+	uint16_t moved = position > reading.reading.position ?
+			position - reading.reading.position : reading.reading.position - position;
+	uint16_t off = position > reading.commanded ? position - reading.commanded : reading.commanded - position;
+	bool moving = reading.reading.valid && moved > deadband;
+	bool offTarget = reading.commanded != 0 && off > deadband;
+	if (moving || offTarget) {
+		reading.periodUs /= 2;
+		if (reading.periodUs < fastUs) {
+			reading.periodUs = fastUs;
+		}
+	} else {
+		reading.periodUs += reading.periodUs / 2;
+		if (reading.periodUs > slowUs) {
+			reading.periodUs = slowUs;
+		}
+	}
+
+	// Taken some time after the query went out, so this is the oldest it can be
+	reading.reading.position = position;
+	reading.reading.readUs = beforeUs;
+	reading.reading.valid = true;
+	reading.dueUs = beforeUs + reading.periodUs;
+	reading.reads++;
+	reads++;
+}
+
+uint8_t SB_PollPlanner::update() {
+	uint8_t done = 0;
+	if (trackedCount == 0) {
+		return done;
+	}
+	uint32_t now = micros();
+	if (readCostUs) {
+		uint32_t capUs = POLL_BURST_READS * readCostUs;
+		uint32_t elapsedUs = now - lastUpdateUs;
+		creditUs = elapsedUs >= capUs - creditUs ? capUs : creditUs + elapsedUs;
+	}
+	lastUpdateUs = now;
+
+	// No more reads a call than channels, however late they are
+	for (uint8_t i = 0; i < trackedCount; i++) {
+		int channel = mostOverdue(micros());
+		if (channel < 0) {
+			break;
+		}
+		if (readCostUs && creditUs < readCostUs) {
+			deferred++;
+			break;
+		}
+		creditUs -= readCostUs;
+		read(channel);
+		done++;
+	}
+	return done;
+}
+
+const SB_PollReading &SB_PollPlanner::getReading(uint8_t channel) const {
+	static const SB_PollReading none;
+	return channel < POLL_MAX_CHANNELS ? channels[channel].reading : none;
+}
+
+uint32_t SB_PollPlanner::getAgeUs(uint8_t channel) const {
+	const SB_PollReading &reading = getReading(channel);
+	return reading.valid ? micros() - reading.readUs : UINT32_MAX;
+}
+
+uint32_t SB_PollPlanner::getPeriodUs(uint8_t channel) const {
+	return channel < POLL_MAX_CHANNELS ? channels[channel].periodUs : 0;
+}
@@ -0,0 +1,169 @@
+/**
+ * Adaptive position polling for SailBot 2021 @ Virginia Tech.
+ *
+ * Reading every servo's position at one fixed rate spends most of the link on
+ * servos that are sitting still, and still reads one that's swinging across
+ * its range too slowly to follow it. SB_PollPlanner gives each channel its own
+ * read period instead. A read that finds the channel moving (it changed since
+ * the last read) or away from the target it was commanded halves the period,
+ * down to the fast period, and a read that finds it still and on target
+ * stretches it by half again, up to the slow period. A new target drops the
+ * channel straight to the fast period, since a move is about to start.
+ *
+ * All the reads share a budget, a fraction of the link's time at the baud.
+ * update() reads the channels that are due, most overdue for their period
+ * first, as long as the budget has room, and leaves the rest for the next
+ * call. Every reading comes with when it was taken, so the caller knows how
+ * stale it is.
+ *
+ * Call update() every loop, and commanded() with every target sent.
+ *
+ * By convention error codes are OR'd into errorCode like SB_Servo's.
+ *
+ * AHJ
+ */
+
+#ifndef SB_poll_planner
+#define SB_poll_planner
+
+#include <PololuMaestro.h>
+#include "SB_MaestroModel.hpp"
+
+#define POLL_MAX_CHANNELS MAESTRO_MAX_CHANNELS
+#define POLL_DEFAULT_FAST_US 20000     // a maestro frame, the output doesn't change any faster
+#define POLL_DEFAULT_SLOW_US 1000000   // the floor, a read a second
+#define POLL_DEFAULT_DEADBAND 4        // quarter us (1 us), changes this small count as still
+#define POLL_DEFAULT_BUDGET_PERCENT 25 // of the link's time that reads may take
+#define POLL_READ_BYTES 4              // a compact getPosition(), 2 bytes each way
+#define POLL_BURST_READS 2             // reads the budget can save up
+
+#define POLL_CHANNEL_ERROR_BIT 0x01 // a channel past POLL_MAX_CHANNELS, ignored
+
+/**
+ * A channel's latest position, in quarter us, and the micros() it was read at
+ */
+struct SB_PollReading {
+	uint16_t position = 0;
+	uint32_t readUs = 0;
+	bool valid = false; // false until the first read
+};
+
+class SB_PollPlanner {
+	private:
+		MiniMaestro &maestro;
+		uint32_t fastUs = POLL_DEFAULT_FAST_US;
+		uint32_t slowUs = POLL_DEFAULT_SLOW_US;
+		uint16_t deadband = POLL_DEFAULT_DEADBAND;
+		uint8_t budgetPercent;
+
+		int errorCode = 0;
+
+		struct Channel {
+			bool tracked = false;
+			uint16_t commanded = 0; // 0 for nothing sent yet
+			uint32_t periodUs = POLL_DEFAULT_FAST_US;
+			uint32_t dueUs = 0;
+			uint32_t reads = 0;
+			SB_PollReading reading;
+		};
+		Channel channels[POLL_MAX_CHANNELS];
+		uint8_t trackedCount = 0;
+
+		// The budget as a bucket of link time: it fills with time passing and
+		// each read takes readCostUs out. 0 for no budget
+		uint32_t readCostUs = 0;
+		uint32_t creditUs = 0;
+		uint32_t lastUpdateUs = 0;
+
+		uint32_t reads = 0;
+		uint32_t deferred = 0;
+		uint32_t maxLatenessUs = 0;
+
+		/**
+		 * The tracked channel furthest past its due time for its period, -1 if
+		 * none are due
+		 */
+		int mostOverdue(uint32_t nowUs) const;
+
+		/**
+		 * Reads a channel and works out its next period from what it found
+		 */
+		void read(uint8_t channel);
+
+	public:
+		/**
+		 * @param maestro -- where the reads go
+		 * @param baud -- the serial link's baud rate, 0 to read whatever's due without a budget
+		 * @param budgetPercent -- how much of the link's time the reads may take
+		 */
+		SB_PollPlanner(MiniMaestro &maestro, uint32_t baud = 0, uint8_t budgetPercent = POLL_DEFAULT_BUDGET_PERCENT);
+
+		/**
+		 * Starts polling a channel, it's due straight away
+		 * @sets POLL_CHANNEL_ERROR_BIT
+		 */
+		void track(uint8_t channel);
+		void untrack(uint8_t channel);
+		bool isTracked(uint8_t channel) const { return channel < POLL_MAX_CHANNELS && channels[channel].tracked; }
+
+		/**
+		 * The target sent to a channel. A new one puts it on the fast period and
+		 * makes it due a fast period after its last read
+		 * @sets POLL_CHANNEL_ERROR_BIT
+		 */
+		void commanded(uint8_t channel, uint16_t target);
+
+		/**
+		 * Reads the channels that are due, as the budget allows. Call it every loop
+		 * @return how many were read
+		 */
+		uint8_t update();
+
+		/**
+		 * The link's speed, for the budget. 0 lifts the budget
+		 */
+		void setBaud(uint32_t baud);
+
+		/**
+		 * @param fast -- the shortest period, for a channel moving or off target
+		 * @param slow -- the longest, for one sitting on its target
+		 */
+		void setPeriods(uint32_t fast, uint32_t slow);
+		void setDeadband(uint16_t quarterUS) { deadband = quarterUS; }
+
+		const SB_PollReading &getReading(uint8_t channel) const;
+
+		/**
+		 * @return how long ago the channel's reading was taken, UINT32_MAX if it
+		 * hasn't been read
+		 */
+		uint32_t getAgeUs(uint8_t channel) const;
+
+		/**
+		 * @return the channel's current read period
+		 */
+		uint32_t getPeriodUs(uint8_t channel) const;
+
+		/**
+		 * @return reads a second the budget allows, 0 for no budget
+		 */
+		uint32_t getBudgetReadsPerSecond() const { return readCostUs ? (1000000 + readCostUs / 2) / readCostUs : 0; }
+
+		uint32_t getReads() const { return reads; }
+		uint32_t getReads(uint8_t channel) const { return channel < POLL_MAX_CHANNELS ? channels[channel].reads : 0; }
+
+		/**
+		 * update() calls that left a due read for later, the budget being spent
+		 */
+		uint32_t getDeferred() const { return deferred; }
+
+		/**
+		 * The furthest past due a read has been taken
+		 */
+		uint32_t getMaxLatenessUs() const { return maxLatenessUs; }
+
+		int getErrorCode() const { return errorCode; }
+		void clearErrorCode() { errorCode = 0; }
+};
+
+#endif
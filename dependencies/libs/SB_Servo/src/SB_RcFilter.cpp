@@ -0,0 +1,126 @@
+/**
+ * Source file for SB_RcFilter.hpp
+ *
+ * AHJ
+ */
+
+#include "SB_RcFilter.hpp"
+
+#if RC_FILTER_DSP
+#define SADD16(a, b) ((uint32_t) __sadd16((a), (b)))
+#define SSUB16(a, b) ((uint32_t) __ssub16((a), (b)))
+#define SMUAD(a, b) ((int32_t) __smuad((a), (b)))
+#else
+#define SADD16(a, b) sadd16((a), (b))
+#define SSUB16(a, b) ssub16((a), (b))
+#define SMUAD(a, b) smuad((a), (b))
+#endif
+
+SB_RcFilter::SB_RcFilter(uint8_t channels, uint8_t windowShift, uint16_t alpha) :
+		channels(channels),
+		windowShift(windowShift),
+		alpha(alpha) {
+
+	if (channels > RC_FILTER_MAX_CHANNELS) {
+		errorCode |= RC_FILTER_CHANNEL_ERROR_BIT;
+		this->channels = RC_FILTER_MAX_CHANNELS;
+	}
+	if (windowShift > RC_FILTER_MAX_WINDOW_SHIFT) {
+		errorCode |= RC_FILTER_WINDOW_ERROR_BIT;
+		this->windowShift = RC_FILTER_MAX_WINDOW_SHIFT;
+	}
+	if (alpha == 0 || alpha > RC_FILTER_ALPHA_ONE) {
+		errorCode |= RC_FILTER_ALPHA_ERROR_BIT;
+		this->alpha = RC_FILTER_ALPHA_ONE;
+	}
+	pairs = (this->channels + 1) / 2;
+	// The odd lane out of the last pair is filtered along with the rest and never read
+	memset(history, 0, sizeof(history));
+	memset(sums, 0, sizeof(sums));
+	memset(state, 0, sizeof(state));
+}
+
+uint32_t SB_RcFilter::sadd16(uint32_t a, uint32_t b) {
+	return pack(low(a) + low(b), high(a) + high(b));
+}
+
+uint32_t SB_RcFilter::ssub16(uint32_t a, uint32_t b) {
+	return pack(low(a) - low(b), high(a) - high(b));
+}
+
+int32_t SB_RcFilter::smuad(uint32_t a, uint32_t b) {
+	// Wraps like the instruction (which sets the Q flag instead), never happens with our ranges
+	return (int32_t) ((uint32_t) (low(a) * low(b)) + (uint32_t) (high(a) * high(b)));
+}
+
+int16_t SB_RcFilter::offset(int widthUs) {
+	// Widths are garbage until a channel has seen a whole pulse, keep them from wrapping
+	const int limit = 1 << (RC_FILTER_INPUT_BITS - 1);
+	int us = widthUs - RC_FILTER_CENTER_US;
+	return us >= limit ? limit - 1 : us < -limit ? -limit : us;
+}
+
+void SB_RcFilter::prime(const int16_t *offsets) {
+	for (uint8_t c = 0; c < RC_FILTER_MAX_CHANNELS; c++) {
+		int16_t x = c < channels ? offsets[c] : 0;
+		for (uint8_t i = 0; i < (1 << windowShift); i++) {
+			history[i][c] = x;
+		}
+		sums[c] = x * (1 << windowShift);
+		state[c] = x * 4;
+	}
+	next = 0;
+	primed = true;
+}
+
+void SB_RcFilter::filter(const int *widthsUs, int *filteredUs) {
+	alignas(4) int16_t x[RC_FILTER_MAX_CHANNELS] = {0};
+	for (uint8_t c = 0; c < channels; c++) {
+		x[c] = offset(widthsUs[c]);
+	}
+	if (!primed) {
+		prime(x);
+	}
+
+	const uint32_t coefficients = pack(alpha, RC_FILTER_ALPHA_ONE - alpha);
+	int16_t *oldest = history[next];
+	for (uint8_t p = 0; p < pairs; p++) {
+		uint8_t c = 2 * p;
+		// Moving average: drop the oldest sample, add the newest, both lanes at once
+		uint32_t in = load(&x[c]);
+		uint32_t sum = SADD16(SSUB16(load(&sums[c]), load(&oldest[c])), in);
+		store(&sums[c], sum);
+		store(&oldest[c], in);
+
+		// IIR: (average, y) . (alpha, 1 - alpha) in one multiply-accumulate per lane
+		uint32_t y = load(&state[c]);
+		int16_t lowY = (SMUAD(pack((low(sum) >> windowShift) * 4, low(y)), coefficients) + 8192) >> 14;
+		int16_t highY = (SMUAD(pack((high(sum) >> windowShift) * 4, high(y)), coefficients) + 8192) >> 14;
+		store(&state[c], pack(lowY, highY));
+
+		filteredUs[c] = output(lowY);
+		if (c + 1 < channels) {
+			filteredUs[c + 1] = output(highY);
+		}
+	}
+	next = (next + 1) & ((1 << windowShift) - 1);
+}
+
+void SB_RcFilter::filterScalar(const int *widthsUs, int *filteredUs) {
+	alignas(4) int16_t x[RC_FILTER_MAX_CHANNELS] = {0};
+	for (uint8_t c = 0; c < channels; c++) {
+		x[c] = offset(widthsUs[c]);
+	}
+	if (!primed) {
+		prime(x);
+	}
+
+	for (uint8_t c = 0; c < channels; c++) {
+		sums[c] = sums[c] - history[next][c] + x[c];
+		history[next][c] = x[c];
+		int32_t average = (sums[c] >> windowShift) * 4;
+		state[c] = (alpha * average + (RC_FILTER_ALPHA_ONE - alpha) * state[c] + 8192) >> 14;
+		filteredUs[c] = output(state[c]);
+	}
+	next = (next + 1) & ((1 << windowShift) - 1);
+}
@@ -0,0 +1,128 @@
+/**
+ * RC channel filtering for SailBot 2021 @ Virginia Tech.
+ *
+ * Smooths the pulse widths read from the AR620 (pwmChannel::pwmValue) with a
+ * moving average followed by a one pole IIR, all channels at once. Widths are
+ * kept as int16 offsets from 1500 us, two channels packed to a 32 bit word, so
+ * on a Cortex-M4/M7 (Teensy 3.x, 4.x) the moving average sums take one SADD16
+ * and one SSUB16 per pair of channels and the IIR one SMUAD per channel.
+ *
+ * filterScalar() does the same arithmetic one channel at a time in plain C++,
+ * and filter() is bit-exact with it: same saturation, same truncation, same
+ * rounding. Off ARM (the host build) filter() runs on portable versions of the
+ * DSP instructions, so the host tests check the packing while the
+ * filterCycles example checks the real instructions on a Teensy.
+ *
+ * Per channel, per frame:
+ *   x = width - 1500, saturated to 12 bits
+ *   average = (sum of the last 2^windowShift x) >> windowShift
+ *   y = (alpha * 4 * average + (RC_FILTER_ALPHA_ONE - alpha) * y + 8192) >> 14, in quarter us
+ *   out = 1500 + ((y + 2) >> 2)
+ *
+ * The history starts full of the first frame's widths, so the output doesn't
+ * ramp up from 1500 at power on.
+ *
+ * By convention error codes are OR'd into errorCode like SB_Servo's.
+ *
+ * AHJ
+ */
+
+#ifndef SB_rc_filter
+#define SB_rc_filter
+
+#include <Arduino.h>
+#include <string.h>
+
+#if defined(__ARM_FEATURE_SIMD32) && defined(__ARM_FEATURE_DSP)
+#include <arm_acle.h>
+#define RC_FILTER_DSP 1
+#else
+#define RC_FILTER_DSP 0
+#endif
+
+#define RC_FILTER_MAX_CHANNELS 8        // the AR620's six, rounded up to whole pairs with room to spare
+#define RC_FILTER_MAX_WINDOW_SHIFT 4    // 16 samples of 12 bits still fit an int16 sum
+#define RC_FILTER_CENTER_US 1500
+#define RC_FILTER_INPUT_BITS 12         // offsets from center saturate to +-2048 us
+#define RC_FILTER_ALPHA_ONE 16384       // 1.0 in the IIR's Q14 coefficients, i.e. no IIR smoothing
+
+#define RC_FILTER_CHANNEL_ERROR_BIT 0x01 // more than RC_FILTER_MAX_CHANNELS channels
+#define RC_FILTER_WINDOW_ERROR_BIT 0x02  // windowShift past RC_FILTER_MAX_WINDOW_SHIFT
+#define RC_FILTER_ALPHA_ERROR_BIT 0x04   // alpha of 0 or over RC_FILTER_ALPHA_ONE
+
+class SB_RcFilter {
+	private:
+		uint8_t channels;
+		uint8_t pairs;
+		uint8_t windowShift;
+		uint8_t next = 0;
+		bool primed = false;
+		int16_t alpha;
+
+		int errorCode = 0;
+
+		// int16 lanes, read and written as packed pairs by filter(). Aligned so
+		// a pair is one word load
+		alignas(4) int16_t history[1 << RC_FILTER_MAX_WINDOW_SHIFT][RC_FILTER_MAX_CHANNELS];
+		alignas(4) int16_t sums[RC_FILTER_MAX_CHANNELS];
+		alignas(4) int16_t state[RC_FILTER_MAX_CHANNELS]; // IIR output, quarter us from center
+
+		/**
+		 * Fills the history with the first frame
+		 */
+		void prime(const int16_t *offsets);
+
+		static int16_t offset(int widthUs);
+		static int output(int16_t quarterUs) { return RC_FILTER_CENTER_US + ((quarterUs + 2) >> 2); }
+
+		static uint32_t load(const int16_t *lanes) { uint32_t word; memcpy(&word, lanes, 4); return word; }
+		static void store(int16_t *lanes, uint32_t word) { memcpy(lanes, &word, 4); }
+		static uint32_t pack(int16_t low, int16_t high) { return (uint16_t) low | ((uint32_t) (uint16_t) high << 16); }
+		static int16_t low(uint32_t word) { return (int16_t) word; }
+		static int16_t high(uint32_t word) { return (int16_t) (word >> 16); }
+
+	public:
+		/**
+		 * @param channels -- how many widths each frame has, up to RC_FILTER_MAX_CHANNELS
+		 * @param windowShift -- the moving average is over 2^windowShift frames, 0 to turn it off
+		 * @param alpha -- IIR weight of the new sample out of RC_FILTER_ALPHA_ONE, which turns it off
+		 * @sets RC_FILTER_CHANNEL_ERROR_BIT, RC_FILTER_WINDOW_ERROR_BIT, RC_FILTER_ALPHA_ERROR_BIT
+		 */
+		SB_RcFilter(uint8_t channels, uint8_t windowShift = 2, uint16_t alpha = RC_FILTER_ALPHA_ONE / 4);
+
+		/**
+		 * Filters one frame with the packed (DSP) arithmetic
+		 * @param widthsUs -- pulse widths in us, one per channel
+		 * @param filteredUs -- where the filtered widths go, may be widthsUs
+		 */
+		void filter(const int *widthsUs, int *filteredUs);
+
+		/**
+		 * Filters one frame a channel at a time. Same results as filter(), it's
+		 * the reference the packed path is tested against
+		 */
+		void filterScalar(const int *widthsUs, int *filteredUs);
+
+		/**
+		 * Forgets the history, the next frame primes the filter again
+		 */
+		void reset() { primed = false; next = 0; }
+
+		uint8_t getChannels() const { return channels; }
+
+		/**
+		 * @return whether filter() uses the DSP instructions rather than their portable versions
+		 */
+		static bool usesDSP() { return RC_FILTER_DSP; }
+
+		// Portable versions of the DSP instructions, exact down to the wrap
+		// around. Public so the tests can check them against the ARM reference
+		static uint32_t sadd16(uint32_t a, uint32_t b);
+		static uint32_t ssub16(uint32_t a, uint32_t b);
+		static int32_t smuad(uint32_t a, uint32_t b);
+
+		int getErrorCode() { return errorCode; }
+		void clearErrorCode() { errorCode = 0; }
+};
+
+#endif
@@ -0,0 +1,158 @@
+/**
+ * Source file for SB_RecorderSinks.hpp, the flash commands are the common
+ * W25Qxx ones
+ *
+ * AHJ
+ */
+
+#include "SB_RecorderSinks.hpp"
+
+#if defined(__IMXRT1062__)
+
+#define FLASH_WRITE_ENABLE 0x06
+#define FLASH_READ_STATUS 0x05
+#define FLASH_PAGE_PROGRAM 0x02
+#define FLASH_SECTOR_ERASE 0x20
+#define FLASH_READ 0x03
+#define FLASH_JEDEC_ID 0x9F
+#define FLASH_STATUS_BUSY 0x01
+
+SB_SpiFlashSink::SB_SpiFlashSink(uint8_t csPin, uint32_t start, uint32_t size, SPIClass &spi, uint32_t clockHz)
+		: spi(spi), settings(clockHz, MSBFIRST, SPI_MODE0), csPin(csPin), start(start), size(size), address(start) {}
+
+void SB_SpiFlashSink::command(uint8_t op) {
+	spi.beginTransaction(settings);
+	digitalWrite(csPin, LOW);
+	spi.transfer(op);
+	digitalWrite(csPin, HIGH);
+	spi.endTransaction();
+}
+
+void SB_SpiFlashSink::command(uint8_t op, uint32_t at) {
+	command(FLASH_WRITE_ENABLE);
+	spi.beginTransaction(settings);
+	digitalWrite(csPin, LOW);
+	spi.transfer(op);
+	spi.transfer(at >> 16);
+	spi.transfer(at >> 8);
+	spi.transfer(at);
+	if (op != FLASH_PAGE_PROGRAM) {
+		digitalWrite(csPin, HIGH);
+		spi.endTransaction();
+	}
+}
+
+void SB_SpiFlashSink::read(uint32_t at, uint8_t *buffer, size_t length) {
+	spi.beginTransaction(settings);
+	digitalWrite(csPin, LOW);
+	spi.transfer(FLASH_READ);
+	spi.transfer(at >> 16);
+	spi.transfer(at >> 8);
+	spi.transfer(at);
+	for (size_t i = 0; i < length; i++) {
+		buffer[i] = spi.transfer(0);
+	}
+	digitalWrite(csPin, HIGH);
+	spi.endTransaction();
+}
+
+bool SB_SpiFlashSink::readBusy() {
+	spi.beginTransaction(settings);
+	digitalWrite(csPin, LOW);
+	spi.transfer(FLASH_READ_STATUS);
+	bool programming = spi.transfer(0) & FLASH_STATUS_BUSY;
+	digitalWrite(csPin, HIGH);
+	spi.endTransaction();
+	return programming;
+}
+
+bool SB_SpiFlashSink::begin() {
+	pinMode(csPin, OUTPUT);
+	digitalWrite(csPin, HIGH);
+	spi.begin();
+	spi.beginTransaction(settings);
+	digitalWrite(csPin, LOW);
+	spi.transfer(FLASH_JEDEC_ID);
+	uint8_t manufacturer = spi.transfer(0);
+	spi.transfer(0);
+	spi.transfer(0);
+	digitalWrite(csPin, HIGH);
+	spi.endTransaction();
+	if (manufacturer == 0x00 || manufacturer == 0xFF) {
+		return false;
+	}
+
+	// The newest block by sequence number, the ring carries on after it
+	address = start;
+	nextSequence = 0;
+	nextRun = 0;
+	bool found = false;
+	uint8_t header[RECORDER_HEADER_BYTES];
+	for (uint32_t at = start; at < start + size; at += RECORDER_BLOCK_BYTES) {
+		read(at, header, sizeof(header));
+		uint32_t sequence = header[4] | (header[5] << 8) | (header[6] << 16) | ((uint32_t) header[7] << 24);
+		if (memcmp(header, "SBFR", 4) == 0 && (!found || (int32_t) (sequence - nextSequence) >= 0)) {
+			found = true;
+			nextSequence = sequence + 1;
+			nextRun = header[16] + 1;
+			address = at + RECORDER_BLOCK_BYTES;
+		}
+	}
+	if (address >= start + size) {
+		address = start;
+	}
+	// The rest of a partly written sector is still erased
+	erased = found && address % FLASH_SECTOR_BYTES != 0;
+	busy = false;
+	return true;
+}
+
+bool SB_SpiFlashSink::ready() {
+	if (busy && (busy = readBusy())) {
+		return false;
+	}
+	if (!erased) {
+		// Erase the sector about to be written, the oldest in the ring
+		command(FLASH_SECTOR_ERASE, address);
+		busy = true;
+		erased = true;
+		return false;
+	}
+	return true;
+}
+
+bool SB_SpiFlashSink::write(const uint8_t *data, size_t length) {
+	if (busy || !erased || length > FLASH_PAGE_BYTES) {
+		return false;
+	}
+	// The page program continues the transaction command() left open
+	command(FLASH_PAGE_PROGRAM, address);
+	for (size_t i = 0; i < length; i++) {
+		spi.transfer(data[i]);
+	}
+	digitalWrite(csPin, HIGH);
+	spi.endTransaction();
+	busy = true;
+
+	address += FLASH_PAGE_BYTES;
+	if (address >= start + size) {
+		address = start;
+	}
+	if (address % FLASH_SECTOR_BYTES == 0) {
+		erased = false;
+	}
+	return true;
+}
+
+void SB_SpiFlashSink::dump(Print &out) {
+	while (busy) {
+		busy = readBusy();
+	}
+	uint8_t buffer[FLASH_PAGE_BYTES];
+	for (uint32_t at = start; at < start + size; at += sizeof(buffer)) {
+		read(at, buffer, sizeof(buffer));
+		out.write(buffer, sizeof(buffer));
+	}
+}
+
+#endif
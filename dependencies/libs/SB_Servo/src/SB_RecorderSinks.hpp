@@ -0,0 +1,86 @@
+/**
+ * Where SB_FlightRecorder's blocks go on the Teensy 4.x, for SailBot 2021 @
+ * Virginia Tech.
+ *
+ * SB_SpiFlashSink -- a W25Qxx style SPI NOR flash chip used as a ring: the
+ * oldest block is erased, a 4K sector, to make room for each new one, so after
+ * a crash it holds the last (size - 4K) bytes of the run. Writes are 256 byte page
+ * programs. ready() reads the status register, it never waits for a program
+ * or an erase to finish, and the erase of the next sector is started by ready()
+ * when the last one is full so it runs while loop() carries on. begin() finds
+ * the newest block already there and carries on after it, pass
+ * getNextSequence() and getNextRun() to the recorder's setSequence() so the
+ * boots can be told apart. dump() copies
+ * the whole ring out (to Serial, say) for recorderToCsv, which puts the blocks
+ * back in order by their sequence numbers.
+ *
+ * There's no SD card sink: the SD library waits for the card inside every
+ * write, now and then for a lot longer while the card is busy, and it can't
+ * say beforehand whether a write will wait, so there's no ready() to give.
+ *
+ * It compiles to nothing off the Teensy 4.x, the host builds write to memory.
+ *
+ * AHJ
+ */
+
+#ifndef SB_recorder_sinks
+#define SB_recorder_sinks
+
+#include "SB_FlightRecorder.hpp"
+
+#if defined(__IMXRT1062__)
+
+#include <SPI.h>
+
+#define FLASH_PAGE_BYTES 256
+#define FLASH_SECTOR_BYTES 4096
+
+class SB_SpiFlashSink : public SB_RecorderSink {
+	private:
+		SPIClass &spi;
+		SPISettings settings;
+		uint8_t csPin;
+		uint32_t start;
+		uint32_t size;
+		uint32_t address;
+		bool busy = false; // a program or erase is in progress
+		bool erased = false; // the sector address is in has been erased
+		uint32_t nextSequence = 0;
+		uint8_t nextRun = 0;
+
+		void read(uint32_t at, uint8_t *buffer, size_t length);
+		bool readBusy();
+
+		void command(uint8_t op);
+		void command(uint8_t op, uint32_t at);
+
+	public:
+		/**
+		 * @param csPin -- the flash's chip select
+		 * @param start, size -- the part of the flash to use, whole sectors
+		 */
+		SB_SpiFlashSink(uint8_t csPin, uint32_t start, uint32_t size, SPIClass &spi = SPI,
+				uint32_t clockHz = 30000000);
+
+		/**
+		 * Finds where the last boot stopped writing
+		 * @return false if no flash answers, by its JEDEC ID
+		 */
+		bool begin();
+
+		uint32_t getNextSequence() const { return nextSequence; }
+		uint8_t getNextRun() const { return nextRun; }
+
+		bool ready() override;
+		bool write(const uint8_t *data, size_t length) override;
+		size_t chunkBytes() const override { return FLASH_PAGE_BYTES; }
+
+		/**
+		 * Copies the whole ring to out, raw. Blocking, not for use while recording
+		 */
+		void dump(Print &out);
+};
+
+#endif
+
+#endif
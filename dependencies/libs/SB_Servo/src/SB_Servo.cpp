@@ -8,8 +8,22 @@
 #include "SB_Servo.hpp"
 
 // Here the maestro is initialized to Serial1 on the Teensy, this is just one of 8 ports 
-MiniMaestro SB_Servo::maestro(Serial1);
+SB_PER_THREAD SB_StreamTap SB_Servo::maestroTap(Serial1);
+SB_PER_THREAD MiniMaestro SB_Servo::maestro(maestroTap);
+SB_PER_THREAD SB_TargetMailbox SB_Servo::targetMailbox(maestro);
+SB_PER_THREAD SB_PollPlanner SB_Servo::pollPlanner(maestro);
+const SB_MaestroModel *SB_Servo::maestroModel = &SB_MaestroModel::mini12;
 int SB_Servo::servoCount{0};
+SB_PER_THREAD SB_Servo::ChannelRecord SB_Servo::channelRecords[NUM_MAESTRO_CHANNELS];
+SB_PER_THREAD bool SB_Servo::elideReadback = true;
+SB_PER_THREAD uint32_t SB_Servo::verifyIntervalUs = READBACK_VERIFY_US;
+SB_PER_THREAD uint8_t SB_Servo::movingState = 0;
+SB_PER_THREAD bool SB_Servo::movingStateValid = false;
+SB_PER_THREAD uint32_t SB_Servo::movingStateUs = 0;
+SB_PER_THREAD uint32_t SB_Servo::movingStateSent = 0;
+SB_PER_THREAD uint32_t SB_Servo::positionReads = 0;
+SB_PER_THREAD uint32_t SB_Servo::movingStateReads = 0;
+SB_PER_THREAD uint32_t SB_Servo::elidedReads = 0;
 
 
 /** 
@@ -52,7 +66,12 @@ SB_Servo::SB_Servo(int minimumUS, int maximumUS, float minimumRange, float maxim
 	checkMinAngle();
 	checkMaxAngle();
 	checkChannel();
-
+	if (!(errorCode & CHANNEL_ERROR_BIT)) { 
+		// A new servo knows nothing of what its channel was told before
+		channelRecords[channelNum] = ChannelRecord();
+		movingStateValid = false;
+		pollPlanner.track(channelNum);
+	}
 }
 
 // In the the future these methods can be shortened and all put together
@@ -115,7 +134,7 @@ void  SB_Servo::checkMaxAngle() {
 }
 
 void SB_Servo::checkChannel() { 
-	if (channelNum < 0 || channelNum >= NUM_MAESTRO_CHANNELS) { 
+	if (!maestroModel->hasChannel(channelNum)) { 
 		errorCode |= CHANNEL_ERROR_BIT;
 		printDebug("checkChannel() error");
 	}
@@ -126,8 +145,7 @@ float SB_Servo::getCurrentDegrees() {
 		printDebug("Bad channel num, aborting getCurrentDegrees()"); 
 		return -1; // Servo not connected properly 
 	} else { 
-		int currentUS = maestro.getPosition(channelNum); 
-		return usToDegrees(currentUS); 
+		return usToDegrees(currentUS()); 
 	}
 }
 
@@ -148,23 +166,228 @@ void SB_Servo::rotateToDegrees(float degree) {
 		printDebug("Bad channel num, aborting rotateTo()"); 
 		return; // Servo not connected yet 
 	} 
-	maestro.setTarget(channelNum, usToWrite); 
-	return;
+	if (maxSlewQ8 == 0 && maxAccelQ8 == 0) { 
+		sendUS(usToWrite);
+		return;
+	}
+	if (sentUS == 0) { 
+		// Nothing sent yet, start from wherever the maestro has it (0 if it's not pulsing, then just go)
+		int current = readUS();
+		if (current == 0) { 
+			sendUS(usToWrite);
+			return;
+		}
+		slewPositionQ8 = current << 8;
+		slewVelocityQ8 = 0;
+		sentUS = current;
+	}
+	slewTarget = usToWrite;
+	if (!slewing) { 
+		slewing = true;
+		lastSlewUs = micros();
+	}
+}
+
+void SB_Servo::writeUS(int us) { 
+	targetMailbox.post(channelNum, us); 
+	sentUS = us;
+	channelRecords[channelNum].commanded = us;
+	pollPlanner.commanded(channelNum, us);
+	if (predictor) { 
+		predictor->commanded(micros(), us);
+	}
+}
+
+int SB_Servo::readUS() { 
+	int us = maestro.getPosition(channelNum);
+	// The query was answered, so everything written before it has gone out
+	targetMailbox.lineClear();
+	ChannelRecord &record = channelRecords[channelNum];
+	record.known = us;
+	record.verifiedUs = micros();
+	positionReads++;
+	if (predictor) { 
+		predictor->measured(micros(), us);
+	}
+	return us;
+}
+
+uint8_t SB_Servo::readMovingState() { 
+	uint32_t now = micros();
+	if (!movingStateValid || movingStateSent != targetMailbox.getSent() ||
+			now - movingStateUs >= READBACK_MOVING_STATE_US) { 
+		movingState = maestro.getMovingState();
+		targetMailbox.lineClear();
+		movingStateValid = true;
+		movingStateUs = micros();
+		movingStateSent = targetMailbox.getSent();
+		movingStateReads++;
+	}
+	return movingState;
+}
+
+int SB_Servo::currentUS() { 
+	ChannelRecord &record = channelRecords[channelNum];
+	// Nothing sent to go on, a target not out yet, or time to check
+	if (!elideReadback || record.commanded == 0 || targetMailbox.isPending(channelNum) ||
+			micros() - record.verifiedUs >= verifyIntervalUs) { 
+		return readUS();
+	}
+	if (record.known != record.commanded) { 
+		// On its way, or got there since it was read: nothing moving means it's there
+		if (readMovingState()) { 
+			return readUS();
+		}
+		record.known = record.commanded;
+	}
+	elidedReads++;
+	return record.known;
+}
+
+void SB_Servo::setReadbackElision(bool enabled, uint32_t verifyInterval) { 
+	elideReadback = enabled;
+	verifyIntervalUs = verifyInterval;
+}
+
+uint8_t SB_Servo::pollPositions() { 
+	uint8_t reads = pollPlanner.update();
+	if (reads) { 
+		// Answered, so everything written before the queries has gone out
+		targetMailbox.lineClear();
+	}
+	return reads;
+}
+
+float SB_Servo::getPolledDegrees(uint32_t *ageUs) { 
+	const SB_PollReading &reading = pollPlanner.getReading(channelNum);
+	if (ageUs) { 
+		*ageUs = pollPlanner.getAgeUs(channelNum);
+	}
+	return reading.valid ? usToDegrees(reading.position) : -1;
+}
+
+float SB_Servo::getEstimatedDegrees() { 
+	int us = predictor ? predictor->estimate(micros()) : sentUS;
+	return us ? usToDegrees(us) : -1;
+}
+
+float SB_Servo::getPredictedDegrees() { 
+	int us = predictor ? predictor->predict(micros()) : sentUS;
+	return us ? usToDegrees(us) : -1;
+}
+
+void SB_Servo::sendUS(int us) { 
+	writeUS(us);
+	slewPositionQ8 = us << 8;
+	slewVelocityQ8 = 0;
+	slewing = false;
+}
+
+/**
+ * Integer square root, the largest r with r * r <= value
+ */
+static uint32_t isqrt64(uint64_t value) { 
+	uint64_t root = 0;
+	uint64_t bit = (uint64_t) 1 << 62;
+	while (bit > value) { 
+		bit >>= 2;
+	}
+	while (bit != 0) { 
+		if (value >= root + bit) { 
+			value -= root + bit;
+			root = (root >> 1) + bit;
+		} else { 
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+	return root;
+}
+
+void SB_Servo::setSlewLimits(float degreesPerSecond, float degreesPerSecond2) { 
+	if (degreesPerSecond < 0 || degreesPerSecond2 < 0) { 
+		errorCode |= SLEW_ERROR_BIT;
+		printDebug("setSlewLimits() error");
+		return;
+	}
+	// Degrees to quarter us the same way degToUS() does, capped well short of overflowing the Q8 math
+	float quarterUSPerDegree = (float) (maxUS - minUS) / maxDegreeRange;
+	float slew = degreesPerSecond * quarterUSPerDegree * 256;
+	float accel = degreesPerSecond2 * quarterUSPerDegree * 256;
+	maxSlewQ8 = slew > INT32_MAX / 4 ? INT32_MAX / 4 : (int32_t) (slew + .5f);
+	maxAccelQ8 = accel > INT32_MAX / 4 ? INT32_MAX / 4 : (int32_t) (accel + .5f);
+	if (maxSlewQ8 == 0 && maxAccelQ8 == 0 && slewing) { 
+		sendUS(slewTarget); // turned off mid move, finish it in one go
+	}
+}
+
+void SB_Servo::update() { 
+	targetMailbox.update();
+	if (!slewing) { 
+		return;
+	}
+	uint32_t now = micros();
+	uint32_t tickUs = now - lastSlewUs;
+	lastSlewUs = now;
+	if (tickUs > SLEW_MAX_TICK_US) { 
+		tickUs = SLEW_MAX_TICK_US;
+	}
+
+	int32_t remaining = (slewTarget << 8) - slewPositionQ8;
+	int32_t direction = remaining >= 0 ? 1 : -1;
+	int64_t speed = maxSlewQ8 ? maxSlewQ8 : INT32_MAX / 4;
+	int64_t velocity;
+	if (maxAccelQ8) { 
+		// No faster than it can still stop from on the target, v^2 = 2 a d
+		int64_t stopping = isqrt64(2 * (uint64_t) maxAccelQ8 * (uint32_t) (remaining * direction));
+		if (stopping < speed) { 
+			speed = stopping;
+		}
+		int64_t change = (int64_t) maxAccelQ8 * tickUs / 1000000;
+		int64_t wanted = direction * speed;
+		velocity = wanted > slewVelocityQ8 + change ? slewVelocityQ8 + change
+			: wanted < slewVelocityQ8 - change ? slewVelocityQ8 - change : wanted;
+	} else { 
+		velocity = direction * speed;
+	}
+
+	int64_t moved = velocity * tickUs / 1000000;
+	if (moved == 0 && velocity != 0) { 
+		moved = velocity > 0 ? 1 : -1; // always some progress, or the last fraction never arrives
+	}
+	if (remaining == 0 || (direction > 0 ? moved >= remaining : moved <= remaining)) { 
+		// Arrived, the last step is always sent
+		if (sentUS != slewTarget) { 
+			writeUS(slewTarget);
+		}
+		slewPositionQ8 = slewTarget << 8;
+		slewVelocityQ8 = 0;
+		slewing = false;
+		return;
+	}
+	slewPositionQ8 += moved;
+	slewVelocityQ8 = velocity;
+
+	// Only send once the output has moved a whole step
+	int output = (slewPositionQ8 + 128) >> 8;
+	if (output - sentUS >= slewStep || sentUS - output >= slewStep) { 
+		writeUS(output);
+	}
 }
 
 
 void SB_Servo::rotateBy(float degreesBy) { 
-	currentDeg = (int) (getCurrentDegrees() + .5); // Round down to make life easier and stop errors
+	float currentDeg = (int) (getCurrentDegrees() + .5); // Round down to make life easier and stop errors
 	float desiredAngle = currentDeg + degreesBy;	
 	rotateToDegrees(desiredAngle);
 }
 
-void SB_Servo::printDebug(String printMe) { 
+void SB_Servo::printDebug(const char *printMe) { 
 #ifdef DEBUG
 	Serial.print("Servo #");
 	Serial.print(servoNumber);
 	Serial.print(": ");
-	Serial.println(String(printMe));
+	Serial.println(printMe);
 #endif
 }
 
@@ -176,22 +399,81 @@ void SB_Servo::clearErrorCode() {
 	errorCode = 0;
 }
 
+static bool beginSerial1(uint32_t baud) { 
+	Serial1.begin(baud);
+	return true;
+}
+
+uint32_t SB_Servo::negotiateMaestroBaud() { 
+	return negotiateMaestroBaud(beginSerial1);
+}
+
+uint32_t SB_Servo::negotiateMaestroBaud(bool (*setBaud)(uint32_t baud)) { 
+	uint32_t baud = maestro.negotiateBaud(setBaud);
+	targetMailbox.setBaud(baud);
+	pollPlanner.setBaud(baud);
+	return baud;
+}
+
+void SB_Servo::setMaestroModel(const SB_MaestroModel &model) { 
+	maestroModel = &model;
+}
+
+const SB_MaestroModel &SB_Servo::getMaestroModel() { 
+	return *maestroModel;
+}
+
 void SB_Servo::setMultipleTargets(std::vector<SB_Servo> servos, std::vector<float> degrees) { 
-	// Need to make sure the channels are contiguous
-	for (int i = 0; i < servos.size() - 1; i++) { 
-		if (servos[i].channelNum + 1 != servos[i + 1].channelNum ) { 
-			// Make an issue!!!!
-			servos[i].printDebug("Continuity is wrong in setMultipleTargets!!!"); 
+	size_t count = servos.size() < degrees.size() ? servos.size() : degrees.size();
+	if (count == 0 || count > NUM_MAESTRO_CHANNELS) { 
+		return;
+	}
+	SB_Servo *pointers[NUM_MAESTRO_CHANNELS];
+	for (size_t i = 0; i < count; i++) { 
+		pointers[i] = &servos[i];
+	}
+	setMultipleTargets(pointers, degrees.data(), count);
+}
+
+void SB_Servo::setMultipleTargets(SB_Servo *const *servos, const float *degrees, uint8_t count) { 
+	if (count == 0 || count > NUM_MAESTRO_CHANNELS) { 
+		return;
+	}
+	// Every channel has to be on the maestro and the channels contiguous, checked
+	// before any channel's record, mailbox slot or poll is touched
+	for (int i = 0; i < count; i++) { 
+		servos[i]->checkChannel();
+		if (servos[i]->errorCode & CHANNEL_ERROR_BIT) { 
+			servos[i]->printDebug("Bad channel num, aborting setMultipleTargets()"); 
+			return;
+		}
+		if (i + 1 < count && servos[i]->channelNum + 1 != servos[i + 1]->channelNum) { 
+			servos[i]->errorCode |= CHANNEL_ERROR_BIT;
+			servos[i]->printDebug("Continuity is wrong in setMultipleTargets!!!"); 
+			return;
 		}
 	}
+	if (servos[0]->channelNum + count > maestroModel->channels) { 
+		servos[0]->errorCode |= CHANNEL_ERROR_BIT;
+		return;
+	}
 
 	uint16_t targets[NUM_MAESTRO_CHANNELS];
-	for (int i = 0; i < degrees.size(); i++) { 
-		targets[i] = servos[i].degToUS(degrees[i]); 
+	for (int i = 0; i < count; i++) { 
+		targets[i] = servos[i]->degToUS(degrees[i]); 
+	}
+	int numberOfServosToMove = count;
+	int firstChannel = servos[0]->channelNum; 
+	// Targets still waiting for these channels would undo the ones sent here
+	for (int i = 0; i < numberOfServosToMove; i++) { 
+		targetMailbox.withdraw(firstChannel + i);
+		channelRecords[firstChannel + i].commanded = targets[i];
+		pollPlanner.commanded(firstChannel + i, targets[i]);
 	}
-	int numberOfServosToMove = servos.size();
-	int firstChannel = servos[0].channelNum; 
-	maestro.setMultiTarget(numberOfServosToMove, firstChannel, &targets[0]);
+	movingStateValid = false;
+	// One setMultiTarget where the maestro has it, back to back setTargets where it doesn't,
+	// the targets waiting in the mailbox go out behind it
+	targetMailbox.written(maestroModel->setTargets(maestro, numberOfServosToMove, firstChannel, &targets[0]));
 }
 
 
@@ -24,6 +24,11 @@
 // the Serial monitor 
 #define DEBUG 
 #include <PololuMaestro.h>
+#include "SB_MaestroModel.hpp"
+#include "SB_PollPlanner.hpp"
+#include "SB_ServoPredictor.hpp"
+#include "SB_StreamTap.hpp"
+#include "SB_TargetMailbox.hpp"
 #include <vector> // Needed for set multiple targets
 
 /** 
@@ -38,6 +43,8 @@
 #define CHANNEL_ERROR_BIT 0x08
 #define ROTATE_TO_UNDER_ERROR_BIT 0x10
 #define ROTATE_TO_OVER_ERROR_BIT 0x20
+// 0x40 and 0x80 are SB_WinchServo's
+#define SLEW_ERROR_BIT 0x100
 
 /**
  * These are default values for instantiated servos
@@ -53,16 +60,72 @@
 #define DEFAULT_MAX_ANGLE 180 
 
 /**
- * The number of servos that the maestro can handle
- * This could change in the future if a different maestro were to be used
+ * The most servos any maestro can handle, for sizing buffers
+ * How many the one we're using has comes from its SB_MaestroModel, see setMaestroModel()
  */
-#define NUM_MAESTRO_CHANNELS 8
+#define NUM_MAESTRO_CHANNELS MAESTRO_MAX_CHANNELS
+
+/**
+ * Slew limiting, see setSlewLimits(). The output is only sent when it has moved
+ * SLEW_DEFAULT_STEP quarter us (1 us) since the last one sent, and a tick longer
+ * than SLEW_MAX_TICK_US (a stalled loop) only counts as that long, so the servo
+ * doesn't jump to make up for it
+ */
+#define SLEW_DEFAULT_STEP 4
+#define SLEW_MAX_TICK_US 100000
+
+/**
+ * Shared state that has to be per thread on the host, where simulations run
+ * SB_Servos side by side, each thread's Serial1 routed to its own emulator
+ */
+#ifdef SB_HOST
+#define SB_PER_THREAD thread_local
+#else
+#define SB_PER_THREAD
+#endif
+
+/**
+ * Readback elision, see setReadbackElision(). A servo at its target is only
+ * read every READBACK_VERIFY_US to check, and one getMovingState() answer
+ * stands in for reading each servo that's been retargeted for up to
+ * READBACK_MOVING_STATE_US (a maestro frame) or until another target goes out
+ */
+#define READBACK_VERIFY_US 1000000
+#define READBACK_MOVING_STATE_US 20000
 
 class SB_Servo { 
 	private: 
+		// Winches send through the same maestro and mailbox
+		friend class SB_WinchServo;
+
 		// We make the maestro static so that it's shared across all instances 
-		// of Servos
-		static MiniMaestro maestro;
+		// of Servos. It talks through a tap that can record its traffic
+		static SB_PER_THREAD SB_StreamTap maestroTap;
+		static SB_PER_THREAD MiniMaestro maestro;
+		// Targets go through a mailbox so a saturated link carries the newest ones
+		static SB_PER_THREAD SB_TargetMailbox targetMailbox;
+		// Reads positions in the background for pollPositions(), each servo at its own rate
+		static SB_PER_THREAD SB_PollPlanner pollPlanner;
+		// What that maestro can do, a Mini Maestro 12 unless setMaestroModel() says otherwise
+		static const SB_MaestroModel *maestroModel;
+		// What each channel was last told and last known to be at, in quarter us,
+		// kept per channel rather than per servo so setMultipleTargets() can update it
+		struct ChannelRecord {
+			uint16_t commanded = 0; // 0 for nothing sent yet
+			uint16_t known = 0;     // from a read, or the target once nothing was moving
+			uint32_t verifiedUs = 0; // when it was last read
+		};
+		static SB_PER_THREAD ChannelRecord channelRecords[NUM_MAESTRO_CHANNELS];
+		static SB_PER_THREAD bool elideReadback;
+		static SB_PER_THREAD uint32_t verifyIntervalUs;
+		// The last getMovingState() answer, good until a target goes out after it
+		static SB_PER_THREAD uint8_t movingState;
+		static SB_PER_THREAD bool movingStateValid;
+		static SB_PER_THREAD uint32_t movingStateUs;
+		static SB_PER_THREAD uint32_t movingStateSent; // the mailbox's sent count when it was read
+		static SB_PER_THREAD uint32_t positionReads;
+		static SB_PER_THREAD uint32_t movingStateReads;
+		static SB_PER_THREAD uint32_t elidedReads;
 		// This is the number of servos we're using, the count increments for 
 		// each servo added. The servo count is used in debugging print values 
 		// as it provides a unique identifier for each servo 
@@ -100,6 +163,49 @@ class SB_Servo {
 
 		const int channelNum; 	// no default value
 		const int servoNumber;  // The identifier for this servo taken from servoCount 
+
+		// Slew limiting, off while both limits are 0. Positions are in the maestro's
+		// quarter us, rates in quarter us per second (and per second squared), all
+		// in Q8 fixed point
+		int32_t maxSlewQ8 = 0;
+		int32_t maxAccelQ8 = 0;
+		int32_t slewStep = SLEW_DEFAULT_STEP;
+		int slewTarget = 0;
+		int32_t slewPositionQ8 = 0; // where the output is
+		int32_t slewVelocityQ8 = 0;
+		int sentUS = 0;             // the last target sent, 0 for none yet
+		bool slewing = false;
+		uint32_t lastSlewUs = 0;
+
+		// Lag prediction, none unless setPredictor() gives one
+		SB_ServoPredictor *predictor = nullptr;
+
+		/**
+		 * Sends a target straight away, and remembers it as where the output is
+		 */
+		void sendUS(int us);
+
+		/**
+		 * Posts a target to the mailbox, telling the predictor
+		 */
+		void writeUS(int us);
+
+		/**
+		 * Reads the position in quarter us, telling the predictor
+		 */
+		int readUS();
+
+		/**
+		 * Where the output is in quarter us: read, or when readback elision
+		 * can tell without reading, the target
+		 */
+		int currentUS();
+
+		/**
+		 * The maestro's moving state, asked for only if the last answer is
+		 * out of date
+		 */
+		static uint8_t readMovingState();
 		
 
 		/** 
@@ -157,9 +263,9 @@ class SB_Servo {
 		 * Simply used to print debug lines if debug mode has been toggled on,
 		 * which can easily be done from line #20
 		 *
-		 * @param String the string to print
+		 * @param printMe the string to print, a literal so nothing is allocated
 		 */
-		void printDebug(String);
+		void printDebug(const char *printMe);
 
    	public: 
 		/**
@@ -205,7 +311,8 @@ class SB_Servo {
 		
 		/** 
 		 * Gets the current degrees of this servo 
-		 * by sending asking the maestro for the current degrees of the servo
+		 * by sending asking the maestro for the current degrees of the servo,
+		 * unless readback elision knows it's at its target, see setReadbackElision()
 		 *
 		 * @return the current degrees.
 		 * -1 if there is a communication failure / channel number not set properly
@@ -250,6 +357,149 @@ class SB_Servo {
 		 */
 		void clearErrorCode();
 
+		/**
+		 * Limits how fast the output moves. With limits set, rotateToDegrees()
+		 * only sets where to go and update() moves the output there: it speeds up
+		 * no faster than the acceleration limit, cruises at the rate limit and
+		 * slows down to stop on the target. A limit of 0 means no limit, both 0
+		 * turns slew limiting off (the default), sending the target straight away
+		 * like before. Can be changed at any time, also mid move
+		 *
+		 * The first move after limits are set starts from the last target sent,
+		 * or from the maestro's position if this servo hasn't sent one yet.
+		 * setMultipleTargets() is never limited
+		 *
+		 * @param degreesPerSecond -- the most the output moves in a second
+		 * @param degreesPerSecond2 -- the most that rate changes in a second
+		 * @sets SLEW_ERROR_BIT if either is negative, the limits are left as they were
+		 */
+		void setSlewLimits(float degreesPerSecond, float degreesPerSecond2);
+
+		/**
+		 * How far in quarter us the output has to move before it's sent again,
+		 * the last step to the target is always sent
+		 */
+		void setSlewStep(int quarterUS) { slewStep = quarterUS > 0 ? quarterUS : 1; }
+
+		/**
+		 * Moves the output toward the target by however long it's been since the
+		 * last call, within the limits, and sends any targets waiting in the
+		 * mailbox. Call it every loop or from a scheduler task, the slew limiting
+		 * does nothing unless it's on and a move is under way
+		 */
+		void update();
+
+		bool isSlewing() const { return slewing; }
+
+		/**
+		 * Models this servo's lag from here on, see SB_ServoPredictor.hpp. The
+		 * predictor is told every target sent (but not setMultipleTargets()) and
+		 * every position read. nullptr turns prediction off again
+		 */
+		void setPredictor(SB_ServoPredictor *newPredictor) { predictor = newPredictor; }
+		SB_ServoPredictor *getPredictor() { return predictor; }
+
+		/**
+		 * Where the servo is now by its predictor, without asking the maestro.
+		 * Without a predictor, the last target sent
+		 *
+		 * @return -1 if nothing has been sent or read yet
+		 */
+		float getEstimatedDegrees();
+
+		/**
+		 * Where the servo will be once the targets already sent have arrived, the
+		 * feedback for a control loop to close around in place of
+		 * getCurrentDegrees() (a Smith predictor), so the lag isn't in the loop.
+		 * Without a predictor, the last target sent
+		 *
+		 * @return -1 if nothing has been sent or read yet
+		 */
+		float getPredictedDegrees();
+
+		/**
+		 * Tells every servo which model of maestro they're plugged into. Call it
+		 * before constructing any, the constructors check the channel against it
+		 *
+		 * @param model -- one of the SB_MaestroModel constants, e.g. SB_MaestroModel::micro6
+		 */
+		static void setMaestroModel(const SB_MaestroModel &model);
+		static const SB_MaestroModel &getMaestroModel();
+
+		/**
+		 * Starts Serial1 at the fastest rate the maestro answers reliably at, in
+		 * place of Serial1.begin(9600). Call it in setup() before anything else
+		 * talks to the maestro, see Maestro::negotiateBaud() for how rates are
+		 * tried. Set the maestro to a fixed baud in the Control Center, or to
+		 * detect it and power it up with the Teensy: a detecting maestro only
+		 * listens at the first rate tried (200000), and SB_Servo's maestro has
+		 * no reset pin to make it listen again
+		 *
+		 * @param setBaud -- sets the port to a rate, Serial1.begin() if left out
+		 * @return the rate Serial1 was left at, 0 if the maestro never answered
+		 */
+		static uint32_t negotiateMaestroBaud();
+		static uint32_t negotiateMaestroBaud(bool (*setBaud)(uint32_t baud));
+
+		/**
+		 * The tap on the maestro's serial port. It records nothing, and holds
+		 * no log, until its start() is given a ring, see SB_StreamTap.hpp
+		 */
+		static SB_StreamTap &getMaestroTap() { return maestroTap; }
+
+		/**
+		 * The mailbox every servo's targets go through, see SB_TargetMailbox.hpp.
+		 * It only holds targets back once it knows the baud: negotiateMaestroBaud()
+		 * tells it, after Serial1.begin() call its setBaud() with the same rate.
+		 * Waiting targets go out from update(), or with its flush()
+		 */
+		static SB_TargetMailbox &getTargetMailbox() { return targetMailbox; }
+
+		/**
+		 * Readback elision, on unless turned off here. Servos remember the
+		 * targets sent, so a servo known to be at its target and not sent
+		 * another since is answered from memory by getCurrentDegrees(), and only
+		 * read every verifyIntervalUs to make sure. A retargeted one is read
+		 * until it gets there, unless one getMovingState() (which covers every
+		 * channel in one byte) says nothing is moving. Monitoring servos that
+		 * are sitting still then costs next to nothing on the bus.
+		 *
+		 * Turn it off if anything else moves the maestro's outputs: a script,
+		 * another controller on the same maestro, or one that may reset
+		 */
+		static void setReadbackElision(bool enabled, uint32_t verifyIntervalUs = READBACK_VERIFY_US);
+
+		/**
+		 * getCurrentDegrees() calls that read the position, that didn't, and
+		 * the getMovingState() queries sent for them, since start up
+		 */
+		static uint32_t getPositionReads() { return positionReads; }
+		static uint32_t getElidedReads() { return elidedReads; }
+		static uint32_t getMovingStateReads() { return movingStateReads; }
+
+		/**
+		 * Reads the positions that are due by the poll planner, see
+		 * SB_PollPlanner.hpp: every servo constructed is polled, fast while it
+		 * moves or is off its target and slower and slower while it sits on it,
+		 * all within a share of the link. Call it every loop if you use
+		 * getPolledDegrees(). The planner only keeps to its share once it knows
+		 * the baud: negotiateMaestroBaud() tells it, after Serial1.begin() call
+		 * its setBaud() with the same rate
+		 *
+		 * @return how many positions were read
+		 */
+		static uint8_t pollPositions();
+		static SB_PollPlanner &getPollPlanner() { return pollPlanner; }
+
+		/**
+		 * This servo's position as of its last read by pollPositions(), which
+		 * doesn't wait on the maestro
+		 *
+		 * @param ageUs -- if not nullptr, set to how long ago it was read
+		 * @return the degrees, -1 if it hasn't been read yet
+		 */
+		float getPolledDegrees(uint32_t *ageUs = nullptr);
+
 		/**
 		 * Moves servos at the exact same time  
 		 * THIS METHOD IS UN TESTED AS IT'S NOT ANTICIPATED TO BE USED 4/6/2021... 
@@ -262,8 +512,19 @@ class SB_Servo {
 		 * @param degrees -- the degrees to send to the servos. They match up respectively. For example 
 		 * degrees[0] is where to turn servos[0]  
 		 *
+		 * Nothing is sent if a servo's channel isn't on the maestro or the channels
+		 * aren't contiguous, that servo gets the error bit
+		 * @sets CHANNEL_ERROR_BIT
 		 */
 		static void setMultipleTargets(std::vector<SB_Servo> servos, std::vector<float> degrees);
+
+		/**
+		 * setMultipleTargets() without the vectors, which are on the heap, for
+		 * code that has to stay off it. The servos are passed by pointer
+		 *
+		 * @param count -- how many servos, and degrees, there are
+		 */
+		static void setMultipleTargets(SB_Servo *const *servos, const float *degrees, uint8_t count);
 };
 
 #endif
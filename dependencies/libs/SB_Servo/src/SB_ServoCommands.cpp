@@ -0,0 +1,124 @@
+/**
+ * Source file for SB_ServoCommands.hpp
+ *
+ * AHJ
+ */
+
+#include "SB_ServoCommands.hpp"
+
+SB_ServoCommands::SB_ServoCommands(Stream &port, SB_Servo *const *servos, uint8_t servoCount)
+		: port(port), servos(servos), servoCount(servoCount) {}
+
+int SB_ServoCommands::poll() {
+	int completed = 0;
+	SB_Command command;
+	for (int i = 0; i < COMMAND_POLL_BYTES && port.available() > 0; i++) {
+		int dataByte = port.read();
+		if (dataByte < 0) {
+			break;
+		}
+		if (parser.feed(dataByte, command)) {
+			dispatch(command);
+			completed++;
+		}
+	}
+	return completed;
+}
+
+SB_Servo *SB_ServoCommands::servoAt(const SB_Command &command) {
+	if (command.count < 1 || command.values[0] < 0 || command.values[0] % 100 != 0) {
+		return nullptr;
+	}
+	int32_t index = command.values[0] / 100;
+	return index < servoCount ? servos[index] : nullptr;
+}
+
+void SB_ServoCommands::reject(const SB_Command &command) {
+	rejected++;
+	if (command.binary) {
+		answer('?', command, (uint8_t) command.letter, 0);
+	} else {
+		port.println('?');
+	}
+}
+
+void SB_ServoCommands::answer(char letter, const SB_Command &command, int32_t first, int32_t second) {
+	uint8_t frame[COMMAND_FRAME_BYTES];
+	SB_CommandParser::encodeFrame(frame, letter, command.values[0] / 100, first, second);
+	port.write(frame, COMMAND_FRAME_BYTES);
+}
+
+void SB_ServoCommands::dispatch(const SB_Command &command) {
+	SB_Servo *servo = command.letter == 'd' ? nullptr : servoAt(command);
+	switch (command.letter) {
+		case 't':
+			if (!servo || command.count < 2) {
+				break;
+			}
+			servo->rotateToDegrees(command.values[1] / 100.0f);
+			handled++;
+			return;
+
+		case 's':
+			if (!servo || command.count < 2) {
+				break;
+			}
+			servo->setSlewLimits(command.values[1] / 100.0f, command.count > 2 ? command.values[2] / 100.0f : 0);
+			handled++;
+			return;
+
+		case 'p': {
+			if (!servo) {
+				break;
+			}
+			handled++;
+			uint32_t ageUs;
+			float degrees = servo->getPolledDegrees(&ageUs);
+			int32_t ageMs = ageUs == UINT32_MAX ? -1 : (int32_t) (ageUs / 1000);
+			if (command.binary) {
+				answer('p', command, (int32_t) (degrees * 100 + (degrees < 0 ? -0.5f : 0.5f)), ageMs);
+			} else {
+				port.print("p ");
+				port.print(command.values[0] / 100);
+				port.print(' ');
+				port.print(degrees, 2);
+				port.print(' ');
+				port.println(ageMs);
+			}
+			return;
+		}
+
+		case 'd':
+			handled++;
+			if (command.binary) {
+				answer('d', command, handled, rejected);
+				return;
+			}
+			port.print("commands ");
+			port.print(handled);
+			port.print(" rejected ");
+			port.print(rejected);
+			port.print(" parser errors 0x");
+			port.println(parser.getErrorCode(), HEX);
+			{
+				const SB_TargetMailbox &mailbox = SB_Servo::getTargetMailbox();
+				port.print("targets sent ");
+				port.print(mailbox.getSent());
+				port.print(" conflated ");
+				port.print(mailbox.getConflated());
+				port.print(" max latency us ");
+				port.println(mailbox.getMaxLatencyUs());
+			}
+			for (uint8_t i = 0; i < servoCount; i++) {
+				port.print("servo ");
+				port.print(i);
+				port.print(" errors 0x");
+				port.println(servos[i]->getErrorCode(), HEX);
+			}
+			if (statsHandler) {
+				statsHandler(port);
+			}
+			return;
+	}
+	reject(command);
+}
@@ -0,0 +1,82 @@
+/**
+ * Runs ground station commands on SB_Servos, for SailBot 2021 @ Virginia Tech.
+ *
+ * Call poll() every loop. It reads what has arrived on the port, at most
+ * COMMAND_POLL_BYTES of it so a flood can't hold the loop up either, feeds it
+ * to a SB_CommandParser and carries out each command it completes. Nothing
+ * waits for the rest of a command; half of one stays with the parser until
+ * the next poll().
+ *
+ * Commands, the index being the servo's place in the array given (see
+ * SB_CommandParser for the line and frame forms):
+ * 		t <index> <degrees>            rotateToDegrees()
+ * 		s <index> <deg/s> [<deg/s^2>]  setSlewLimits(), acceleration 0 if left out
+ * 		p <index>                      answers "p <index> <degrees> <age ms>", from getPolledDegrees()
+ * 		d                              answers with the command counts, the target
+ * 		                               mailbox's counts, each servo's error code,
+ * 		                               then the stats handler's output
+ *
+ * Lines are answered with lines and frames with frames: 'p' with the degrees
+ * in hundredths and the reading's age as the values, 'd' with the commands carried out and
+ * rejected. A command that's unknown, is missing values or names a servo that
+ * isn't there is answered "?", or with a '?' frame holding its letter as the
+ * first value.
+ *
+ * No command waits on the maestro. 'p' answers with the servo's last reading by
+ * SB_Servo::pollPositions(), which the sketch calls every loop, -1 degrees and
+ * -1 ms if it hasn't been read yet.
+ *
+ * AHJ
+ */
+
+#ifndef SB_servo_commands
+#define SB_servo_commands
+
+#include "SB_CommandParser.hpp"
+#include "SB_Servo.hpp"
+
+#define COMMAND_POLL_BYTES 64
+
+class SB_ServoCommands {
+	private:
+		Stream &port;
+		SB_Servo *const *servos;
+		uint8_t servoCount;
+		SB_CommandParser parser;
+		void (*statsHandler)(Print &) = nullptr;
+		uint32_t handled = 0;
+		uint32_t rejected = 0;
+
+		SB_Servo *servoAt(const SB_Command &command);
+		void reject(const SB_Command &command);
+		void answer(char letter, const SB_Command &command, int32_t first, int32_t second);
+
+	public:
+		/**
+		 * @param port -- where commands come from and answers go, usually Serial
+		 * @param servos -- the servos commands can name, by index; kept, not copied
+		 */
+		SB_ServoCommands(Stream &port, SB_Servo *const *servos, uint8_t servoCount);
+
+		/**
+		 * Adds to what 'd' prints, for example pwmStatsPrint from main
+		 */
+		void setStatsHandler(void (*handler)(Print &)) { statsHandler = handler; }
+
+		/**
+		 * Reads what has arrived, carrying out any commands it completes
+		 * @return the number of commands completed, carried out or rejected
+		 */
+		int poll();
+
+		/**
+		 * Carries out a command, however it arrived
+		 */
+		void dispatch(const SB_Command &command);
+
+		uint32_t getHandled() const { return handled; }
+		uint32_t getRejected() const { return rejected; }
+		SB_CommandParser &getParser() { return parser; }
+};
+
+#endif
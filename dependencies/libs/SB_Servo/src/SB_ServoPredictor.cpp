@@ -0,0 +1,239 @@
+/**
+ * Source file for SB_ServoPredictor.hpp
+ *
+ * AHJ
+ */
+
+#include "SB_ServoPredictor.hpp"
+
+#include <algorithm>
+#include <stdlib.h>
+
+void SB_ServoPredictor::setModel(const SB_ServoModel &newModel) {
+	model = newModel;
+	rateQ8 = (int64_t) model.rate << 8;
+}
+
+void SB_ServoPredictor::start(uint32_t nowUs, int position) {
+	started = true;
+	delayed.positionQ8 = ahead.positionQ8 = position << 8;
+	delayed.input = ahead.input = position;
+	delayed.timeUs = ahead.timeUs = nowUs;
+	offset = 0;
+	count = 0;
+}
+
+void SB_ServoPredictor::step(Track &track, uint32_t toUs) {
+	// Unsigned, so it's right across the micros() wrap. Times only go forward
+	uint32_t elapsed = toUs - track.timeUs;
+	track.timeUs = toUs;
+	int32_t remaining = (track.input << 8) - track.positionQ8;
+	int64_t moved = rateQ8 * elapsed / 1000000;
+	if (rateQ8 == 0 || moved >= abs(remaining)) {
+		track.positionQ8 = track.input << 8;
+	} else {
+		track.positionQ8 += remaining > 0 ? moved : -moved;
+	}
+}
+
+void SB_ServoPredictor::advance(uint32_t nowUs) {
+	// Everything is measured forward from where the delayed track is up to,
+	// which no target still waiting was sent after
+	uint32_t spanUs = nowUs - delayed.timeUs;
+	// Targets whose dead time is up take over, in the order they were sent
+	while (count) {
+		uint32_t sentAgoUs = delayed.timeUs - history[first].timeUs;
+		if (sentAgoUs < model.delayUs) {
+			uint32_t appliedUs = model.delayUs - sentAgoUs; // after the track's time
+			if (appliedUs > spanUs) {
+				break;
+			}
+			spanUs -= appliedUs;
+			step(delayed, delayed.timeUs + appliedUs);
+		}
+		// else applied before the track's time, a shorter dead time from
+		// setModel(): it takes over from here
+		delayed.input = history[first].target;
+		first = (first + 1) % PREDICTOR_HISTORY;
+		count--;
+	}
+	step(delayed, nowUs);
+	step(ahead, nowUs);
+}
+
+void SB_ServoPredictor::commanded(uint32_t nowUs, int target) {
+	if (!started) {
+		// Nothing to go on, so it's taken to be there already
+		start(nowUs, target);
+	}
+	advance(nowUs);
+	if (count == PREDICTOR_HISTORY) {
+		delayed.input = history[first].target;
+		first = (first + 1) % PREDICTOR_HISTORY;
+		count--;
+		errorCode |= PREDICTOR_HISTORY_BIT;
+	}
+	history[(first + count) % PREDICTOR_HISTORY] = {nowUs, (uint16_t) target};
+	count++;
+	ahead.input = target;
+	addToLog(nowUs, target, 0);
+}
+
+void SB_ServoPredictor::measured(uint32_t nowUs, int position) {
+	if (position == 0) {
+		return; // not pulsing, nothing to learn
+	}
+	if (!started) {
+		start(nowUs, position);
+	}
+	advance(nowUs);
+	offset = position - ((delayed.positionQ8 + 128) >> 8);
+	addToLog(nowUs, ahead.input, position);
+}
+
+int SB_ServoPredictor::estimate(uint32_t nowUs) {
+	if (!started) {
+		return 0;
+	}
+	advance(nowUs);
+	return ((delayed.positionQ8 + 128) >> 8) + offset;
+}
+
+int SB_ServoPredictor::predict(uint32_t nowUs) {
+	if (!started) {
+		return 0;
+	}
+	advance(nowUs);
+	return ((ahead.positionQ8 + 128) >> 8) + offset;
+}
+
+void SB_ServoPredictor::startLog(SB_LagSample *samples, size_t capacity) {
+	log = samples;
+	logCapacity = capacity;
+	logLength = 0;
+}
+
+void SB_ServoPredictor::addToLog(uint32_t timeUs, uint16_t target, uint16_t position) {
+	if (!log) {
+		return;
+	}
+	if (logLength == logCapacity) {
+		errorCode |= PREDICTOR_LOG_FULL_BIT;
+		return;
+	}
+	log[logLength++] = {timeUs, target, position};
+}
+
+/**
+ * One step in a log: the target sent, where the output started from, and the
+ * readings up to the next target
+ */
+struct Step {
+	uint32_t sentUs;
+	int target;
+	int from;
+	size_t begin;
+	size_t end;
+};
+
+/**
+ * Finds the next usable step at or after index
+ * @param position -- the last reading before index, 0 for none, kept up to date
+ * @return false when there are none left
+ */
+static bool nextStep(const SB_LagSample *samples, size_t length, size_t &index, int &position, Step &found) {
+	for (; index < length; index++) {
+		const SB_LagSample &sample = samples[index];
+		if (sample.position) {
+			position = sample.position;
+			continue;
+		}
+		if (position == 0 || abs(sample.target - position) < PREDICTOR_MIN_STEP) {
+			continue;
+		}
+		found = {sample.timeUs, sample.target, position, index + 1, index + 1};
+		while (found.end < length && samples[found.end].position) {
+			found.end++;
+		}
+		index++;
+		return true;
+	}
+	return false;
+}
+
+bool SB_ServoPredictor::identify(const SB_LagSample *samples, size_t length, SB_ServoModel &model) {
+	// Rate: each step's average between its first reading on the move and its
+	// last before arriving, the median of those
+	float rates[PREDICTOR_MAX_STEPS];
+	size_t rateCount = 0;
+	size_t steps = 0;
+	size_t index = 0;
+	int position = 0;
+	Step step;
+	while (nextStep(samples, length, index, position, step)) {
+		steps++;
+		long moving = -1;
+		long lastMoving = -1;
+		for (size_t i = step.begin; i < step.end; i++) {
+			int reading = samples[i].position;
+			if (abs(step.target - reading) <= PREDICTOR_MOVE_THRESHOLD) {
+				break;
+			}
+			if (abs(reading - step.from) > PREDICTOR_MOVE_THRESHOLD) {
+				if (moving < 0) {
+					moving = i;
+				}
+				lastMoving = i;
+			}
+		}
+		if (moving >= 0 && lastMoving > moving && rateCount < PREDICTOR_MAX_STEPS) {
+			const SB_LagSample &a = samples[moving];
+			const SB_LagSample &b = samples[lastMoving];
+			rates[rateCount++] = abs(b.position - a.position) * 1e6f / (b.timeUs - a.timeUs);
+		}
+	}
+	if (steps == 0) {
+		return false;
+	}
+	float rate = 0;
+	if (rateCount) {
+		std::sort(rates, rates + rateCount);
+		rate = rates[rateCount / 2];
+	}
+
+	// Dead time: with a rate, whatever makes the straight line through the
+	// readings on the move fit best; without one, halfway between the last
+	// reading that hadn't moved and the first that had
+	double delaySum = 0;
+	size_t delayCount = 0;
+	index = 0;
+	position = 0;
+	while (nextStep(samples, length, index, position, step)) {
+		uint32_t stillUs = step.sentUs;
+		for (size_t i = step.begin; i < step.end; i++) {
+			const SB_LagSample &sample = samples[i];
+			int moved = abs(sample.position - step.from);
+			if (moved <= PREDICTOR_MOVE_THRESHOLD) {
+				stillUs = sample.timeUs;
+				continue;
+			}
+			if (rate == 0) {
+				delaySum += (stillUs + sample.timeUs) / 2.0 - step.sentUs;
+				delayCount++;
+				break;
+			}
+			if (abs(step.target - sample.position) <= PREDICTOR_MOVE_THRESHOLD) {
+				break;
+			}
+			delaySum += (double) (sample.timeUs - step.sentUs) - moved * 1e6 / rate;
+			delayCount++;
+		}
+	}
+	if (delayCount == 0) {
+		return false;
+	}
+	double delay = delaySum / delayCount;
+	model.delayUs = delay > 0 ? (uint32_t) (delay + .5) : 0;
+	model.rate = (uint32_t) (rate + .5f);
+	return true;
+}
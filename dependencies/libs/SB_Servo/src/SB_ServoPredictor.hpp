@@ -0,0 +1,156 @@
+/**
+ * Predicts where a servo is from what it was told, for SailBot 2021 @ Virginia
+ * Tech.
+ *
+ * A target sent through SB_Servo doesn't move anything straight away: it spends
+ * a few bytes' time on the wire, waits for the Maestro's next 20 ms frame, and
+ * then the output moves no faster than the Maestro's speed setting (or the
+ * servo itself) allows. A control loop closed around getCurrentDegrees() sees
+ * all that as lag and oscillates if its gains are turned up.
+ *
+ * SB_ServoPredictor models the lag as a dead time followed by a rate limit, and
+ * runs the model twice over the targets it's told about: once with the dead
+ * time, for where the servo is now, and once without, for where it will be
+ * once the targets already sent have arrived. That second one is the feedback
+ * a Smith predictor gives the controller, so the controller sees the result of
+ * what it asked for without the dead time in the loop. Each position actually
+ * read corrects both by however far the model was out, so a servo that's
+ * stalled or pushed off by a load still shows up, and nothing needs reading
+ * more often than it did before.
+ *
+ * Identifying the model: hand the predictor a buffer with startLog(), then step
+ * the servo between targets (slew limiting off) while reading its position
+ * every few ms, and pass the log to identify(). The first reading of each step
+ * should be taken straight after the target is sent. getPosition() reports the
+ * pulse the Maestro is sending, not where the horn is, so the servo's own
+ * mechanical lag isn't in the log: if it matters, add it to the dead time and
+ * use the slower of the two rates (the servo's from its data sheet) by hand.
+ *
+ * Positions are the maestro's quarter us, rates quarter us per second. Attach
+ * one to a servo with SB_Servo::setPredictor(), which tells it every target
+ * sent and position read.
+ *
+ * By convention error codes are OR'd into errorCode like SB_Servo's.
+ *
+ * AHJ
+ */
+
+#ifndef SB_servo_predictor
+#define SB_servo_predictor
+
+#include <Arduino.h>
+
+#define PREDICTOR_HISTORY 32     // targets that can be on their way at once
+#define PREDICTOR_MIN_STEP 40    // quarter us, smaller target changes aren't used to identify
+#define PREDICTOR_MOVE_THRESHOLD 8 // quarter us, how far the output has to move to count as moving
+#define PREDICTOR_MAX_STEPS 64 // steps identify() takes the rate from, it uses the first this many
+
+#define PREDICTOR_HISTORY_BIT 0x01 // more targets on their way than PREDICTOR_HISTORY, the oldest was applied early
+#define PREDICTOR_LOG_FULL_BIT 0x02 // the log filled up, later samples weren't logged
+
+/**
+ * The lag model
+ */
+struct SB_ServoModel {
+	uint32_t delayUs = 0; // from the target being sent to the output starting to move
+	uint32_t rate = 0;    // quarter us per second the output moves at, 0 for no limit
+};
+
+/**
+ * A log entry: a target sent (position 0) or a position read, and the target
+ * in effect at the time
+ */
+struct SB_LagSample {
+	uint32_t timeUs;
+	uint16_t target;
+	uint16_t position;
+};
+
+class SB_ServoPredictor {
+	private:
+		/**
+		 * The model run over one input: where it has the output, as of when
+		 */
+		struct Track {
+			int32_t positionQ8 = 0;
+			int32_t input = 0;
+			uint32_t timeUs = 0;
+		};
+
+		struct Sent {
+			uint32_t timeUs;
+			uint16_t target;
+		};
+
+		int errorCode = 0;
+		SB_ServoModel model;
+		int64_t rateQ8 = 0; // model.rate in Q8
+
+		bool started = false;
+		Track delayed; // targets applied after the dead time, where the output is
+		Track ahead;   // targets applied as they're sent, where it's heading
+		int32_t offset = 0; // the last reading less the model's position for it
+
+		// Targets sent and not yet past the dead time, oldest at first
+		Sent history[PREDICTOR_HISTORY];
+		uint8_t first = 0;
+		uint8_t count = 0;
+
+		SB_LagSample *log = nullptr;
+		size_t logCapacity = 0;
+		size_t logLength = 0;
+
+		void step(Track &track, uint32_t toUs);
+		void advance(uint32_t nowUs);
+		void start(uint32_t nowUs, int position);
+		void addToLog(uint32_t timeUs, uint16_t target, uint16_t position);
+
+	public:
+		SB_ServoPredictor() {}
+		SB_ServoPredictor(const SB_ServoModel &model) { setModel(model); }
+
+		void setModel(const SB_ServoModel &model);
+		const SB_ServoModel &getModel() const { return model; }
+
+		/**
+		 * A target was sent at nowUs
+		 * @sets PREDICTOR_HISTORY_BIT
+		 */
+		void commanded(uint32_t nowUs, int target);
+
+		/**
+		 * The position was read at nowUs, corrects the model from it
+		 */
+		void measured(uint32_t nowUs, int position);
+
+		/**
+		 * Where the output is at nowUs, the dead time allowed for. Both are in
+		 * quarter us and 0 until the first target or reading
+		 */
+		int estimate(uint32_t nowUs);
+
+		/**
+		 * Where the output will be once the targets sent by nowUs have had their
+		 * dead time, the Smith predictor's feedback
+		 */
+		int predict(uint32_t nowUs);
+
+		/**
+		 * Logs every target and reading from here on to samples, until it's full
+		 * @sets PREDICTOR_LOG_FULL_BIT
+		 */
+		void startLog(SB_LagSample *samples, size_t capacity);
+		void stopLog() { log = nullptr; }
+		size_t getLogLength() const { return logLength; }
+
+		/**
+		 * Works out the dead time and rate from a log
+		 * @return false if it has no steps to go on, model is left alone
+		 */
+		static bool identify(const SB_LagSample *samples, size_t length, SB_ServoModel &model);
+
+		int getErrorCode() { return errorCode; }
+		void clearErrorCode() { errorCode = 0; }
+};
+
+#endif
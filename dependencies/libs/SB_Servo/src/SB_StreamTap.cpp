@@ -0,0 +1,175 @@
+/**
+ * Source file for SB_StreamTap.hpp
+ *
+ * AHJ
+ */
+
+#include "SB_StreamTap.hpp"
+
+#include <string.h>
+
+static const uint8_t MAGIC[4] = {'S', 'B', 'T', 'P'};
+
+// First byte of an entry: a byte, or a gap
+#define ENTRY_BYTE 0x80
+#define ENTRY_RX 0x40
+#define ENTRY_GAP_MS 0x40
+#define BYTE_GAP_MAX 63
+#define GAP_MAX 16383
+
+static void put32(uint8_t *at, uint32_t value) {
+	for (int i = 0; i < 4; i++) {
+		at[i] = value >> (8 * i);
+	}
+}
+
+static uint32_t get32(const uint8_t *at) {
+	return at[0] | (at[1] << 8) | (at[2] << 16) | ((uint32_t) at[3] << 24);
+}
+
+/**
+ * @return how far an entry moves time on
+ */
+static uint32_t advance(const uint8_t *entry) {
+	if (entry[0] & ENTRY_BYTE) {
+		return entry[0] & BYTE_GAP_MAX;
+	}
+	uint32_t gap = ((entry[0] & 0x3F) << 8) | entry[1];
+	return entry[0] & ENTRY_GAP_MS ? gap * 1000 : gap;
+}
+
+void SB_StreamTap::start(uint8_t *ring, size_t bytes, uint32_t baud) {
+	size_t entryCount = ring ? bytes / TAP_ENTRY_BYTES : 0;
+	entries = (uint8_t (*)[TAP_ENTRY_BYTES]) ring;
+	capacity = entryCount > TAP_MAX_ENTRIES ? TAP_MAX_ENTRIES : entryCount;
+	this->baud = baud;
+	head = 0;
+	count = 0;
+	startUs = lastUs = micros();
+	overwritten = 0;
+	if (capacity == 0) {
+		errorCode |= TAP_BUFFER_BIT;
+		recording = false;
+		return;
+	}
+	recording = true;
+}
+
+void SB_StreamTap::append(uint8_t first, uint8_t second) {
+	if (count == capacity) {
+		// Make room, the time the oldest entry covered goes into the start time
+		startUs += advance(entries[head]);
+		if (entries[head][0] & ENTRY_BYTE) {
+			overwritten++;
+			errorCode |= TAP_OVERWRITE_BIT;
+		}
+		head = (head + 1) % capacity;
+		count--;
+	}
+	uint8_t *entry = entries[(head + count) % capacity];
+	entry[0] = first;
+	entry[1] = second;
+	count++;
+}
+
+void SB_StreamTap::record(uint8_t direction, uint8_t value) {
+	uint32_t now = micros();
+	uint32_t gap = now - lastUs;
+	while (gap > BYTE_GAP_MAX) {
+		if (gap > GAP_MAX) {
+			uint32_t ms = gap / 1000 > GAP_MAX ? GAP_MAX : gap / 1000;
+			append(ENTRY_GAP_MS | (ms >> 8), ms);
+			gap -= ms * 1000;
+		} else {
+			append(gap >> 8, gap);
+			gap = 0;
+		}
+	}
+	append(ENTRY_BYTE | (direction == TAP_RX ? ENTRY_RX : 0) | gap, value);
+	lastUs = now;
+}
+
+int SB_StreamTap::read() {
+	int value = stream.read();
+	if (value >= 0) {
+		bytesRead++;
+		if (recording) {
+			record(TAP_RX, value);
+		}
+	}
+	return value;
+}
+
+size_t SB_StreamTap::write(uint8_t dataByte) {
+	size_t written = stream.write(dataByte);
+	if (written == 1) {
+		bytesWritten++;
+		if (recording) {
+			record(TAP_TX, dataByte);
+		}
+	}
+	return written;
+}
+
+size_t SB_StreamTap::write(const uint8_t *buffer, size_t size) {
+	// One write for the port, so a packet still goes to the UART in one go
+	size_t written = stream.write(buffer, size);
+	bytesWritten += written;
+	if (recording) {
+		for (size_t i = 0; i < written; i++) {
+			record(TAP_TX, buffer[i]);
+		}
+	}
+	return written;
+}
+
+uint32_t SB_StreamTap::getLoggedBytes() const {
+	uint32_t bytes = 0;
+	for (uint16_t i = 0; i < count; i++) {
+		bytes += (entries[(head + i) % capacity][0] & ENTRY_BYTE) != 0;
+	}
+	return bytes;
+}
+
+size_t SB_StreamTap::dump(Print &out) {
+	uint8_t header[TAP_HEADER_BYTES] = {0};
+	memcpy(header, MAGIC, sizeof(MAGIC));
+	header[4] = TAP_VERSION;
+	put32(header + 8, startUs);
+	put32(header + 12, count);
+	put32(header + 16, overwritten);
+	put32(header + 20, baud);
+	size_t written = out.write(header, sizeof(header));
+	if (count == 0) {
+		return written;
+	}
+	// The ring in at most two pieces
+	uint16_t first = count < capacity - head ? count : capacity - head;
+	written += out.write(entries[head], TAP_ENTRY_BYTES * first);
+	written += out.write(entries[0], TAP_ENTRY_BYTES * (count - first));
+	return written;
+}
+
+long SB_StreamTap::decode(const uint8_t *log, size_t length, SB_TapByte *bytes, size_t maxBytes, uint32_t &baud) {
+	if (length < TAP_HEADER_BYTES || memcmp(log, MAGIC, sizeof(MAGIC)) != 0 || log[4] != TAP_VERSION) {
+		return -1;
+	}
+	uint32_t timeUs = get32(log + 8);
+	uint32_t entryCount = get32(log + 12);
+	baud = get32(log + 20);
+	if (length < TAP_HEADER_BYTES + 2 * (size_t) entryCount) {
+		return -1;
+	}
+	long decoded = 0;
+	const uint8_t *entry = log + TAP_HEADER_BYTES;
+	for (uint32_t i = 0; i < entryCount; i++, entry += 2) {
+		timeUs += advance(entry);
+		if (entry[0] & ENTRY_BYTE) {
+			if ((size_t) decoded == maxBytes) {
+				return -1;
+			}
+			bytes[decoded++] = {timeUs, (uint8_t) (entry[0] & ENTRY_RX ? TAP_RX : TAP_TX), entry[1]};
+		}
+	}
+	return decoded;
+}
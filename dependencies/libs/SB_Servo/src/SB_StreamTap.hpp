@@ -0,0 +1,135 @@
+/**
+ * Records the traffic on a Maestro's serial port, for SailBot 2021 @ Virginia
+ * Tech.
+ *
+ * SB_StreamTap is a Stream that sits between a Maestro and its port and passes
+ * everything through, noting each byte written and each byte read, with the
+ * time, in a ring of RAM the caller hands to start(). When the ring is full
+ * the oldest bytes make room, so after an incident it holds the traffic
+ * leading up to it. Until start() it keeps nothing but the byte counts, so a
+ * tap that's never started costs no RAM for a log. dump() writes the
+ * log out (to Serial, say), and on the host SB_TapReplay feeds it to the
+ * Maestro emulator to reproduce what happened and to work out how busy the bus
+ * would have been with a different encoding or batching.
+ *
+ * SB_Servo's Maestro talks through one, SB_Servo::getMaestroTap(), which records
+ * nothing until start() is called. On the host each thread has its own, like
+ * the rest of SB_Servo's shared state.
+ *
+ * Each byte takes 2 bytes of log (TAP_ENTRY_BYTES): a direction bit, up to 63 us since the byte
+ * before, and the byte. Longer gaps add an entry of their own, in us up to
+ * 16383, in ms beyond. Times are when the program wrote or read the byte, a
+ * byte written goes on the wire as soon as the ones ahead of it in the UART
+ * have, a byte read came off it any time since the last read.
+ *
+ * Log layout, numbers little endian:
+ * 		0  "SBTP"
+ * 		4  format version, 1, and 3 bytes of 0
+ * 		8  time before the first entry, micros() (uint32)
+ * 		12 number of entries (uint32)
+ * 		16 bytes the ring overwrote (uint32)
+ * 		20 baud, 0 if start() wasn't told (uint32)
+ * 		24 entries, 2 bytes each, oldest first
+ *
+ * By convention error codes are OR'd into errorCode like SB_Servo's.
+ *
+ * AHJ
+ */
+
+#ifndef SB_stream_tap
+#define SB_stream_tap
+
+#include <Arduino.h>
+
+#define TAP_ENTRY_BYTES 2
+#define TAP_MAX_ENTRIES 65535 // the most of a ring start() uses, 128 KB
+#define TAP_HEADER_BYTES 24
+#define TAP_VERSION 1
+
+#define TAP_TX 0 // written to the Maestro
+#define TAP_RX 1 // read from it
+
+#define TAP_OVERWRITE_BIT 0x01 // the ring was full, the oldest bytes were lost
+#define TAP_BUFFER_BIT 0x02    // start() was given no room for a single entry, nothing is recorded
+
+/**
+ * One decoded byte
+ */
+struct SB_TapByte {
+	uint32_t timeUs;
+	uint8_t direction;
+	uint8_t value;
+};
+
+class SB_StreamTap : public Stream {
+	private:
+		Stream &stream;
+		int errorCode = 0;
+		bool recording = false;
+		uint32_t baud = 0;
+
+		uint8_t (*entries)[TAP_ENTRY_BYTES] = nullptr;
+		uint16_t capacity = 0;
+		uint16_t head = 0; // the oldest entry
+		uint16_t count = 0;
+		uint32_t startUs = 0; // time before the oldest entry
+		uint32_t lastUs = 0;  // time of the newest entry
+
+		uint32_t bytesWritten = 0;
+		uint32_t bytesRead = 0;
+		uint32_t overwritten = 0;
+
+		void append(uint8_t first, uint8_t second);
+		void record(uint8_t direction, uint8_t value);
+
+	public:
+		explicit SB_StreamTap(Stream &stream) : stream(stream) {}
+
+		/**
+		 * Clears the log and starts recording into ring, which has to stay
+		 * around until the log has been dumped. 8 KB holds about 0.4 s of a
+		 * saturated 115200 baud link both ways
+		 * @param ring, bytes -- the room for the log, TAP_ENTRY_BYTES an entry
+		 * @param baud -- the port's baud, kept in the log for the replay
+		 * @sets TAP_BUFFER_BIT
+		 */
+		void start(uint8_t *ring, size_t bytes, uint32_t baud = 0);
+		void stop() { recording = false; }
+		bool isRecording() const { return recording; }
+
+		int available() override { return stream.available(); }
+		int peek() override { return stream.peek(); }
+		int read() override;
+		size_t write(uint8_t dataByte) override;
+		size_t write(const uint8_t *buffer, size_t size) override;
+		using Print::write;
+		void flush() override { stream.flush(); }
+
+		/**
+		 * Writes the log, see the layout above. Call stop() first if the
+		 * port is busy, or what's written is what was there at the start
+		 * @return the bytes written
+		 */
+		size_t dump(Print &out);
+
+		/**
+		 * @return the bytes in the log, for sizing decode()'s buffer
+		 */
+		uint32_t getLoggedBytes() const;
+		uint32_t getBytesWritten() const { return bytesWritten; }
+		uint32_t getBytesRead() const { return bytesRead; }
+		uint32_t getOverwritten() const { return overwritten; }
+
+		int getErrorCode() { return errorCode; }
+		void clearErrorCode() { errorCode = 0; }
+
+		/**
+		 * Decodes a log as written by dump()
+		 * @param bytes -- room for maxBytes, the log's entry count is always enough
+		 * @param baud -- the baud from the log goes here
+		 * @return the number of bytes decoded, -1 if it isn't a valid log
+		 */
+		static long decode(const uint8_t *log, size_t length, SB_TapByte *bytes, size_t maxBytes, uint32_t &baud);
+};
+
+#endif
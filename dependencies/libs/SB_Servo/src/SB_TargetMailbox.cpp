@@ -0,0 +1,112 @@
+/**
+ * Source file for SB_TargetMailbox.hpp
+ *
+ * AHJ
+ */
+
+#include "SB_TargetMailbox.hpp"
+
+SB_TargetMailbox::SB_TargetMailbox(MiniMaestro &maestro, uint32_t baud, uint8_t overheadBytes) :
+		maestro(maestro),
+		packetBytes(MAILBOX_TARGET_BYTES + overheadBytes) {
+	setBaud(baud);
+}
+
+void SB_TargetMailbox::setBaud(uint32_t baud) {
+	byteTimeUs = baud ? (10000000 + baud - 1) / baud : 0; // 10 bits a byte, 8N1
+}
+
+bool SB_TargetMailbox::hasRoom(uint32_t nowUs) const {
+	if (byteTimeUs == 0) {
+		// No baud, straight out whatever was written before
+		return true;
+	}
+	int32_t backlogUs = (int32_t) (txDoneUs - nowUs);
+	if (backlogUs < 0) {
+		backlogUs = 0;
+	}
+	return (uint32_t) backlogUs + packetBytes * byteTimeUs <= backlogBytes * byteTimeUs;
+}
+
+void SB_TargetMailbox::sendNext(uint32_t nowUs) {
+	uint8_t channel = line[first];
+	first = (first + 1) % MAILBOX_MAX_CHANNELS;
+	count--;
+	queued[channel] = false;
+	if (!pending[channel]) {
+		// Withdrawn since it was posted
+		return;
+	}
+	pending[channel] = false;
+	pendingCount--;
+
+	maestro.setTarget(channel, targets[channel]);
+	if ((int32_t) (nowUs - txDoneUs) > 0) {
+		txDoneUs = nowUs;
+	}
+	txDoneUs += packetBytes * byteTimeUs;
+
+	uint32_t latencyUs = nowUs - postedUs[channel];
+	if (latencyUs > maxLatencyUs) {
+		maxLatencyUs = latencyUs;
+	}
+	totalLatencyUs += latencyUs;
+	sent++;
+}
+
+void SB_TargetMailbox::post(uint8_t channel, uint16_t target) {
+	if (channel >= MAILBOX_MAX_CHANNELS) {
+		errorCode |= MAILBOX_CHANNEL_ERROR_BIT;
+		return;
+	}
+	uint32_t now = micros();
+	posted++;
+	if (pending[channel]) {
+		conflated++;
+		channelConflated[channel]++;
+	} else {
+		pending[channel] = true;
+		pendingCount++;
+		if (!queued[channel]) {
+			line[(first + count) % MAILBOX_MAX_CHANNELS] = channel;
+			count++;
+			queued[channel] = true;
+		}
+	}
+	targets[channel] = target;
+	postedUs[channel] = now;
+	update();
+}
+
+void SB_TargetMailbox::update() {
+	uint32_t now = micros();
+	while (count > 0 && hasRoom(now)) {
+		sendNext(now);
+	}
+}
+
+void SB_TargetMailbox::flush() {
+	uint32_t now = micros();
+	while (count > 0) {
+		sendNext(now);
+	}
+}
+
+void SB_TargetMailbox::withdraw(uint8_t channel) {
+	if (channel < MAILBOX_MAX_CHANNELS && pending[channel]) {
+		pending[channel] = false;
+		pendingCount--;
+	}
+}
+
+void SB_TargetMailbox::written(uint8_t bytes) {
+	uint32_t now = micros();
+	if ((int32_t) (now - txDoneUs) > 0) {
+		txDoneUs = now;
+	}
+	txDoneUs += bytes * byteTimeUs;
+}
+
+void SB_TargetMailbox::lineClear() {
+	txDoneUs = micros();
+}
@@ -0,0 +1,158 @@
+/**
+ * Latest-value-wins target sending for SailBot 2021 @ Virginia Tech.
+ *
+ * A setTarget() takes 4 bytes' time on the wire, 4.2 ms at 9600 baud. A control
+ * loop setting a few servos every millisecond asks for more than that, and
+ * every target it writes waits in the UART behind the ones before it, so the
+ * Maestro works through targets that get older and older while the newest
+ * ones pile up behind them.
+ *
+ * SB_TargetMailbox keeps one slot per channel instead. post() puts a target in
+ * its channel's slot, replacing one that hasn't gone out yet, and the slots are
+ * only written to the port while the line has room: no more than the backlog
+ * (two compact setTargets by default) waiting in the UART. A channel keeps its
+ * place in line when its target is replaced, so every channel gets its turn and
+ * a target is never older than one round of the waiting channels plus the
+ * backlog when it goes out, however far the loop outruns the link.
+ *
+ * Whether the line has room is worked out from the baud and what the mailbox
+ * has written, the same way SB_FrameDispatcher times its batches. Anything else
+ * written to the port can be accounted with written(), and lineClear() says
+ * the line is idle, e.g. once a query has been answered. With a baud of 0 (the
+ * default) targets go straight out, as if there were no mailbox.
+ *
+ * Call update() every loop to send what's waiting as room comes up.
+ *
+ * By convention error codes are OR'd into errorCode like SB_Servo's.
+ *
+ * AHJ
+ */
+
+#ifndef SB_target_mailbox
+#define SB_target_mailbox
+
+#include <PololuMaestro.h>
+#include "SB_MaestroModel.hpp"
+
+#define MAILBOX_MAX_CHANNELS MAESTRO_MAX_CHANNELS
+#define MAILBOX_TARGET_BYTES 4          // a compact protocol setTarget
+#define MAILBOX_DEFAULT_BACKLOG_BYTES 8 // how much may wait in the UART, two setTargets
+
+#define MAILBOX_CHANNEL_ERROR_BIT 0x01 // a target for a channel past MAILBOX_MAX_CHANNELS, it was dropped
+
+class SB_TargetMailbox {
+	private:
+		MiniMaestro &maestro;
+		uint32_t byteTimeUs = 0;
+		uint8_t packetBytes;
+		uint8_t backlogBytes = MAILBOX_DEFAULT_BACKLOG_BYTES;
+		uint32_t txDoneUs = 0; // when what's been written should be off the wire
+
+		int errorCode = 0;
+
+		// The slots, and when the target in each was posted
+		uint16_t targets[MAILBOX_MAX_CHANNELS];
+		uint32_t postedUs[MAILBOX_MAX_CHANNELS];
+		bool pending[MAILBOX_MAX_CHANNELS] = {false};
+		bool queued[MAILBOX_MAX_CHANNELS] = {false}; // in the line below, even if withdrawn since
+
+		// Channels in the order they'll go out, each at most once
+		uint8_t line[MAILBOX_MAX_CHANNELS];
+		uint8_t first = 0;
+		uint8_t count = 0;
+		uint8_t pendingCount = 0;
+
+		uint32_t posted = 0;
+		uint32_t sent = 0;
+		uint32_t conflated = 0;
+		uint32_t channelConflated[MAILBOX_MAX_CHANNELS] = {0};
+		uint32_t maxLatencyUs = 0;
+		uint64_t totalLatencyUs = 0;
+
+		/**
+		 * Whether another target fits in the UART at nowUs
+		 */
+		bool hasRoom(uint32_t nowUs) const;
+
+		/**
+		 * Writes the next waiting channel's target, if any is still waiting
+		 */
+		void sendNext(uint32_t nowUs);
+
+	public:
+		/**
+		 * @param maestro -- where targets go
+		 * @param baud -- the serial link's baud rate, 0 to send every target straight away
+		 * @param overheadBytes -- bytes each command carries besides its own: 0 for the compact
+		 * protocol, 2 for the Pololu protocol, one more with CRC enabled
+		 */
+		SB_TargetMailbox(MiniMaestro &maestro, uint32_t baud = 0, uint8_t overheadBytes = 0);
+
+		/**
+		 * Puts a target in its channel's slot, replacing one not sent yet, and
+		 * sends it if the line has room
+		 * @sets MAILBOX_CHANNEL_ERROR_BIT
+		 */
+		void post(uint8_t channel, uint16_t target);
+
+		/**
+		 * Sends waiting targets while the line has room. Call it every loop
+		 */
+		void update();
+
+		/**
+		 * Sends every waiting target now, room or not
+		 */
+		void flush();
+
+		/**
+		 * Drops a channel's waiting target, for when it's been set another way
+		 */
+		void withdraw(uint8_t channel);
+
+		/**
+		 * Other bytes were written to the port, they're ahead of the next target
+		 */
+		void written(uint8_t bytes);
+
+		/**
+		 * The line is idle: everything written has gone out, e.g. a query sent
+		 * after it has been answered
+		 */
+		void lineClear();
+
+		void setBaud(uint32_t baud);
+		uint32_t getByteTimeUs() const { return byteTimeUs; }
+
+		/**
+		 * How many bytes may wait in the UART, at least one target's worth
+		 */
+		void setBacklog(uint8_t bytes) { backlogBytes = bytes > packetBytes ? bytes : packetBytes; }
+
+		bool isPending(uint8_t channel) const { return channel < MAILBOX_MAX_CHANNELS && pending[channel]; }
+		uint8_t getPendingCount() const { return pendingCount; }
+
+		uint32_t getPosted() const { return posted; }
+		uint32_t getSent() const { return sent; }
+
+		/**
+		 * Targets replaced by a newer one for the same channel before they were
+		 * sent, in all and for one channel
+		 */
+		uint32_t getConflated() const { return conflated; }
+		uint32_t getConflated(uint8_t channel) const {
+			return channel < MAILBOX_MAX_CHANNELS ? channelConflated[channel] : 0;
+		}
+
+		/**
+		 * From a sent target being posted to it being written, the longest and
+		 * the average
+		 */
+		uint32_t getMaxLatencyUs() const { return maxLatencyUs; }
+		float getAverageLatencyUs() const { return sent ? (float) totalLatencyUs / sent : 0; }
+
+		int getErrorCode() { return errorCode; }
+		void clearErrorCode() { errorCode = 0; }
+};
+
+#endif
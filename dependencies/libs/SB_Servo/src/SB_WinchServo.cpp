@@ -0,0 +1,244 @@
+/**
+ * Source file for SB_WinchServo.hpp
+ *
+ * AHJ
+ */
+
+#include "SB_WinchServo.hpp"
+
+SB_WinchServo::SB_WinchServo(int channel) :
+	SB_WinchServo(WINCH_MULTI_TURN, DEFAULT_WINCH_MIN_US, DEFAULT_WINCH_MAX_US, DEFAULT_WINCH_TURNS,
+			DEFAULT_WINCH_TURNS_PER_SECOND, DEFAULT_DRUM_CIRCUMFERENCE_MM, channel) {}
+
+SB_WinchServo::SB_WinchServo(WinchMode winchMode, int minimumUS, int maximumUS, float turns,
+	float rate, float circumference, int channel) :
+		mode(winchMode),
+		minUS(4 * minimumUS), // the maestro uses 4x us, see SB_Servo
+		maxUS(4 * maximumUS),
+		maxTurns(turns),
+		turnsPerSecond(rate),
+		drumCircumference(circumference),
+		channelNum(channel) {
+
+	checkUS();
+	checkTurns();
+	checkDrum();
+	checkChannel();
+	lastUpdateUs = micros();
+}
+
+void SB_WinchServo::checkUS() {
+	if (minUS < 0 || maxUS <= minUS) {
+		errorCode |= US_ERROR_BIT;
+	}
+}
+
+void SB_WinchServo::checkTurns() {
+	if (maxTurns <= 0 || turnsPerSecond <= 0) {
+		errorCode |= TURNS_ERROR_BIT;
+	}
+}
+
+void SB_WinchServo::checkDrum() {
+	if (drumCircumference <= 0) {
+		errorCode |= DRUM_ERROR_BIT;
+	}
+}
+
+void SB_WinchServo::checkChannel() {
+	if (!SB_Servo::getMaestroModel().hasChannel(channelNum)) {
+		errorCode |= CHANNEL_ERROR_BIT;
+	}
+}
+
+float SB_WinchServo::clampTurns(float turns) {
+	if (turns > maxTurns) {
+		errorCode |= ROTATE_TO_OVER_ERROR_BIT;
+		return maxTurns;
+	} else if (turns < 0) {
+		errorCode |= ROTATE_TO_UNDER_ERROR_BIT;
+		return 0;
+	}
+	return turns;
+}
+
+int SB_WinchServo::turnsToUS(float turns) {
+	return (int) ((float) (maxUS - minUS) / maxTurns * turns + minUS + 0.5f);
+}
+
+int SB_WinchServo::speedToUS(float rate) {
+	int neutral = (minUS + maxUS) / 2;
+	float halfRange = (maxUS - minUS) / 2.0f;
+	rate = constrain(rate, -turnsPerSecond, turnsPerSecond);
+	return neutral + (int) lroundf(rate / turnsPerSecond * halfRange);
+}
+
+float SB_WinchServo::usToSpeed(int us) {
+	int neutral = (minUS + maxUS) / 2;
+	return (us - neutral) * turnsPerSecond / ((maxUS - minUS) / 2.0f);
+}
+
+void SB_WinchServo::integrate(uint32_t nowUs) {
+	float seconds = (uint32_t) (nowUs - lastUpdateUs) / 1e6f;
+	lastUpdateUs = nowUs;
+	if (speed == 0) {
+		return;
+	}
+
+	float moved = speed * seconds;
+	if (mode == WINCH_MULTI_TURN) {
+		// The servo's own position loop stops it at the target
+		float remaining = targetTurns - estimatedTurns;
+		if (remaining >= 0 ? moved >= remaining : moved <= remaining) {
+			estimatedTurns = targetTurns;
+			speed = 0;
+			return;
+		}
+	}
+	// A continuous winch keeps turning until update() sends it a new speed
+	estimatedTurns += moved;
+
+	// A continuous winch at a fixed speed runs until the end of its travel
+	if (estimatedTurns >= maxTurns && speed > 0) {
+		estimatedTurns = maxTurns;
+		halt();
+	} else if (estimatedTurns <= 0 && speed < 0) {
+		estimatedTurns = 0;
+		halt();
+	}
+}
+
+float SB_WinchServo::approachSpeed() {
+	// Full speed, then proportionally slower over the last WINCH_SLOWDOWN_TURNS
+	float fraction = constrain((targetTurns - estimatedTurns) / WINCH_SLOWDOWN_TURNS, -1.0f, 1.0f);
+	return roundf(fraction * WINCH_SPEED_STEPS) / WINCH_SPEED_STEPS * turnsPerSecond;
+}
+
+void SB_WinchServo::sendUS(int us) {
+	if (errorCode & CHANNEL_ERROR_BIT) {
+		return;
+	}
+	if (us != commandedUS) {
+		SB_Servo::targetMailbox.post(channelNum, us);
+		commandedUS = us;
+	}
+}
+
+void SB_WinchServo::setLineLength(float mm) {
+	setTurns(mm / drumCircumference);
+}
+
+int SB_WinchServo::retarget(float turns) {
+	targetTurns = clampTurns(turns);
+	if (mode == WINCH_MULTI_TURN) {
+		speed = targetTurns == estimatedTurns ? 0
+			: targetTurns > estimatedTurns ? turnsPerSecond : -turnsPerSecond;
+		return turnsToUS(targetTurns);
+	}
+	driving = true;
+	int us = speedToUS(approachSpeed());
+	speed = usToSpeed(us);
+	return us;
+}
+
+void SB_WinchServo::setTurns(float turns) {
+	integrate(micros());
+	sendUS(retarget(turns));
+}
+
+void SB_WinchServo::setSpeed(float rate) {
+	if (mode != WINCH_CONTINUOUS) {
+		return;
+	}
+	integrate(micros());
+	driving = false;
+	int us = speedToUS(rate);
+	sendUS(us);
+	speed = usToSpeed(us);
+}
+
+void SB_WinchServo::stop() {
+	integrate(micros());
+	halt();
+}
+
+void SB_WinchServo::halt() {
+	driving = false;
+	speed = 0;
+	targetTurns = estimatedTurns;
+	if (mode == WINCH_MULTI_TURN) {
+		sendUS(turnsToUS(estimatedTurns));
+	} else {
+		sendUS(speedToUS(0));
+	}
+}
+
+void SB_WinchServo::update() {
+	SB_Servo::targetMailbox.update();
+	integrate(micros());
+	if (mode == WINCH_CONTINUOUS && driving) {
+		int us = speedToUS(approachSpeed());
+		sendUS(us);
+		speed = usToSpeed(us);
+		if (speed == 0) {
+			driving = false;
+		}
+	}
+}
+
+void SB_WinchServo::zeroTurns(float turns) {
+	integrate(micros());
+	estimatedTurns = turns;
+	if (mode == WINCH_MULTI_TURN) {
+		// Whatever was last commanded is where it's heading from here
+		targetTurns = estimatedTurns;
+		speed = 0;
+	}
+}
+
+int SB_WinchServo::getTurnCount() const {
+	return (int) floorf(estimatedTurns);
+}
+
+int SB_WinchServo::getErrorCode() {
+	return errorCode;
+}
+
+void SB_WinchServo::clearErrorCode() {
+	errorCode = 0;
+}
+
+void SB_WinchServo::setMultipleTargets(std::vector<SB_WinchServo *> winches, std::vector<float> lengths) {
+	if (winches.empty() || lengths.size() < winches.size() || winches.size() > NUM_MAESTRO_CHANNELS) {
+		return;
+	}
+	setMultipleTargets(winches.data(), lengths.data(), winches.size());
+}
+
+void SB_WinchServo::setMultipleTargets(SB_WinchServo *const *winches, const float *lengths, uint8_t count) {
+	if (count == 0 || count > NUM_MAESTRO_CHANNELS) {
+		return;
+	}
+	// Need to make sure the channels are on the maestro and contiguous
+	for (uint8_t i = 0; i < count; i++) {
+		if (!SB_Servo::getMaestroModel().hasChannel(winches[i]->channelNum)
+			|| (i + 1 < count && winches[i]->channelNum + 1 != winches[i + 1]->channelNum)) {
+			winches[i]->errorCode |= CHANNEL_ERROR_BIT;
+			return;
+		}
+	}
+
+	uint16_t targets[NUM_MAESTRO_CHANNELS];
+	uint32_t now = micros();
+	for (uint8_t i = 0; i < count; i++) {
+		SB_WinchServo &winch = *winches[i];
+		winch.integrate(now);
+		winch.commandedUS = winch.retarget(lengths[i] / winch.drumCircumference);
+		targets[i] = winch.commandedUS;
+		// A target still waiting would undo this one
+		SB_Servo::targetMailbox.withdraw(winch.channelNum);
+	}
+	SB_Servo::movingStateValid = false;
+	SB_Servo::targetMailbox.written(
+		SB_Servo::getMaestroModel().setTargets(SB_Servo::maestro, count, winches[0]->channelNum, targets));
+}
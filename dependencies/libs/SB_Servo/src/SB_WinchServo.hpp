@@ -0,0 +1,251 @@
+/**
+ * A sail winch servo for SailBot 2021 @ Virginia Tech.
+ *
+ * SB_Servo covers servos that sweep a bounded 0-360 degree arc. A winch drum
+ * turns many times, and what we care about is how much line is let out, so
+ * this class works in turns of the drum and millimetres of line instead of
+ * degrees. Two kinds of winch servo are supported:
+ *
+ * 		WINCH_MULTI_TURN  -- e.g. the HS-785HB, the pulse width sets the drum
+ * 		                     position across its whole travel (3.5 turns for 600-2400 us)
+ * 		WINCH_CONTINUOUS  -- a continuous rotation servo, the pulse width sets the
+ * 		                     speed and direction, the midpoint stops it
+ *
+ * Neither kind can tell us where the drum really is: a multi-turn servo only
+ * reports its commanded pulse and a continuous one doesn't know its position
+ * at all. So the position is estimated by integrating the commanded speed over
+ * time in update(), and nothing is read back from the Maestro. Call update()
+ * from loop() as often as you like, it only writes to the Maestro when a
+ * continuous winch needs a new speed. zeroTurns() re-homes the estimate, e.g.
+ * when the sail is sheeted all the way in against its stop.
+ *
+ * Winches send through SB_Servo's maestro and target mailbox, so their traffic
+ * is in its tap and counted in the mailbox's link budget. update() also sends
+ * whatever the mailbox has waiting, like SB_Servo::update().
+ *
+ * Error reporting is the same as SB_Servo: bits are OR'd into an error code,
+ * check it with getErrorCode().
+ *
+ * AHJ
+ */
+
+#ifndef SB_winch_servo
+#define SB_winch_servo
+
+#include <SB_Servo.hpp> // US_ERROR_BIT, CHANNEL_ERROR_BIT, ROTATE_TO_*, NUM_MAESTRO_CHANNELS and the maestro model
+
+/**
+ * Winch specific error codes, these carry on from the SB_Servo ones so a winch
+ * and a servo's codes can be OR'd together and still be told apart
+ */
+#define TURNS_ERROR_BIT 0x40 // the travel in turns or the turn rate doesn't make sense
+#define DRUM_ERROR_BIT 0x80  // the drum circumference doesn't make sense
+
+/**
+ * Defaults are the HS-785HB winch servo on a 40 mm drum:
+ * 3.5 turns over 600-2400 us, roughly 1.4 s per turn unloaded
+ */
+#define DEFAULT_WINCH_MIN_US 600
+#define DEFAULT_WINCH_MAX_US 2400
+#define DEFAULT_WINCH_TURNS 3.5f
+#define DEFAULT_WINCH_TURNS_PER_SECOND 0.7f
+#define DEFAULT_DRUM_CIRCUMFERENCE_MM 125.7f
+
+/**
+ * A continuous winch slows down over the last WINCH_SLOWDOWN_TURNS before its
+ * target, in WINCH_SPEED_STEPS steps of speed so it sends a handful of pulse
+ * updates rather than one every loop. It stops once the slowest step would
+ * overshoot, within WINCH_SLOWDOWN_TURNS / WINCH_SPEED_STEPS / 2 of the target
+ */
+#define WINCH_SLOWDOWN_TURNS 0.25f
+#define WINCH_SPEED_STEPS 8
+
+enum WinchMode {
+	WINCH_MULTI_TURN,
+	WINCH_CONTINUOUS
+};
+
+class SB_WinchServo {
+	private:
+		int errorCode = 0;
+
+		const WinchMode mode;
+
+		// Quarter microseconds like SB_Servo. For a continuous winch minUS is full
+		// speed taking line in and maxUS full speed letting it out
+		const int minUS;
+		const int maxUS;
+
+		const float maxTurns;          // the travel, or line capacity, in turns of the drum
+		const float turnsPerSecond;    // how fast the drum turns at full speed
+		const float drumCircumference; // mm of line per turn
+
+		const int channelNum;
+
+		float estimatedTurns = 0;
+		float targetTurns = 0;
+		float speed = 0;          // turns per second the drum is believed to be turning, signed
+		int commandedUS = 0;      // the last pulse sent, 0 before the first
+		uint32_t lastUpdateUs = 0;
+		bool driving = false;     // a continuous winch heading for targetTurns
+
+		/**
+		 * The configuration checks, same idea as the SB_Servo ones
+		 * @sets US_ERROR_BIT
+		 * @sets TURNS_ERROR_BIT
+		 * @sets DRUM_ERROR_BIT
+		 * @sets CHANNEL_ERROR_BIT
+		 */
+		void checkUS();
+		void checkTurns();
+		void checkDrum();
+		void checkChannel();
+
+		/**
+		 * Clamps turns into the travel
+		 * @sets ROTATE_TO_UNDER_ERROR_BIT
+		 * @sets ROTATE_TO_OVER_ERROR_BIT
+		 */
+		float clampTurns(float turns);
+
+		/**
+		 * The pulse for a drum position (multi-turn) or speed (continuous)
+		 */
+		int turnsToUS(float turns);
+		int speedToUS(float turnsPerSecond);
+
+		/**
+		 * The speed a continuous winch actually gets for a pulse, after rounding
+		 */
+		float usToSpeed(int us);
+
+		/**
+		 * Advances the estimate to now at the current speed
+		 */
+		void integrate(uint32_t nowUs);
+
+		/**
+		 * stop() without bringing the estimate up to now first, for integrate()
+		 * to stop at the ends of the travel
+		 */
+		void halt();
+
+		/**
+		 * The speed a continuous winch should be doing to reach its target
+		 */
+		float approachSpeed();
+
+		/**
+		 * Sets a new target and the speed towards it
+		 * @return the pulse to send
+		 * @sets ROTATE_TO_UNDER_ERROR_BIT
+		 * @sets ROTATE_TO_OVER_ERROR_BIT
+		 */
+		int retarget(float turns);
+
+		/**
+		 * Sends a pulse unless it's the one already sent
+		 */
+		void sendUS(int us);
+
+	public:
+		/**
+		 * A multi-turn winch with the default HS-785HB values
+		 * @param channel -- the Maestro channel the winch is plugged into
+		 */
+		SB_WinchServo(int channel);
+
+		/**
+		 * Big fat constructor
+		 *
+		 * @param mode -- WINCH_MULTI_TURN or WINCH_CONTINUOUS
+		 * @param minUS -- the pulse at 0 turns (multi-turn) or full speed reeling in (continuous)
+		 * @param maxUS -- the pulse at maxTurns (multi-turn) or full speed letting out (continuous)
+		 * @param maxTurns -- how many turns of line the drum can let out
+		 * @param turnsPerSecond -- how fast the drum turns at full speed, found experimentally
+		 * @param drumCircumference -- mm of line per turn of the drum
+		 * @param channel -- the Maestro channel the winch is plugged into
+		 */
+		SB_WinchServo(WinchMode mode, int minUS, int maxUS, float maxTurns,
+				float turnsPerSecond, float drumCircumference, int channel);
+
+		/**
+		 * Lets line out (or takes it in) to a length, 0 being all the way in
+		 * @param mm -- the length of line to have out
+		 * @sets ROTATE_TO_UNDER_ERROR_BIT
+		 * @sets ROTATE_TO_OVER_ERROR_BIT
+		 */
+		void setLineLength(float mm);
+
+		/**
+		 * The same as setLineLength() in turns of the drum
+		 * @sets ROTATE_TO_UNDER_ERROR_BIT
+		 * @sets ROTATE_TO_OVER_ERROR_BIT
+		 */
+		void setTurns(float turns);
+
+		/**
+		 * Turns a continuous winch at a fixed speed until told otherwise (or it
+		 * runs out of travel). Does nothing for a multi-turn winch
+		 * @param turnsPerSecond -- positive lets line out, negative takes it in
+		 */
+		void setSpeed(float turnsPerSecond);
+
+		/**
+		 * Stops where it's believed to be
+		 */
+		void stop();
+
+		/**
+		 * Brings the position estimate up to now and, for a continuous winch,
+		 * sends a new speed if it needs one. Call it every loop
+		 */
+		void update();
+
+		/**
+		 * Tells the winch where it really is, e.g. at a limit switch
+		 */
+		void zeroTurns(float turns = 0);
+
+		/**
+		 * The estimated drum position, in turns since zero
+		 */
+		float getTurns() const { return estimatedTurns; }
+
+		/**
+		 * Whole turns since zero, the fractional part dropped
+		 */
+		int getTurnCount() const;
+		float getTargetTurns() const { return targetTurns; }
+		float getLineLength() const { return estimatedTurns * drumCircumference; }
+		float getTargetLineLength() const { return targetTurns * drumCircumference; }
+		float getSpeed() const { return speed; }
+		bool isMoving() const { return speed != 0; }
+
+		int getErrorCode();
+		void clearErrorCode();
+
+		/**
+		 * Sends every winch its line length in one Maestro command (one write of
+		 * back to back setTargets on a model without setMultiTarget), the winches
+		 * need contiguous channel numbers like SB_Servo::setMultipleTargets().
+		 * Unlike the SB_Servo version they're passed by pointer, a winch keeps
+		 * track of where it is and copies would lose that
+		 *
+		 * @param winches -- the winches to move
+		 * @param lengths -- mm of line for each, lengths[0] goes to winches[0]
+		 * @sets ROTATE_TO_UNDER_ERROR_BIT
+		 * @sets ROTATE_TO_OVER_ERROR_BIT
+		 * @sets CHANNEL_ERROR_BIT
+		 */
+		static void setMultipleTargets(std::vector<SB_WinchServo *> winches, std::vector<float> lengths);
+
+		/**
+		 * The same without the vectors, which are on the heap
+		 *
+		 * @param count -- how many winches, and lengths, there are
+		 */
+		static void setMultipleTargets(SB_WinchServo *const *winches, const float *lengths, uint8_t count);
+};
+
+#endif
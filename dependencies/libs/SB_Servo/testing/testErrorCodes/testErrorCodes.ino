@@ -49,7 +49,7 @@ void loop() {
     SB_Servo angleUnderRange(500, 2500, 50, 200, 40, 200, 0); 
   	SB_Servo angleOverRange(500, 2500, 0, 200, 3, 250, 0); 
   	SB_Servo angleOutOfBounds(500, 2500, 50, 150, 0, 200, 0); 
-  	SB_Servo badChannelNum(500, 2500, 0, 200, 3, 200, 9);  // bad channel number
+  	SB_Servo badChannelNum(500, 2500, 0, 200, 3, 200, 24);  // bad channel number, no maestro has a 25th
 		
     
   	Serial.print("Expected error code for negative minimum us: ");
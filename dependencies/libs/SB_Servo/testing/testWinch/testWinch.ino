@@ -0,0 +1,88 @@
+/**
+ * Tests the sail winch: a multi-turn winch on channel 2 and a continuous
+ * rotation winch on channel 3.
+ * Lets line out and takes it in, calling update() every loop, and prints where
+ * each winch believes it is against where it was sent. Watch the drums to
+ * check the estimates, then the line lengths and turn counts should match
+ * what you see (mark the drums with tape).
+ *
+ * AHJ
+ */
+#include <SB_WinchServo.hpp>
+
+// HS-785HB on a 40 mm drum, the defaults
+SB_WinchServo sheet(2);
+// A continuous servo, 1.5 turns a second flat out, 10 turns of line on a 30 mm drum
+SB_WinchServo reel(WINCH_CONTINUOUS, 1000, 2000, 10, 1.5, 94.2, 3);
+
+// Line lengths to step through, in mm
+float lengths[] = {0, 200, 400, 100, 300, 0};
+int step = 0;
+unsigned long stepStart = 0;
+bool loopOnce = true;
+
+void printWinch(const char *name, SB_WinchServo &winch) {
+	Serial.print(name);
+	Serial.print(" expected length: ");
+	Serial.print(winch.getTargetLineLength());
+	Serial.print(" estimated: ");
+	Serial.print(winch.getLineLength());
+	Serial.print(" turns: ");
+	Serial.print(winch.getTurns());
+	Serial.print(" whole turns: ");
+	Serial.print(winch.getTurnCount());
+	Serial.print(" error code: ");
+	Serial.println(winch.getErrorCode());
+}
+
+void setup() {
+	Serial.begin(9600);
+	Serial1.begin(9600);
+	delay(1000);
+
+	// Sheet both winches all the way in, then call that zero
+	sheet.setTurns(0);
+	reel.setSpeed(-1.5);
+	delay(8000);
+	reel.stop();
+	sheet.zeroTurns();
+	reel.zeroTurns();
+
+	Serial.println("Expected error code for a length past the end of the line:");
+	Serial.println(ROTATE_TO_OVER_ERROR_BIT);
+	sheet.setLineLength(1000);
+	Serial.print("Actual: ");
+	Serial.println(sheet.getErrorCode());
+	sheet.setLineLength(0);
+	sheet.clearErrorCode();
+	delay(3000);
+	sheet.zeroTurns();
+	stepStart = millis();
+}
+
+void loop() {
+	sheet.update();
+	reel.update();
+	if (!loopOnce) {
+		// End of test
+		return;
+	}
+
+	// Both winches get each length in one command, then 4 s to get there
+	if (millis() - stepStart > 4000 || step == 0) {
+		if (step > 0) {
+			printWinch("Sheet", sheet);
+			printWinch("Reel", reel);
+		}
+		if (step == sizeof(lengths) / sizeof(lengths[0])) {
+			loopOnce = false;
+			return;
+		}
+		Serial.print("Moving to ");
+		Serial.print(lengths[step]);
+		Serial.println(" mm");
+		SB_WinchServo::setMultipleTargets({&sheet, &reel}, {lengths[step], lengths[step]});
+		step++;
+		stepStart = millis();
+	}
+}
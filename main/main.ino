@@ -1,4 +1,5 @@
 #include "pwm_channel.h"
+#include "pwm_stats.h"
 
 // pwm channel instantiations for testing
 pwmChannel CH2;
@@ -15,6 +16,10 @@ void setup(void)
 
 void loop(void) 
 {
+  // keep the channel statistics, 's' over serial prints them, 'r' starts them over
+  pwmStatsUpdate();
+  pwmStatsCommand(Serial);
+
   // Every 50 milliseconds print the values of the two channels
   static int refTime = micros();
   int curTime = micros();
@@ -25,5 +30,19 @@ void loop(void)
     refTime = curTime;
     Serial.println(CH2.pwmValue);
     Serial.println(CH3.pwmValue); 
+
+    // report interrupt storms as they happen (a loose lead, ESC noise)
+    static uint32_t reportedStorms = 0;
+    uint32_t storms = pwmStorms();
+    if(storms != reportedStorms)
+    {
+      reportedStorms = storms;
+      Serial.print("PWM storms: ");
+      Serial.print(storms);
+      Serial.print(" CH2 valid: ");
+      Serial.print(CH2.valid);
+      Serial.print(" CH3 valid: ");
+      Serial.println(CH3.valid);
+    }
   }
 }
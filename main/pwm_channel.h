@@ -9,6 +9,14 @@
 #define CH2_PIN 19      // right stick (horizontal movement)
 #define CH3_PIN 18      // right stick (vertical movement)
 
+/*    PWM_CHANNELS is how many pwmChannel structs are in use. Each is listed with its
+ * pin and rising ISR in the pwmPins table in pwm_channel.ino, CHn_INDEX is its place
+ * in the table.
+ */
+#define PWM_CHANNELS 2
+#define CH2_INDEX 0
+#define CH3_INDEX 1
+
 // PWM Struct
 /* Struct Description:
  *  a pwmChannel struct provides an interface between an AR620 PWM Channel and the teensy 4.0
@@ -30,6 +38,23 @@
  *  fallTime:
  *    type: volatile int
  *    purpose: stores the width of a pwm signal pulse in microseconds
+ *
+ *  valid:
+ *    type: volatile bool
+ *    purpose: true once a whole pulse has been measured, false from an interrupt storm
+ *             (see INTERRUPT STORMS below) until a clean pulse has been measured again.
+ *             Don't trust pwmValue while it's false
+ *
+ *  storms:
+ *    type: volatile uint32_t
+ *    purpose: counts the times the channel went over its edge budget and was masked
+ *
+ *  pulses:
+ *    type: volatile uint32_t
+ *    purpose: counts the pulses measured, so code outside the ISRs can tell a new
+ *             pwmValue from the one it has already seen
+ *
+ *  The rest are the storm guard's bookkeeping and shouldn't be touched.
  */
 struct pwmChannel
 {
@@ -38,6 +63,21 @@ struct pwmChannel
 
   // pulse time of the pwm signal
   volatile int pwmValue = 0;
+
+  // pwmValue is a real measurement
+  volatile bool valid = false;
+
+  // interrupt storms survived
+  volatile uint32_t storms = 0;
+
+  // pulses measured
+  volatile uint32_t pulses = 0;
+
+  // storm guard bookkeeping
+  volatile bool rose = false;           // a rising edge has been seen since the last fall (or unmask)
+  volatile bool masked = false;         // over budget, the pin's interrupt is off until the storm timer
+  volatile int windowStart = 0;         // start of the current budget window
+  volatile uint16_t windowEdges = 0;    // edges seen in it
 };
 
 // FUNCTIONS
@@ -74,4 +114,125 @@ void initPWM();
   // channel 3 ISR(s)
     void CH3_RISE_ISR();
     void CH3_FALL_ISR();
+
+// INTERRUPT STORMS
+/*    A loose receiver lead or ESC noise can toggle a pin far faster than any receiver
+ * would, and with an ISR per edge the teensy would do nothing but run ISRs. Every
+ * channel gets a budget of PWM_EDGE_BUDGET edges per PWM_STORM_WINDOW_US (a receiver
+ * frame, 2 edges in a healthy one). The edge that goes over it masks the pin's
+ * interrupt, marks the channel invalid and counts a storm. A timer unmasks every
+ * masked pin PWM_STORM_BACKOFF_US later, and the channel becomes valid again with the
+ * next whole pulse it measures. While a pin is masked it costs nothing, so however bad
+ * the noise a storming channel takes at most PWM_EDGE_BUDGET ISRs per backoff.
+ *
+ *  The guard is the same for initPWM() and initPWMPort(), and uses one IntervalTimer.
+ */
+#define PWM_STORM_WINDOW_US 22000   // the AR620's frame period
+#define PWM_EDGE_BUDGET 6           // three pulses' worth, for windows that straddle frames
+#define PWM_STORM_BACKOFF_US 100000
+
+// Storm timer ISR
+/*  STORM TIMER ISR
+ *    trigger: PWM_STORM_BACKOFF_US after a channel was masked
+ *    purpose: unmasks every masked channel and stops the timer
+ */
+void PWM_STORM_TIMER_ISR();
+
+// Storm total
+/* Function Description:
+ *  pwmStorms adds up the storms of every channel, for the control loop to report.
+ */
+uint32_t pwmStorms();
+
+// PORT CAPTURE
+/*    An alternative to initPWM() and the per channel ISRs above. Every receiver
+ * channel is on the same GPIO port (pins 18 and 19 are both GPIO6 on the teensy 4.0),
+ * so one ISR on the port's interrupt can read the whole port register at once, XOR
+ * it with what it read last time to find every channel that changed, and timestamp
+ * them all with a single micros() call. Edges that arrive together cost one ISR
+ * entry instead of one each, and there's no attachInterrupt() flipping between
+ * RISING and FALLING inside the ISRs.
+ *
+ *  The port ISR serves every channel in the pwmPins table.
+ *
+ *  The port ISR takes over the teensy 4's shared GPIO6-9 interrupt vector, so
+ * attachInterrupt() can't be used on any other pin alongside it.
+ */
+// Initialization function
+/* Function Description:
+ *  initPWMPort configures the channel pins as inputs and attaches PORT_CHANGE_ISR
+ * to both edges of all of them. Call it INSTEAD of initPWM().
+ *
+ *  Returns false, having called initPWM() instead, if the pins aren't all on one
+ * port.
+ */
+bool initPWMPort();
+
+// Port ISR
+/*  PORT CHANGE ISR
+ *    trigger: ANY EDGE on any channel pin
+ *    purpose: records the rise time of every channel that went high and the pulse
+ *             width of every channel that went low, all at the same time
+ */
+void PORT_CHANGE_ISR();
+
+// HARDWARE CAPTURE
+/*    Timestamps taken with micros() inside an ISR are late by however long the ISR
+ * took to start, and by however long something else (Serial, noInterrupts()) had
+ * interrupts masked. The teensy 4's QuadTimer 3 can latch its counter on both edges
+ * of pins 19, 18, 14 and 15 by itself, so the ISR only reads times the hardware
+ * already took: no jitter, and no attachInterrupt() per edge.
+ *
+ *  On the host there are no timers, the simulation latches the time of every pin's
+ * edges instead, so this is also the simulated backend. On any other board the port
+ * and timer backends aren't built, initPWMPort() and initPWMTimer() just call
+ * initPWM() and return false.
+ */
+
+// Initialization function
+/* Function Description:
+ *  initPWMTimer routes the channel pins to the timer and starts capturing. Call it
+ * INSTEAD of initPWM(). Returns false, having called initPWM() instead, if a pin has
+ * no timer input.
+ */
+bool initPWMTimer();
+
+// Timer ISR
+/*  CAPTURE TIMER ISR
+ *    trigger: a latched edge on any channel's timer input
+ *    purpose: turns the latched times into rise times and pulse widths
+ */
+void PWM_CAPTURE_TIMER_ISR();
+
+// CAPTURE BACKENDS
+/*    initPWM(), initPWMPort() and initPWMTimer() are three ways of getting the same
+ * pwmChannel values, each one a pwmCaptureBackend. Switching with pwmBegin() hands
+ * the pins back from the current backend first, so they can be swapped at run time
+ * (e.g. to compare them on the bench). The storm guard masks and unmasks pins
+ * through the backend in charge.
+ *
+ *    pwmIsrCapture    -- a rising and falling ISR per channel, initPWM()
+ *    pwmPortCapture   -- one ISR for the whole GPIO port, initPWMPort()
+ *    pwmTimerCapture  -- latched timer input capture, initPWMTimer()
+ */
+struct pwmCaptureBackend
+{
+  const char *name;
+  bool (*begin)();              // takes the pins, false if it fell back to initPWM()
+  void (*end)();                // lets them go
+  void (*mask)(uint8_t index);  // stops and restarts capture on one channel (pwmPins order)
+  void (*unmask)(uint8_t index);
+};
+
+extern const pwmCaptureBackend pwmIsrCapture;
+extern const pwmCaptureBackend pwmPortCapture;
+extern const pwmCaptureBackend pwmTimerCapture;
+
+// Backend switching
+/* Function Description:
+ *  pwmBegin ends the backend in charge (if any) and begins the given one. Returns
+ * what its begin() returned. pwmBackend returns the backend in charge.
+ */
+bool pwmBegin(const pwmCaptureBackend &backend);
+const pwmCaptureBackend *pwmBackend();
 #endif
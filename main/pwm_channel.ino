@@ -1,3 +1,53 @@
+// CHANNEL TABLE
+/*  Every pwmChannel struct in use, with its name, pin and rising edge ISR, at its CHn_INDEX.
+ * The storm guard and the port ISR work from this table, so a new channel needs a
+ * line here as well as its ISRs.
+ */
+struct pwmPin
+{
+  pwmChannel *channel;
+  const char *name;
+  uint8_t pin;
+  void (*riseISR)();
+};
+
+static const pwmPin pwmPins[PWM_CHANNELS] =
+{
+  {&CH2, "CH2", CH2_PIN, CH2_RISE_ISR},
+  {&CH3, "CH3", CH3_PIN, CH3_RISE_ISR},
+};
+
+static const pwmCaptureBackend *activeBackend = nullptr;  // whoever set the pins up last
+
+static bool pwmEdgeAllowed(uint8_t index, int now);
+
+// Edge bookkeeping shared by every ISR
+/*  A fall only makes a measurement if the channel saw the rise before it, so a pin
+ * unmasked mid pulse (or read for the first time mid pulse) doesn't produce a garbage
+ * width.
+ */
+static inline void pwmRose(pwmChannel &channel, int now)
+{
+  channel.riseTime = now;
+  channel.rose = true;
+}
+
+static inline void pwmMeasured(pwmChannel &channel, int width)
+{
+  if (channel.rose)
+  {
+    channel.pwmValue = width;
+    channel.valid = true;
+    channel.rose = false;
+    channel.pulses++;
+  }
+}
+
+static inline void pwmFell(pwmChannel &channel, int now)
+{
+  pwmMeasured(channel, now - channel.riseTime);
+}
+
 // Initialization function
 /* Function Structure / Implementation
  *  
@@ -14,6 +64,8 @@
  */
 void initPWM()
 {
+  activeBackend = &pwmIsrCapture;
+
   // configure digital IO pins
     pinMode(CH2_PIN, INPUT);  
     pinMode(CH3_PIN, INPUT);
@@ -35,20 +87,29 @@ void initPWM()
    * however, micros() does.
    * 
    *  The rising edge ISR should do nothing else and should exit right after the micros() call.
+   *
+   *  Both ISRs take their timestamp first and check the channel's edge budget before anything else, an
+   * edge over budget masks the pin and is otherwise ignored (see INTERRUPT STORMS).
    */
 
     // channel 2 ISR (rising)
       void CH2_RISE_ISR()
       {
+        int now = micros();
+        if (!pwmEdgeAllowed(CH2_INDEX, now))
+          return;
         attachInterrupt(digitalPinToInterrupt(CH2_PIN), CH2_FALL_ISR, FALLING);
-        CH2.riseTime = micros();
+        pwmRose(CH2, now);
       }
 
     // channel 3 ISR (rising)
       void CH3_RISE_ISR()
       {
+        int now = micros();
+        if (!pwmEdgeAllowed(CH3_INDEX, now))
+          return;
         attachInterrupt(digitalPinToInterrupt(CH3_PIN), CH3_FALL_ISR, FALLING);
-        CH3.riseTime = micros();
+        pwmRose(CH3, now);
       }
 
   // FALLING EDGE
@@ -67,13 +128,477 @@ void initPWM()
     // channel 2 ISR (falling)
       void CH2_FALL_ISR()
       {
+        int now = micros();
+        if (!pwmEdgeAllowed(CH2_INDEX, now))
+          return;
         attachInterrupt(digitalPinToInterrupt(CH2_PIN), CH2_RISE_ISR, RISING);
-        CH2.pwmValue = micros() - CH2.riseTime;
+        pwmFell(CH2, now);
       }
 
       // channel 3 ISR (falling)
       void CH3_FALL_ISR()
       {
+        int now = micros();
+        if (!pwmEdgeAllowed(CH3_INDEX, now))
+          return;
         attachInterrupt(digitalPinToInterrupt(CH3_PIN), CH3_RISE_ISR, RISING);
-        CH3.pwmValue= micros() - CH3.riseTime;
+        pwmFell(CH3, now);
       }
+
+// PORT CAPTURE
+/*  Port and timer capture need a teensy 4's registers or the host's simulated port.
+ * Anywhere else only the ISR backend is built, initPWMPort() and initPWMTimer() fall
+ * back to initPWM() like they do for pins they can't serve.
+ */
+#if defined(__IMXRT1062__) || defined(SB_HOST)
+  #define PWM_PORT_CAPTURE
+#endif
+
+#if defined(PWM_PORT_CAPTURE)
+/*  portMasks holds each channel's bit in the port register, in pwmPins order.
+ */
+  static uint32_t portMasks[PWM_CHANNELS];
+  static uint32_t portMask = 0;             // every unmasked channel's bit
+  static volatile uint32_t portLevels = 0;  // the port as the ISR last read it
+
+#if defined(__IMXRT1062__)
+  /*  On the teensy 4 the port's registers follow its data register (GPIOn_DR), which
+   * is what portOutputRegister() points at.
+   */
+  #define PORT_PSR 2        // pad status, the input levels
+  #define PORT_IMR 5        // interrupt mask
+  #define PORT_ISR 6        // interrupt status, write 1s to clear
+  #define PORT_EDGE_SEL 7   // interrupt on both edges, overrides the ICR settings
+
+  static volatile uint32_t *portGpio;
+
+  static inline uint32_t readPortLevels() { return portGpio[PORT_PSR]; }
+#else
+  // On the host the port is the simulation's, pin n is bit n
+  static inline uint32_t readPortLevels() { return (uint32_t) readPort(); }
+
+  static void (*portIsr)() = nullptr;  // the ISR on the simulation's port interrupt
+#endif
+
+/*  Works out every channel's bit in the port, false if they're on more than one port.
+ */
+static bool portSetup()
+{
+  portMask = 0;
+  #if defined(__IMXRT1062__)
+    portGpio = portOutputRegister(pwmPins[0].pin);
+  #endif
+
+  for (uint8_t i = 0; i < PWM_CHANNELS; i++)
+  {
+    pinMode(pwmPins[i].pin, INPUT);
+    #if defined(__IMXRT1062__)
+      if (portOutputRegister(pwmPins[i].pin) != portGpio)
+        return false;
+      portMasks[i] = digitalPinToBitMask(pwmPins[i].pin);
+    #else
+      portMasks[i] = 1UL << pwmPins[i].pin;
+    #endif
+    portMask |= portMasks[i];
+  }
+  return true;
+}
+
+bool initPWMPort()
+{
+  if (!portSetup())
+  {
+    // split across ports, one ISR can't see them all
+    initPWM();
+    return false;
+  }
+
+  noInterrupts();
+  activeBackend = &pwmPortCapture;
+  portLevels = readPortLevels();
+  #if defined(__IMXRT1062__)
+    portGpio[PORT_IMR] &= ~portMask;
+    portGpio[PORT_EDGE_SEL] |= portMask;
+    portGpio[PORT_ISR] = portMask;  // clear anything stale
+    attachInterruptVector(IRQ_GPIO6789, PORT_CHANGE_ISR);
+    NVIC_ENABLE_IRQ(IRQ_GPIO6789);
+    portGpio[PORT_IMR] |= portMask;
+  #else
+    portIsr = PORT_CHANGE_ISR;
+    attachPortInterrupt(portMask, portIsr);
+  #endif
+  interrupts();
+  return true;
+}
+
+/*  The ISR acknowledges the port's interrupt flags BEFORE reading the levels, so an
+ * edge landing after the read raises the interrupt again rather than being lost.
+ * The work per entry is the same however many channels changed: one clock read, one
+ * port read, one pass over the channels.
+ */
+void PORT_CHANGE_ISR()
+{
+  int now = micros();
+
+  #if defined(__IMXRT1062__)
+    portGpio[PORT_ISR] = portGpio[PORT_ISR] & portMask;
+  #endif
+  uint32_t levels = readPortLevels();
+  uint32_t changed = (levels ^ portLevels) & portMask;
+  portLevels = levels;
+
+  for (uint8_t i = 0; i < PWM_CHANNELS; i++)
+  {
+    if ((changed & portMasks[i]) && pwmEdgeAllowed(i, now))
+    {
+      if (levels & portMasks[i])
+        pwmRose(*pwmPins[i].channel, now);
+      else
+        pwmFell(*pwmPins[i].channel, now);
+    }
+  }
+
+  #if defined(__IMXRT1062__)
+    asm volatile("dsb" ::: "memory");  // let the flag clear before returning, or the ISR runs twice
+  #endif
+}
+#else
+bool initPWMPort()
+{
+  initPWM();
+  return false;
+}
+#endif
+
+// HARDWARE CAPTURE
+#if defined(__IMXRT1062__)
+  /*  QuadTimer 3's four channels take their inputs from pins 19, 18, 14 and 15 (ALT1
+   * on their pads, with the input daisy chain pointed at the same pads). Each channel
+   * counts the 150 MHz IP bus clock / 8 and latches its counter into CAPT on both
+   * edges of its pin. The 16 bit counters wrap every 3.5 ms, longer than any servo
+   * pulse, so a width is the difference of two latches mod 2^16. The QuadTimer clocks
+   * are left on by the teensy's startup code.
+   */
+  #define TIMER_TICKS_PER_4US 75  // 18.75 MHz
+
+  static int8_t timerChannels[PWM_CHANNELS];  // QuadTimer 3 channel of each pwmPins entry
+  static uint16_t timerRise[PWM_CHANNELS];     // latched count of the last rising edge
+
+  static int8_t quadTimer3Channel(uint8_t pin, volatile uint32_t **select)
+  {
+    switch (pin)
+    {
+      case 19: *select = &IOMUXC_QTIMER3_TIMER0_SELECT_INPUT; return 0;
+      case 18: *select = &IOMUXC_QTIMER3_TIMER1_SELECT_INPUT; return 1;
+      case 14: *select = &IOMUXC_QTIMER3_TIMER2_SELECT_INPUT; return 2;
+      case 15: *select = &IOMUXC_QTIMER3_TIMER3_SELECT_INPUT; return 3;
+    }
+    return -1;
+  }
+
+bool initPWMTimer()
+{
+  volatile uint32_t *selects[PWM_CHANNELS];
+  for (uint8_t i = 0; i < PWM_CHANNELS; i++)
+  {
+    timerChannels[i] = quadTimer3Channel(pwmPins[i].pin, &selects[i]);
+    if (timerChannels[i] < 0)
+    {
+      // no timer input on this pin
+      initPWM();
+      return false;
+    }
+  }
+
+  noInterrupts();
+  activeBackend = &pwmTimerCapture;
+  for (uint8_t i = 0; i < PWM_CHANNELS; i++)
+  {
+    IMXRT_TMR3.CH[timerChannels[i]].CTRL = 0;  // stopped while it's set up
+    IMXRT_TMR3.CH[timerChannels[i]].LOAD = 0;
+    IMXRT_TMR3.CH[timerChannels[i]].CNTR = 0;
+    IMXRT_TMR3.CH[timerChannels[i]].CSCTRL = 0;
+    IMXRT_TMR3.CH[timerChannels[i]].SCTRL = TMR_SCTRL_CAPTURE_MODE(3) | TMR_SCTRL_IEFIE;  // both edges
+    *selects[i] = 1;
+    *portConfigRegister(pwmPins[i].pin) = 1;  // ALT1, the timer input
+    // count up forever from the IP bus clock / 8, capturing from the channel's own pin
+    IMXRT_TMR3.CH[timerChannels[i]].CTRL = TMR_CTRL_CM(1) | TMR_CTRL_PCS(8 + 3) | TMR_CTRL_SCS(timerChannels[i]);
+  }
+  attachInterruptVector(IRQ_QTIMER3, PWM_CAPTURE_TIMER_ISR);
+  NVIC_ENABLE_IRQ(IRQ_QTIMER3);
+  interrupts();
+  return true;
+}
+
+/*  A capture blocks the next one until its flag is cleared, so the ISR reads CAPT
+ * before clearing it. The level is the pin's level by the time the ISR runs, which is
+ * still the edge's for any pulse longer than the ISR latency. micros() is only for the
+ * storm guard's budget window, the widths come from the latches.
+ */
+void PWM_CAPTURE_TIMER_ISR()
+{
+  int now = micros();
+  for (uint8_t i = 0; i < PWM_CHANNELS; i++)
+  {
+    uint16_t status = IMXRT_TMR3.CH[timerChannels[i]].SCTRL;
+    if (!(status & TMR_SCTRL_IEF) || !(status & TMR_SCTRL_IEFIE))
+      continue;
+    uint16_t latched = IMXRT_TMR3.CH[timerChannels[i]].CAPT;
+    IMXRT_TMR3.CH[timerChannels[i]].SCTRL = status & ~TMR_SCTRL_IEF;
+    if (!pwmEdgeAllowed(i, now))
+      continue;
+
+    if (status & TMR_SCTRL_INPUT)
+    {
+      timerRise[i] = latched;
+      pwmRose(*pwmPins[i].channel, now);
+    }
+    else
+    {
+      uint16_t ticks = latched - timerRise[i];
+      pwmMeasured(*pwmPins[i].channel, (ticks * 4 + TIMER_TICKS_PER_4US / 2) / TIMER_TICKS_PER_4US);
+    }
+  }
+  asm volatile("dsb" ::: "memory");
+}
+
+static void timerEnd()
+{
+  NVIC_DISABLE_IRQ(IRQ_QTIMER3);
+  for (uint8_t i = 0; i < PWM_CHANNELS; i++)
+  {
+    IMXRT_TMR3.CH[timerChannels[i]].CTRL = 0;
+    IMXRT_TMR3.CH[timerChannels[i]].SCTRL = 0;
+    pinMode(pwmPins[i].pin, INPUT);  // back to GPIO
+  }
+}
+
+static void timerMask(uint8_t index)
+{
+  IMXRT_TMR3.CH[timerChannels[index]].SCTRL &= ~TMR_SCTRL_IEFIE;
+}
+
+static void timerUnmask(uint8_t index)
+{
+  // drop whatever was latched while it was masked
+  uint16_t status = IMXRT_TMR3.CH[timerChannels[index]].SCTRL;
+  IMXRT_TMR3.CH[timerChannels[index]].SCTRL = (status & ~TMR_SCTRL_IEF) | TMR_SCTRL_IEFIE;
+}
+#elif defined(SB_HOST)
+  /*  On the host the simulation latches the time of every pin's last edge
+   * (pinCaptureMicros()), and one interrupt covers all the pins like the port's. An
+   * edge is new when its latch has moved on since the ISR last looked.
+   */
+  static unsigned long timerLatched[PWM_CHANNELS];
+
+bool initPWMTimer()
+{
+  portSetup();
+  noInterrupts();
+  activeBackend = &pwmTimerCapture;
+  for (uint8_t i = 0; i < PWM_CHANNELS; i++)
+    timerLatched[i] = pinCaptureMicros(pwmPins[i].pin);
+  portIsr = PWM_CAPTURE_TIMER_ISR;
+  attachPortInterrupt(portMask, portIsr);
+  interrupts();
+  return true;
+}
+
+void PWM_CAPTURE_TIMER_ISR()
+{
+  for (uint8_t i = 0; i < PWM_CHANNELS; i++)
+  {
+    unsigned long latched = pinCaptureMicros(pwmPins[i].pin);
+    if (!(portMask & portMasks[i]) || latched == timerLatched[i])
+      continue;
+    timerLatched[i] = latched;
+    if (!pwmEdgeAllowed(i, latched))
+      continue;
+
+    if (digitalRead(pwmPins[i].pin))
+      pwmRose(*pwmPins[i].channel, latched);
+    else
+      pwmFell(*pwmPins[i].channel, latched);
+  }
+}
+
+static void timerEnd()
+{
+  attachPortInterrupt(0, nullptr);
+}
+
+static void timerMask(uint8_t index)
+{
+  portMask &= ~portMasks[index];
+  attachPortInterrupt(portMask, portIsr);
+}
+
+static void timerUnmask(uint8_t index)
+{
+  timerLatched[index] = pinCaptureMicros(pwmPins[index].pin);
+  portMask |= portMasks[index];
+  attachPortInterrupt(portMask, portIsr);
+}
+#else
+bool initPWMTimer()
+{
+  initPWM();
+  return false;
+}
+#endif
+
+// CAPTURE BACKENDS
+/*  Each backend's begin is its init function, end/mask/unmask undo and redo what it
+ * set up for one or all channels.
+ */
+static bool isrBegin()
+{
+  initPWM();
+  return true;
+}
+
+static void isrEnd()
+{
+  for (uint8_t i = 0; i < PWM_CHANNELS; i++)
+    detachInterrupt(digitalPinToInterrupt(pwmPins[i].pin));
+}
+
+static void isrMask(uint8_t index)
+{
+  detachInterrupt(digitalPinToInterrupt(pwmPins[index].pin));
+}
+
+static void isrUnmask(uint8_t index)
+{
+  // the next edge worth anything is a rise
+  attachInterrupt(digitalPinToInterrupt(pwmPins[index].pin), pwmPins[index].riseISR, RISING);
+}
+
+#if defined(PWM_PORT_CAPTURE)
+static void portEnd()
+{
+  #if defined(__IMXRT1062__)
+    portGpio[PORT_IMR] &= ~portMask;
+  #else
+    attachPortInterrupt(0, nullptr);
+  #endif
+}
+
+static void portMaskChannel(uint8_t index)
+{
+  portMask &= ~portMasks[index];
+  #if defined(__IMXRT1062__)
+    portGpio[PORT_IMR] &= ~portMasks[index];
+  #else
+    attachPortInterrupt(portMask, portIsr);
+  #endif
+}
+
+static void portUnmaskChannel(uint8_t index)
+{
+  #if defined(__IMXRT1062__)
+    portGpio[PORT_ISR] = portMasks[index];  // flagged while it was masked
+  #endif
+  // carry on from the level it's at now, so the first change seen is a real edge
+  portLevels = (portLevels & ~portMasks[index]) | (readPortLevels() & portMasks[index]);
+  portMask |= portMasks[index];
+  #if defined(__IMXRT1062__)
+    portGpio[PORT_IMR] |= portMasks[index];
+  #else
+    attachPortInterrupt(portMask, portIsr);
+  #endif
+}
+
+#endif
+
+const pwmCaptureBackend pwmIsrCapture = {"isr", isrBegin, isrEnd, isrMask, isrUnmask};
+#if defined(PWM_PORT_CAPTURE)
+const pwmCaptureBackend pwmPortCapture = {"port", initPWMPort, portEnd, portMaskChannel, portUnmaskChannel};
+const pwmCaptureBackend pwmTimerCapture = {"timer", initPWMTimer, timerEnd, timerMask, timerUnmask};
+#else
+// never in charge, their begin hands the pins to pwmIsrCapture
+const pwmCaptureBackend pwmPortCapture = {"port", initPWMPort, isrEnd, isrMask, isrUnmask};
+const pwmCaptureBackend pwmTimerCapture = {"timer", initPWMTimer, isrEnd, isrMask, isrUnmask};
+#endif
+
+bool pwmBegin(const pwmCaptureBackend &backend)
+{
+  noInterrupts();
+  if (activeBackend)
+    activeBackend->end();
+  activeBackend = nullptr;
+  // nothing stays masked across the switch, the new backend starts clean
+  for (uint8_t i = 0; i < PWM_CHANNELS; i++)
+  {
+    pwmPins[i].channel->masked = false;
+    pwmPins[i].channel->rose = false;
+    pwmPins[i].channel->windowEdges = 0;
+  }
+  interrupts();
+  return backend.begin();
+}
+
+const pwmCaptureBackend *pwmBackend()
+{
+  return activeBackend;
+}
+
+// INTERRUPT STORMS
+/*  pwmEdgeAllowed counts an edge against its channel's budget and returns false, having
+ * masked the pin through the backend in charge, when it's one too many.
+ *
+ *  The storm timer runs only while something is masked, its one tick unmasks every
+ * masked channel, so a channel stays masked for at most PWM_STORM_BACKOFF_US.
+ */
+  static IntervalTimer stormTimer;
+  static volatile bool stormTimerRunning = false;
+
+static void pwmUnmask(uint8_t index)
+{
+  pwmChannel &channel = *pwmPins[index].channel;
+  channel.windowStart = micros();
+  channel.windowEdges = 0;
+  channel.rose = false;
+  channel.masked = false;
+  activeBackend->unmask(index);
+}
+
+static bool pwmEdgeAllowed(uint8_t index, int now)
+{
+  pwmChannel &channel = *pwmPins[index].channel;
+  if (now - channel.windowStart >= PWM_STORM_WINDOW_US)
+  {
+    channel.windowStart = now;
+    channel.windowEdges = 0;
+  }
+  if (++channel.windowEdges <= PWM_EDGE_BUDGET)
+    return true;
+
+  channel.valid = false;
+  channel.rose = false;
+  channel.masked = true;
+  channel.storms++;
+  activeBackend->mask(index);
+  if (!stormTimerRunning)
+    stormTimerRunning = stormTimer.begin(PWM_STORM_TIMER_ISR, PWM_STORM_BACKOFF_US);
+  return false;
+}
+
+void PWM_STORM_TIMER_ISR()
+{
+  stormTimer.end();
+  stormTimerRunning = false;
+  for (uint8_t i = 0; i < PWM_CHANNELS; i++)
+  {
+    if (pwmPins[i].channel->masked)
+      pwmUnmask(i);
+  }
+}
+
+uint32_t pwmStorms()
+{
+  uint32_t total = 0;
+  for (uint8_t i = 0; i < PWM_CHANNELS; i++)
+    total += pwmPins[i].channel->storms;
+  return total;
+}
@@ -0,0 +1,86 @@
+#ifndef PWM_STATS_H
+#define PWM_STATS_H
+
+#include "pwm_channel.h"
+
+// PWM Statistics
+/*    Running statistics of every channel's pulse widths, for judging the receiver and
+ * transmitter without logging every sample: count, mean, variance, min, max, and a
+ * 16 bin histogram. Everything is integer (fixed point) and O(1) per pulse, and is
+ * updated from loop() by pwmStatsUpdate(), never inside an ISR.
+ *
+ *  The sums are of widths as offsets from PWM_STATS_CENTER_US, exact in 64 bits, and
+ * the mean and variance are only worked out when a snapshot is taken. (A running mean
+ * in fixed point, Welford's way, stops moving once delta / count rounds to 0.)
+ *
+ *  Histogram bins are 2^PWM_STATS_BIN_SHIFT us wide starting at PWM_STATS_HIST_START_US,
+ * the first and last bins also take everything below and above.
+ */
+#define PWM_STATS_CENTER_US 1500
+#define PWM_STATS_BINS 16
+#define PWM_STATS_BIN_SHIFT 6             // 64 us bins
+#define PWM_STATS_HIST_START_US 988       // 16 bins cover 988 to 2012 us
+
+// Stats Struct
+/* Struct Description:
+ *  one pwmStats per pwmChannel, in pwmPins order. Only pwmStatsUpdate() and
+ * pwmStatsReset() should write to it, read it through pwmStatsTake().
+ */
+struct pwmStats
+{
+  uint32_t lastPulse = 0;     // the channel's pulses count when last sampled
+  uint32_t count = 0;
+  uint32_t missed = 0;        // pulses that came and went between two pwmStatsUpdate() calls
+  int64_t sum = 0;            // of (width - PWM_STATS_CENTER_US)
+  int64_t sumSquares = 0;
+  int min = 0;
+  int max = 0;
+  uint32_t histogram[PWM_STATS_BINS] = {0};
+};
+
+// Snapshot Struct
+/* Struct Description:
+ *  a copy of a channel's statistics at one moment, with the mean and variance worked out.
+ *  meanQ8 is the mean width in 1/256 us, varianceUs2 the sample variance in us^2.
+ */
+struct pwmStatsSnapshot
+{
+  uint32_t count;
+  uint32_t missed;
+  int32_t meanQ8;
+  uint32_t varianceUs2;
+  int min;
+  int max;
+  uint32_t histogram[PWM_STATS_BINS];
+};
+
+// FUNCTIONS
+
+// Update function
+/* Function Description:
+ *  pwmStatsUpdate adds each channel's latest pulse to its statistics if it is new since
+ * the last call. Call it every loop(), more often than the receiver's frame period or
+ * pulses are counted as missed instead.
+ */
+void pwmStatsUpdate();
+
+// Snapshot and reset functions
+/* Function Description:
+ *  pwmStatsTake copies a channel's statistics (index in pwmPins order) into snapshot.
+ *  pwmStatsReset starts every channel's statistics over.
+ */
+void pwmStatsTake(uint8_t index, pwmStatsSnapshot &snapshot);
+void pwmStatsReset();
+
+// Serial functions
+/* Function Description:
+ *  pwmStatsPrint writes one line per channel:
+ *    CH2 n=1234 missed=0 mean=1500.25 var=3 min=1497 max=1504 hist=0,0,...
+ *
+ *  pwmStatsCommand reads one command character from a stream if there is one, without
+ * waiting: 's' prints a snapshot, 'r' resets, 'S' does both at once so no pulse falls
+ * between them. Anything else is ignored. Returns the character handled, or 0.
+ */
+void pwmStatsPrint(Print &out);
+char pwmStatsCommand(Stream &serial);
+#endif
@@ -0,0 +1,139 @@
+// PWM STATISTICS
+/*  One pwmStats per entry of the pwmPins table in pwm_channel.ino.
+ */
+  static pwmStats pwmChannelStats[PWM_CHANNELS];
+
+static uint8_t pwmStatsBin(int width)
+{
+  int bin = (width - PWM_STATS_HIST_START_US) >> PWM_STATS_BIN_SHIFT;
+  return bin < 0 ? 0 : bin >= PWM_STATS_BINS ? PWM_STATS_BINS - 1 : bin;
+}
+
+static void pwmStatsAdd(pwmStats &stats, int width)
+{
+  int32_t offset = width - PWM_STATS_CENTER_US;
+  if (stats.count == 0 || width < stats.min)
+    stats.min = width;
+  if (stats.count == 0 || width > stats.max)
+    stats.max = width;
+  stats.count++;
+  stats.sum += offset;
+  stats.sumSquares += (int64_t) offset * offset;
+  stats.histogram[pwmStatsBin(width)]++;
+}
+
+// Update function
+/*  The pulse count and width are copied out together with interrupts off, so the
+ * width always belongs to the count.
+ */
+void pwmStatsUpdate()
+{
+  for (uint8_t i = 0; i < PWM_CHANNELS; i++)
+  {
+    pwmChannel &channel = *pwmPins[i].channel;
+    noInterrupts();
+    uint32_t pulses = channel.pulses;
+    int width = channel.pwmValue;
+    interrupts();
+
+    pwmStats &stats = pwmChannelStats[i];
+    if (pulses == stats.lastPulse)
+      continue;
+    stats.missed += pulses - stats.lastPulse - 1;
+    stats.lastPulse = pulses;
+    pwmStatsAdd(stats, width);
+  }
+}
+
+// Snapshot and reset functions
+/*  Mean and variance come from the sums:
+ *    mean = sum / n
+ *    variance = (sumSquares - mean * sum) / (n - 1)
+ *  with the mean kept in 1/256 us so its rounding doesn't show in the variance.
+ */
+void pwmStatsTake(uint8_t index, pwmStatsSnapshot &snapshot)
+{
+  const pwmStats &stats = pwmChannelStats[index];
+  snapshot.count = stats.count;
+  snapshot.missed = stats.missed;
+  snapshot.min = stats.min;
+  snapshot.max = stats.max;
+  for (uint8_t bin = 0; bin < PWM_STATS_BINS; bin++)
+    snapshot.histogram[bin] = stats.histogram[bin];
+
+  snapshot.meanQ8 = PWM_STATS_CENTER_US * 256;
+  snapshot.varianceUs2 = 0;
+  if (stats.count == 0)
+    return;
+  int64_t scaled = stats.sum * 256;
+  int64_t half = scaled < 0 ? -(int64_t) stats.count / 2 : (int64_t) stats.count / 2;
+  int64_t offsetQ8 = (scaled + half) / (int64_t) stats.count;
+  snapshot.meanQ8 += offsetQ8;
+  if (stats.count > 1)
+  {
+    int64_t deviations = stats.sumSquares - ((offsetQ8 * stats.sum + 128) >> 8);
+    snapshot.varianceUs2 = deviations > 0 ? (deviations + (stats.count - 1) / 2) / (stats.count - 1) : 0;
+  }
+}
+
+void pwmStatsReset()
+{
+  for (uint8_t i = 0; i < PWM_CHANNELS; i++)
+  {
+    // start from the channel's current count, so the next pulse isn't counted as missed
+    pwmChannelStats[i] = pwmStats();
+    pwmChannelStats[i].lastPulse = pwmPins[i].channel->pulses;
+  }
+}
+
+// Serial functions
+void pwmStatsPrint(Print &out)
+{
+  for (uint8_t i = 0; i < PWM_CHANNELS; i++)
+  {
+    pwmStatsSnapshot snapshot;
+    pwmStatsTake(i, snapshot);
+    out.print(pwmPins[i].name);
+    out.print(" n=");
+    out.print((unsigned long) snapshot.count);
+    out.print(" missed=");
+    out.print((unsigned long) snapshot.missed);
+    out.print(" mean=");
+    out.print(snapshot.meanQ8 / 256.0);
+    out.print(" var=");
+    out.print((unsigned long) snapshot.varianceUs2);
+    out.print(" min=");
+    out.print(snapshot.min);
+    out.print(" max=");
+    out.print(snapshot.max);
+    out.print(" hist=");
+    for (uint8_t bin = 0; bin < PWM_STATS_BINS; bin++)
+    {
+      if (bin)
+        out.print(',');
+      out.print((unsigned long) snapshot.histogram[bin]);
+    }
+    out.println();
+  }
+}
+
+char pwmStatsCommand(Stream &serial)
+{
+  if (serial.available() <= 0)
+    return 0;
+  char command = serial.read();
+  switch (command)
+  {
+    case 's':
+      pwmStatsPrint(serial);
+      return command;
+    case 'r':
+      pwmStatsReset();
+      return command;
+    case 'S':
+      pwmStatsPrint(serial);
+      pwmStatsReset();
+      return command;
+  }
+  return 0;
+}